@@ -553,6 +553,20 @@ snd_pcm_sframes_t snd_pcm_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t
 snd_pcm_sframes_t snd_pcm_readn(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size);
 int snd_pcm_wait(snd_pcm_t *pcm, int timeout);
 
+/** PCM wait set handle (see #snd_pcm_wait_many) */
+typedef struct _snd_pcm_waitset snd_pcm_waitset_t;
+/** Wait on the set with epoll when available */
+#define SND_PCM_WAITSET_EPOLL	0x00000001
+
+int snd_pcm_waitset_open(snd_pcm_waitset_t **setp, int mode);
+int snd_pcm_waitset_close(snd_pcm_waitset_t *set);
+int snd_pcm_waitset_add(snd_pcm_waitset_t *set, snd_pcm_t *pcm);
+int snd_pcm_waitset_remove(snd_pcm_waitset_t *set, snd_pcm_t *pcm);
+int snd_pcm_waitset_update(snd_pcm_waitset_t *set);
+int snd_pcm_wait_many(snd_pcm_waitset_t *set, int timeout,
+		      snd_pcm_t **pcms, snd_pcm_sframes_t *avail,
+		      unsigned int space);
+
 int snd_pcm_link(snd_pcm_t *pcm1, snd_pcm_t *pcm2);
 int snd_pcm_unlink(snd_pcm_t *pcm);
 
@@ -1117,6 +1131,10 @@ int snd_pcm_mmap_begin(snd_pcm_t *pcm,
 snd_pcm_sframes_t snd_pcm_mmap_commit(snd_pcm_t *pcm,
 				      snd_pcm_uframes_t offset,
 				      snd_pcm_uframes_t frames);
+snd_pcm_sframes_t snd_pcm_mmap_commit_avail(snd_pcm_t *pcm,
+					    snd_pcm_uframes_t offset,
+					    snd_pcm_uframes_t frames,
+					    snd_pcm_sframes_t *availp);
 snd_pcm_sframes_t snd_pcm_mmap_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size);
 snd_pcm_sframes_t snd_pcm_mmap_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_uframes_t size);
 snd_pcm_sframes_t snd_pcm_mmap_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size);
@@ -1261,6 +1279,10 @@ int snd_pcm_scope_s16_open(snd_pcm_t *pcm, const char *name,
 			   snd_pcm_scope_t **scopep);
 int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 					      unsigned int channel);
+int snd_pcm_scope_levels_open(snd_pcm_t *pcm, const char *name,
+			      snd_pcm_scope_t **scopep);
+int snd_pcm_scope_levels_get(snd_pcm_scope_t *scope, unsigned int channel,
+			     float *peak, float *rms, float *true_peak);
 
 /** \} */
 
@@ -73,7 +73,7 @@ typedef snd_pcm_ioplug_callback snd_pcm_ioplug_callback_t;
  */
 #define SND_PCM_IOPLUG_VERSION_MAJOR	1	/**< Protocol major version */
 #define SND_PCM_IOPLUG_VERSION_MINOR	0	/**< Protocol minor version */
-#define SND_PCM_IOPLUG_VERSION_TINY	2	/**< Protocol tiny version */
+#define SND_PCM_IOPLUG_VERSION_TINY	3	/**< Protocol tiny version */
 /**
  * IO-plugin protocol version
  */
@@ -211,6 +211,23 @@ struct snd_pcm_ioplug_callback {
 	 * set the channel map; optional; since v1.0.2
 	 */
 	int (*set_chmap)(snd_pcm_ioplug_t *io, const snd_pcm_chmap_t *map);
+	/**
+	 * expose the own ring buffer as mmap areas; optional; since v1.0.3
+	 *
+	 * Called after hw_params with the array of channel areas to fill.
+	 * Return -ENXIO to let alsa-lib allocate the buffer as usual.
+	 */
+	int (*mmap_areas)(snd_pcm_ioplug_t *io, snd_pcm_channel_area_t *areas);
+	/**
+	 * notify the frames committed to the own ring buffer;
+	 * optional; since v1.0.3
+	 *
+	 * Called instead of transfer when the buffer given by mmap_areas
+	 * is in use.
+	 */
+	snd_pcm_sframes_t (*mmap_commit)(snd_pcm_ioplug_t *io,
+					 snd_pcm_uframes_t offset,
+					 snd_pcm_uframes_t size);
 };
 
 
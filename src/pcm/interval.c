@@ -160,6 +160,12 @@ int snd_interval_refine(snd_interval_t *i, const snd_interval_t *v)
 	int changed = 0;
 	if (snd_interval_empty(i))
 		return -ENOENT;
+	/* an empty v (e.g. from snd_interval_mul() of an empty operand)
+	 * has no valid bounds */
+	if (snd_interval_empty(v)) {
+		snd_interval_none(i);
+		return -EINVAL;
+	}
 	if (i->min < v->min) {
 		i->min = v->min;
 		i->openmin = v->openmin;
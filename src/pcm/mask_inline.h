@@ -30,38 +30,19 @@
 #define MASK_OFS(i)	((i) >> 5)
 #define MASK_BIT(i)	(1U << ((i) & 31))
 
+/* bits from (i & 31) up to 31 of the word containing i */
+#define MASK_BITS_FROM(i)	(~0U << ((i) & 31))
+/* bits from 0 up to (i & 31) of the word containing i */
+#define MASK_BITS_TO(i)		(~0U >> (31 - ((i) & 31)))
+
 MASK_INLINE unsigned int ld2(uint32_t v)
 {
-        unsigned r = 0;
-
-        if (v >= 0x10000) {
-                v >>= 16;
-                r += 16;
-        }
-        if (v >= 0x100) {
-                v >>= 8;
-                r += 8;
-        }
-        if (v >= 0x10) {
-                v >>= 4;
-                r += 4;
-        }
-        if (v >= 4) {
-                v >>= 2;
-                r += 2;
-        }
-        if (v >= 2)
-                r++;
-        return r;
+	return v ? 31 - __builtin_clz(v) : 0;
 }
 
 MASK_INLINE unsigned int hweight32(uint32_t v)
 {
-        v = (v & 0x55555555) + ((v >> 1) & 0x55555555);
-        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-        v = (v & 0x0F0F0F0F) + ((v >> 4) & 0x0F0F0F0F);
-        v = (v & 0x00FF00FF) + ((v >> 8) & 0x00FF00FF);
-        return (v & 0x0000FFFF) + ((v >> 16) & 0x0000FFFF);
+	return __builtin_popcount(v);
 }
 
 MASK_INLINE size_t snd_mask_sizeof(void)
@@ -141,18 +122,30 @@ MASK_INLINE void snd_mask_reset(snd_mask_t *mask, unsigned int val)
 
 MASK_INLINE void snd_mask_set_range(snd_mask_t *mask, unsigned int from, unsigned int to)
 {
-	unsigned int i;
+	unsigned int i, first = MASK_OFS(from), last = MASK_OFS(to);
 	assert(to <= SND_MASK_MAX && from <= to);
-	for (i = from; i <= to; i++)
-		mask->bits[MASK_OFS(i)] |= MASK_BIT(i);
+	if (first == last) {
+		mask->bits[first] |= MASK_BITS_FROM(from) & MASK_BITS_TO(to);
+		return;
+	}
+	mask->bits[first] |= MASK_BITS_FROM(from);
+	for (i = first + 1; i < last; i++)
+		mask->bits[i] = ~0U;
+	mask->bits[last] |= MASK_BITS_TO(to);
 }
 
 MASK_INLINE void snd_mask_reset_range(snd_mask_t *mask, unsigned int from, unsigned int to)
 {
-	unsigned int i;
+	unsigned int i, first = MASK_OFS(from), last = MASK_OFS(to);
 	assert(to <= SND_MASK_MAX && from <= to);
-	for (i = from; i <= to; i++)
-		mask->bits[MASK_OFS(i)] &= ~MASK_BIT(i);
+	if (first == last) {
+		mask->bits[first] &= ~(MASK_BITS_FROM(from) & MASK_BITS_TO(to));
+		return;
+	}
+	mask->bits[first] &= ~MASK_BITS_FROM(from);
+	for (i = first + 1; i < last; i++)
+		mask->bits[i] = 0;
+	mask->bits[last] &= ~MASK_BITS_TO(to);
 }
 
 MASK_INLINE void snd_mask_leave(snd_mask_t *mask, unsigned int val)
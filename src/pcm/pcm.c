@@ -112,6 +112,13 @@ description for more details and \ref snd_pcm_poll_descriptors_revents for
 events demangling). The implemented transfer routines can be found in
 the \ref alsa_transfers section.
 
+Applications driving many streams at once (for example one thread serving
+several devices) can register the handles in a wait set created by
+\ref snd_pcm_waitset_open and wait for all of them with
+\ref snd_pcm_wait_many. The descriptors are collected once, all streams
+are waited for with a single poll() or epoll_wait() call and the ready
+streams are returned together with their available frames.
+
 \subsection pcm_transfer_async Asynchronous notification
 
 ALSA driver and library knows to handle the asynchronous notifications over
@@ -515,6 +522,24 @@ LIBASOUND_THREAD_SAFE=0 aplay foo.wav
 \endcode
 for making the debugging easier.
 
+\section pcm_refine_cache Refinement cache
+
+Each PCM handle remembers the results of the hw_params refinements which
+come again, so that the repeated #snd_pcm_hw_params_any(),
+snd_pcm_hw_params_set_*() and #snd_pcm_hw_refine() calls with the same
+configuration space don't walk down the whole plugin chain again.  The results depending on the
+state outside the handle, such as the kernel driver or the other clients
+of a shared slave, are never cached.  The cache can be disabled by passing
+0 to the environment variable LIBASOUND_REFINE_CACHE.  It is guarded by the
+thread-safety lock of the handle, so concurrent refinements on one handle
+are fine unless that lock is disabled with LIBASOUND_THREAD_SAFE=0.
+
+The rules of the configuration space are evaluated by a worklist
+scheduler visiting only the rules whose parameters have changed.
+Passing "passes" to the environment variable LIBASOUND_REFINE_ENGINE
+selects the former engine re-checking all rules in passes; both give
+identical results.
+
 \section pcm_dev_names PCM naming conventions
 
 The ALSA library uses a generic string representation for names of devices.
@@ -668,6 +693,9 @@ playback devices.
 #include <sys/mman.h>
 #include <limits.h>
 #include "pcm_local.h"
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #ifndef DOC_HIDDEN
 /* return specific error codes for known bad PCM states */
@@ -2783,6 +2811,13 @@ int snd_pcm_new(snd_pcm_t **pcmp, snd_pcm_type_t type, const char *name,
 		pcm->lock_enabled = do_lock_enable;
 	}
 #endif
+	/* evaluated at each open, so that they can be toggled for comparison */
+	{
+		char *p = getenv("LIBASOUND_REFINE_CACHE");
+		pcm->refine_nocache = p && *p == '0';
+		p = getenv("LIBASOUND_REFINE_ENGINE");
+		pcm->refine_passes = p && !strcmp(p, "passes");
+	}
 	*pcmp = pcm;
 	return 0;
 }
@@ -2794,6 +2829,7 @@ int snd_pcm_free(snd_pcm_t *pcm)
 	free(pcm->hw.link_dst);
 	free(pcm->appl.link_dst);
 	snd_dlobj_cache_put(pcm->open_func);
+	snd_pcm_hw_refine_cache_free(pcm);
 #ifdef THREAD_SAFE_API
 	pthread_mutex_destroy(&pcm->lock);
 #endif
@@ -2918,6 +2954,358 @@ int snd_pcm_wait_nocheck(snd_pcm_t *pcm, int timeout)
 }
 #endif
 
+#ifndef DOC_HIDDEN
+struct snd_pcm_waitset_entry {
+	snd_pcm_t *pcm;
+	unsigned int pfd;		/* first descriptor in set->pfds */
+	unsigned int npfds;
+};
+
+struct _snd_pcm_waitset {
+	int mode;
+	int epoll_fd;			/* -1 = plain poll() */
+	int dirty;
+	unsigned int count;
+	unsigned int alloc;
+	unsigned int next;		/* entry to check first */
+	struct snd_pcm_waitset_entry *entries;
+	unsigned int npfds;
+	unsigned int pfds_alloc;
+	struct pollfd *pfds;
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event *events;
+#endif
+};
+#endif
+
+/**
+ * \brief Create a set of PCM handles for #snd_pcm_wait_many
+ * \param setp Returned wait set handle
+ * \param mode Mode flags (#SND_PCM_WAITSET_EPOLL)
+ * \return 0 on success otherwise a negative error code
+ *
+ * With #SND_PCM_WAITSET_EPOLL the descriptors are registered to an
+ * epoll instance once and only the ready ones are reported by the kernel.
+ * When epoll is not available or some descriptor cannot be registered
+ * (e.g. two handles share a descriptor), plain poll() is used instead.
+ */
+int snd_pcm_waitset_open(snd_pcm_waitset_t **setp, int mode)
+{
+	snd_pcm_waitset_t *set;
+
+	assert(setp);
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return -ENOMEM;
+	set->mode = mode;
+	set->epoll_fd = -1;
+	*setp = set;
+	return 0;
+}
+
+/**
+ * \brief Free a wait set
+ * \param set Wait set handle
+ * \return 0 on success otherwise a negative error code
+ *
+ * The registered PCM handles are not closed.
+ */
+int snd_pcm_waitset_close(snd_pcm_waitset_t *set)
+{
+	assert(set);
+	if (set->epoll_fd >= 0)
+		close(set->epoll_fd);
+	free(set->entries);
+	free(set->pfds);
+#ifdef HAVE_SYS_EPOLL_H
+	free(set->events);
+#endif
+	free(set);
+	return 0;
+}
+
+/**
+ * \brief Add a PCM handle to a wait set
+ * \param set Wait set handle
+ * \param pcm PCM handle
+ * \return 0 on success otherwise a negative error code
+ */
+int snd_pcm_waitset_add(snd_pcm_waitset_t *set, snd_pcm_t *pcm)
+{
+	unsigned int i;
+
+	assert(set && pcm);
+	for (i = 0; i < set->count; i++)
+		if (set->entries[i].pcm == pcm)
+			return -EEXIST;
+	if (set->count == set->alloc) {
+		unsigned int alloc = set->alloc ? set->alloc * 2 : 8;
+		struct snd_pcm_waitset_entry *entries;
+
+		entries = realloc(set->entries, alloc * sizeof(*entries));
+		if (!entries)
+			return -ENOMEM;
+		set->entries = entries;
+		set->alloc = alloc;
+	}
+	set->entries[set->count].pcm = pcm;
+	set->entries[set->count].pfd = 0;
+	set->entries[set->count].npfds = 0;
+	set->count++;
+	set->dirty = 1;
+	return 0;
+}
+
+/**
+ * \brief Remove a PCM handle from a wait set
+ * \param set Wait set handle
+ * \param pcm PCM handle
+ * \return 0 on success otherwise a negative error code
+ */
+int snd_pcm_waitset_remove(snd_pcm_waitset_t *set, snd_pcm_t *pcm)
+{
+	unsigned int i;
+
+	assert(set && pcm);
+	for (i = 0; i < set->count; i++) {
+		if (set->entries[i].pcm == pcm) {
+			memmove(&set->entries[i], &set->entries[i + 1],
+				(set->count - i - 1) * sizeof(set->entries[0]));
+			set->count--;
+			if (set->next >= set->count)
+				set->next = 0;
+			set->dirty = 1;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int snd_pcm_waitset_epoll(snd_pcm_waitset_t *set)
+{
+	struct epoll_event *events;
+	unsigned int i;
+	int fd;
+
+	events = realloc(set->events, set->pfds_alloc * sizeof(*events));
+	if (!events)
+		return -ENOMEM;
+	set->events = events;
+	fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	for (i = 0; i < set->npfds; i++) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		/* POLL* and EPOLL* values are identical on Linux */
+		ev.events = set->pfds[i].events;
+		ev.data.u64 = i;
+		if (epoll_ctl(fd, EPOLL_CTL_ADD, set->pfds[i].fd, &ev) < 0) {
+			int err = -errno;
+			close(fd);
+			return err;
+		}
+	}
+	set->epoll_fd = fd;
+	return 0;
+}
+#endif
+
+/**
+ * \brief Re-read the poll descriptors of all PCM handles in a wait set
+ * \param set Wait set handle
+ * \return 0 on success otherwise a negative error code
+ *
+ * The descriptors are collected when the set is waited on for the first
+ * time after #snd_pcm_waitset_add or #snd_pcm_waitset_remove. Call this
+ * function when the descriptors of a registered handle might have changed
+ * (e.g. after setting the hardware parameters).
+ */
+int snd_pcm_waitset_update(snd_pcm_waitset_t *set)
+{
+	unsigned int i, npfds = 0;
+	int err;
+
+	assert(set);
+	if (set->epoll_fd >= 0) {
+		close(set->epoll_fd);
+		set->epoll_fd = -1;
+	}
+	set->dirty = 1;
+	for (i = 0; i < set->count; i++) {
+		struct snd_pcm_waitset_entry *e = &set->entries[i];
+
+		snd_pcm_lock(e->pcm->fast_op_arg);
+		err = __snd_pcm_poll_descriptors_count(e->pcm);
+		if (err <= 0) {
+			snd_pcm_unlock(e->pcm->fast_op_arg);
+			SNDERR("Invalid poll_fds %d", err);
+			return err < 0 ? err : -EIO;
+		}
+		if (npfds + err > set->pfds_alloc) {
+			unsigned int alloc = (npfds + err) * 2;
+			struct pollfd *pfds;
+
+			pfds = realloc(set->pfds, alloc * sizeof(*pfds));
+			if (!pfds) {
+				snd_pcm_unlock(e->pcm->fast_op_arg);
+				return -ENOMEM;
+			}
+			set->pfds = pfds;
+			set->pfds_alloc = alloc;
+		}
+		err = __snd_pcm_poll_descriptors(e->pcm, set->pfds + npfds, err);
+		snd_pcm_unlock(e->pcm->fast_op_arg);
+		if (err <= 0)
+			return err < 0 ? err : -EIO;
+		e->pfd = npfds;
+		e->npfds = err;
+		npfds += err;
+	}
+	set->npfds = npfds;
+#ifdef HAVE_SYS_EPOLL_H
+	if ((set->mode & SND_PCM_WAITSET_EPOLL) && npfds > 0) {
+		err = snd_pcm_waitset_epoll(set);
+		if (err == -ENOMEM)
+			return err;
+		/* EEXIST, EPERM etc. - keep using poll() */
+	}
+#endif
+	set->dirty = 0;
+	return 0;
+}
+
+static int snd_pcm_waitset_poll(snd_pcm_waitset_t *set, int timeout)
+{
+	unsigned int i;
+	int n;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->epoll_fd >= 0) {
+		n = epoll_wait(set->epoll_fd, set->events, set->npfds, timeout);
+		if (n <= 0)
+			return n;
+		for (i = 0; i < set->npfds; i++)
+			set->pfds[i].revents = 0;
+		for (i = 0; i < (unsigned int)n; i++)
+			set->pfds[set->events[i].data.u64].revents =
+				set->events[i].events;
+		return n;
+	}
+#endif
+	n = poll(set->pfds, set->npfds, timeout);
+	return n;
+}
+
+/**
+ * \brief Wait for any PCM handle of a wait set to become ready
+ * \param set Wait set handle
+ * \param timeout maximum time in milliseconds to wait,
+ *        a negative value means infinity
+ * \param pcms Returned ready PCM handles
+ * \param avail Returned available frames for each ready handle, or
+ *        a negative error code (-EPIPE for the xrun and -ESTRPIPE for
+ *        the suspended status, others for general errors)
+ * \param space Size of the \a pcms and \a avail arrays
+ * \return number of ready handles, 0 on timeout otherwise a negative
+ *         error code
+ *
+ * All descriptors of the set are waited for with a single system call and
+ * each ready handle is locked only once to demangle its events and to
+ * update its available frames (as #snd_pcm_avail_update does). When more
+ * than \a space handles are ready, the next call starts the scan after the
+ * last reported handle, so the remaining ones are not starved.
+ *
+ * The set itself is not protected by any lock; it must not be modified
+ * while another thread waits on it.
+ */
+int snd_pcm_wait_many(snd_pcm_waitset_t *set, int timeout,
+		      snd_pcm_t **pcms, snd_pcm_sframes_t *avail,
+		      unsigned int space)
+{
+	snd_htimestamp_t start, now;
+	unsigned int i, k, ready;
+	int err, left = timeout;
+
+	assert(set && pcms && avail);
+	if (set->dirty) {
+		err = snd_pcm_waitset_update(set);
+		if (err < 0)
+			return err;
+	}
+	if (set->count == 0 || space == 0)
+		return -EINVAL;
+	if (timeout > 0)
+		gettimestamp(&start, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	for (;;) {
+		err = snd_pcm_waitset_poll(set, left);
+		if (err < 0) {
+			if (errno != EINTR)
+				return -errno;
+		} else if (err == 0) {
+			return 0;
+		} else {
+			ready = 0;
+			for (k = 0; k < set->count && ready < space; k++) {
+				struct snd_pcm_waitset_entry *e;
+				struct pollfd *pfd;
+				unsigned short revents = 0;
+				snd_pcm_t *pcm;
+				snd_pcm_sframes_t frames;
+				unsigned int j;
+
+				i = (set->next + k) % set->count;
+				e = &set->entries[i];
+				pfd = set->pfds + e->pfd;
+				pcm = e->pcm;
+				for (j = 0; j < e->npfds; j++)
+					if (pfd[j].revents)
+						break;
+				if (j == e->npfds)
+					continue;
+				snd_pcm_lock(pcm->fast_op_arg);
+				frames = __snd_pcm_poll_revents(pcm, pfd, e->npfds,
+								&revents);
+				if (frames < 0) {
+					/* keep the error */
+				} else if (revents & (POLLERR | POLLNVAL)) {
+					/* check more precisely */
+					frames = pcm_state_to_error(__snd_pcm_state(pcm));
+					if (frames >= 0)
+						frames = -EIO;
+				} else if (revents & (POLLIN | POLLOUT)) {
+					frames = __snd_pcm_avail_update(pcm);
+				} else {
+					snd_pcm_unlock(pcm->fast_op_arg);
+					continue;
+				}
+				snd_pcm_unlock(pcm->fast_op_arg);
+				pcms[ready] = pcm;
+				avail[ready] = frames;
+				ready++;
+				/* the others are checked first next time */
+				if (ready == space)
+					set->next = (i + 1) % set->count;
+			}
+			if (ready > 0)
+				return ready;
+		}
+		/* spurious wakeup or signal - wait for the rest of timeout */
+		if (timeout > 0) {
+			long ms;
+
+			gettimestamp(&now, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+			ms = (now.tv_sec - start.tv_sec) * 1000 +
+			     (now.tv_nsec - start.tv_nsec) / 1000000;
+			if (ms >= timeout)
+				return 0;
+			left = timeout - ms;
+		}
+	}
+}
+
 /**
  * \brief Return number of frames ready to be read (capture) / written (playback)
  * \param pcm PCM handle
@@ -3048,6 +3436,16 @@ int snd_pcm_area_silence(const snd_pcm_channel_area_t *dst_area, snd_pcm_uframes
 	dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
 	width = snd_pcm_format_physical_width(format);
 	silence = snd_pcm_format_silence_64(format);
+	/*
+	 * Contiguous samples with the same silence byte (all signed
+	 * formats): let memset() do the job.
+	 */
+	if (dst_area->step == (unsigned int) width && width >= 8 &&
+	    dst_area->first % 8 == 0 &&
+	    silence == (silence & 0xff) * 0x0101010101010101ULL) {
+		memset(dst, silence & 0xff, (size_t)samples * width / 8);
+		return 0;
+	}
         /*
          * Iterate copying silent sample for sample data aligned to 64 bit.
          * This is a fast path.
@@ -3337,6 +3735,9 @@ int snd_pcm_areas_copy(const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_
 		SNDMSG("invalid frames %ld", frames);
 		return -EINVAL;
 	}
+	if (snd_pcm_areas_transpose(dst_areas, dst_offset, src_areas, src_offset,
+				    channels, frames, width))
+		return 0;
 	while (channels > 0) {
 		unsigned int step = src_areas->step;
 		void *src_addr = src_areas->addr;
@@ -7330,6 +7731,71 @@ snd_pcm_sframes_t snd_pcm_mmap_commit(snd_pcm_t *pcm,
 	return result;
 }
 
+/**
+ * \brief Application has completed the access to area requested with #snd_pcm_mmap_begin and wants the available frames
+ * \param pcm PCM handle
+ * \param offset area offset in area steps (== frames)
+ * \param frames area portion size in frames
+ * \param availp Returns the number of available frames after the commit
+ * \return count of transferred frames otherwise a negative error code
+ *
+ * This function combines #snd_pcm_mmap_commit() and #snd_pcm_avail().
+ * The application pointer update, the hardware pointer synchronization
+ * and the status query are folded into a single kernel call when the
+ * PCM uses the SYNC_PTR ioctl for the control and status data, which
+ * saves the syscalls otherwise issued per transfer in low-latency loops.
+ *
+ * The function is thread-safe when built with the proper option.
+ */
+snd_pcm_sframes_t snd_pcm_mmap_commit_avail(snd_pcm_t *pcm,
+					    snd_pcm_uframes_t offset,
+					    snd_pcm_uframes_t frames,
+					    snd_pcm_sframes_t *availp)
+{
+	snd_pcm_sframes_t result, avail;
+	int err;
+
+	assert(pcm && availp);
+	err = bad_pcm_state(pcm, P_STATE_RUNNABLE, 0);
+	if (err < 0)
+		return err;
+	snd_pcm_lock(pcm->fast_op_arg);
+	if (CHECK_SANITY(offset != *pcm->appl.ptr % pcm->buffer_size)) {
+		SNDMSG("commit offset (%ld) doesn't match with appl_ptr (%ld) %% buf_size (%ld)",
+		       offset, *pcm->appl.ptr, pcm->buffer_size);
+		result = -EPIPE;
+		goto unlock;
+	}
+	if (CHECK_SANITY(frames > snd_pcm_mmap_avail(pcm))) {
+		SNDMSG("commit frames (%ld) overflow (avail = %ld)", frames,
+		       snd_pcm_mmap_avail(pcm));
+		result = -EPIPE;
+		goto unlock;
+	}
+	if (pcm->fast_ops->mmap_commit_avail) {
+		result = pcm->fast_ops->mmap_commit_avail(pcm->fast_op_arg,
+							  offset, frames,
+							  availp);
+		goto unlock;
+	}
+	result = __snd_pcm_mmap_commit(pcm, offset, frames);
+	if (result < 0)
+		goto unlock;
+	err = __snd_pcm_hwsync(pcm);
+	if (err < 0) {
+		result = err;
+		goto unlock;
+	}
+	avail = __snd_pcm_avail_update(pcm);
+	if (avail < 0)
+		result = avail;
+	else
+		*availp = avail;
+ unlock:
+	snd_pcm_unlock(pcm->fast_op_arg);
+	return result;
+}
+
 #ifndef DOC_HIDDEN
 /* locked version*/
 snd_pcm_sframes_t __snd_pcm_mmap_commit(snd_pcm_t *pcm,
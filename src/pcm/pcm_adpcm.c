@@ -59,6 +59,9 @@ IMA compatibility project proceedings, Vol 2, Issue 2, May 1992.
 #include "bswap.h"
 #include "pcm_local.h"
 #include "pcm_plugin.h"
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "plugin_ops.h"
 
@@ -165,33 +168,64 @@ static char adpcm_encoder(int sl, snd_pcm_adpcm_state_t * state)
 }
 
 
-static int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
-{
-	short pred_diff;	/* Predicted difference to next sample */
-	short step;		/* holds previous StepSize value */
-	char sign;
-
-	int i;
+/*
+ * The decoder steps are looked up in tables built on the first use and
+ * shared by all instances: the predicted difference (computed as in
+ * adpcm_encoder(), with the same short arithmetic) and the next clamped
+ * StepSize index for each StepSize index and code magnitude.
+ */
+static short adpcm_diff_table[89][8];
+static unsigned char adpcm_next_table[89][8];
 
-	/* Separate sign and magnitude */
-	sign = code & 0x8;
-	code &= 0x7;
+#ifdef HAVE_LIBPTHREAD
+static pthread_once_t adpcm_tables_once = PTHREAD_ONCE_INIT;
+#else
+static int adpcm_tables_ready;
+#endif
 
-	/*
-	 * Computes pred_diff = (code + 0.5) * step / 4,
-	 * but see comment in adpcm_coder.
-	 */
+static void adpcm_build_tables(void)
+{
+	int idx, code, i;
 
-	step = StepSize[state->step_idx];
+	for (idx = 0; idx < 89; idx++) {
+		for (code = 0; code < 8; code++) {
+			short step = StepSize[idx];
+			short pred_diff = step >> 3;
+			int next;
 
-	/* Compute difference and new predicted value */
-	pred_diff = step >> 3;
-	for (i = 0x4; i; i >>= 1, step >>= 1) {
-		if (code & i) {
-			pred_diff += step;
+			for (i = 0x4; i; i >>= 1, step >>= 1) {
+				if (code & i)
+					pred_diff += step;
+			}
+			adpcm_diff_table[idx][code] = pred_diff;
+			next = idx + IndexAdjust[code];
+			if (next < 0)
+				next = 0;
+			else if (next > 88)
+				next = 88;
+			adpcm_next_table[idx][code] = next;
 		}
 	}
-	state->pred_val += (sign) ? -pred_diff : pred_diff;
+}
+
+static inline void adpcm_init_tables(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&adpcm_tables_once, adpcm_build_tables);
+#else
+	if (!adpcm_tables_ready) {
+		adpcm_build_tables();
+		adpcm_tables_ready = 1;
+	}
+#endif
+}
+
+static inline int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
+{
+	unsigned int magnitude = code & 0x7;
+	short pred_diff = adpcm_diff_table[state->step_idx][magnitude];
+
+	state->pred_val += (code & 0x8) ? -pred_diff : pred_diff;
 
 	/* Clamp output value */
 	if (state->pred_val > 32767) {
@@ -200,14 +234,7 @@ static int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
 		state->pred_val = -32768;
 	}
 
-	/* Find new StepSize index value */
-	state->step_idx += IndexAdjust[code];
-
-	if (state->step_idx < 0) {
-		state->step_idx = 0;
-	} else if (state->step_idx > 88) {
-		state->step_idx = 88;
-	}
+	state->step_idx = adpcm_next_table[state->step_idx][magnitude];
 	return (state->pred_val);
 }
 
@@ -226,12 +253,16 @@ void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
 	unsigned int channel;
+
+	adpcm_init_tables();
 	for (channel = 0; channel < channels; ++channel, ++states) {
 		const char *src;
 		int srcbit;
 		char *dst;
 		int src_step, srcbit_step, dst_step;
 		snd_pcm_uframes_t frames1;
+		/* keep the state out of memory the samples may alias */
+		snd_pcm_adpcm_state_t state = *states;
 		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
 		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
 		srcbit = src_area->first + src_area->step * src_offset;
@@ -242,6 +273,25 @@ void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (putidx == SND_PCM_LINEAR_S16_INDEX) {
+			while (frames1-- > 0) {
+				unsigned char v;
+				if (srcbit)
+					v = *src & 0x0f;
+				else
+					v = (*src >> 4) & 0x0f;
+				*(int16_t *)dst = adpcm_decoder(v, &state);
+				src += src_step;
+				srcbit += srcbit_step;
+				if (srcbit == 8) {
+					src++;
+					srcbit = 0;
+				}
+				dst += dst_step;
+			}
+			*states = state;
+			continue;
+		}
 		while (frames1-- > 0) {
 			int16_t sample;
 			unsigned char v;
@@ -249,7 +299,7 @@ void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 				v = *src & 0x0f;
 			else
 				v = (*src >> 4) & 0x0f;
-			sample = adpcm_decoder(v, states);
+			sample = adpcm_decoder(v, &state);
 			goto *put;
 #define PUT16_END after
 #include "plugin_ops.h"
@@ -263,6 +313,7 @@ void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 			}
 			dst += dst_step;
 		}
+		*states = state;
 	}
 }
 
@@ -286,6 +337,8 @@ void snd_pcm_adpcm_encode(const snd_pcm_channel_area_t *dst_areas,
 		int dstbit;
 		int src_step, dst_step, dstbit_step;
 		snd_pcm_uframes_t frames1;
+		/* keep the state out of memory the samples may alias */
+		snd_pcm_adpcm_state_t state = *states;
 		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
 		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
 		src = snd_pcm_channel_area_addr(src_area, src_offset);
@@ -298,12 +351,16 @@ void snd_pcm_adpcm_encode(const snd_pcm_channel_area_t *dst_areas,
 		frames1 = frames;
 		while (frames1-- > 0) {
 			int v;
+			if (getidx == SND_PCM_LINEAR_S16_INDEX) {
+				sample = *(const int16_t *)src;
+				goto after;
+			}
 			goto *get;
 #define GET16_END after
 #include "plugin_ops.h"
 #undef GET16_END
 		after:
-			v = adpcm_encoder(sample, states);
+			v = adpcm_encoder(sample, &state);
 			if (dstbit)
 				*dst = (*dst & 0xf0) | v;
 			else
@@ -316,6 +373,7 @@ void snd_pcm_adpcm_encode(const snd_pcm_channel_area_t *dst_areas,
 				dstbit = 0;
 			}
 		}
+		*states = state;
 	}
 }
 
@@ -29,6 +29,9 @@
 #include "bswap.h"
 #include "pcm_local.h"
 #include "pcm_plugin.h"
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "plugin_ops.h"
 
@@ -141,6 +144,50 @@ static int alaw_to_s16(unsigned char a_val)
 
 #ifndef DOC_HIDDEN
 
+/*
+ * The conversions are done via tables built on the first use and shared
+ * by all instances.  The A-law code depends only on the sign and on the
+ * magnitude >> 4, the index 2048 is the clipped magnitude of -32768.
+ */
+static unsigned char alaw_enc_table[2049];
+static int16_t alaw_dec_table[256];
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_once_t alaw_tables_once = PTHREAD_ONCE_INIT;
+#else
+static int alaw_tables_ready;
+#endif
+
+static void alaw_build_tables(void)
+{
+	int i;
+
+	for (i = 0; i < 2048; i++)
+		alaw_enc_table[i] = s16_to_alaw(i << 4) ^ 0xD5;
+	alaw_enc_table[2048] = alaw_enc_table[2047];
+	for (i = 0; i < 256; i++)
+		alaw_dec_table[i] = alaw_to_s16(i);
+}
+
+static inline void alaw_init_tables(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&alaw_tables_once, alaw_build_tables);
+#else
+	if (!alaw_tables_ready) {
+		alaw_build_tables();
+		alaw_tables_ready = 1;
+	}
+#endif
+}
+
+static inline unsigned char alaw_encode_sample(int pcm_val)
+{
+	if (pcm_val >= 0)
+		return alaw_enc_table[pcm_val >> 4] ^ 0xD5;
+	return alaw_enc_table[-pcm_val >> 4] ^ 0x55;
+}
+
 void snd_pcm_alaw_decode(const snd_pcm_channel_area_t *dst_areas,
 			 snd_pcm_uframes_t dst_offset,
 			 const snd_pcm_channel_area_t *src_areas,
@@ -152,7 +199,19 @@ void snd_pcm_alaw_decode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
+	snd_pcm_channel_area_t dst_all, src_all;
 	unsigned int channel;
+
+	alaw_init_tables();
+	if (snd_pcm_area_collapse(&dst_all, dst_areas, channels) &&
+	    snd_pcm_area_collapse(&src_all, src_areas, channels)) {
+		dst_areas = &dst_all;
+		src_areas = &src_all;
+		dst_offset *= channels;
+		src_offset *= channels;
+		frames *= channels;
+		channels = 1;
+	}
 	for (channel = 0; channel < channels; ++channel) {
 		const unsigned char *src;
 		char *dst;
@@ -165,8 +224,23 @@ void snd_pcm_alaw_decode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (putidx == SND_PCM_LINEAR_S16_INDEX) {
+			if (src_step == 1 && dst_step == 2) {
+				int16_t *d = (int16_t *)dst;
+				snd_pcm_uframes_t i;
+				for (i = 0; i < frames1; i++)
+					d[i] = alaw_dec_table[src[i]];
+				continue;
+			}
+			while (frames1-- > 0) {
+				*(int16_t *)dst = alaw_dec_table[*src];
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
-			int16_t sample = alaw_to_s16(*src);
+			int16_t sample = alaw_dec_table[*src];
 			goto *put;
 #define PUT16_END after
 #include "plugin_ops.h"
@@ -189,8 +263,20 @@ void snd_pcm_alaw_encode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef GET16_LABELS
 	void *get = get16_labels[getidx];
+	snd_pcm_channel_area_t dst_all, src_all;
 	unsigned int channel;
 	int16_t sample = 0;
+
+	alaw_init_tables();
+	if (snd_pcm_area_collapse(&dst_all, dst_areas, channels) &&
+	    snd_pcm_area_collapse(&src_all, src_areas, channels)) {
+		dst_areas = &dst_all;
+		src_areas = &src_all;
+		dst_offset *= channels;
+		src_offset *= channels;
+		frames *= channels;
+		channels = 1;
+	}
 	for (channel = 0; channel < channels; ++channel) {
 		const char *src;
 		char *dst;
@@ -203,13 +289,28 @@ void snd_pcm_alaw_encode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (getidx == SND_PCM_LINEAR_S16_INDEX) {
+			if (src_step == 2 && dst_step == 1) {
+				const int16_t *s = (const int16_t *)src;
+				snd_pcm_uframes_t i;
+				for (i = 0; i < frames1; i++)
+					dst[i] = alaw_encode_sample(s[i]);
+				continue;
+			}
+			while (frames1-- > 0) {
+				*dst = alaw_encode_sample(*(const int16_t *)src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			goto *get;
 #define GET16_END after
 #include "plugin_ops.h"
 #undef GET16_END
 		after:
-			*dst = s16_to_alaw(sample);
+			*dst = alaw_encode_sample(sample);
 			src += src_step;
 			dst += dst_step;
 		}
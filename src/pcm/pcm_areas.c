@@ -0,0 +1,598 @@
+/*
+ *  PCM Interface - interleaved <-> non-interleaved area transposition
+ *
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * snd_pcm_areas_copy() handles a copy between an interleaved and
+ * a non-interleaved buffer one channel at a time, with a strided access
+ * on one side.  The kernels below transpose all channels at once for the
+ * common layouts (2, 4, 6 or 8 channels, 16, 24 or 32-bit samples).
+ * The 16 and 32-bit power-of-two channel counts use SSE2 unpacks or NEON
+ * structure loads/stores; the rest are loops with a constant channel count
+ * which the compiler fully unrolls.
+ */
+
+#include <string.h>
+#include "pcm_local.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define AREAS_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define AREAS_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#define MAX_TRANSPOSE_CHANNELS	8
+
+/* scalar kernels; channels is a constant at each call site */
+
+static inline void interleave_16(uint16_t *dst, const uint16_t **src,
+				 unsigned int channels,
+				 snd_pcm_uframes_t start, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	dst += start * channels;
+	for (f = start; f < frames; f++)
+		for (c = 0; c < channels; c++)
+			*dst++ = src[c][f];
+}
+
+static inline void deinterleave_16(uint16_t **dst, const uint16_t *src,
+				   unsigned int channels,
+				   snd_pcm_uframes_t start, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	src += start * channels;
+	for (f = start; f < frames; f++)
+		for (c = 0; c < channels; c++)
+			dst[c][f] = *src++;
+}
+
+static inline void interleave_32(uint32_t *dst, const uint32_t **src,
+				 unsigned int channels,
+				 snd_pcm_uframes_t start, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	dst += start * channels;
+	for (f = start; f < frames; f++)
+		for (c = 0; c < channels; c++)
+			*dst++ = src[c][f];
+}
+
+static inline void deinterleave_32(uint32_t **dst, const uint32_t *src,
+				   unsigned int channels,
+				   snd_pcm_uframes_t start, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	src += start * channels;
+	for (f = start; f < frames; f++)
+		for (c = 0; c < channels; c++)
+			dst[c][f] = *src++;
+}
+
+static inline void interleave_24(uint8_t *dst, const uint8_t **src,
+				 unsigned int channels, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	for (f = 0; f < frames; f++)
+		for (c = 0; c < channels; c++, dst += 3)
+			memcpy(dst, src[c] + f * 3, 3);
+}
+
+static inline void deinterleave_24(uint8_t **dst, const uint8_t *src,
+				   unsigned int channels, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	for (f = 0; f < frames; f++)
+		for (c = 0; c < channels; c++, src += 3)
+			memcpy(dst[c] + f * 3, src, 3);
+}
+
+#ifdef AREAS_SIMD_SSE2
+
+#define LOAD(p)		_mm_loadu_si128((const __m128i *)(p))
+#define STORE(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+
+/* 8x8 16-bit transposition, its own inverse */
+static inline void sse2_transpose_8x16(__m128i *v)
+{
+	__m128i a[8], b[8];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		a[i * 2] = _mm_unpacklo_epi16(v[i * 2], v[i * 2 + 1]);
+		a[i * 2 + 1] = _mm_unpackhi_epi16(v[i * 2], v[i * 2 + 1]);
+	}
+	for (i = 0; i < 2; i++) {
+		b[i * 4 + 0] = _mm_unpacklo_epi32(a[i * 4 + 0], a[i * 4 + 2]);
+		b[i * 4 + 1] = _mm_unpackhi_epi32(a[i * 4 + 0], a[i * 4 + 2]);
+		b[i * 4 + 2] = _mm_unpacklo_epi32(a[i * 4 + 1], a[i * 4 + 3]);
+		b[i * 4 + 3] = _mm_unpackhi_epi32(a[i * 4 + 1], a[i * 4 + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		v[i * 2] = _mm_unpacklo_epi64(b[i], b[i + 4]);
+		v[i * 2 + 1] = _mm_unpackhi_epi64(b[i], b[i + 4]);
+	}
+}
+
+static inline void sse2_transpose_4x32(__m128i *v)
+{
+	__m128i a0 = _mm_unpacklo_epi32(v[0], v[1]);
+	__m128i a1 = _mm_unpackhi_epi32(v[0], v[1]);
+	__m128i a2 = _mm_unpacklo_epi32(v[2], v[3]);
+	__m128i a3 = _mm_unpackhi_epi32(v[2], v[3]);
+
+	v[0] = _mm_unpacklo_epi64(a0, a2);
+	v[1] = _mm_unpackhi_epi64(a0, a2);
+	v[2] = _mm_unpacklo_epi64(a1, a3);
+	v[3] = _mm_unpackhi_epi64(a1, a3);
+}
+
+/* returns the number of frames done */
+static snd_pcm_uframes_t simd_interleave_16(uint16_t *dst, const uint16_t **src,
+					    unsigned int channels,
+					    snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 8 <= frames; f += 8, dst += 16) {
+			__m128i a = LOAD(src[0] + f), b = LOAD(src[1] + f);
+			STORE(dst, _mm_unpacklo_epi16(a, b));
+			STORE(dst + 8, _mm_unpackhi_epi16(a, b));
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 8 <= frames; f += 8, dst += 32) {
+			__m128i ab0 = _mm_unpacklo_epi16(LOAD(src[0] + f), LOAD(src[1] + f));
+			__m128i ab1 = _mm_unpackhi_epi16(LOAD(src[0] + f), LOAD(src[1] + f));
+			__m128i cd0 = _mm_unpacklo_epi16(LOAD(src[2] + f), LOAD(src[3] + f));
+			__m128i cd1 = _mm_unpackhi_epi16(LOAD(src[2] + f), LOAD(src[3] + f));
+			STORE(dst, _mm_unpacklo_epi32(ab0, cd0));
+			STORE(dst + 8, _mm_unpackhi_epi32(ab0, cd0));
+			STORE(dst + 16, _mm_unpacklo_epi32(ab1, cd1));
+			STORE(dst + 24, _mm_unpackhi_epi32(ab1, cd1));
+		}
+		return f;
+	case 8:
+		for (f = 0; f + 8 <= frames; f += 8, dst += 64) {
+			__m128i v[8];
+			int i;
+			for (i = 0; i < 8; i++)
+				v[i] = LOAD(src[i] + f);
+			sse2_transpose_8x16(v);
+			for (i = 0; i < 8; i++)
+				STORE(dst + i * 8, v[i]);
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_deinterleave_16(uint16_t **dst, const uint16_t *src,
+					      unsigned int channels,
+					      snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 8 <= frames; f += 8, src += 16) {
+			__m128i a = LOAD(src), b = LOAD(src + 8), t;
+			int i;
+			/* the perfect shuffle of 16 elements has order 4 */
+			for (i = 0; i < 3; i++) {
+				t = _mm_unpacklo_epi16(a, b);
+				b = _mm_unpackhi_epi16(a, b);
+				a = t;
+			}
+			STORE(dst[0] + f, a);
+			STORE(dst[1] + f, b);
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 8 <= frames; f += 8, src += 32) {
+			__m128i v0 = LOAD(src), v1 = LOAD(src + 8);
+			__m128i v2 = LOAD(src + 16), v3 = LOAD(src + 24);
+			__m128i t0 = _mm_unpacklo_epi16(v0, v1);
+			__m128i t1 = _mm_unpackhi_epi16(v0, v1);
+			__m128i t2 = _mm_unpacklo_epi16(v2, v3);
+			__m128i t3 = _mm_unpackhi_epi16(v2, v3);
+			__m128i u0 = _mm_unpacklo_epi16(t0, t1);
+			__m128i u1 = _mm_unpackhi_epi16(t0, t1);
+			__m128i u2 = _mm_unpacklo_epi16(t2, t3);
+			__m128i u3 = _mm_unpackhi_epi16(t2, t3);
+			STORE(dst[0] + f, _mm_unpacklo_epi64(u0, u2));
+			STORE(dst[1] + f, _mm_unpackhi_epi64(u0, u2));
+			STORE(dst[2] + f, _mm_unpacklo_epi64(u1, u3));
+			STORE(dst[3] + f, _mm_unpackhi_epi64(u1, u3));
+		}
+		return f;
+	case 8:
+		for (f = 0; f + 8 <= frames; f += 8, src += 64) {
+			__m128i v[8];
+			int i;
+			for (i = 0; i < 8; i++)
+				v[i] = LOAD(src + i * 8);
+			sse2_transpose_8x16(v);
+			for (i = 0; i < 8; i++)
+				STORE(dst[i] + f, v[i]);
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_interleave_32(uint32_t *dst, const uint32_t **src,
+					    unsigned int channels,
+					    snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 4 <= frames; f += 4, dst += 8) {
+			__m128i a = LOAD(src[0] + f), b = LOAD(src[1] + f);
+			STORE(dst, _mm_unpacklo_epi32(a, b));
+			STORE(dst + 4, _mm_unpackhi_epi32(a, b));
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 4 <= frames; f += 4, dst += 16) {
+			__m128i v[4];
+			int i;
+			for (i = 0; i < 4; i++)
+				v[i] = LOAD(src[i] + f);
+			sse2_transpose_4x32(v);
+			for (i = 0; i < 4; i++)
+				STORE(dst + i * 4, v[i]);
+		}
+		return f;
+	case 8:
+		for (f = 0; f + 4 <= frames; f += 4, dst += 32) {
+			__m128i lo[4], hi[4];
+			int i;
+			for (i = 0; i < 4; i++) {
+				lo[i] = LOAD(src[i] + f);
+				hi[i] = LOAD(src[i + 4] + f);
+			}
+			sse2_transpose_4x32(lo);
+			sse2_transpose_4x32(hi);
+			for (i = 0; i < 4; i++) {
+				STORE(dst + i * 8, lo[i]);
+				STORE(dst + i * 8 + 4, hi[i]);
+			}
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_deinterleave_32(uint32_t **dst, const uint32_t *src,
+					      unsigned int channels,
+					      snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 4 <= frames; f += 4, src += 8) {
+			__m128i a = LOAD(src), b = LOAD(src + 4);
+			__m128i t0 = _mm_unpacklo_epi32(a, b);
+			__m128i t1 = _mm_unpackhi_epi32(a, b);
+			STORE(dst[0] + f, _mm_unpacklo_epi32(t0, t1));
+			STORE(dst[1] + f, _mm_unpackhi_epi32(t0, t1));
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 4 <= frames; f += 4, src += 16) {
+			__m128i v[4];
+			int i;
+			for (i = 0; i < 4; i++)
+				v[i] = LOAD(src + i * 4);
+			sse2_transpose_4x32(v);
+			for (i = 0; i < 4; i++)
+				STORE(dst[i] + f, v[i]);
+		}
+		return f;
+	case 8:
+		for (f = 0; f + 4 <= frames; f += 4, src += 32) {
+			__m128i lo[4], hi[4];
+			int i;
+			for (i = 0; i < 4; i++) {
+				lo[i] = LOAD(src + i * 8);
+				hi[i] = LOAD(src + i * 8 + 4);
+			}
+			sse2_transpose_4x32(lo);
+			sse2_transpose_4x32(hi);
+			for (i = 0; i < 4; i++) {
+				STORE(dst[i] + f, lo[i]);
+				STORE(dst[i + 4] + f, hi[i]);
+			}
+		}
+		return f;
+	}
+	return 0;
+}
+
+#undef LOAD
+#undef STORE
+
+#elif defined(AREAS_SIMD_NEON)
+
+static snd_pcm_uframes_t simd_interleave_16(uint16_t *dst, const uint16_t **src,
+					    unsigned int channels,
+					    snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 8 <= frames; f += 8, dst += 16) {
+			uint16x8x2_t v;
+			v.val[0] = vld1q_u16(src[0] + f);
+			v.val[1] = vld1q_u16(src[1] + f);
+			vst2q_u16(dst, v);
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 8 <= frames; f += 8, dst += 32) {
+			uint16x8x4_t v;
+			v.val[0] = vld1q_u16(src[0] + f);
+			v.val[1] = vld1q_u16(src[1] + f);
+			v.val[2] = vld1q_u16(src[2] + f);
+			v.val[3] = vld1q_u16(src[3] + f);
+			vst4q_u16(dst, v);
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_deinterleave_16(uint16_t **dst, const uint16_t *src,
+					      unsigned int channels,
+					      snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 8 <= frames; f += 8, src += 16) {
+			uint16x8x2_t v = vld2q_u16(src);
+			vst1q_u16(dst[0] + f, v.val[0]);
+			vst1q_u16(dst[1] + f, v.val[1]);
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 8 <= frames; f += 8, src += 32) {
+			uint16x8x4_t v = vld4q_u16(src);
+			vst1q_u16(dst[0] + f, v.val[0]);
+			vst1q_u16(dst[1] + f, v.val[1]);
+			vst1q_u16(dst[2] + f, v.val[2]);
+			vst1q_u16(dst[3] + f, v.val[3]);
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_interleave_32(uint32_t *dst, const uint32_t **src,
+					    unsigned int channels,
+					    snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 4 <= frames; f += 4, dst += 8) {
+			uint32x4x2_t v;
+			v.val[0] = vld1q_u32(src[0] + f);
+			v.val[1] = vld1q_u32(src[1] + f);
+			vst2q_u32(dst, v);
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 4 <= frames; f += 4, dst += 16) {
+			uint32x4x4_t v;
+			v.val[0] = vld1q_u32(src[0] + f);
+			v.val[1] = vld1q_u32(src[1] + f);
+			v.val[2] = vld1q_u32(src[2] + f);
+			v.val[3] = vld1q_u32(src[3] + f);
+			vst4q_u32(dst, v);
+		}
+		return f;
+	}
+	return 0;
+}
+
+static snd_pcm_uframes_t simd_deinterleave_32(uint32_t **dst, const uint32_t *src,
+					      unsigned int channels,
+					      snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t f;
+
+	switch (channels) {
+	case 2:
+		for (f = 0; f + 4 <= frames; f += 4, src += 8) {
+			uint32x4x2_t v = vld2q_u32(src);
+			vst1q_u32(dst[0] + f, v.val[0]);
+			vst1q_u32(dst[1] + f, v.val[1]);
+		}
+		return f;
+	case 4:
+		for (f = 0; f + 4 <= frames; f += 4, src += 16) {
+			uint32x4x4_t v = vld4q_u32(src);
+			vst1q_u32(dst[0] + f, v.val[0]);
+			vst1q_u32(dst[1] + f, v.val[1]);
+			vst1q_u32(dst[2] + f, v.val[2]);
+			vst1q_u32(dst[3] + f, v.val[3]);
+		}
+		return f;
+	}
+	return 0;
+}
+
+#else
+
+#define simd_interleave_16(dst, src, channels, frames)		0
+#define simd_deinterleave_16(dst, src, channels, frames)	0
+#define simd_interleave_32(dst, src, channels, frames)		0
+#define simd_deinterleave_32(dst, src, channels, frames)	0
+
+#endif
+
+/* the areas describe one interleaved buffer, byte aligned */
+static int areas_interleaved(const snd_pcm_channel_area_t *areas,
+			     unsigned int channels, unsigned int width)
+{
+	unsigned int c;
+
+	if (!areas[0].addr || areas[0].first % 8 ||
+	    areas[0].step != channels * width)
+		return 0;
+	for (c = 1; c < channels; c++) {
+		if (areas[c].addr != areas[0].addr ||
+		    areas[c].step != areas[0].step ||
+		    areas[c].first != areas[0].first + c * width)
+			return 0;
+	}
+	return 1;
+}
+
+/* each area is a contiguous, byte aligned channel buffer */
+static int areas_planar(const snd_pcm_channel_area_t *areas,
+			unsigned int channels, unsigned int width)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		if (!areas[c].addr || areas[c].first % 8 ||
+		    areas[c].step != width)
+			return 0;
+	}
+	return 1;
+}
+
+#define TRANSPOSE(kernel, dst, src, channels, start, frames) \
+	switch (channels) { \
+	case 2: kernel(dst, src, 2, start, frames); break; \
+	case 4: kernel(dst, src, 4, start, frames); break; \
+	case 6: kernel(dst, src, 6, start, frames); break; \
+	case 8: kernel(dst, src, 8, start, frames); break; \
+	}
+
+#define TRANSPOSE_24(kernel, dst, src, channels, frames) \
+	switch (channels) { \
+	case 2: kernel(dst, src, 2, frames); break; \
+	case 4: kernel(dst, src, 4, frames); break; \
+	case 6: kernel(dst, src, 6, frames); break; \
+	case 8: kernel(dst, src, 8, frames); break; \
+	}
+
+/*
+ * copy the areas when one side is an interleaved buffer and the other
+ * side contiguous channel buffers
+ *
+ * returns 1 when the areas were copied, 0 when the layout is not handled
+ */
+int snd_pcm_areas_transpose(const snd_pcm_channel_area_t *dst_areas,
+			    snd_pcm_uframes_t dst_offset,
+			    const snd_pcm_channel_area_t *src_areas,
+			    snd_pcm_uframes_t src_offset,
+			    unsigned int channels, snd_pcm_uframes_t frames,
+			    unsigned int width)
+{
+	void *planar[MAX_TRANSPOSE_CHANNELS];
+	void *inter;
+	snd_pcm_uframes_t done;
+	unsigned int c;
+	int to_inter;
+
+	if (channels < 2 || channels > MAX_TRANSPOSE_CHANNELS || (channels & 1))
+		return 0;
+	if (width != 16 && width != 24 && width != 32)
+		return 0;
+	if (areas_interleaved(dst_areas, channels, width) &&
+	    areas_planar(src_areas, channels, width)) {
+		to_inter = 1;
+		inter = snd_pcm_channel_area_addr(dst_areas, dst_offset);
+		for (c = 0; c < channels; c++)
+			planar[c] = snd_pcm_channel_area_addr(&src_areas[c], src_offset);
+	} else if (areas_interleaved(src_areas, channels, width) &&
+		   areas_planar(dst_areas, channels, width)) {
+		to_inter = 0;
+		inter = snd_pcm_channel_area_addr(src_areas, src_offset);
+		for (c = 0; c < channels; c++)
+			planar[c] = snd_pcm_channel_area_addr(&dst_areas[c], dst_offset);
+	} else {
+		return 0;
+	}
+
+	switch (width) {
+	case 16:
+		if (to_inter) {
+			done = simd_interleave_16(inter, (const uint16_t **)planar,
+						  channels, frames);
+			TRANSPOSE(interleave_16, (uint16_t *)inter,
+				  (const uint16_t **)planar, channels, done, frames);
+		} else {
+			done = simd_deinterleave_16((uint16_t **)planar, inter,
+						    channels, frames);
+			TRANSPOSE(deinterleave_16, (uint16_t **)planar,
+				  (const uint16_t *)inter, channels, done, frames);
+		}
+		break;
+	case 24:
+		if (to_inter)
+			TRANSPOSE_24(interleave_24, (uint8_t *)inter,
+				     (const uint8_t **)planar, channels, frames)
+		else
+			TRANSPOSE_24(deinterleave_24, (uint8_t **)planar,
+				     (const uint8_t *)inter, channels, frames)
+		break;
+	case 32:
+		if (to_inter) {
+			done = simd_interleave_32(inter, (const uint32_t **)planar,
+						  channels, frames);
+			TRANSPOSE(interleave_32, (uint32_t *)inter,
+				  (const uint32_t **)planar, channels, done, frames);
+		} else {
+			done = simd_deinterleave_32((uint32_t **)planar, inter,
+						    channels, frames);
+			TRANSPOSE(deinterleave_32, (uint32_t **)planar,
+				  (const uint32_t *)inter, channels, done, frames);
+		}
+		break;
+	}
+	return 1;
+}
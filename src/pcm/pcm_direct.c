@@ -84,7 +84,9 @@ int snd_pcm_direct_semaphore_create_or_connect(snd_pcm_direct_t *dmix)
 
 static unsigned int snd_pcm_direct_magic(snd_pcm_direct_t *dmix)
 {
-	if (!dmix->direct_memory_access)
+	if (dmix->ring_mix)
+		return 0xc15ad300 + sizeof(snd_pcm_direct_share_t);
+	else if (!dmix->direct_memory_access)
 		return 0xa15ad300 + sizeof(snd_pcm_direct_share_t);
 	else
 		return 0xb15ad300 + sizeof(snd_pcm_direct_share_t);
@@ -1904,6 +1906,9 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 	rec->direct_memory_access = 0;
 #endif
 	rec->hw_ptr_alignment = SND_PCM_HW_PTR_ALIGNMENT_AUTO;
+	rec->mix_kernel = SND_PCM_DMIX_KERNEL_AUTO;
+	rec->ring_mix = 0;
+	rec->ring_slots = 16;
 	rec->tstamp_type = -1;
 
 	/* read defaults */
@@ -1968,6 +1973,29 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 
 			continue;
 		}
+		if (strcmp(id, "mix_kernel") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (strcmp(str, "auto") == 0)
+				rec->mix_kernel = SND_PCM_DMIX_KERNEL_AUTO;
+			else if (strcmp(str, "generic") == 0)
+				rec->mix_kernel = SND_PCM_DMIX_KERNEL_GENERIC;
+			else if (strcmp(str, "sse2") == 0)
+				rec->mix_kernel = SND_PCM_DMIX_KERNEL_SSE2;
+			else if (strcmp(str, "avx2") == 0)
+				rec->mix_kernel = SND_PCM_DMIX_KERNEL_AVX2;
+			else if (strcmp(str, "neon") == 0)
+				rec->mix_kernel = SND_PCM_DMIX_KERNEL_NEON;
+			else {
+				SNDERR("The field mix_kernel is invalid : %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "tstamp_type") == 0) {
 			const char *str;
 			err = snd_config_get_string(n, &str);
@@ -2068,6 +2096,25 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 			rec->direct_memory_access = err;
 			continue;
 		}
+		if (strcmp(id, "ring_mix") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			rec->ring_mix = err;
+			continue;
+		}
+		if (strcmp(id, "ring_mix_clients") == 0) {
+			long val;
+			err = snd_config_get_integer(n, &val);
+			if (err < 0)
+				return err;
+			if (val < 1 || val > 64) {
+				SNDERR("The field ring_mix_clients must be in range 1-64");
+				return -EINVAL;
+			}
+			rec->ring_slots = val;
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -62,6 +62,14 @@ typedef enum snd_pcm_direct_hw_ptr_alignment {
 	SND_PCM_HW_PTR_ALIGNMENT_AUTO = 3	/* automatic selection */
 } snd_pcm_direct_hw_ptr_alignment_t;
 
+typedef enum snd_pcm_direct_mix_kernel {
+	SND_PCM_DMIX_KERNEL_AUTO = 0,	/* best kernel supported by the CPU */
+	SND_PCM_DMIX_KERNEL_GENERIC = 1,	/* portable C code */
+	SND_PCM_DMIX_KERNEL_SSE2 = 2,	/* x86-64 SSE2 */
+	SND_PCM_DMIX_KERNEL_AVX2 = 3,	/* x86-64 AVX2 */
+	SND_PCM_DMIX_KERNEL_NEON = 4	/* ARM NEON */
+} snd_pcm_direct_mix_kernel_t;
+
 struct slave_params {
 	snd_pcm_format_t format;
 	int rate;
@@ -128,6 +136,7 @@ typedef struct {
 } snd_pcm_direct_share_t;
 
 typedef struct snd_pcm_direct snd_pcm_direct_t;
+typedef struct snd_pcm_dmix_ring snd_pcm_dmix_ring_t;
 
 struct snd_pcm_direct {
 	snd_pcm_type_t type;		/* type (dmix, dsnoop, dshare) */
@@ -172,6 +181,7 @@ struct snd_pcm_direct {
 	unsigned int *bindings;
 	unsigned int recoveries;	/* mirror of executed recoveries on slave */
 	int direct_memory_access;	/* use arch-optimized buffer RW */
+	int ring_mix;			/* per-client rings, lock-free mixing */
 	snd_pcm_direct_hw_ptr_alignment_t hw_ptr_alignment;
 	int tstamp_type;		/* cached from conf, can be -1(default) on top of real types */
 	union {
@@ -187,6 +197,14 @@ struct snd_pcm_direct {
 			mix_areas_24_t *remix_areas_24;
 			mix_areas_u8_t *remix_areas_u8;
 			unsigned int use_sem;
+			snd_pcm_direct_mix_kernel_t mix_kernel;
+			int shmid_ring;			/* IPC ring_mix memory identification */
+			snd_pcm_dmix_ring_t *ring;	/* shared client rings */
+			unsigned int ring_slots;	/* number of client rings */
+			unsigned int ring_slot;		/* our ring */
+			int ring_restart;		/* slave pointer was reset */
+			signed int *ring_scratch;	/* local sum buffer of the mixer */
+			unsigned long long *ring_appl;	/* local appl_ptr snapshots */
 		} dmix;
 		struct {
 			unsigned long long chn_mask;
@@ -358,7 +376,10 @@ struct snd_pcm_direct_open_conf {
 	int max_periods;
 	int var_periodsize;
 	int direct_memory_access;
+	int ring_mix;
+	unsigned int ring_slots;
 	snd_pcm_direct_hw_ptr_alignment_t hw_ptr_alignment;
+	snd_pcm_direct_mix_kernel_t mix_kernel;
 	int tstamp_type;
 	snd_config_t *slave;
 	snd_config_t *bindings;
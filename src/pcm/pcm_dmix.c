@@ -150,6 +150,8 @@ static void dmix_server_free(snd_pcm_direct_t *dmix)
 #define dmix_supported_format generic_dmix_supported_format
 #endif
 #endif
+#include "pcm_dmix_simd.c"
+#include "pcm_dmix_ring.c"
 
 static void mix_areas(snd_pcm_direct_t *dmix,
 		      const snd_pcm_channel_area_t *src_areas,
@@ -313,6 +315,7 @@ static void snd_pcm_dmix_sync_area(snd_pcm_t *pcm)
 	snd_pcm_direct_t *dmix = pcm->private_data;
 	snd_pcm_uframes_t slave_hw_ptr, slave_appl_ptr, slave_size;
 	snd_pcm_uframes_t appl_ptr, size, transfer;
+	snd_pcm_uframes_t slave_start;
 	const snd_pcm_channel_area_t *src_areas, *dst_areas;
 	
 	/* calculate the size to transfer */
@@ -360,6 +363,7 @@ static void snd_pcm_dmix_sync_area(snd_pcm_t *pcm)
 	appl_ptr = dmix->last_appl_ptr % pcm->buffer_size;
 	dmix->last_appl_ptr += size;
 	dmix->last_appl_ptr %= pcm->boundary;
+	slave_start = dmix->slave_appl_ptr;
 	slave_appl_ptr = dmix->slave_appl_ptr % dmix->slave_buffer_size;
 	dmix->slave_appl_ptr += size;
 	dmix->slave_appl_ptr %= dmix->slave_boundary;
@@ -370,7 +374,10 @@ static void snd_pcm_dmix_sync_area(snd_pcm_t *pcm)
 			transfer = pcm->buffer_size - appl_ptr;
 		if (slave_appl_ptr + transfer > dmix->slave_buffer_size)
 			transfer = dmix->slave_buffer_size - slave_appl_ptr;
-		mix_areas(dmix, src_areas, dst_areas, appl_ptr, slave_appl_ptr, transfer);
+		if (dmix->ring_mix)
+			dmix_ring_write_areas(dmix, src_areas, appl_ptr, slave_appl_ptr, transfer);
+		else
+			mix_areas(dmix, src_areas, dst_areas, appl_ptr, slave_appl_ptr, transfer);
 		size -= transfer;
 		if (! size)
 			break;
@@ -380,6 +387,8 @@ static void snd_pcm_dmix_sync_area(snd_pcm_t *pcm)
 		appl_ptr %= pcm->buffer_size;
 	}
 	dmix_up_sem(dmix);
+	if (dmix->ring_mix)
+		dmix_ring_publish(dmix, slave_start);
 }
 
 /*
@@ -558,6 +567,7 @@ static int snd_pcm_dmix_reset(snd_pcm_t *pcm)
 	dmix->appl_ptr = dmix->last_appl_ptr = dmix->hw_ptr;
 	dmix->slave_appl_ptr = dmix->slave_hw_ptr = *dmix->spcm->hw.ptr;
 	snd_pcm_direct_reset_slave_ptr(pcm, dmix);
+	dmix->u.dmix.ring_restart = 1;
 	return 0;
 }
 
@@ -568,6 +578,7 @@ static int snd_pcm_dmix_start_timer(snd_pcm_t *pcm, snd_pcm_direct_t *dmix)
 	snd_pcm_hwsync(dmix->spcm);
 	dmix->slave_appl_ptr = dmix->slave_hw_ptr = *dmix->spcm->hw.ptr;
 	snd_pcm_direct_reset_slave_ptr(pcm, dmix);
+	dmix->u.dmix.ring_restart = 1;
 	err = snd_timer_start(dmix->timer);
 	if (err < 0)
 		return err;
@@ -749,23 +760,28 @@ static snd_pcm_sframes_t snd_pcm_dmix_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t f
 	dmix->slave_appl_ptr -= size;
 	dmix->slave_appl_ptr %= dmix->slave_boundary;
 	slave_appl_ptr = dmix->slave_appl_ptr % dmix->slave_buffer_size;
-	dmix_down_sem(dmix);
-	for (;;) {
-		transfer = size;
-		if (appl_ptr + transfer > pcm->buffer_size)
-			transfer = pcm->buffer_size - appl_ptr;
-		if (slave_appl_ptr + transfer > dmix->slave_buffer_size)
-			transfer = dmix->slave_buffer_size - slave_appl_ptr;
-		remix_areas(dmix, src_areas, dst_areas, appl_ptr, slave_appl_ptr, transfer);
-		size -= transfer;
-		if (! size)
-			break;
-		slave_appl_ptr += transfer;
-		slave_appl_ptr %= dmix->slave_buffer_size;
-		appl_ptr += transfer;
-		appl_ptr %= pcm->buffer_size;
+	if (dmix->ring_mix) {
+		/* the mixer drops the rewound frames from the slave buffer */
+		dmix_ring_publish(dmix, dmix->slave_appl_ptr);
+	} else {
+		dmix_down_sem(dmix);
+		for (;;) {
+			transfer = size;
+			if (appl_ptr + transfer > pcm->buffer_size)
+				transfer = pcm->buffer_size - appl_ptr;
+			if (slave_appl_ptr + transfer > dmix->slave_buffer_size)
+				transfer = dmix->slave_buffer_size - slave_appl_ptr;
+			remix_areas(dmix, src_areas, dst_areas, appl_ptr, slave_appl_ptr, transfer);
+			size -= transfer;
+			if (! size)
+				break;
+			slave_appl_ptr += transfer;
+			slave_appl_ptr %= dmix->slave_buffer_size;
+			appl_ptr += transfer;
+			appl_ptr %= pcm->buffer_size;
+		}
+		dmix_up_sem(dmix);
 	}
-	dmix_up_sem(dmix);
 
 	snd_pcm_mmap_appl_backward(pcm, frames_to_remix);
 	result += frames_to_remix;
@@ -815,6 +831,8 @@ static int snd_pcm_dmix_close(snd_pcm_t *pcm)
  	if (dmix->client)
  		snd_pcm_direct_client_discard(dmix);
  	shm_sum_discard(dmix);
+	if (dmix->u.dmix.shmid_ring >= 0)
+		dmix_ring_discard(dmix);
 	if (snd_pcm_direct_shm_discard(dmix)) {
 		if (snd_pcm_direct_semaphore_discard(dmix))
 			snd_pcm_direct_semaphore_final(dmix, DIRECT_IPC_SEM_CLIENT);
@@ -920,6 +938,13 @@ static void snd_pcm_dmix_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_pcm_direct_t *dmix = pcm->private_data;
 
 	snd_output_printf(out, "Direct Stream Mixing PCM\n");
+	if (dmix->ring_mix)
+		snd_output_printf(out, "Ring mix: client %u/%u, %llu mixes\n",
+				  dmix->u.dmix.ring_slot, dmix->u.dmix.ring->slots,
+				  dmix->u.dmix.ring->mixes);
+	else if (dmix->u.dmix.use_sem)	/* the lockless mixing has no kernels */
+		snd_output_printf(out, "Mix kernel: %s\n",
+				  simd_mix_kernel_names[dmix->u.dmix.mix_kernel]);
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -1026,6 +1051,10 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 	dmix->tstamp_type = opts->tstamp_type;
 	dmix->semid = -1;
 	dmix->shmid = -1;
+	dmix->ring_mix = opts->ring_mix;
+	dmix->u.dmix.ring_slots = opts->ring_slots;
+	dmix->u.dmix.ring_slot = UINT_MAX;
+	dmix->u.dmix.shmid_ring = -1;
 
 	ret = snd_pcm_new(&pcm, dmix->type = SND_PCM_TYPE_DMIX, name, stream, mode);
 	if (ret < 0)
@@ -1064,6 +1093,7 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 	dmix->hw_ptr_alignment = opts->hw_ptr_alignment;
 	dmix->sync_ptr = snd_pcm_dmix_sync_ptr;
 	dmix->direct_memory_access = opts->direct_memory_access;
+	dmix->u.dmix.mix_kernel = opts->mix_kernel;
 
  retry:
 	if (first_instance) {
@@ -1154,6 +1184,14 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 		goto _err;
 	}
 
+	if (dmix->ring_mix) {
+		ret = dmix_ring_create_or_connect(dmix);
+		if (ret < 0) {
+			SNDERR("unable to initialize client rings");
+			goto _err;
+		}
+	}
+
 	ret = snd_pcm_direct_initialize_poll_fd(dmix);
 	if (ret < 0) {
 		SNDERR("unable to initialize poll_fd");
@@ -1161,6 +1199,10 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 	}
 
 	mix_select_callbacks(dmix);
+	if (dmix->ring_mix)
+		dmix->u.dmix.use_sem = 0;	/* clients never mix concurrently */
+	else
+		simd_mix_select_callbacks(dmix);
 		
 	pcm->poll_fd = dmix->poll_fd;
 	pcm->poll_events = POLLIN;	/* it's different than other plugins */
@@ -1188,6 +1230,8 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 		snd_pcm_close(spcm);
 	if (dmix->u.dmix.shmid_sum >= 0)
 		shm_sum_discard(dmix);
+	if (dmix->u.dmix.shmid_ring >= 0)
+		dmix_ring_discard(dmix);
 	if ((dmix->shmid >= 0) && (snd_pcm_direct_shm_discard(dmix))) {
 		if (snd_pcm_direct_semaphore_discard(dmix))
 			snd_pcm_direct_semaphore_final(dmix, DIRECT_IPC_SEM_CLIENT);
@@ -1226,6 +1270,11 @@ pcm.name {
 	tstamp_type STR		# timestamp type
 				# STR can be one of the below strings :
 				# default, gettimeofday, monotonic, monotonic_raw
+	mix_kernel STR		# mixing code implementation
+				# STR can be one of the below strings :
+				# auto (default), generic, sse2, avx2, neon
+	ring_mix BOOL		# per-client rings with lock-free mixing
+	ring_mix_clients INT	# max. number of ring_mix clients (default 16)
 	slave STR
 	# or
 	slave {			# Slave definition
@@ -1279,6 +1328,27 @@ the possible configurations:
   case of a dependency to another sound device (e.g. forwarding of
   microphone to speaker). Else "no" will be chosen.
 
+<code>mix_kernel</code> selects the implementation of the mixing
+loops for the native-endian \c S16 and \c S32 formats. By default
+(auto) the best vector kernel supported by the CPU is chosen once at
+open time: AVX2 or SSE2 on x86-64, NEON on ARM. "generic" forces the
+portable C code, the other values force a specific vector kernel
+(useful for A/B testing). A kernel not supported by the CPU falls back
+to the generic code with an error message. The vector kernels are used
+only when the mixing is protected by the semaphore, i.e. they are
+ignored with <code>direct_memory_access</code> (lockless dmix).
+
+When <code>ring_mix</code> is set true, each client writes its samples
+into its own ring in a shared memory area instead of adding them into
+the shared sum buffer under the semaphore. The slave buffer is then
+computed by a single mixer which sums all client rings; the client
+which posts new data while no mix is in progress becomes the mixer,
+clients arriving during a mix only leave a request for it and never
+wait. This removes the contention between many writers at the cost of
+one ring per client (<code>ring_mix_clients</code> limits their count).
+All clients of the same dmix must use the same setting. Only the
+native-endian \c S16 and \c S32 slave formats are supported.
+
 Note that the dmix plugin itself supports only a single configuration.
 That is, it supports only the fixed rate (default 48000), format
 (\c S16), channels (2), and period_time (125000).
@@ -0,0 +1,401 @@
+/*
+ * lock-free ring mixing mode
+ *
+ * Each client owns a slot in a shared memory area.  A slot holds a
+ * private copy of the slave ring buffer (in the 32-bit sum domain) which
+ * is written only by its owner, and the slave position up to which the
+ * owner has written (appl_ptr).  Writers never wait for each other:
+ * after publishing new data, a client requests a mix and, if no mix is
+ * in progress, performs it itself.  Requests arriving while a mix runs
+ * are picked up by the running mixer before it releases the mixer lock.
+ *
+ * The mixer recomputes the dirty part of the slave buffer from scratch
+ * by summing all slots which cover it, so the cost is linear in the
+ * number of clients and a rewind is only a matter of moving appl_ptr
+ * back.  Only the native-endian S16 and S32 formats are supported.
+ */
+
+#define DMIX_RING_MAX_SLOTS	64
+#define DMIX_RING_IDLE		(~0ULL)
+
+/* shared among the clients - be careful to be 32/64bit compatible! */
+struct snd_pcm_dmix_ring {
+	unsigned int mixer;		/* pid of the running mixer or 0 */
+	unsigned int pending;		/* mix request */
+	unsigned int slots;		/* number of client slots */
+	unsigned int channels;		/* slave channels */
+	unsigned long long buffer_size;	/* slave buffer size */
+	unsigned long long mixes;	/* executed mixes */
+	struct {
+		unsigned int owner;	/* pid of the client or 0 */
+		unsigned int pad;
+		unsigned long long start_ptr;	/* first written position */
+		unsigned long long appl_ptr;	/* written up to (owner) */
+		unsigned long long mixed_ptr;	/* mixed up to (mixer) */
+	} slot[DMIX_RING_MAX_SLOTS];
+};
+
+static inline signed int *dmix_ring_slot_data(snd_pcm_direct_t *dmix,
+					      unsigned int slot)
+{
+	snd_pcm_dmix_ring_t *ring = dmix->u.dmix.ring;
+
+	return (signed int *)(ring + 1) +
+		slot * ring->buffer_size * ring->channels;
+}
+
+static int dmix_ring_discard(snd_pcm_direct_t *dmix);
+
+static int dmix_ring_create_or_connect(snd_pcm_direct_t *dmix)
+{
+	snd_pcm_dmix_ring_t *ring;
+	struct shmid_ds buf;
+	unsigned int i, pid;
+	int tmpid, err;
+	size_t size;
+
+	switch (dmix->shmptr->s.format) {
+	case SND_PCM_FORMAT_S16:
+	case SND_PCM_FORMAT_S32:
+		break;
+	default:
+		SNDERR("ring_mix supports only native-endian S16 and S32 formats");
+		return -EINVAL;
+	}
+	size = sizeof(*ring) + (size_t)dmix->u.dmix.ring_slots *
+	       dmix->shmptr->s.channels * dmix->slave_buffer_size *
+	       sizeof(signed int);
+retryshm:
+	dmix->u.dmix.shmid_ring = shmget(dmix->ipc_key + 2, size,
+					 IPC_CREAT | dmix->ipc_perm);
+	err = -errno;
+	if (dmix->u.dmix.shmid_ring < 0) {
+		if (errno == EINVAL)
+		if ((tmpid = shmget(dmix->ipc_key + 2, 0, dmix->ipc_perm)) != -1)
+		if (!shmctl(tmpid, IPC_STAT, &buf))
+		if (!buf.shm_nattch)
+		/* no users so destroy the segment */
+		if (!shmctl(tmpid, IPC_RMID, NULL))
+			goto retryshm;
+		return err;
+	}
+	if (shmctl(dmix->u.dmix.shmid_ring, IPC_STAT, &buf) < 0) {
+		err = -errno;
+		dmix_ring_discard(dmix);
+		return err;
+	}
+	if (dmix->ipc_gid >= 0) {
+		buf.shm_perm.gid = dmix->ipc_gid;
+		shmctl(dmix->u.dmix.shmid_ring, IPC_SET, &buf);
+	}
+	ring = shmat(dmix->u.dmix.shmid_ring, 0, 0);
+	if (ring == (void *) -1) {
+		err = -errno;
+		dmix_ring_discard(dmix);
+		return err;
+	}
+	dmix->u.dmix.ring = ring;
+	/* the segment is created under the client semaphore */
+	if (ring->slots == 0) {
+		ring->slots = dmix->u.dmix.ring_slots;
+		ring->channels = dmix->shmptr->s.channels;
+		ring->buffer_size = dmix->slave_buffer_size;
+	} else if (ring->slots != dmix->u.dmix.ring_slots ||
+		   ring->channels != dmix->shmptr->s.channels ||
+		   ring->buffer_size != dmix->slave_buffer_size) {
+		SNDERR("ring_mix configuration mismatch with other clients");
+		dmix_ring_discard(dmix);
+		return -EINVAL;
+	}
+
+	/* claim a free slot, reuse the slots of dead clients */
+	pid = getpid();
+	for (i = 0; i < ring->slots; i++) {
+		unsigned int owner = 0;
+		if (__atomic_compare_exchange_n(&ring->slot[i].owner, &owner,
+						pid, 0, __ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			break;
+		if (kill(owner, 0) < 0 && errno == ESRCH &&
+		    __atomic_compare_exchange_n(&ring->slot[i].owner, &owner,
+						pid, 0, __ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			break;
+	}
+	if (i >= ring->slots) {
+		SNDERR("no free ring_mix slot (%u clients)", ring->slots);
+		dmix_ring_discard(dmix);
+		return -EBUSY;
+	}
+	__atomic_store_n(&ring->slot[i].appl_ptr, DMIX_RING_IDLE,
+			 __ATOMIC_RELEASE);
+	dmix->u.dmix.ring_slot = i;
+	/* the previous owner may have used other channel bindings */
+	memset(dmix_ring_slot_data(dmix, i), 0, ring->buffer_size *
+	       ring->channels * sizeof(signed int));
+	dmix->u.dmix.ring_restart = 1;
+
+	dmix->u.dmix.ring_scratch = malloc(dmix->slave_buffer_size *
+					   ring->channels * sizeof(signed int));
+	dmix->u.dmix.ring_appl = malloc(ring->slots *
+					sizeof(*dmix->u.dmix.ring_appl));
+	if (!dmix->u.dmix.ring_scratch || !dmix->u.dmix.ring_appl) {
+		dmix_ring_discard(dmix);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int dmix_ring_discard(snd_pcm_direct_t *dmix)
+{
+	snd_pcm_dmix_ring_t *ring = dmix->u.dmix.ring;
+	struct shmid_ds buf;
+	int ret = 0;
+
+	free(dmix->u.dmix.ring_scratch);
+	dmix->u.dmix.ring_scratch = NULL;
+	free(dmix->u.dmix.ring_appl);
+	dmix->u.dmix.ring_appl = NULL;
+	if (dmix->u.dmix.shmid_ring < 0)
+		return -EINVAL;
+	if (ring) {
+		if (dmix->u.dmix.ring_slot < ring->slots) {
+			unsigned int pid = getpid();
+			__atomic_compare_exchange_n(&ring->slot[dmix->u.dmix.ring_slot].owner,
+						    &pid, 0, 0, __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED);
+		}
+		if (shmdt(ring) < 0)
+			return -errno;
+	}
+	dmix->u.dmix.ring = NULL;
+	dmix->u.dmix.ring_slot = UINT_MAX;
+	if (shmctl(dmix->u.dmix.shmid_ring, IPC_STAT, &buf) < 0)
+		return -errno;
+	if (buf.shm_nattch == 0) {	/* we're the last user, destroy the segment */
+		if (shmctl(dmix->u.dmix.shmid_ring, IPC_RMID, NULL) < 0)
+			return -errno;
+		ret = 1;
+	}
+	dmix->u.dmix.shmid_ring = -1;
+	return ret;
+}
+
+/*
+ * copy the client samples to our slot (slave buffer coordinates)
+ */
+static void dmix_ring_write_areas(snd_pcm_direct_t *dmix,
+				  const snd_pcm_channel_area_t *src_areas,
+				  snd_pcm_uframes_t src_ofs,
+				  snd_pcm_uframes_t dst_ofs,
+				  snd_pcm_uframes_t size)
+{
+	unsigned int channels = dmix->shmptr->s.channels;
+	signed int *data = dmix_ring_slot_data(dmix, dmix->u.dmix.ring_slot);
+	int is16 = snd_pcm_format_width(dmix->shmptr->s.format) == 16;
+	unsigned int chn, dchn;
+
+	for (chn = 0; chn < dmix->channels; chn++) {
+		const snd_pcm_channel_area_t *area = &src_areas[chn];
+		const char *src;
+		signed int *dst;
+		unsigned int step = area->step / 8;
+		snd_pcm_uframes_t frames;
+
+		dchn = dmix->bindings ? dmix->bindings[chn] : chn;
+		if (dchn >= channels)
+			continue;
+		src = snd_pcm_channel_area_addr(area, src_ofs);
+		dst = data + dst_ofs * channels + dchn;
+		if (is16) {
+			for (frames = size; frames > 0; frames--) {
+				*dst = *(const signed short *)src;
+				src += step;
+				dst += channels;
+			}
+		} else {
+			for (frames = size; frames > 0; frames--) {
+				*dst = *(const signed int *)src >> 8;
+				src += step;
+				dst += channels;
+			}
+		}
+	}
+}
+
+/*
+ * offset of ptr in the window starting at base, clamped to the buffer
+ */
+static snd_pcm_uframes_t dmix_ring_offset(snd_pcm_direct_t *dmix,
+					  snd_pcm_uframes_t base,
+					  unsigned long long ptr)
+{
+	snd_pcm_uframes_t ofs;
+
+	ofs = pcm_frame_diff(ptr, base, dmix->slave_boundary);
+	if (ofs > dmix->slave_boundary / 2)	/* behind the window */
+		return 0;
+	if (ofs > dmix->slave_buffer_size)
+		return dmix->slave_buffer_size;
+	return ofs;
+}
+
+static void dmix_ring_mix_once(snd_pcm_direct_t *dmix)
+{
+	snd_pcm_dmix_ring_t *ring = dmix->u.dmix.ring;
+	unsigned long long *appl = dmix->u.dmix.ring_appl;
+	signed int *sum = dmix->u.dmix.ring_scratch;
+	snd_pcm_uframes_t buffer_size = dmix->slave_buffer_size;
+	snd_pcm_uframes_t base, lo, hi, ofs, end, a, m, idx;
+	const snd_pcm_channel_area_t *dst_areas;
+	unsigned int channels = ring->channels;
+	unsigned int i, chn;
+	int is16 = snd_pcm_format_width(dmix->shmptr->s.format) == 16;
+
+	/* never touch the frames already played */
+	base = dmix->slave_hw_ptr;
+	lo = buffer_size;
+	hi = 0;
+	for (i = 0; i < ring->slots; i++) {
+		appl[i] = DMIX_RING_IDLE;
+		if (!__atomic_load_n(&ring->slot[i].owner, __ATOMIC_ACQUIRE))
+			continue;
+		appl[i] = __atomic_load_n(&ring->slot[i].appl_ptr, __ATOMIC_ACQUIRE);
+		if (appl[i] == DMIX_RING_IDLE ||
+		    appl[i] == ring->slot[i].mixed_ptr)
+			continue;
+		a = dmix_ring_offset(dmix, base, appl[i]);
+		m = dmix_ring_offset(dmix, base, ring->slot[i].mixed_ptr);
+		if (a > m) {
+			ofs = a;
+			a = m;
+			m = ofs;
+		}
+		if (a < lo)
+			lo = a;
+		if (m > hi)
+			hi = m;
+	}
+	if (lo < hi) {
+		memset(sum + lo * channels, 0, (hi - lo) * channels * sizeof(*sum));
+		for (i = 0; i < ring->slots; i++) {
+			const signed int *data;
+			if (appl[i] == DMIX_RING_IDLE)
+				continue;
+			data = dmix_ring_slot_data(dmix, i);
+			ofs = dmix_ring_offset(dmix, base,
+					       __atomic_load_n(&ring->slot[i].start_ptr,
+							       __ATOMIC_RELAXED));
+			if (ofs < lo)
+				ofs = lo;
+			end = dmix_ring_offset(dmix, base, appl[i]);
+			if (end > hi)
+				end = hi;
+			for (; ofs < end; ofs++) {
+				idx = (base + ofs) % buffer_size;
+				for (chn = 0; chn < channels; chn++)
+					sum[ofs * channels + chn] += data[idx * channels + chn];
+			}
+		}
+		dst_areas = snd_pcm_mmap_areas(dmix->spcm);
+		for (chn = 0; chn < channels; chn++) {
+			for (ofs = lo; ofs < hi; ofs++) {
+				signed int sample = sum[ofs * channels + chn];
+				void *dst;
+
+				idx = (base + ofs) % buffer_size;
+				dst = snd_pcm_channel_area_addr(&dst_areas[chn], idx);
+				if (is16) {
+					if (sample > 0x7fff)
+						sample = 0x7fff;
+					else if (sample < -0x8000)
+						sample = -0x8000;
+					*(signed short *)dst = sample;
+				} else {
+					if (sample > 0x7fffff)
+						sample = 0x7fffffff;
+					else if (sample < -0x800000)
+						sample = -0x80000000;
+					else
+						sample *= 256;
+					*(signed int *)dst = sample;
+				}
+			}
+		}
+		ring->mixes++;
+	}
+	for (i = 0; i < ring->slots; i++) {
+		if (appl[i] != DMIX_RING_IDLE)
+			ring->slot[i].mixed_ptr = appl[i];
+	}
+}
+
+/*
+ * request a mix and run it unless another client is already mixing
+ */
+static void dmix_ring_mix(snd_pcm_direct_t *dmix)
+{
+	snd_pcm_dmix_ring_t *ring = dmix->u.dmix.ring;
+	unsigned int pid = getpid();
+	unsigned int owner;
+
+	__atomic_store_n(&ring->pending, 1, __ATOMIC_SEQ_CST);
+	for (;;) {
+		owner = 0;
+		if (!__atomic_compare_exchange_n(&ring->mixer, &owner, pid, 0,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED)) {
+			/* the running mixer will pick up our request */
+			if (kill(owner, 0) == 0 || errno != ESRCH)
+				return;
+			/* stale lock of a dead mixer */
+			__atomic_compare_exchange_n(&ring->mixer, &owner, 0, 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED);
+			continue;
+		}
+		while (__atomic_exchange_n(&ring->pending, 0, __ATOMIC_ACQ_REL))
+			dmix_ring_mix_once(dmix);
+		__atomic_store_n(&ring->mixer, 0, __ATOMIC_RELEASE);
+		/* catch a request posted after the last pass */
+		if (!__atomic_load_n(&ring->pending, __ATOMIC_ACQUIRE))
+			return;
+	}
+}
+
+/*
+ * publish our slave position (called after writing or rewinding)
+ */
+static void dmix_ring_publish(snd_pcm_direct_t *dmix,
+			      snd_pcm_uframes_t start_ptr)
+{
+	snd_pcm_dmix_ring_t *ring = dmix->u.dmix.ring;
+	unsigned int slot = dmix->u.dmix.ring_slot;
+	snd_pcm_uframes_t lag;
+
+	/* keep start_ptr close to the window, the mixer compares
+	 * the positions modulo boundary
+	 */
+	lag = pcm_frame_diff(dmix->slave_appl_ptr, ring->slot[slot].start_ptr,
+			     dmix->slave_boundary);
+	if (!dmix->u.dmix.ring_restart && lag > dmix->slave_buffer_size &&
+	    lag < dmix->slave_boundary / 2) {
+		start_ptr = dmix->slave_appl_ptr + dmix->slave_boundary -
+			    dmix->slave_buffer_size;
+		start_ptr %= dmix->slave_boundary;
+		__atomic_store_n(&ring->slot[slot].start_ptr,
+				 (unsigned long long)start_ptr, __ATOMIC_RELAXED);
+	}
+	if (dmix->u.dmix.ring_restart) {
+		__atomic_store_n(&ring->slot[slot].start_ptr,
+				 (unsigned long long)start_ptr, __ATOMIC_RELAXED);
+		/* the mixer ignores the slot until appl_ptr is published */
+		if (ring->slot[slot].appl_ptr == DMIX_RING_IDLE)
+			ring->slot[slot].mixed_ptr = start_ptr;
+		dmix->u.dmix.ring_restart = 0;
+	}
+	__atomic_store_n(&ring->slot[slot].appl_ptr,
+			 (unsigned long long)dmix->slave_appl_ptr,
+			 __ATOMIC_RELEASE);
+	dmix_ring_mix(dmix);
+}
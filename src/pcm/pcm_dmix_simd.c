@@ -0,0 +1,417 @@
+/*
+ * vectorized mixing code (SSE2/AVX2 on x86-64, NEON on ARM)
+ *
+ * These kernels implement exactly the same arithmetic as the generic
+ * native-endian 16/32-bit mixers, several samples at once.  They are
+ * not atomic, so they are used only when the sum buffer is protected
+ * by the client semaphore (use_sem).  The vector loop runs only for
+ * contiguous (interleaved) areas; anything else, and the tail of the
+ * block, is passed to the generic code.
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DMIX_SIMD_X86_64
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define DMIX_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef DMIX_SIMD_X86_64
+
+static inline __m128i sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i sse2_clip_24(__m128i sample)
+{
+	__m128i over = _mm_cmpgt_epi32(sample, _mm_set1_epi32(0x7fffff));
+	__m128i under = _mm_cmplt_epi32(sample, _mm_set1_epi32(-0x800000));
+	__m128i res = _mm_slli_epi32(sample, 8);
+
+	res = sse2_select(over, _mm_set1_epi32(0x7fffffff), res);
+	return sse2_select(under, _mm_set1_epi32((int)0x80000000), res);
+}
+
+static inline void sse2_mix_16(unsigned int size,
+			       volatile signed short *dst, signed short *src,
+			       volatile signed int *sum, int remix)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; size >= 8; size -= 8, dst += 8, src += 8, sum += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)src);
+		__m128i d = _mm_loadu_si128((const __m128i *)dst);
+		__m128i z = _mm_cmpeq_epi16(d, zero);
+		__m128i zlo = _mm_unpacklo_epi16(z, z);
+		__m128i zhi = _mm_unpackhi_epi16(z, z);
+		__m128i slo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i shi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		__m128i sumlo = _mm_loadu_si128((const __m128i *)sum);
+		__m128i sumhi = _mm_loadu_si128((const __m128i *)(sum + 4));
+
+		if (remix) {
+			slo = _mm_sub_epi32(zero, slo);
+			shi = _mm_sub_epi32(zero, shi);
+			s = _mm_sub_epi16(zero, s);
+		}
+		sumlo = sse2_select(zlo, slo, _mm_add_epi32(sumlo, slo));
+		sumhi = sse2_select(zhi, shi, _mm_add_epi32(sumhi, shi));
+		_mm_storeu_si128((__m128i *)sum, sumlo);
+		_mm_storeu_si128((__m128i *)(sum + 4), sumhi);
+		d = sse2_select(z, s, _mm_packs_epi32(sumlo, sumhi));
+		_mm_storeu_si128((__m128i *)dst, d);
+	}
+	if (size)
+		(remix ? generic_remix_areas_16_native : generic_mix_areas_16_native)
+			(size, dst, src, sum, 2, 2, 4);
+}
+
+static inline void sse2_mix_32(unsigned int size,
+			       volatile signed int *dst, signed int *src,
+			       volatile signed int *sum, int remix)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; size >= 4; size -= 4, dst += 4, src += 4, sum += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)src);
+		__m128i d = _mm_loadu_si128((const __m128i *)dst);
+		__m128i z = _mm_cmpeq_epi32(d, zero);
+		__m128i sample = _mm_srai_epi32(s, 8);
+		__m128i t = _mm_loadu_si128((const __m128i *)sum);
+
+		if (remix) {
+			t = _mm_sub_epi32(t, sample);
+			sample = _mm_sub_epi32(zero, sample);
+			s = _mm_sub_epi32(zero, s);
+		} else {
+			t = _mm_add_epi32(t, sample);
+		}
+		t = sse2_select(z, sample, t);
+		_mm_storeu_si128((__m128i *)sum, t);
+		d = sse2_select(z, s, sse2_clip_24(t));
+		_mm_storeu_si128((__m128i *)dst, d);
+	}
+	if (size)
+		(remix ? generic_remix_areas_32_native : generic_mix_areas_32_native)
+			(size, dst, src, sum, 4, 4, 4);
+}
+
+#define DMIX_AVX2 __attribute__((target("avx2")))
+
+static inline DMIX_AVX2 __m256i avx2_select(__m256i mask, __m256i a, __m256i b)
+{
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline DMIX_AVX2 __m256i avx2_clip_24(__m256i sample)
+{
+	__m256i over = _mm256_cmpgt_epi32(sample, _mm256_set1_epi32(0x7fffff));
+	__m256i under = _mm256_cmpgt_epi32(_mm256_set1_epi32(-0x800000), sample);
+	__m256i res = _mm256_slli_epi32(sample, 8);
+
+	res = avx2_select(over, _mm256_set1_epi32(0x7fffffff), res);
+	return avx2_select(under, _mm256_set1_epi32((int)0x80000000), res);
+}
+
+static inline DMIX_AVX2 void avx2_mix_16(unsigned int size,
+					 volatile signed short *dst,
+					 signed short *src,
+					 volatile signed int *sum, int remix)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (; size >= 16; size -= 16, dst += 16, src += 16, sum += 16) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)src);
+		__m256i d = _mm256_loadu_si256((const __m256i *)dst);
+		__m256i z = _mm256_cmpeq_epi16(d, zero);
+		__m256i zlo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(z));
+		__m256i zhi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(z, 1));
+		__m256i slo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+		__m256i shi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+		__m256i sumlo = _mm256_loadu_si256((const __m256i *)sum);
+		__m256i sumhi = _mm256_loadu_si256((const __m256i *)(sum + 8));
+
+		if (remix) {
+			slo = _mm256_sub_epi32(zero, slo);
+			shi = _mm256_sub_epi32(zero, shi);
+			s = _mm256_sub_epi16(zero, s);
+		}
+		sumlo = avx2_select(zlo, slo, _mm256_add_epi32(sumlo, slo));
+		sumhi = avx2_select(zhi, shi, _mm256_add_epi32(sumhi, shi));
+		_mm256_storeu_si256((__m256i *)sum, sumlo);
+		_mm256_storeu_si256((__m256i *)(sum + 8), sumhi);
+		/* packs works per 128-bit lane, restore the sample order */
+		d = _mm256_permute4x64_epi64(_mm256_packs_epi32(sumlo, sumhi), 0xd8);
+		d = avx2_select(z, s, d);
+		_mm256_storeu_si256((__m256i *)dst, d);
+	}
+	if (size)
+		sse2_mix_16(size, dst, src, sum, remix);
+}
+
+static inline DMIX_AVX2 void avx2_mix_32(unsigned int size,
+					 volatile signed int *dst,
+					 signed int *src,
+					 volatile signed int *sum, int remix)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (; size >= 8; size -= 8, dst += 8, src += 8, sum += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)src);
+		__m256i d = _mm256_loadu_si256((const __m256i *)dst);
+		__m256i z = _mm256_cmpeq_epi32(d, zero);
+		__m256i sample = _mm256_srai_epi32(s, 8);
+		__m256i t = _mm256_loadu_si256((const __m256i *)sum);
+
+		if (remix) {
+			t = _mm256_sub_epi32(t, sample);
+			sample = _mm256_sub_epi32(zero, sample);
+			s = _mm256_sub_epi32(zero, s);
+		} else {
+			t = _mm256_add_epi32(t, sample);
+		}
+		t = avx2_select(z, sample, t);
+		_mm256_storeu_si256((__m256i *)sum, t);
+		d = avx2_select(z, s, avx2_clip_24(t));
+		_mm256_storeu_si256((__m256i *)dst, d);
+	}
+	if (size)
+		sse2_mix_32(size, dst, src, sum, remix);
+}
+
+#endif /* DMIX_SIMD_X86_64 */
+
+#ifdef DMIX_SIMD_NEON
+
+static inline int32x4_t neon_clip_24(int32x4_t sample)
+{
+	uint32x4_t over = vcgtq_s32(sample, vdupq_n_s32(0x7fffff));
+	uint32x4_t under = vcltq_s32(sample, vdupq_n_s32(-0x800000));
+	int32x4_t res = vshlq_n_s32(sample, 8);
+
+	res = vbslq_s32(over, vdupq_n_s32(0x7fffffff), res);
+	return vbslq_s32(under, vdupq_n_s32((int)0x80000000), res);
+}
+
+static inline void neon_mix_16(unsigned int size,
+			       volatile signed short *dst, signed short *src,
+			       volatile signed int *sum, int remix)
+{
+	for (; size >= 8; size -= 8, dst += 8, src += 8, sum += 8) {
+		int16x8_t s = vld1q_s16(src);
+		int16x8_t d = vld1q_s16((const int16_t *)dst);
+		uint16x8_t z = vceqq_s16(d, vdupq_n_s16(0));
+		uint32x4_t zlo = vreinterpretq_u32_s32(vmovl_s16(vreinterpret_s16_u16(vget_low_u16(z))));
+		uint32x4_t zhi = vreinterpretq_u32_s32(vmovl_s16(vreinterpret_s16_u16(vget_high_u16(z))));
+		int32x4_t slo = vmovl_s16(vget_low_s16(s));
+		int32x4_t shi = vmovl_s16(vget_high_s16(s));
+		int32x4_t sumlo = vld1q_s32((const int32_t *)sum);
+		int32x4_t sumhi = vld1q_s32((const int32_t *)(sum + 4));
+
+		if (remix) {
+			slo = vnegq_s32(slo);
+			shi = vnegq_s32(shi);
+			s = vnegq_s16(s);
+		}
+		sumlo = vbslq_s32(zlo, slo, vaddq_s32(sumlo, slo));
+		sumhi = vbslq_s32(zhi, shi, vaddq_s32(sumhi, shi));
+		vst1q_s32((int32_t *)sum, sumlo);
+		vst1q_s32((int32_t *)(sum + 4), sumhi);
+		d = vcombine_s16(vqmovn_s32(sumlo), vqmovn_s32(sumhi));
+		vst1q_s16((int16_t *)dst, vbslq_s16(z, s, d));
+	}
+	if (size)
+		(remix ? generic_remix_areas_16_native : generic_mix_areas_16_native)
+			(size, dst, src, sum, 2, 2, 4);
+}
+
+static inline void neon_mix_32(unsigned int size,
+			       volatile signed int *dst, signed int *src,
+			       volatile signed int *sum, int remix)
+{
+	for (; size >= 4; size -= 4, dst += 4, src += 4, sum += 4) {
+		int32x4_t s = vld1q_s32(src);
+		int32x4_t d = vld1q_s32((const int32_t *)dst);
+		uint32x4_t z = vceqq_s32(d, vdupq_n_s32(0));
+		int32x4_t sample = vshrq_n_s32(s, 8);
+		int32x4_t t = vld1q_s32((const int32_t *)sum);
+
+		if (remix) {
+			t = vsubq_s32(t, sample);
+			sample = vnegq_s32(sample);
+			s = vnegq_s32(s);
+		} else {
+			t = vaddq_s32(t, sample);
+		}
+		t = vbslq_s32(z, sample, t);
+		vst1q_s32((int32_t *)sum, t);
+		vst1q_s32((int32_t *)dst, vbslq_s32(z, s, neon_clip_24(t)));
+	}
+	if (size)
+		(remix ? generic_remix_areas_32_native : generic_mix_areas_32_native)
+			(size, dst, src, sum, 4, 4, 4);
+}
+
+#endif /* DMIX_SIMD_NEON */
+
+/*
+ * area callbacks: the vector path is taken only for contiguous areas,
+ * attr carries the target attribute so that the kernels get inlined
+ */
+#define DMIX_SIMD_CALLBACKS(isa, attr)					\
+static attr void isa##_mix_areas_16(unsigned int size,			\
+			       volatile signed short *dst,		\
+			       signed short *src,			\
+			       volatile signed int *sum,		\
+			       size_t dst_step, size_t src_step,	\
+			       size_t sum_step)				\
+{									\
+	if (dst_step == 2 && src_step == 2 && sum_step == 4)		\
+		isa##_mix_16(size, dst, src, sum, 0);			\
+	else								\
+		generic_mix_areas_16_native(size, dst, src, sum,	\
+					    dst_step, src_step, sum_step); \
+}									\
+static attr void isa##_remix_areas_16(unsigned int size,			\
+				 volatile signed short *dst,		\
+				 signed short *src,			\
+				 volatile signed int *sum,		\
+				 size_t dst_step, size_t src_step,	\
+				 size_t sum_step)			\
+{									\
+	if (dst_step == 2 && src_step == 2 && sum_step == 4)		\
+		isa##_mix_16(size, dst, src, sum, 1);			\
+	else								\
+		generic_remix_areas_16_native(size, dst, src, sum,	\
+					      dst_step, src_step, sum_step); \
+}									\
+static attr void isa##_mix_areas_32(unsigned int size,			\
+			       volatile signed int *dst,		\
+			       signed int *src,				\
+			       volatile signed int *sum,		\
+			       size_t dst_step, size_t src_step,	\
+			       size_t sum_step)				\
+{									\
+	if (dst_step == 4 && src_step == 4 && sum_step == 4)		\
+		isa##_mix_32(size, dst, src, sum, 0);			\
+	else								\
+		generic_mix_areas_32_native(size, dst, src, sum,	\
+					    dst_step, src_step, sum_step); \
+}									\
+static attr void isa##_remix_areas_32(unsigned int size,			\
+				 volatile signed int *dst,		\
+				 signed int *src,			\
+				 volatile signed int *sum,		\
+				 size_t dst_step, size_t src_step,	\
+				 size_t sum_step)			\
+{									\
+	if (dst_step == 4 && src_step == 4 && sum_step == 4)		\
+		isa##_mix_32(size, dst, src, sum, 1);			\
+	else								\
+		generic_remix_areas_32_native(size, dst, src, sum,	\
+					      dst_step, src_step, sum_step); \
+}
+
+#ifdef DMIX_SIMD_X86_64
+DMIX_SIMD_CALLBACKS(sse2, )
+DMIX_SIMD_CALLBACKS(avx2, DMIX_AVX2)
+#endif
+
+#ifdef DMIX_SIMD_NEON
+DMIX_SIMD_CALLBACKS(neon, )
+#endif
+
+static const char *const simd_mix_kernel_names[] = {
+	[SND_PCM_DMIX_KERNEL_AUTO] = "auto",
+	[SND_PCM_DMIX_KERNEL_GENERIC] = "generic",
+	[SND_PCM_DMIX_KERNEL_SSE2] = "sse2",
+	[SND_PCM_DMIX_KERNEL_AVX2] = "avx2",
+	[SND_PCM_DMIX_KERNEL_NEON] = "neon",
+};
+
+static int simd_mix_kernel_supported(snd_pcm_direct_mix_kernel_t kernel)
+{
+	switch (kernel) {
+	case SND_PCM_DMIX_KERNEL_GENERIC:
+		return 1;
+#ifdef DMIX_SIMD_X86_64
+	case SND_PCM_DMIX_KERNEL_SSE2:
+		return 1;	/* part of the x86-64 baseline */
+	case SND_PCM_DMIX_KERNEL_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+#ifdef DMIX_SIMD_NEON
+	case SND_PCM_DMIX_KERNEL_NEON:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * override the native-endian 16/32-bit callbacks with vector kernels
+ *
+ * called after mix_select_callbacks(); the lockless (direct memory
+ * access) callbacks are kept as they are, since the vector kernels
+ * rely on the client semaphore.
+ */
+static void simd_mix_select_callbacks(snd_pcm_direct_t *dmix)
+{
+	snd_pcm_direct_mix_kernel_t kernel = dmix->u.dmix.mix_kernel;
+
+	if (!dmix->u.dmix.use_sem) {
+		if (kernel != SND_PCM_DMIX_KERNEL_AUTO)
+			SNDERR("mix_kernel %s is ignored for direct memory access",
+			       simd_mix_kernel_names[kernel]);
+		return;
+	}
+	if (kernel == SND_PCM_DMIX_KERNEL_AUTO) {
+		if (simd_mix_kernel_supported(SND_PCM_DMIX_KERNEL_AVX2))
+			kernel = SND_PCM_DMIX_KERNEL_AVX2;
+		else if (simd_mix_kernel_supported(SND_PCM_DMIX_KERNEL_SSE2))
+			kernel = SND_PCM_DMIX_KERNEL_SSE2;
+		else if (simd_mix_kernel_supported(SND_PCM_DMIX_KERNEL_NEON))
+			kernel = SND_PCM_DMIX_KERNEL_NEON;
+		else
+			kernel = SND_PCM_DMIX_KERNEL_GENERIC;
+	} else if (!simd_mix_kernel_supported(kernel)) {
+		SNDERR("mix_kernel %s is not supported on this CPU, using generic",
+		       simd_mix_kernel_names[kernel]);
+		kernel = SND_PCM_DMIX_KERNEL_GENERIC;
+	}
+	/* the vector kernels handle only the cpu endian formats */
+	if (!snd_pcm_format_cpu_endian(dmix->shmptr->s.format))
+		kernel = SND_PCM_DMIX_KERNEL_GENERIC;
+	dmix->u.dmix.mix_kernel = kernel;
+
+	switch (kernel) {
+#ifdef DMIX_SIMD_X86_64
+	case SND_PCM_DMIX_KERNEL_SSE2:
+		dmix->u.dmix.mix_areas_16 = sse2_mix_areas_16;
+		dmix->u.dmix.mix_areas_32 = sse2_mix_areas_32;
+		dmix->u.dmix.remix_areas_16 = sse2_remix_areas_16;
+		dmix->u.dmix.remix_areas_32 = sse2_remix_areas_32;
+		break;
+	case SND_PCM_DMIX_KERNEL_AVX2:
+		dmix->u.dmix.mix_areas_16 = avx2_mix_areas_16;
+		dmix->u.dmix.mix_areas_32 = avx2_mix_areas_32;
+		dmix->u.dmix.remix_areas_16 = avx2_remix_areas_16;
+		dmix->u.dmix.remix_areas_32 = avx2_remix_areas_32;
+		break;
+#endif
+#ifdef DMIX_SIMD_NEON
+	case SND_PCM_DMIX_KERNEL_NEON:
+		dmix->u.dmix.mix_areas_16 = neon_mix_areas_16;
+		dmix->u.dmix.mix_areas_32 = neon_mix_areas_32;
+		dmix->u.dmix.remix_areas_16 = neon_remix_areas_16;
+		dmix->u.dmix.remix_areas_32 = neon_remix_areas_32;
+		break;
+#endif
+	default:
+		break;
+	}
+}
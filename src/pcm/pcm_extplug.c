@@ -62,9 +62,13 @@ static const unsigned int excl_parbits[SND_PCM_EXTPLUG_HW_PARAMS] = {
 
 /*
  * set min/max values for the given parameter
+ *
+ * The constraints of the plugin change, hence the cached refinements
+ * of the whole chain become stale.
  */
 int snd_ext_parm_set_minmax(struct snd_ext_parm *parm, unsigned int min, unsigned int max)
 {
+	snd_pcm_hw_refine_invalidate();
 	parm->num_list = 0;
 	free(parm->list);
 	parm->list = NULL;
@@ -96,11 +100,13 @@ int snd_ext_parm_set_list(struct snd_ext_parm *parm, unsigned int num_list, cons
 	parm->num_list = num_list;
 	parm->list = new_list;
 	parm->active = 1;
+	snd_pcm_hw_refine_invalidate();
 	return 0;
 }
 
 void snd_ext_parm_clear(struct snd_ext_parm *parm)
 {
+	snd_pcm_hw_refine_invalidate();
 	free(parm->list);
 	memset(parm, 0, sizeof(*parm));
 }
@@ -882,5 +888,6 @@ int snd_pcm_extplug_set_param_link(snd_pcm_extplug_t *extplug, int type,
 	}
 	ext->params[type].keep_link = keep_link ? 1 : 0;
 	ext->sparams[type].keep_link = keep_link ? 1 : 0;
+	snd_pcm_hw_refine_invalidate();
 	return 0;
 }
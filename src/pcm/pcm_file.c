@@ -26,11 +26,18 @@
  *
  */
   
+#include "config.h"
+#include "pcm_local.h"
+#include "pcm_plugin.h"
+#include "pcm_flac.h"
 #include "bswap.h"
 #include <ctype.h>
 #include <string.h>
-#include "pcm_local.h"
-#include "pcm_plugin.h"
+#include <sys/stat.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <semaphore.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -51,9 +58,22 @@ const char *_snd_module_pcm_file = "";
 
 typedef enum _snd_pcm_file_format {
 	SND_PCM_FILE_FORMAT_RAW,
-	SND_PCM_FILE_FORMAT_WAV
+	SND_PCM_FILE_FORMAT_WAV,
+	SND_PCM_FILE_FORMAT_FLAC
 } snd_pcm_file_format_t;
 
+/* what the writer thread queue does when it is full */
+typedef enum _snd_pcm_file_overflow {
+	SND_PCM_FILE_OVERFLOW_DROP,
+	SND_PCM_FILE_OVERFLOW_BLOCK
+} snd_pcm_file_overflow_t;
+
+#define DEFAULT_QUEUE_TIME	1000	/* ms */
+#define DEFAULT_WRITE_SIZE	(64 * 1024)
+#define DIRECT_ALIGN		4096	/* O_DIRECT buffer and offset alignment */
+
+#define WAV_HEADER_SIZE		44
+
 /* WAV format chunk */
 struct wav_fmt {
 	short fmt;
@@ -90,6 +110,49 @@ typedef struct {
 	struct wav_fmt wav_header;
 	size_t filelen;
 	char ifmmap_overwritten;
+	size_t rbuf_pos;
+	snd_pcm_flac_enc_t *flac_enc;
+	snd_pcm_flac_dec_t *flac_dec;	/* infile is a FLAC stream */
+	/* writer thread */
+	int thread;
+	snd_pcm_file_overflow_t overflow;
+	unsigned int queue_time;	/* ms */
+	size_t write_size_req;
+	int direct_req;
+	unsigned int prealloc_time;	/* ms */
+	unsigned int header_interval;	/* ms */
+#ifdef HAVE_LIBPTHREAD
+	pthread_t writer;
+	sem_t writer_wakeup;		/* data queued for an idle writer */
+	sem_t writer_space;		/* space freed for a waiting producer */
+	int writer_running;
+	int writer_quit;
+	int writer_idle;
+	int writer_waiting;
+	int writer_err;
+	/*
+	 * the bytes from file_ptr_bytes on are owned by the writer once
+	 * they are queued; both counters only grow, the queue depth is
+	 * queue_head - queue_tail
+	 */
+	unsigned long long queue_head;	/* bytes queued, producer side */
+	unsigned long long queue_tail;	/* bytes written, writer side */
+	unsigned long long flush_head;	/* write everything up to here */
+	size_t queue_max;		/* max queue depth in bytes */
+	unsigned long long dropped_bytes;
+	/* owned by the writer */
+	size_t write_size;
+	int direct;
+	int seekable;
+	off_t file_offset;
+	off_t allocated;
+	size_t prealloc_bytes;
+	size_t header_bytes;
+	size_t header_filelen;
+	char *stage;			/* aligned buffer for O_DIRECT */
+	size_t stage_size;
+	size_t stage_used;
+#endif
 } snd_pcm_file_t;
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
@@ -310,14 +373,32 @@ static int snd_pcm_file_areas_read_infile(snd_pcm_t *pcm,
 	bytes = snd_pcm_frames_to_bytes(pcm, frames);
 	if (bytes < 0)
 		return bytes;
-	bytes = read(file->ifd, file->rbuf, bytes);
-	if (bytes < 0) {
-		SYSERR("read from file failed, error: %d", bytes);
-		return bytes;
+	/* read ahead as much as rbuf takes instead of one transfer */
+	if (file->rbuf_used_bytes < (size_t)bytes) {
+		ssize_t r;
+		memmove(file->rbuf, file->rbuf + file->rbuf_pos,
+			file->rbuf_used_bytes);
+		file->rbuf_pos = 0;
+		if (file->flac_dec)
+			r = snd_pcm_flac_dec_read(file->flac_dec,
+						  file->rbuf + file->rbuf_used_bytes,
+						  file->rbuf_size_bytes - file->rbuf_used_bytes);
+		else
+			r = read(file->ifd, file->rbuf + file->rbuf_used_bytes,
+				 file->rbuf_size_bytes - file->rbuf_used_bytes);
+		if (r < 0) {
+			SYSERR("read from file failed, error: %d", r);
+			return r;
+		}
+		file->rbuf_used_bytes += r;
 	}
+	if ((size_t)bytes > file->rbuf_used_bytes)
+		bytes = file->rbuf_used_bytes;
 
-	snd_pcm_areas_from_buf(pcm, areas_if, file->rbuf);
+	snd_pcm_areas_from_buf(pcm, areas_if, file->rbuf + file->rbuf_pos);
 	snd_pcm_areas_copy(areas, offset, areas_if, 0, pcm->channels, snd_pcm_bytes_to_frames(pcm, bytes), pcm->format);
+	file->rbuf_pos += bytes;
+	file->rbuf_used_bytes -= bytes;
 
 	return bytes;
 }
@@ -335,10 +416,10 @@ static void setup_wav_header(snd_pcm_t *pcm, struct wav_fmt *fmt)
 	fmt->bits = TO_LE16(fmt->bits);
 }
 
-static int write_wav_header(snd_pcm_t *pcm)
+/* fill the WAV_HEADER_SIZE bytes of the header */
+static void make_wav_header(snd_pcm_t *pcm, char *buf)
 {
 	snd_pcm_file_t *file = pcm->private_data;
-	ssize_t res;
 
 	static const char header[] = {
 		'R', 'I', 'F', 'F',
@@ -351,21 +432,25 @@ static int write_wav_header(snd_pcm_t *pcm)
 		'd', 'a', 't', 'a',
 		0, 0, 0, 0
 	};
-	
+
 	setup_wav_header(pcm, &file->wav_header);
+	memcpy(buf, header, sizeof(header));
+	memcpy(buf + sizeof(header), &file->wav_header, sizeof(file->wav_header));
+	memcpy(buf + sizeof(header) + sizeof(file->wav_header), header2,
+	       sizeof(header2));
+}
+
+static int write_wav_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	char header[WAV_HEADER_SIZE];
+	ssize_t res;
 
+	make_wav_header(pcm, header);
 	res = safe_write(file->fd, header, sizeof(header));
 	if (res != sizeof(header))
 		goto write_error;
 
-	res = safe_write(file->fd, &file->wav_header, sizeof(file->wav_header));
-	if (res != sizeof(file->wav_header))
-		goto write_error;
-
-	res = safe_write(file->fd, header2, sizeof(header2));
-	if (res != sizeof(header2))
-		goto write_error;
-
 	return 0;
 
 write_error:
@@ -385,31 +470,481 @@ write_error:
 	return -EIO;
 }
 
-/* fix up the length fields in WAV header */
+/*
+ * fix up the length fields in WAV header; pwrite() leaves the file
+ * position alone, so this may run while the data is being written
+ */
 static void fixup_wav_header(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
-	int len, ret;
+	int len;
 
 	/* RIFF length */
-	if (lseek(file->fd, 4, SEEK_SET) == 4) {
-		len = (file->filelen + 0x24) > 0x7fffffff ?
-			0x7fffffff : (int)(file->filelen + 0x24);
-		len = TO_LE32(len);
-		ret = safe_write(file->fd, &len, 4);
-		if (ret < 0)
-			return;
-	}
+	len = (file->filelen + 0x24) > 0x7fffffff ?
+		0x7fffffff : (int)(file->filelen + 0x24);
+	len = TO_LE32(len);
+	if (pwrite(file->fd, &len, 4, 4) != 4)
+		return;
 	/* data length */
-	if (lseek(file->fd, 0x28, SEEK_SET) == 0x28) {
-		len = file->filelen > 0x7fffffff ?
-			0x7fffffff : (int)file->filelen;
-		len = TO_LE32(len);
-		ret = safe_write(file->fd, &len, 4);
-		if (ret < 0)
-			return;
+	len = file->filelen > 0x7fffffff ?
+		0x7fffffff : (int)file->filelen;
+	len = TO_LE32(len);
+	if (pwrite(file->fd, &len, 4, 0x28) != 4)
+		return;
+}
+
+/* FLAC encoder output without the writer thread */
+static int snd_pcm_file_flac_write(void *private_data, const void *buf,
+				   size_t len)
+{
+	snd_pcm_file_t *file = private_data;
+	const char *p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		r = safe_write(file->fd, p, len);
+		if (r <= 0)
+			return r < 0 ? r : -EIO;
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/* create the encoder and write the FLAC stream header */
+static int write_flac_header(snd_pcm_t *pcm, snd_pcm_flac_write_t write,
+			     void *private_data)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	unsigned char header[SND_PCM_FLAC_HEADER_SIZE];
+	int err;
+
+	err = snd_pcm_flac_enc_open(&file->flac_enc, pcm->format,
+				    pcm->channels, pcm->rate);
+	if (err < 0) {
+		SNDERR("%s cannot be encoded as FLAC", file->fname);
+		return err;
+	}
+	snd_pcm_flac_enc_header(file->flac_enc, header);
+	err = write(private_data, header, sizeof(header));
+	if (err < 0) {
+		SYSERR("%s write header failed, file data may be corrupt", file->fname);
+		snd_pcm_flac_enc_close(file->flac_enc);
+		file->flac_enc = NULL;
+		return -EIO;
+	}
+	return 0;
+}
+
+/* update the frame count and sizes in the STREAMINFO block */
+static void fixup_flac_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	unsigned char info[SND_PCM_FLAC_STREAMINFO_SIZE];
+
+	snd_pcm_flac_enc_streaminfo(file->flac_enc, info);
+	if (pwrite(file->fd, info, sizeof(info),
+		   SND_PCM_FLAC_STREAMINFO_OFFSET) != sizeof(info))
+		return;
+}
+
+#ifdef HAVE_LIBPTHREAD
+/*
+ * The writer thread: the producer copies the frames into wbuf as usual
+ * and, instead of writing the bytes beyond the rewindable part, moves
+ * them to the queue by advancing queue_head.  The writer writes them to
+ * the file and advances queue_tail.  Neither side takes a lock; the
+ * semaphores are only posted when the other side went to sleep.
+ *
+ * The writer waits for write_size bytes before it writes, unless the
+ * producer flushed (flush_head) or the thread terminates.  A regular
+ * file is written with pwrite() at file_offset, optionally through an
+ * aligned stage buffer for O_DIRECT, and preallocated ahead.
+ */
+static size_t snd_pcm_file_queued_bytes(snd_pcm_file_t *file)
+{
+	if (!file->writer_running)
+		return 0;
+	return __atomic_load_n(&file->queue_head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&file->queue_tail, __ATOMIC_ACQUIRE);
+}
+
+static int snd_pcm_file_set_direct(snd_pcm_file_t *file, int on)
+{
+	int flags = fcntl(file->fd, F_GETFL);
+
+	if (flags < 0)
+		return -errno;
+	flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	if (fcntl(file->fd, F_SETFL, flags) < 0)
+		return -errno;
+	return 0;
+}
+
+/* write at the writer position, returns the written bytes */
+static ssize_t snd_pcm_file_writer_write(snd_pcm_file_t *file,
+					 const void *buf, size_t n)
+{
+	ssize_t r;
+
+	if (!file->seekable)
+		return safe_write(file->fd, buf, n);
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (file->prealloc_bytes &&
+	    file->file_offset + (off_t)n > file->allocated) {
+		if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->allocated,
+			      file->prealloc_bytes) < 0)
+			file->prealloc_bytes = 0; /* not supported here */
+		else
+			file->allocated += file->prealloc_bytes;
+	}
+#endif
+	do {
+		r = pwrite(file->fd, buf, n, file->file_offset);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0)
+		return -errno;
+	file->file_offset += r;
+	return r;
+}
+
+/* write out the stage buffer; the last, partial block without O_DIRECT */
+static int snd_pcm_file_writer_flush_stage(snd_pcm_file_t *file)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	if (file->stage_used < file->stage_size && file->direct) {
+		snd_pcm_file_set_direct(file, 0);
+		file->direct = 0;
+	}
+	while (pos < file->stage_used) {
+		r = snd_pcm_file_writer_write(file, file->stage + pos,
+					      file->stage_used - pos);
+		if (r <= 0)
+			return r < 0 ? r : -EIO;
+		pos += r;
+	}
+	file->stage_used = 0;
+	return 0;
+}
+
+/* returns the bytes taken from buf */
+static ssize_t snd_pcm_file_writer_out(snd_pcm_file_t *file,
+				       const char *buf, size_t n)
+{
+	int err;
+
+	if (!file->stage)
+		return snd_pcm_file_writer_write(file, buf, n);
+	if (n > file->stage_size - file->stage_used)
+		n = file->stage_size - file->stage_used;
+	memcpy(file->stage + file->stage_used, buf, n);
+	file->stage_used += n;
+	if (file->stage_used == file->stage_size) {
+		err = snd_pcm_file_writer_flush_stage(file);
+		if (err < 0)
+			return err;
+	}
+	return n;
+}
+
+/* FLAC encoder output in the writer thread */
+static int snd_pcm_file_writer_sink(void *private_data, const void *buf,
+				    size_t len)
+{
+	snd_pcm_file_t *file = private_data;
+	const char *p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		r = snd_pcm_file_writer_out(file, p, len);
+		if (r <= 0)
+			return r < 0 ? r : -EIO;
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static int snd_pcm_file_writer_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	char header[WAV_HEADER_SIZE];
+	size_t pos = 0;
+	ssize_t r;
+
+	make_wav_header(pcm, header);
+	while (pos < sizeof(header)) {
+		r = snd_pcm_file_writer_out(file, header + pos,
+					    sizeof(header) - pos);
+		if (r <= 0) {
+			memset(&file->wav_header, 0, sizeof(struct wav_fmt));
+			return r < 0 ? r : -EIO;
+		}
+		pos += r;
+	}
+	return 0;
+}
+
+/* update the WAV or FLAC header every header_interval ms of data */
+static void snd_pcm_file_writer_fixup(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+
+	if (!file->header_bytes || (!file->wav_header.fmt && !file->flac_enc) ||
+	    !file->seekable ||
+	    file->filelen - file->header_filelen < file->header_bytes)
+		return;
+	/* the header is still in the stage buffer */
+	if (file->stage && !file->file_offset)
+		return;
+	if (file->direct)
+		snd_pcm_file_set_direct(file, 0);
+	if (file->flac_enc)
+		fixup_flac_header(pcm);
+	else
+		fixup_wav_header(pcm);
+	if (file->direct)
+		snd_pcm_file_set_direct(file, 1);
+	file->header_filelen = file->filelen;
+}
+
+static void *snd_pcm_file_writer_thread(void *arg)
+{
+	snd_pcm_t *pcm = arg;
+	snd_pcm_file_t *file = pcm->private_data;
+	unsigned long long head, tail = file->queue_tail;
+	size_t pos, n, min;
+	ssize_t r;
+	int err;
+
+	while (1) {
+		head = __atomic_load_n(&file->queue_head, __ATOMIC_SEQ_CST);
+		min = file->write_size;
+		if (__atomic_load_n(&file->writer_quit, __ATOMIC_SEQ_CST) ||
+		    __atomic_load_n(&file->flush_head, __ATOMIC_SEQ_CST) > tail)
+			min = 1;
+		if (head - tail < min) {
+			if (head == tail &&
+			    __atomic_load_n(&file->writer_quit, __ATOMIC_SEQ_CST))
+				break;
+			__atomic_store_n(&file->writer_idle, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&file->queue_head, __ATOMIC_SEQ_CST) == head &&
+			    !__atomic_load_n(&file->writer_quit, __ATOMIC_SEQ_CST) &&
+			    __atomic_load_n(&file->flush_head, __ATOMIC_SEQ_CST) <= tail)
+				sem_wait(&file->writer_wakeup);
+			__atomic_store_n(&file->writer_idle, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		pos = tail % file->wbuf_size_bytes;
+		n = head - tail;
+		if (n > file->wbuf_size_bytes - pos)
+			n = file->wbuf_size_bytes - pos;
+		if (!file->writer_err && file->format == SND_PCM_FILE_FORMAT_WAV &&
+		    !file->wav_header.fmt) {
+			err = snd_pcm_file_writer_header(pcm);
+			if (err < 0)
+				__atomic_store_n(&file->writer_err, err, __ATOMIC_RELEASE);
+		}
+		if (!file->writer_err && file->format == SND_PCM_FILE_FORMAT_FLAC &&
+		    !file->flac_enc) {
+			err = write_flac_header(pcm, snd_pcm_file_writer_sink, file);
+			if (err < 0)
+				__atomic_store_n(&file->writer_err, err, __ATOMIC_RELEASE);
+		}
+		if (!file->writer_err) {
+			if (file->flac_enc) {
+				err = snd_pcm_flac_enc_write(file->flac_enc,
+							     file->wbuf + pos, n,
+							     snd_pcm_file_writer_sink,
+							     file);
+				r = err < 0 ? err : (ssize_t)n;
+			} else {
+				r = snd_pcm_file_writer_out(file, file->wbuf + pos, n);
+			}
+			if (r <= 0) {
+				SYSERR("%s write failed, file data may be corrupt", file->fname);
+				__atomic_store_n(&file->writer_err, r < 0 ? (int)r : -EIO,
+						 __ATOMIC_RELEASE);
+			} else {
+				n = r;
+				file->filelen += r;
+				snd_pcm_file_writer_fixup(pcm);
+			}
+		}
+		if (file->writer_err)
+			__atomic_add_fetch(&file->dropped_bytes, n, __ATOMIC_RELAXED);
+		tail += n;
+		__atomic_store_n(&file->queue_tail, tail, __ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&file->writer_waiting, 0, __ATOMIC_SEQ_CST))
+			sem_post(&file->writer_space);
+	}
+	if (file->stage && !file->writer_err) {
+		err = snd_pcm_file_writer_flush_stage(file);
+		if (err < 0)
+			SYSERR("%s write failed, file data may be corrupt", file->fname);
+	}
+	if (file->direct) {
+		/* the header fixup at close is a small write */
+		snd_pcm_file_set_direct(file, 0);
+		file->direct = 0;
+	}
+	return NULL;
+}
+
+/* hand the oldest bytes of wbuf to the writer thread */
+static int snd_pcm_file_queue_bytes(snd_pcm_file_t *file, size_t bytes)
+{
+	unsigned long long head;
+	size_t depth;
+
+	assert(bytes <= file->wbuf_used_bytes);
+	file->wbuf_used_bytes -= bytes;
+	file->file_ptr_bytes = (file->file_ptr_bytes + bytes) % file->wbuf_size_bytes;
+	head = file->queue_head + bytes;
+	__atomic_store_n(&file->queue_head, head, __ATOMIC_SEQ_CST);
+	depth = head - __atomic_load_n(&file->queue_tail, __ATOMIC_SEQ_CST);
+	if (depth > file->queue_max)
+		file->queue_max = depth;
+	/* everything handed over, i.e. drain, drop or reset */
+	if (!file->wbuf_used_bytes)
+		__atomic_store_n(&file->flush_head, head, __ATOMIC_SEQ_CST);
+	if ((depth >= file->write_size || !file->wbuf_used_bytes) &&
+	    __atomic_exchange_n(&file->writer_idle, 0, __ATOMIC_SEQ_CST))
+		sem_post(&file->writer_wakeup);
+	return __atomic_load_n(&file->writer_err, __ATOMIC_ACQUIRE);
+}
+
+/* wait until the writer has written more than the given queue depth */
+static int snd_pcm_file_writer_wait(snd_pcm_file_t *file, size_t depth)
+{
+	while (snd_pcm_file_queued_bytes(file) > depth) {
+		__atomic_store_n(&file->writer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (snd_pcm_file_queued_bytes(file) > depth)
+			sem_wait(&file->writer_space);
+		__atomic_store_n(&file->writer_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+	return __atomic_load_n(&file->writer_err, __ATOMIC_ACQUIRE);
+}
+
+static int snd_pcm_file_writer_start(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_t *slave = file->gen.slave;
+	size_t frame_bytes = snd_pcm_frames_to_bytes(slave, 1);
+	off_t offset;
+	int err;
+
+	file->queue_head = file->queue_tail = file->flush_head = 0;
+	file->writer_quit = file->writer_idle = file->writer_waiting = 0;
+	file->writer_err = 0;
+	file->queue_max = 0;
+	file->dropped_bytes = 0;
+
+	/* a pipe, a socket or an O_APPEND fd is written sequentially */
+	offset = lseek(file->fd, 0, SEEK_CUR);
+	file->seekable = offset >= 0 &&
+			 !(fcntl(file->fd, F_GETFL) & O_APPEND);
+	file->file_offset = file->allocated = offset >= 0 ? offset : 0;
+	file->prealloc_bytes = (size_t)slave->rate * frame_bytes *
+			       file->prealloc_time / 1000;
+	file->header_bytes = (size_t)slave->rate * frame_bytes *
+			     file->header_interval / 1000;
+	file->header_filelen = 0;
+	/* at most half of the queue, so that a full queue is written */
+	file->write_size = file->write_size_req;
+	if (file->write_size > (file->wbuf_size_bytes - file->buffer_bytes) / 2)
+		file->write_size = (file->wbuf_size_bytes - file->buffer_bytes) / 2;
+	if (!file->write_size)
+		file->write_size = 1;
+
+	file->direct = 0;
+	if (file->direct_req) {
+		if (!file->seekable || offset % DIRECT_ALIGN)
+			SNDERR("%s: O_DIRECT needs a regular file, writing buffered",
+			       file->fname);
+		else if (snd_pcm_file_set_direct(file, 1) < 0)
+			SYSERR("%s: O_DIRECT not supported, writing buffered",
+			       file->fname);
+		else
+			file->direct = 1;
+	}
+	if (file->direct) {
+		file->stage_size = (file->write_size + DIRECT_ALIGN - 1) &
+				   ~(size_t)(DIRECT_ALIGN - 1);
+		file->stage_used = 0;
+		err = posix_memalign((void **)&file->stage, DIRECT_ALIGN,
+				     file->stage_size);
+		if (err) {
+			file->stage = NULL;
+			snd_pcm_file_set_direct(file, 0);
+			file->direct = 0;
+			return -err;
+		}
 	}
+
+	if (sem_init(&file->writer_wakeup, 0, 0) < 0)
+		goto _errno;
+	if (sem_init(&file->writer_space, 0, 0) < 0) {
+		sem_destroy(&file->writer_wakeup);
+		goto _errno;
+	}
+	err = pthread_create(&file->writer, NULL, snd_pcm_file_writer_thread, pcm);
+	if (err) {
+		SNDERR("cannot create the writer thread");
+		sem_destroy(&file->writer_wakeup);
+		sem_destroy(&file->writer_space);
+		err = -err;
+		goto _err;
+	}
+	file->writer_running = 1;
+	return 0;
+
+ _errno:
+	err = -errno;
+ _err:
+	free(file->stage);
+	file->stage = NULL;
+	if (file->direct)
+		snd_pcm_file_set_direct(file, 0);
+	file->direct = 0;
+	return err;
+}
+
+/* write out the queue and terminate the writer thread */
+static void snd_pcm_file_writer_stop(snd_pcm_file_t *file)
+{
+	if (!file->writer_running)
+		return;
+	__atomic_store_n(&file->writer_quit, 1, __ATOMIC_SEQ_CST);
+	sem_post(&file->writer_wakeup);
+	pthread_join(file->writer, NULL);
+	sem_destroy(&file->writer_wakeup);
+	sem_destroy(&file->writer_space);
+	free(file->stage);
+	file->stage = NULL;
+	if (file->seekable) {
+		struct stat st;
+
+		/* pwrite() leaves the fd offset alone */
+		lseek(file->fd, file->file_offset, SEEK_SET);
+		/*
+		 * drop the unused preallocation (kept beyond the end of file),
+		 * but never data past our offset, e.g. in a file descriptor given by the caller
+		 */
+		if (file->allocated > file->file_offset &&
+		    fstat(file->fd, &st) == 0 &&
+		    st.st_size <= file->file_offset &&
+		    ftruncate(file->fd, file->file_offset) < 0)
+			SYSERR("%s: cannot trim the preallocation", file->fname);
+	}
+	file->writer_running = 0;
 }
+#else
+#define snd_pcm_file_queued_bytes(file)		0
+#define snd_pcm_file_writer_stop(file)		do { } while (0)
+#endif /* HAVE_LIBPTHREAD */
 #endif /* DOC_HIDDEN */
 
 
@@ -421,6 +956,10 @@ static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 	snd_pcm_sframes_t err = 0;
 	assert(bytes <= file->wbuf_used_bytes);
 
+#ifdef HAVE_LIBPTHREAD
+	if (file->writer_running)
+		return snd_pcm_file_queue_bytes(file, bytes);
+#endif
 	if (file->format == SND_PCM_FILE_FORMAT_WAV &&
 	    !file->wav_header.fmt) {
 		err = write_wav_header(pcm);
@@ -430,13 +969,29 @@ static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 			return err;
 		}
 	}
+	if (file->format == SND_PCM_FILE_FORMAT_FLAC && !file->flac_enc) {
+		err = write_flac_header(pcm, snd_pcm_file_flac_write, file);
+		if (err < 0) {
+			file->wbuf_used_bytes = 0;
+			file->file_ptr_bytes = 0;
+			return err;
+		}
+	}
 
 	while (bytes > 0) {
 		size_t n = bytes;
 		size_t cont = file->wbuf_size_bytes - file->file_ptr_bytes;
 		if (n > cont)
 			n = cont;
-		err = safe_write(file->fd, file->wbuf + file->file_ptr_bytes, n);
+		if (file->flac_enc) {
+			err = snd_pcm_flac_enc_write(file->flac_enc,
+						     file->wbuf + file->file_ptr_bytes,
+						     n, snd_pcm_file_flac_write, file);
+			if (err >= 0)
+				err = n;
+		} else {
+			err = safe_write(file->fd, file->wbuf + file->file_ptr_bytes, n);
+		}
 		if (err < 0) {
 			file->wbuf_used_bytes = 0;
 			file->file_ptr_bytes = 0;
@@ -465,7 +1020,26 @@ static int snd_pcm_file_add_frames(snd_pcm_t *pcm,
 		int err = 0;
 		snd_pcm_uframes_t n = frames;
 		snd_pcm_uframes_t cont = file->wbuf_size - file->appl_ptr;
-		snd_pcm_uframes_t avail = file->wbuf_size - snd_pcm_bytes_to_frames(pcm, file->wbuf_used_bytes);
+		snd_pcm_uframes_t avail = file->wbuf_size -
+			snd_pcm_bytes_to_frames(pcm, file->wbuf_used_bytes +
+						snd_pcm_file_queued_bytes(file));
+#ifdef HAVE_LIBPTHREAD
+		if (!avail && file->writer_running) {
+			/* the writer queue is full */
+			size_t depth = file->wbuf_size_bytes - file->wbuf_used_bytes -
+				snd_pcm_frames_to_bytes(pcm, 1);
+			if (file->overflow == SND_PCM_FILE_OVERFLOW_DROP) {
+				__atomic_add_fetch(&file->dropped_bytes,
+						   snd_pcm_frames_to_bytes(pcm, frames),
+						   __ATOMIC_RELAXED);
+				return 0;
+			}
+			err = snd_pcm_file_writer_wait(file, depth);
+			if (err < 0)
+				return err;
+			continue;
+		}
+#endif
 		if (n > cont)
 			n = cont;
 		if (n > avail)
@@ -492,6 +1066,16 @@ static int snd_pcm_file_add_frames(snd_pcm_t *pcm,
 static int snd_pcm_file_close(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_writer_stop(file);
+	if (file->flac_enc) {
+		/* the last, partial block */
+		if (snd_pcm_flac_enc_finish(file->flac_enc,
+					    snd_pcm_file_flac_write, file) < 0)
+			SYSERR("%s write failed, file data may be corrupt", file->fname);
+		if (file->fname)
+			fixup_flac_header(pcm);
+		snd_pcm_flac_enc_close(file->flac_enc);
+	}
 	if (file->fname) {
 		if (file->wav_header.fmt)
 			fixup_wav_header(pcm);
@@ -502,6 +1086,7 @@ static int snd_pcm_file_close(snd_pcm_t *pcm)
 			close(file->fd);
 		}
 	}
+	snd_pcm_flac_dec_close(file->flac_dec);
 	if (file->ifname) {
 		free((void *)file->ifname);
 		close(file->ifd);
@@ -542,6 +1127,10 @@ static int snd_pcm_file_drain(snd_pcm_t *pcm)
 		__snd_pcm_lock(pcm);
 		snd_pcm_file_write_bytes(pcm, file->wbuf_used_bytes);
 		assert(file->wbuf_used_bytes == 0);
+#ifdef HAVE_LIBPTHREAD
+		if (file->writer_running)
+			snd_pcm_file_writer_wait(file, 0);
+#endif
 		__snd_pcm_unlock(pcm);
 	}
 	return err;
@@ -579,7 +1168,8 @@ static snd_pcm_sframes_t snd_pcm_file_forwardable(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
 	snd_pcm_sframes_t res = snd_pcm_forwardable(file->gen.slave);
-	snd_pcm_sframes_t n = snd_pcm_bytes_to_frames(pcm, file->wbuf_size_bytes - file->wbuf_used_bytes);
+	snd_pcm_sframes_t n = snd_pcm_bytes_to_frames(pcm, file->wbuf_size_bytes - file->wbuf_used_bytes -
+						      snd_pcm_file_queued_bytes(file));
 	if (res > n)
 		res = n;
 	return res;
@@ -590,10 +1180,12 @@ static snd_pcm_sframes_t snd_pcm_file_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_file_t *file = pcm->private_data;
 	snd_pcm_sframes_t err;
 	snd_pcm_uframes_t n;
+	size_t queued;
 	
 	n = snd_pcm_frames_to_bytes(pcm, frames);
-	if (file->wbuf_used_bytes + n > file->wbuf_size_bytes)
-		frames = snd_pcm_bytes_to_frames(pcm, file->wbuf_size_bytes - file->wbuf_used_bytes);
+	queued = snd_pcm_file_queued_bytes(file);
+	if (file->wbuf_used_bytes + queued + n > file->wbuf_size_bytes)
+		frames = snd_pcm_bytes_to_frames(pcm, file->wbuf_size_bytes - file->wbuf_used_bytes - queued);
 	err = INTERNAL(snd_pcm_forward)(file->gen.slave, frames);
 	if (err > 0) {
 		file->appl_ptr = (file->appl_ptr + err) % file->wbuf_size;
@@ -737,6 +1329,7 @@ static int snd_pcm_file_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t
 static int snd_pcm_file_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_writer_stop(file);
 	free(file->wbuf);
 	free(file->wbuf_areas);
 	free(file->final_fname);
@@ -756,8 +1349,23 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	int err = _snd_pcm_hw_params_internal(slave, params);
 	if (err < 0)
 		return err;
+	if (file->format == SND_PCM_FILE_FORMAT_FLAC && !file->flac_enc &&
+	    (!snd_pcm_flac_format_supported(slave->format) ||
+	     slave->channels > SND_PCM_FLAC_MAX_CHANNELS)) {
+		SNDERR("FLAC needs an 8, 16 or 24-bit format and at most %d channels",
+		       SND_PCM_FLAC_MAX_CHANNELS);
+		snd_pcm_hw_free(slave);
+		return -EINVAL;
+	}
 	file->buffer_bytes = snd_pcm_frames_to_bytes(slave, slave->buffer_size);
 	file->wbuf_size = slave->buffer_size * 2;
+	if (file->thread) {
+		/* the rewindable part plus the writer queue */
+		snd_pcm_uframes_t queue = (snd_pcm_uframes_t)slave->rate *
+					  file->queue_time / 1000;
+		if (queue > slave->buffer_size)
+			file->wbuf_size = slave->buffer_size + queue;
+	}
 	file->wbuf_size_bytes = snd_pcm_frames_to_bytes(slave, file->wbuf_size);
 	file->wbuf_used_bytes = 0;
 	file->ifmmap_overwritten = 0;
@@ -776,11 +1384,20 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	file->rbuf_size = slave->buffer_size;
 	file->rbuf_size_bytes = snd_pcm_frames_to_bytes(slave, file->rbuf_size);
 	file->rbuf_used_bytes = 0;
+	file->rbuf_pos = 0;
 	file->rbuf = malloc(file->rbuf_size_bytes);
 	if (file->rbuf == NULL) {
 		snd_pcm_file_hw_free(pcm);
 		return -ENOMEM;
 	}
+	if (file->flac_dec) {
+		err = snd_pcm_flac_dec_set_format(file->flac_dec, slave->format,
+						  slave->channels);
+		if (err < 0) {
+			snd_pcm_file_hw_free(pcm);
+			return err;
+		}
+	}
 	file->appl_ptr = file->file_ptr_bytes = 0;
 	for (channel = 0; channel < slave->channels; ++channel) {
 		snd_pcm_channel_area_t *a = &file->wbuf_areas[channel];
@@ -795,6 +1412,15 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 			return err;
 		}
 	}
+#ifdef HAVE_LIBPTHREAD
+	if (file->thread) {
+		err = snd_pcm_file_writer_start(pcm);
+		if (err < 0) {
+			snd_pcm_file_hw_free(pcm);
+			return err;
+		}
+	}
+#endif
 
 	/* pointer may have changed - e.g if plug is used. */
 	snd_pcm_unlink_hw_ptr(pcm, file->gen.slave);
@@ -816,6 +1442,25 @@ static void snd_pcm_file_dump(snd_pcm_t *pcm, snd_output_t *out)
 	if (file->final_fname)
 		snd_output_printf(out, "Final file PCM (file=%s)\n",
 				file->final_fname);
+#ifdef HAVE_LIBPTHREAD
+	if (file->thread) {
+		snd_output_printf(out, "Writer thread: queue %lu bytes (%s on overflow), "
+				  "max depth %lu bytes, dropped %llu bytes\n",
+				  file->wbuf_size_bytes - file->buffer_bytes,
+				  file->overflow == SND_PCM_FILE_OVERFLOW_DROP ?
+				  "drop" : "block",
+				  (unsigned long)file->queue_max,
+				  __atomic_load_n(&file->dropped_bytes, __ATOMIC_RELAXED));
+		snd_output_printf(out, "Writer: %lu byte writes%s, prealloc %lu bytes, "
+				  "header every %lu bytes\n",
+				  (unsigned long)file->write_size,
+				  file->direct ? " (O_DIRECT)" : "",
+				  (unsigned long)file->prealloc_bytes,
+				  (unsigned long)file->header_bytes);
+	}
+#endif
+	if (file->flac_enc)
+		snd_pcm_flac_enc_dump(file->flac_enc, out);
 
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
@@ -885,7 +1530,7 @@ static const snd_pcm_fast_ops_t snd_pcm_file_fast_ops = {
  * \param ifd Input file descriptor (if (ifd < 0) && (ifname == NULL), no input
  *            redirection will be performed)
  * \param trunc Truncate the file if it already exists
- * \param fmt File format ("raw" or "wav" are available)
+ * \param fmt File format ("raw", "wav" or "flac" are available)
  * \param perm File permission
  * \param slave Slave PCM handle
  * \param close_slave When set, the slave PCM handle is closed with copy PCM
@@ -913,6 +1558,8 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		format = SND_PCM_FILE_FORMAT_RAW;
 	else if (!strcmp(fmt, "wav"))
 		format = SND_PCM_FILE_FORMAT_WAV;
+	else if (!strcmp(fmt, "flac"))
+		format = SND_PCM_FILE_FORMAT_FLAC;
 	else {
 		SNDERR("file format %s is unknown", fmt);
 		return -EINVAL;
@@ -939,6 +1586,18 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		}
 		file->ifname = strdup(ifname);
 	}
+	if (ifd >= 0 && stream == SND_PCM_STREAM_CAPTURE) {
+		/* a FLAC infile is decoded, anything else is read raw */
+		err = snd_pcm_flac_dec_open(&file->flac_dec, ifd);
+		if (err < 0 && err != -ENOENT) {
+			if (file->ifname)
+				close(ifd);
+			free(file->fname);
+			free(file->ifname);
+			free(file);
+			return err;
+		}
+	}
 	file->fd = fd;
 	file->ifd = ifd;
 	file->format = format;
@@ -947,6 +1606,7 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_FILE, name, slave->stream, slave->mode);
 	if (err < 0) {
+		snd_pcm_flac_dec_close(file->flac_dec);
 		free(file->fname);
 		free(file->ifname);
 		free(file);
@@ -1001,14 +1661,46 @@ pcm.name {
 				# %%	replaced with %
 	or
 	file INT		# Output file descriptor number
-	infile STR		# Input filename - only raw format
+	infile STR		# Input filename - raw or FLAC format
 	or
 	infile INT		# Input file descriptor number
-	[format STR]		# File format ("raw" or "wav")
+	[format STR]		# File format ("raw", "wav" or "flac")
 	[perm INT]		# Output file permission (octal, def. 0600)
+	[truncate BOOL]		# Truncate an existing file (default yes)
+	[thread BOOL]		# Write from a separate thread (default no)
+	[queue_time INT]	# Writer thread queue length in ms
+				# (default 1000)
+	[overflow STR]		# When the queue is full: "drop" the new
+				# data or "block" until there is space
+				# (default "drop")
+	[write_size INT]	# Bytes the writer thread collects before
+				# writing (default 65536)
+	[direct BOOL]		# Write a regular file with O_DIRECT
+				# (default no, needs thread)
+	[prealloc_time INT]	# Preallocate the file this many ms of data
+				# ahead (default 0 = off, needs thread)
+	[header_interval INT]	# Update the WAV/FLAC header every this many ms
+				# of data (default 0 = at close only,
+				# needs thread)
 }
 \endcode
 
+With thread set, the stream does not wait for the file writes: the data
+leaving the rewindable window is queued to a writer thread instead,
+so a stalled file system does not turn into an xrun of the slave.
+When the writer falls behind by more than queue_time, the new data is
+either dropped from the file (the amount is shown by snd_pcm_dump())
+or the stream waits for the writer.  A regular file is written with
+pwrite() in write_size chunks; with direct set, the writes go through an
+aligned buffer with O_DIRECT, bypassing the page cache, and the last,
+partial block is written normally at close.
+
+The "flac" format stores a lossless FLAC stream, encoded by the writer
+thread when thread is set.  It takes 8, 16 and 24-bit linear formats with
+up to 8 channels; split wider streams over several file plugins (e.g.
+with the multi plugin).  An infile that starts with a FLAC stream is
+decoded; its channels and sample width must match the stream.
+
 \subsection pcm_plugins_file_funcref Function reference
 
 <UL>
@@ -1043,6 +1735,12 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 	const char *format = NULL;
 	long fd = -1, ifd = -1, trunc = 1;
 	long perm = 0600;
+	int thread = 0;
+	long queue_time = DEFAULT_QUEUE_TIME;
+	snd_pcm_file_overflow_t overflow = SND_PCM_FILE_OVERFLOW_DROP;
+	long write_size = DEFAULT_WRITE_SIZE;
+	long prealloc_time = 0, header_interval = 0;
+	int direct = 0;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1103,6 +1801,91 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 			trunc = err;
 			continue;
 		}
+		if (strcmp(id, "thread") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return -EINVAL;
+#ifndef HAVE_LIBPTHREAD
+			if (err) {
+				SNDERR("The writer thread needs pthread support");
+				return -EINVAL;
+			}
+#endif
+			thread = err;
+			continue;
+		}
+		if (strcmp(id, "queue_time") == 0) {
+			err = snd_config_get_integer(n, &queue_time);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return err;
+			}
+			if (queue_time <= 0 || queue_time > 60000) {
+				SNDERR("Invalid queue_time value %ld", queue_time);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "overflow") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (strcmp(str, "drop") == 0)
+				overflow = SND_PCM_FILE_OVERFLOW_DROP;
+			else if (strcmp(str, "block") == 0)
+				overflow = SND_PCM_FILE_OVERFLOW_BLOCK;
+			else {
+				SNDERR("Invalid overflow policy %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "write_size") == 0) {
+			err = snd_config_get_integer(n, &write_size);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return err;
+			}
+			if (write_size <= 0 || write_size > 64 * 1024 * 1024) {
+				SNDERR("Invalid write_size value %ld", write_size);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "direct") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return -EINVAL;
+			direct = err;
+			continue;
+		}
+		if (strcmp(id, "prealloc_time") == 0) {
+			err = snd_config_get_integer(n, &prealloc_time);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return err;
+			}
+			if (prealloc_time < 0 || prealloc_time > 3600000) {
+				SNDERR("Invalid prealloc_time value %ld", prealloc_time);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "header_interval") == 0) {
+			err = snd_config_get_integer(n, &header_interval);
+			if (err < 0) {
+				SNDERR("Invalid type for %s", id);
+				return err;
+			}
+			if (header_interval < 0 || header_interval > 3600000) {
+				SNDERR("Invalid header_interval value %ld", header_interval);
+				return -EINVAL;
+			}
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1121,6 +1904,10 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		SNDERR("slave is not defined");
 		return -EINVAL;
 	}
+	if (!thread && (direct || prealloc_time || header_interval)) {
+		SNDERR("direct, prealloc_time and header_interval need thread");
+		return -EINVAL;
+	}
 	err = snd_pcm_slave_conf(root, slave, &sconf, 0);
 	if (err < 0)
 		return err;
@@ -1135,9 +1922,21 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		return err;
 	err = snd_pcm_file_open(pcmp, name, fname, fd, ifname, ifd,
 				trunc, format, perm, spcm, 1, stream);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	if (thread) {
+		snd_pcm_file_t *file = (*pcmp)->private_data;
+		file->thread = 1;
+		file->queue_time = queue_time;
+		file->overflow = overflow;
+		file->write_size_req = write_size;
+		file->direct_req = direct;
+		file->prealloc_time = prealloc_time;
+		file->header_interval = header_interval;
+	}
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_file_open, SND_PCM_DLSYM_VERSION);
@@ -0,0 +1,1308 @@
+/*
+ *  PCM - FLAC stream encoder and decoder for the file plugin
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The encoder writes a native FLAC stream: the STREAMINFO block and
+ * fixed-size frames of BLOCK_FRAMES frames.  Each channel is coded with
+ * the best of the fixed polynomial predictors (orders 0 to 4) and a
+ * partitioned Rice code of the residual, or as a constant or verbatim
+ * subframe when that is smaller.  Stereo streams try the left/side,
+ * side/right and mid/side decorrelations as well.  There is no LPC
+ * analysis and no MD5 signature (it is left unset, as allowed).
+ *
+ * The decoder reads any FLAC stream with up to 8 channels and 8 to 24
+ * bits per sample, including LPC subframes written by other encoders.
+ */
+
+#include <stdint.h>
+#include "pcm_local.h"
+#include "pcm_flac.h"
+
+#ifndef DOC_HIDDEN
+
+#define BLOCK_FRAMES		4096
+#define MAX_PARTITION_ORDER	8
+#define MAX_FIXED_ORDER		4
+#define MAX_LPC_ORDER		32
+
+#define SUBFRAME_CONSTANT	0
+#define SUBFRAME_VERBATIM	1
+#define SUBFRAME_FIXED		2
+
+#define CHANNELS_LEFT_SIDE	8
+#define CHANNELS_SIDE_RIGHT	9
+#define CHANNELS_MID_SIDE	10
+
+/* the sample layout of a linear PCM format */
+struct flac_sfmt {
+	unsigned int bytes;	/* physical bytes */
+	unsigned int bits;	/* significant bits */
+	int big_endian;
+	int is_unsigned;
+};
+
+struct flac_crc {
+	uint8_t crc8[256];
+	uint16_t crc16[256];
+};
+
+struct flac_subframe {
+	int type;
+	unsigned int order;
+	unsigned int porder;
+	unsigned int method;	/* 0: 4-bit Rice parameters, 1: 5-bit */
+	unsigned char k[1 << MAX_PARTITION_ORDER];
+	unsigned long long bits;
+};
+
+struct snd_pcm_flac_enc {
+	struct flac_sfmt sfmt;
+	struct flac_crc crc;
+	unsigned int channels;
+	unsigned int rate;
+	size_t frame_bytes;
+	unsigned char *in;		/* the pending partial block */
+	size_t in_used;
+	int32_t *samples;		/* BLOCK_FRAMES per channel */
+	int32_t *side;			/* mid and side of a stereo block */
+	int32_t *mid;
+	uint32_t *fold;			/* folded residual */
+	struct flac_subframe *sf;	/* the choice for each candidate */
+	unsigned char *out;		/* one encoded frame */
+	unsigned int frame_number;
+	unsigned long long total_frames;
+	unsigned int min_frame_size;
+	unsigned int max_frame_size;
+	unsigned long long in_bytes;
+	unsigned long long out_bytes;
+};
+
+struct snd_pcm_flac_dec {
+	int fd;
+	struct flac_sfmt sfmt;		/* output sample layout */
+	struct flac_crc crc;
+	unsigned int channels;
+	unsigned int bps;
+	unsigned int rate;
+	unsigned int max_block;
+	unsigned char *in;		/* the current frame and read-ahead */
+	size_t in_size;
+	size_t in_len;
+	size_t pos;			/* bit position in "in" */
+	int eof;
+	int failed;			/* stop at a corrupt frame */
+	int32_t *samples;		/* max_block per channel */
+	unsigned char *out;		/* the decoded frame */
+	size_t out_pos;
+	size_t out_len;
+};
+
+#endif /* DOC_HIDDEN */
+
+static int flac_sfmt_init(struct flac_sfmt *f, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S8:
+	case SND_PCM_FORMAT_U8:
+		f->bytes = 1;
+		f->bits = 8;
+		break;
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S16_BE:
+		f->bytes = 2;
+		f->bits = 16;
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_BE:
+		f->bytes = 4;
+		f->bits = 24;
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S24_3BE:
+		f->bytes = 3;
+		f->bits = 24;
+		break;
+	default:
+		return -EINVAL;
+	}
+	f->big_endian = snd_pcm_format_big_endian(format) == 1;
+	f->is_unsigned = format == SND_PCM_FORMAT_U8;
+	return 0;
+}
+
+int snd_pcm_flac_format_supported(snd_pcm_format_t format)
+{
+	struct flac_sfmt f;
+
+	return flac_sfmt_init(&f, format) == 0;
+}
+
+/* interleaved frames to one array per channel */
+static void flac_load(const struct flac_sfmt *f, const unsigned char *src,
+		      unsigned int channels, unsigned int frames,
+		      int32_t *dst, unsigned int stride)
+{
+	unsigned int shift = 32 - f->bits, i, c, b;
+	uint32_t flip = f->is_unsigned ? 1U << (f->bits - 1) : 0;
+	uint32_t u;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++) {
+			u = 0;
+			if (f->big_endian)
+				for (b = 0; b < f->bytes; b++)
+					u = (u << 8) | src[b];
+			else
+				for (b = f->bytes; b-- > 0; )
+					u = (u << 8) | src[b];
+			dst[c * stride + i] = (int32_t)((u ^ flip) << shift) >> shift;
+			src += f->bytes;
+		}
+	}
+}
+
+/* one array per channel to interleaved frames */
+static void flac_store(const struct flac_sfmt *f, unsigned char *dst,
+		       unsigned int channels, unsigned int frames,
+		       const int32_t *src, unsigned int stride)
+{
+	uint32_t flip = f->is_unsigned ? 1U << (f->bits - 1) : 0;
+	unsigned int i, c, b;
+	uint32_t u;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++) {
+			u = (uint32_t)src[c * stride + i] ^ flip;
+			if (f->big_endian)
+				for (b = f->bytes; b-- > 0; u >>= 8)
+					dst[b] = u;
+			else
+				for (b = 0; b < f->bytes; b++, u >>= 8)
+					dst[b] = u;
+			dst += f->bytes;
+		}
+	}
+}
+
+static void flac_crc_init(struct flac_crc *crc)
+{
+	unsigned int i, b;
+
+	for (i = 0; i < 256; i++) {
+		unsigned int c8 = i, c16 = i << 8;
+		for (b = 0; b < 8; b++) {
+			c8 = (c8 << 1) ^ ((c8 & 0x80) ? 0x07 : 0);
+			c16 = (c16 << 1) ^ ((c16 & 0x8000) ? 0x8005 : 0);
+		}
+		crc->crc8[i] = c8;
+		crc->crc16[i] = c16;
+	}
+}
+
+static unsigned int flac_crc8(const struct flac_crc *crc,
+			      const unsigned char *buf, size_t len)
+{
+	unsigned int c = 0;
+
+	while (len--)
+		c = crc->crc8[c ^ *buf++];
+	return c;
+}
+
+static unsigned int flac_crc16(const struct flac_crc *crc,
+			       const unsigned char *buf, size_t len)
+{
+	unsigned int c = 0;
+
+	while (len--)
+		c = ((c << 8) & 0xffff) ^ crc->crc16[(c >> 8) ^ *buf++];
+	return c;
+}
+
+/* the frame header codes of the common block sizes and rates */
+static unsigned int flac_block_code(unsigned int frames)
+{
+	unsigned int i;
+
+	if (frames == 192)
+		return 1;
+	for (i = 0; i < 4; i++)
+		if (frames == 576U << i)
+			return 2 + i;
+	for (i = 0; i < 8; i++)
+		if (frames == 256U << i)
+			return 8 + i;
+	return frames <= 256 ? 6 : 7;
+}
+
+static const unsigned int flac_rates[16] = {
+	0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+	32000, 44100, 48000, 96000, 0, 0, 0, 0
+};
+
+static unsigned int flac_rate_code(unsigned int rate)
+{
+	unsigned int i;
+
+	for (i = 1; i < 12; i++)
+		if (flac_rates[i] == rate)
+			return i;
+	return 0;	/* from STREAMINFO */
+}
+
+static unsigned int flac_size_code(unsigned int bits)
+{
+	switch (bits) {
+	case 8:
+		return 1;
+	case 16:
+		return 4;
+	default:
+		return 6;
+	}
+}
+
+/*
+ * encoder
+ */
+
+struct flac_bitwriter {
+	unsigned char *buf;
+	size_t pos;
+	uint64_t acc;
+	unsigned int bits;
+};
+
+/* n <= 32 */
+static inline void bw_put(struct flac_bitwriter *bw, uint32_t val, unsigned int n)
+{
+	bw->acc = (bw->acc << n) | (val & (uint32_t)((1ULL << n) - 1));
+	bw->bits += n;
+	while (bw->bits >= 8) {
+		bw->bits -= 8;
+		bw->buf[bw->pos++] = bw->acc >> bw->bits;
+	}
+}
+
+static inline void bw_align(struct flac_bitwriter *bw)
+{
+	if (bw->bits)
+		bw_put(bw, 0, 8 - bw->bits);
+}
+
+static inline void bw_rice(struct flac_bitwriter *bw, uint32_t u, unsigned int k)
+{
+	uint32_t q = u >> k;
+
+	if (q + 1 + k <= 32) {
+		bw_put(bw, (1U << k) | (u & ((1U << k) - 1)), q + 1 + k);
+		return;
+	}
+	for (; q >= 32; q -= 32)
+		bw_put(bw, 0, 32);
+	bw_put(bw, 1, q + 1);
+	bw_put(bw, u, k);
+}
+
+static void bw_utf8(struct flac_bitwriter *bw, uint32_t v)
+{
+	unsigned int n, i;
+
+	if (v < 0x80) {
+		bw_put(bw, v, 8);
+		return;
+	}
+	for (n = 2; n < 6 && v >= (1U << (5 * n + 1)); n++)
+		;
+	bw_put(bw, (0xff00 >> n) | (v >> (6 * (n - 1))), 8);
+	for (i = n - 1; i-- > 0; )
+		bw_put(bw, 0x80 | ((v >> (6 * i)) & 0x3f), 8);
+}
+
+static inline uint32_t fold(int32_t r)
+{
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+/* residual of the fixed predictor of the given order at x[i] */
+static inline int32_t fixed_residual(const int32_t *x, unsigned int i,
+				     unsigned int order)
+{
+	switch (order) {
+	case 0:
+		return x[i];
+	case 1:
+		return x[i] - x[i - 1];
+	case 2:
+		return x[i] - 2 * x[i - 1] + x[i - 2];
+	case 3:
+		return x[i] - 3 * (x[i - 1] - x[i - 2]) - x[i - 3];
+	default:
+		return x[i] - 4 * (x[i - 1] + x[i - 3]) + 6 * x[i - 2] + x[i - 4];
+	}
+}
+
+/* the fixed predictor with the smallest residual magnitude */
+static unsigned int fixed_best_order(const int32_t *x, unsigned int n)
+{
+	uint64_t sum[MAX_FIXED_ORDER + 1] = { 0, 0, 0, 0, 0 };
+	unsigned int i, o, best = 0;
+	int32_t e0, e1, e2, e3, e4;
+
+	for (i = MAX_FIXED_ORDER; i < n; i++) {
+		e0 = x[i];
+		e1 = e0 - x[i - 1];
+		e2 = e1 - (x[i - 1] - x[i - 2]);
+		e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+		e4 = fixed_residual(x, i, 4);
+		sum[0] += e0 < 0 ? -(int64_t)e0 : e0;
+		sum[1] += e1 < 0 ? -(int64_t)e1 : e1;
+		sum[2] += e2 < 0 ? -(int64_t)e2 : e2;
+		sum[3] += e3 < 0 ? -(int64_t)e3 : e3;
+		sum[4] += e4 < 0 ? -(int64_t)e4 : e4;
+	}
+	for (o = 1; o <= MAX_FIXED_ORDER; o++)
+		if (sum[o] < sum[best])
+			best = o;
+	return best;
+}
+
+/* the cheapest Rice parameter for count values summing up to sum */
+static unsigned int rice_param(uint64_t sum, unsigned int count,
+			       unsigned int max_k, uint64_t *bits)
+{
+	uint64_t cost, best_cost = (uint64_t)-1;
+	unsigned int k, best = 0;
+
+	for (k = 0; k <= max_k; k++) {
+		cost = (uint64_t)count * (k + 1) + (sum >> k);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = k;
+		} else if ((sum >> k) < count) {
+			break;
+		}
+	}
+	*bits = best_cost;
+	return best;
+}
+
+/* choose the subframe type for n samples of bps bits */
+static void subframe_analyze(snd_pcm_flac_enc_t *enc, const int32_t *x,
+			     unsigned int n, unsigned int bps,
+			     struct flac_subframe *sf)
+{
+	uint64_t sums[1 << MAX_PARTITION_ORDER], bits, total;
+	unsigned char k[1 << MAX_PARTITION_ORDER];
+	unsigned int i, j, p, max_p, parts, order, param_bits, max_k;
+	uint32_t *u = enc->fold;
+
+	for (i = 1; i < n && x[i] == x[0]; i++)
+		;
+	if (i == n) {
+		sf->type = SUBFRAME_CONSTANT;
+		sf->bits = 8 + bps;
+		return;
+	}
+	sf->type = SUBFRAME_VERBATIM;
+	sf->bits = 8 + (uint64_t)n * bps;
+	if (n <= MAX_FIXED_ORDER)
+		return;
+
+	order = fixed_best_order(x, n);
+	for (i = order; i < n; i++)
+		u[i] = fold(fixed_residual(x, i, order));
+
+	/* residual sums of the finest partitions, merged pairwise */
+	for (max_p = 0; max_p < MAX_PARTITION_ORDER; max_p++)
+		if ((n >> (max_p + 1)) << (max_p + 1) != n ||
+		    (n >> (max_p + 1)) <= order)
+			break;
+	parts = 1 << max_p;
+	for (j = 0; j < parts; j++) {
+		unsigned int start = j * (n >> max_p), end = start + (n >> max_p);
+		uint64_t s = 0;
+		if (start < order)
+			start = order;
+		for (i = start; i < end; i++)
+			s += u[i];
+		sums[j] = s;
+	}
+	sf->method = bps > 16;
+	param_bits = sf->method ? 5 : 4;
+	max_k = sf->method ? 30 : 14;
+	sf->bits = (uint64_t)-1;
+	for (p = max_p + 1; p-- > 0; ) {
+		parts = 1 << p;
+		if (p < max_p)
+			for (j = 0; j < parts; j++)
+				sums[j] = sums[2 * j] + sums[2 * j + 1];
+		total = 0;
+		for (j = 0; j < parts; j++) {
+			unsigned int count = n >> p;
+			if (j == 0)
+				count -= order;
+			k[j] = rice_param(sums[j], count, max_k, &bits);
+			total += param_bits + bits;
+		}
+		if (total < sf->bits) {
+			sf->bits = total;
+			sf->porder = p;
+			memcpy(sf->k, k, parts);
+		}
+	}
+	sf->bits += 8 + (uint64_t)order * bps + 2 + 4;
+	if (sf->bits < 8 + (uint64_t)n * bps) {
+		sf->type = SUBFRAME_FIXED;
+		sf->order = order;
+	} else {
+		sf->type = SUBFRAME_VERBATIM;
+		sf->bits = 8 + (uint64_t)n * bps;
+	}
+}
+
+static void subframe_write(struct flac_bitwriter *bw, const int32_t *x,
+			   unsigned int n, unsigned int bps,
+			   const struct flac_subframe *sf)
+{
+	unsigned int i, j, parts, start, end;
+
+	switch (sf->type) {
+	case SUBFRAME_CONSTANT:
+		bw_put(bw, 0x00, 8);
+		bw_put(bw, x[0], bps);
+		break;
+	case SUBFRAME_VERBATIM:
+		bw_put(bw, 0x02, 8);
+		for (i = 0; i < n; i++)
+			bw_put(bw, x[i], bps);
+		break;
+	default:
+		bw_put(bw, (0x08 | sf->order) << 1, 8);
+		for (i = 0; i < sf->order; i++)
+			bw_put(bw, x[i], bps);
+		bw_put(bw, sf->method, 2);
+		bw_put(bw, sf->porder, 4);
+		parts = 1 << sf->porder;
+		for (j = 0; j < parts; j++) {
+			start = j * (n >> sf->porder);
+			end = start + (n >> sf->porder);
+			if (start < sf->order)
+				start = sf->order;
+			bw_put(bw, sf->k[j], sf->method ? 5 : 4);
+			for (i = start; i < end; i++)
+				bw_rice(bw, fold(fixed_residual(x, i, sf->order)),
+					sf->k[j]);
+		}
+		break;
+	}
+}
+
+/* encode one frame of n frames from interleaved PCM */
+static int flac_encode_frame(snd_pcm_flac_enc_t *enc, const unsigned char *src,
+			     unsigned int n, snd_pcm_flac_write_t write,
+			     void *private_data)
+{
+	struct flac_subframe *sf = enc->sf;
+	const int32_t *sig[SND_PCM_FLAC_MAX_CHANNELS];
+	unsigned int sig_bps[SND_PCM_FLAC_MAX_CHANNELS];
+	struct flac_bitwriter bw;
+	unsigned int c, i, assignment, bps = enc->sfmt.bits, block_code;
+	struct flac_subframe *sfc[SND_PCM_FLAC_MAX_CHANNELS];
+	int err;
+
+	flac_load(&enc->sfmt, src, enc->channels, n, enc->samples, BLOCK_FRAMES);
+
+	assignment = enc->channels - 1;
+	for (c = 0; c < enc->channels; c++) {
+		sig[c] = enc->samples + c * BLOCK_FRAMES;
+		sig_bps[c] = bps;
+	}
+	if (enc->channels == 2) {
+		const int32_t *l = sig[0], *r = sig[1];
+		uint64_t independent, left_side, side_right, mid_side, best;
+
+		for (i = 0; i < n; i++) {
+			enc->side[i] = l[i] - r[i];
+			enc->mid[i] = (l[i] + r[i]) >> 1;
+		}
+		subframe_analyze(enc, l, n, bps, &sf[0]);
+		subframe_analyze(enc, r, n, bps, &sf[1]);
+		subframe_analyze(enc, enc->side, n, bps + 1, &sf[2]);
+		subframe_analyze(enc, enc->mid, n, bps, &sf[3]);
+		independent = sf[0].bits + sf[1].bits;
+		left_side = sf[0].bits + sf[2].bits;
+		side_right = sf[2].bits + sf[1].bits;
+		mid_side = sf[3].bits + sf[2].bits;
+		best = independent;
+		sfc[0] = &sf[0];
+		sfc[1] = &sf[1];
+		if (left_side < best) {
+			best = left_side;
+			assignment = CHANNELS_LEFT_SIDE;
+			sfc[1] = &sf[2];
+			sig[1] = enc->side;
+			sig_bps[1] = bps + 1;
+		}
+		if (side_right < best) {
+			best = side_right;
+			assignment = CHANNELS_SIDE_RIGHT;
+			sfc[0] = &sf[2];
+			sfc[1] = &sf[1];
+			sig[0] = enc->side;
+			sig_bps[0] = bps + 1;
+			sig[1] = r;
+			sig_bps[1] = bps;
+		}
+		if (mid_side < best) {
+			assignment = CHANNELS_MID_SIDE;
+			sfc[0] = &sf[3];
+			sfc[1] = &sf[2];
+			sig[0] = enc->mid;
+			sig_bps[0] = bps;
+			sig[1] = enc->side;
+			sig_bps[1] = bps + 1;
+		}
+	} else {
+		for (c = 0; c < enc->channels; c++) {
+			sfc[c] = &sf[c];
+			subframe_analyze(enc, sig[c], n, bps, sfc[c]);
+		}
+	}
+
+	/* frame header */
+	bw.buf = enc->out;
+	bw.pos = 0;
+	bw.acc = 0;
+	bw.bits = 0;
+	block_code = flac_block_code(n);
+	bw_put(&bw, 0xfff8, 16);	/* sync, fixed block size */
+	bw_put(&bw, block_code, 4);
+	bw_put(&bw, flac_rate_code(enc->rate), 4);
+	bw_put(&bw, assignment, 4);
+	bw_put(&bw, flac_size_code(bps), 3);
+	bw_put(&bw, 0, 1);
+	bw_utf8(&bw, enc->frame_number);
+	if (block_code == 6)
+		bw_put(&bw, n - 1, 8);
+	else if (block_code == 7)
+		bw_put(&bw, n - 1, 16);
+	bw_put(&bw, flac_crc8(&enc->crc, bw.buf, bw.pos), 8);
+
+	for (c = 0; c < enc->channels; c++)
+		subframe_write(&bw, sig[c], n, sig_bps[c], sfc[c]);
+	bw_align(&bw);
+	bw_put(&bw, flac_crc16(&enc->crc, bw.buf, bw.pos), 16);
+
+	err = write(private_data, enc->out, bw.pos);
+	if (err < 0)
+		return err;
+	enc->frame_number++;
+	enc->total_frames += n;
+	if (!enc->min_frame_size || bw.pos < enc->min_frame_size)
+		enc->min_frame_size = bw.pos;
+	if (bw.pos > enc->max_frame_size)
+		enc->max_frame_size = bw.pos;
+	enc->out_bytes += bw.pos;
+	return 0;
+}
+
+int snd_pcm_flac_enc_open(snd_pcm_flac_enc_t **encp, snd_pcm_format_t format,
+			  unsigned int channels, unsigned int rate)
+{
+	snd_pcm_flac_enc_t *enc;
+	size_t out_size;
+
+	if (channels < 1 || channels > SND_PCM_FLAC_MAX_CHANNELS ||
+	    rate < 1 || rate >= (1 << 20))
+		return -EINVAL;
+	enc = calloc(1, sizeof(*enc));
+	if (!enc)
+		return -ENOMEM;
+	if (flac_sfmt_init(&enc->sfmt, format) < 0) {
+		free(enc);
+		return -EINVAL;
+	}
+	flac_crc_init(&enc->crc);
+	enc->channels = channels;
+	enc->rate = rate;
+	enc->frame_bytes = enc->sfmt.bytes * channels;
+	/* a frame is never larger than verbatim subframes */
+	out_size = 32 + channels * (8 + BLOCK_FRAMES * (enc->sfmt.bits + 1) / 8);
+	enc->in = malloc(BLOCK_FRAMES * enc->frame_bytes);
+	enc->samples = malloc(sizeof(int32_t) * BLOCK_FRAMES * channels);
+	enc->side = malloc(sizeof(int32_t) * BLOCK_FRAMES);
+	enc->mid = malloc(sizeof(int32_t) * BLOCK_FRAMES);
+	enc->fold = malloc(sizeof(uint32_t) * BLOCK_FRAMES);
+	enc->out = malloc(out_size);
+	/* independent channels, or left, right, side and mid */
+	enc->sf = malloc(sizeof(*enc->sf) * (channels > 4 ? channels : 4));
+	if (!enc->in || !enc->samples || !enc->side || !enc->mid ||
+	    !enc->fold || !enc->out || !enc->sf) {
+		snd_pcm_flac_enc_close(enc);
+		return -ENOMEM;
+	}
+	*encp = enc;
+	return 0;
+}
+
+void snd_pcm_flac_enc_close(snd_pcm_flac_enc_t *enc)
+{
+	if (!enc)
+		return;
+	free(enc->in);
+	free(enc->samples);
+	free(enc->side);
+	free(enc->mid);
+	free(enc->fold);
+	free(enc->out);
+	free(enc->sf);
+	free(enc);
+}
+
+/* the STREAMINFO block with what has been encoded so far */
+void snd_pcm_flac_enc_streaminfo(snd_pcm_flac_enc_t *enc, unsigned char *buf)
+{
+	struct flac_bitwriter bw = { buf, 0, 0, 0 };
+
+	bw_put(&bw, BLOCK_FRAMES, 16);
+	bw_put(&bw, BLOCK_FRAMES, 16);
+	bw_put(&bw, enc->min_frame_size, 24);
+	bw_put(&bw, enc->max_frame_size, 24);
+	bw_put(&bw, enc->rate, 20);
+	bw_put(&bw, enc->channels - 1, 3);
+	bw_put(&bw, enc->sfmt.bits - 1, 5);
+	bw_put(&bw, enc->total_frames >> 32, 4);
+	bw_put(&bw, enc->total_frames, 32);
+	memset(buf + bw.pos, 0, 16);	/* MD5 not computed */
+}
+
+/* the stream marker and the STREAMINFO block, SND_PCM_FLAC_HEADER_SIZE bytes */
+void snd_pcm_flac_enc_header(snd_pcm_flac_enc_t *enc, unsigned char *buf)
+{
+	memcpy(buf, "fLaC", 4);
+	buf[4] = 0x80;		/* last metadata block, STREAMINFO */
+	buf[5] = 0;
+	buf[6] = 0;
+	buf[7] = SND_PCM_FLAC_STREAMINFO_SIZE;
+	snd_pcm_flac_enc_streaminfo(enc, buf + SND_PCM_FLAC_STREAMINFO_OFFSET);
+}
+
+/* encode interleaved PCM bytes; the encoded frames go to write() */
+int snd_pcm_flac_enc_write(snd_pcm_flac_enc_t *enc, const void *buf,
+			   size_t bytes, snd_pcm_flac_write_t write,
+			   void *private_data)
+{
+	const unsigned char *src = buf;
+	size_t block_bytes = BLOCK_FRAMES * enc->frame_bytes, n;
+	int err;
+
+	enc->in_bytes += bytes;
+	while (bytes > 0) {
+		if (!enc->in_used && bytes >= block_bytes) {
+			err = flac_encode_frame(enc, src, BLOCK_FRAMES,
+						write, private_data);
+			if (err < 0)
+				return err;
+			src += block_bytes;
+			bytes -= block_bytes;
+			continue;
+		}
+		n = block_bytes - enc->in_used;
+		if (n > bytes)
+			n = bytes;
+		memcpy(enc->in + enc->in_used, src, n);
+		enc->in_used += n;
+		src += n;
+		bytes -= n;
+		if (enc->in_used == block_bytes) {
+			enc->in_used = 0;
+			err = flac_encode_frame(enc, enc->in, BLOCK_FRAMES,
+						write, private_data);
+			if (err < 0)
+				return err;
+		}
+	}
+	return 0;
+}
+
+/* encode the last, partial block */
+int snd_pcm_flac_enc_finish(snd_pcm_flac_enc_t *enc,
+			    snd_pcm_flac_write_t write, void *private_data)
+{
+	unsigned int frames = enc->in_used / enc->frame_bytes;
+
+	enc->in_used = 0;
+	if (!frames)
+		return 0;
+	return flac_encode_frame(enc, enc->in, frames, write, private_data);
+}
+
+void snd_pcm_flac_enc_dump(snd_pcm_flac_enc_t *enc, snd_output_t *out)
+{
+	snd_output_printf(out, "FLAC: %u frames of %u, %llu bytes from %llu",
+			  enc->frame_number, BLOCK_FRAMES,
+			  enc->out_bytes, enc->in_bytes);
+	if (enc->out_bytes)
+		snd_output_printf(out, " (ratio %.2f)",
+				  (double)(enc->in_bytes - enc->in_used) /
+				  enc->out_bytes);
+	snd_output_printf(out, "\n");
+}
+
+/*
+ * decoder
+ */
+
+#define DEC_READ_SIZE	(64 * 1024)
+#define DEC_PAD		8	/* zeroed bytes after the data */
+
+/* read more of the stream, returns 0 at the end of the file */
+static ssize_t dec_fill(snd_pcm_flac_dec_t *dec)
+{
+	ssize_t r;
+
+	if (dec->eof)
+		return 0;
+	if (dec->in_size - dec->in_len < DEC_READ_SIZE + DEC_PAD) {
+		size_t size = dec->in_len + DEC_READ_SIZE + DEC_PAD;
+		unsigned char *in = realloc(dec->in, size);
+		if (!in)
+			return -ENOMEM;
+		dec->in = in;
+		dec->in_size = size;
+	}
+	do {
+		r = read(dec->fd, dec->in + dec->in_len, DEC_READ_SIZE);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0)
+		return -errno;
+	if (r == 0)
+		dec->eof = 1;
+	dec->in_len += r;
+	memset(dec->in + dec->in_len, 0, DEC_PAD);
+	return r;
+}
+
+/* make sure that bytes from the current position are buffered */
+static int dec_need(snd_pcm_flac_dec_t *dec, size_t bytes)
+{
+	ssize_t r;
+
+	while (dec->in_len < dec->pos / 8 + bytes) {
+		r = dec_fill(dec);
+		if (r <= 0)
+			return r < 0 ? r : -ENODATA;
+	}
+	return 0;
+}
+
+static inline uint64_t dec_window(snd_pcm_flac_dec_t *dec)
+{
+	const unsigned char *p = dec->in + dec->pos / 8;
+	uint64_t w = 0;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		w = (w << 8) | p[i];
+	return w << (dec->pos % 8);
+}
+
+/* n <= 32; past the end of the stream the bits read as zero */
+static inline uint32_t dec_bits(snd_pcm_flac_dec_t *dec, unsigned int n)
+{
+	uint64_t w;
+
+	if (!n)
+		return 0;
+	if (dec->pos / 8 + 8 > dec->in_len)
+		dec_need(dec, 8);
+	w = dec_window(dec);
+	dec->pos += n;
+	return w >> (64 - n);
+}
+
+static inline int32_t dec_sbits(snd_pcm_flac_dec_t *dec, unsigned int n)
+{
+	if (!n)
+		return 0;
+	return (int32_t)(dec_bits(dec, n) << (32 - n)) >> (32 - n);
+}
+
+static inline int dec_unary(snd_pcm_flac_dec_t *dec, uint32_t *q)
+{
+	unsigned int valid, z;
+	uint64_t w;
+
+	*q = 0;
+	for (;;) {
+		if (dec->pos / 8 + 8 > dec->in_len &&
+		    dec_need(dec, 8) < 0 && dec->pos / 8 >= dec->in_len)
+			return -ENODATA;
+		valid = 64 - dec->pos % 8;
+		w = dec_window(dec);
+		if (w) {
+			z = __builtin_clzll(w);
+			if (z < valid) {
+				*q += z;
+				dec->pos += z + 1;
+				return 0;
+			}
+		}
+		*q += valid;
+		dec->pos += valid;
+	}
+}
+
+static int dec_residual(snd_pcm_flac_dec_t *dec, int32_t *res,
+			unsigned int n, unsigned int order)
+{
+	unsigned int method, porder, parts, j, i, count, k, escape;
+	uint32_t q, u;
+	int err;
+
+	method = dec_bits(dec, 2);
+	if (method > 1)
+		return -EINVAL;
+	escape = method ? 31 : 15;
+	porder = dec_bits(dec, 4);
+	parts = 1 << porder;
+	if ((n >> porder) << porder != n || (n >> porder) < order)
+		return -EINVAL;
+	for (j = 0; j < parts; j++) {
+		count = n >> porder;
+		if (j == 0)
+			count -= order;
+		k = dec_bits(dec, method ? 5 : 4);
+		if (k == escape) {
+			k = dec_bits(dec, 5);
+			for (i = 0; i < count; i++)
+				*res++ = dec_sbits(dec, k);
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			err = dec_unary(dec, &q);
+			if (err < 0)
+				return err;
+			u = (q << k) | dec_bits(dec, k);
+			*res++ = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+		}
+	}
+	return 0;
+}
+
+static int dec_subframe(snd_pcm_flac_dec_t *dec, int32_t *x, unsigned int n,
+			unsigned int bps)
+{
+	unsigned int type, wasted = 0, order, i, j, precision;
+	int32_t coef[MAX_LPC_ORDER];
+	int shift, err;
+	uint32_t q;
+
+	if (dec_bits(dec, 1))
+		return -EINVAL;
+	type = dec_bits(dec, 6);
+	if (dec_bits(dec, 1)) {
+		err = dec_unary(dec, &q);
+		if (err < 0)
+			return err;
+		wasted = q + 1;
+		if (wasted >= bps)
+			return -EINVAL;
+		bps -= wasted;
+	}
+	if (type == 0) {
+		int32_t v = dec_sbits(dec, bps);
+		for (i = 0; i < n; i++)
+			x[i] = v;
+	} else if (type == 1) {
+		for (i = 0; i < n; i++)
+			x[i] = dec_sbits(dec, bps);
+	} else if (type >= 8 && type <= 12) {
+		order = type - 8;
+		if (order > n)
+			return -EINVAL;
+		for (i = 0; i < order; i++)
+			x[i] = dec_sbits(dec, bps);
+		err = dec_residual(dec, x + order, n, order);
+		if (err < 0)
+			return err;
+		for (i = order; i < n; i++) {
+			int64_t p;
+			switch (order) {
+			case 0:
+				p = 0;
+				break;
+			case 1:
+				p = x[i - 1];
+				break;
+			case 2:
+				p = 2 * (int64_t)x[i - 1] - x[i - 2];
+				break;
+			case 3:
+				p = 3 * ((int64_t)x[i - 1] - x[i - 2]) + x[i - 3];
+				break;
+			default:
+				p = 4 * ((int64_t)x[i - 1] + x[i - 3]) -
+				    6 * (int64_t)x[i - 2] - x[i - 4];
+				break;
+			}
+			x[i] += (int32_t)p;
+		}
+	} else if (type >= 32) {
+		order = type - 31;
+		if (order > n)
+			return -EINVAL;
+		for (i = 0; i < order; i++)
+			x[i] = dec_sbits(dec, bps);
+		precision = dec_bits(dec, 4) + 1;
+		if (precision == 16)
+			return -EINVAL;
+		shift = dec_sbits(dec, 5);
+		if (shift < 0)
+			return -EINVAL;
+		for (j = 0; j < order; j++)
+			coef[j] = dec_sbits(dec, precision);
+		err = dec_residual(dec, x + order, n, order);
+		if (err < 0)
+			return err;
+		for (i = order; i < n; i++) {
+			int64_t p = 0;
+			for (j = 0; j < order; j++)
+				p += (int64_t)coef[j] * x[i - 1 - j];
+			x[i] += (int32_t)(p >> shift);
+		}
+	} else {
+		return -EINVAL;
+	}
+	if (wasted)
+		for (i = 0; i < n; i++)
+			x[i] = (uint32_t)x[i] << wasted;
+	return 0;
+}
+
+/* decode the next frame into dec->out, returns 0 at the end of the stream */
+static int dec_frame(snd_pcm_flac_dec_t *dec)
+{
+	unsigned int block_code, rate_code, assignment, size_code, n, bps, c, i;
+	unsigned int channels, crc;
+	size_t start;
+	uint32_t v;
+	int32_t *x0, *x1;
+	int err;
+
+	/* keep only the unread data */
+	start = dec->pos / 8;
+	memmove(dec->in, dec->in + start, dec->in_len - start);
+	dec->in_len -= start;
+	dec->pos = 0;
+	memset(dec->in + dec->in_len, 0, DEC_PAD);
+
+	err = dec_need(dec, 2);
+	if (err == -ENODATA)
+		return 0;
+	if (err < 0)
+		return err;
+	if (dec->in[0] != 0xff || (dec->in[1] & 0xfe) != 0xf8) {
+		SNDERR("FLAC frame sync lost");
+		return -EIO;
+	}
+	err = dec_need(dec, 16);
+	if (err < 0 && err != -ENODATA)
+		return err;
+	dec_bits(dec, 16);
+	block_code = dec_bits(dec, 4);
+	rate_code = dec_bits(dec, 4);
+	assignment = dec_bits(dec, 4);
+	size_code = dec_bits(dec, 3);
+	dec_bits(dec, 1);
+	/* frame or sample number, coded like UTF-8 */
+	v = dec_bits(dec, 8);
+	for (i = 0; i < 8 && (v & (0x80 >> i)); i++)
+		;
+	if (i == 1 || i == 8)
+		return -EIO;
+	for (c = 1; c < i; c++)
+		dec_bits(dec, 8);
+	switch (block_code) {
+	case 0:
+		return -EIO;
+	case 1:
+		n = 192;
+		break;
+	case 2: case 3: case 4: case 5:
+		n = 576 << (block_code - 2);
+		break;
+	case 6:
+		n = dec_bits(dec, 8) + 1;
+		break;
+	case 7:
+		n = dec_bits(dec, 16) + 1;
+		break;
+	default:
+		n = 256 << (block_code - 8);
+		break;
+	}
+	if (rate_code == 12)
+		dec_bits(dec, 8);
+	else if (rate_code == 13 || rate_code == 14)
+		dec_bits(dec, 16);
+	crc = dec_bits(dec, 8);
+	if (crc != flac_crc8(&dec->crc, dec->in, dec->pos / 8 - 1)) {
+		SNDERR("FLAC frame header CRC mismatch");
+		return -EIO;
+	}
+	switch (size_code) {
+	case 0:
+		bps = dec->bps;
+		break;
+	case 1:
+		bps = 8;
+		break;
+	case 2:
+		bps = 12;
+		break;
+	case 4:
+		bps = 16;
+		break;
+	case 5:
+		bps = 20;
+		break;
+	case 6:
+		bps = 24;
+		break;
+	default:
+		return -EIO;
+	}
+	channels = assignment < 8 ? assignment + 1 : 2;
+	if (assignment > CHANNELS_MID_SIDE || channels != dec->channels ||
+	    bps != dec->bps || n > dec->max_block) {
+		SNDERR("FLAC frame does not match the stream");
+		return -EIO;
+	}
+
+	for (c = 0; c < channels; c++) {
+		unsigned int sbps = bps;
+		if ((assignment == CHANNELS_LEFT_SIDE && c == 1) ||
+		    (assignment == CHANNELS_SIDE_RIGHT && c == 0) ||
+		    (assignment == CHANNELS_MID_SIDE && c == 1))
+			sbps++;
+		err = dec_subframe(dec, dec->samples + c * dec->max_block, n, sbps);
+		if (err < 0)
+			goto _corrupt;
+	}
+	dec->pos = (dec->pos + 7) & ~(size_t)7;
+	crc = dec_bits(dec, 16);
+	err = -EIO;
+	if (dec->pos / 8 > dec->in_len ||
+	    crc != flac_crc16(&dec->crc, dec->in, dec->pos / 8 - 2))
+		goto _corrupt;
+
+	x0 = dec->samples;
+	x1 = dec->samples + dec->max_block;
+	switch (assignment) {
+	case CHANNELS_LEFT_SIDE:
+		for (i = 0; i < n; i++)
+			x1[i] = x0[i] - x1[i];
+		break;
+	case CHANNELS_SIDE_RIGHT:
+		for (i = 0; i < n; i++)
+			x0[i] += x1[i];
+		break;
+	case CHANNELS_MID_SIDE:
+		for (i = 0; i < n; i++) {
+			int32_t mid = ((uint32_t)x0[i] << 1) | (x1[i] & 1);
+			int32_t side = x1[i];
+			x0[i] = (mid + side) >> 1;
+			x1[i] = (mid - side) >> 1;
+		}
+		break;
+	}
+	flac_store(&dec->sfmt, dec->out, channels, n, dec->samples, dec->max_block);
+	dec->out_pos = 0;
+	dec->out_len = (size_t)n * channels * dec->sfmt.bytes;
+	return 1;
+
+ _corrupt:
+	if (err == -ENODATA || (dec->eof && dec->pos / 8 > dec->in_len))
+		SNDERR("FLAC stream truncated");
+	else
+		SNDERR("FLAC frame corrupt");
+	return -EIO;
+}
+
+/* read exactly len bytes of the metadata */
+static int dec_read_bytes(snd_pcm_flac_dec_t *dec, unsigned char *buf, size_t len)
+{
+	int err = dec_need(dec, len);
+
+	if (err < 0)
+		return err == -ENODATA ? -EIO : err;
+	memcpy(buf, dec->in + dec->pos / 8, len);
+	dec->pos += len * 8;
+	return 0;
+}
+
+/* returns -ENOENT when fd does not start with a FLAC stream */
+int snd_pcm_flac_dec_open(snd_pcm_flac_dec_t **decp, int fd)
+{
+	snd_pcm_flac_dec_t *dec;
+	unsigned char buf[SND_PCM_FLAC_STREAMINFO_SIZE];
+	unsigned int last, type, length, min_block;
+	off_t offset;
+	int err;
+
+	/* look without consuming, a raw file is read as it is */
+	offset = lseek(fd, 0, SEEK_CUR);
+	if (offset < 0 || pread(fd, buf, 4, offset) != 4 ||
+	    memcmp(buf, "fLaC", 4))
+		return -ENOENT;
+
+	dec = calloc(1, sizeof(*dec));
+	if (!dec)
+		return -ENOMEM;
+	dec->fd = fd;
+	flac_crc_init(&dec->crc);
+	err = dec_read_bytes(dec, buf, 4);
+	if (err < 0)
+		goto _err;
+	do {
+		err = dec_read_bytes(dec, buf, 4);
+		if (err < 0)
+			goto _err;
+		last = buf[0] & 0x80;
+		type = buf[0] & 0x7f;
+		length = (buf[1] << 16) | (buf[2] << 8) | buf[3];
+		if (type == 0) {
+			if (length != SND_PCM_FLAC_STREAMINFO_SIZE) {
+				err = -EIO;
+				goto _err;
+			}
+			err = dec_read_bytes(dec, buf, length);
+			if (err < 0)
+				goto _err;
+			min_block = (buf[0] << 8) | buf[1];
+			dec->max_block = (buf[2] << 8) | buf[3];
+			dec->rate = (buf[10] << 12) | (buf[11] << 4) | (buf[12] >> 4);
+			dec->channels = ((buf[12] >> 1) & 7) + 1;
+			dec->bps = (((buf[12] & 1) << 4) | (buf[13] >> 4)) + 1;
+			if (min_block < 16 || dec->max_block < min_block) {
+				err = -EIO;
+				goto _err;
+			}
+			continue;
+		}
+		/* skip the other metadata */
+		while (length > 0) {
+			unsigned int n = length < sizeof(buf) ? length : sizeof(buf);
+			err = dec_read_bytes(dec, buf, n);
+			if (err < 0)
+				goto _err;
+			length -= n;
+		}
+	} while (!last);
+	if (!dec->max_block) {
+		SNDERR("FLAC stream without STREAMINFO");
+		err = -EIO;
+		goto _err;
+	}
+	if (dec->bps < 8 || dec->bps > 24) {
+		SNDERR("FLAC streams with %u bits are not supported", dec->bps);
+		err = -EINVAL;
+		goto _err;
+	}
+	dec->samples = malloc(sizeof(int32_t) * dec->max_block * dec->channels);
+	if (!dec->samples) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	*decp = dec;
+	return 0;
+
+ _err:
+	if (err == -EIO)
+		SNDERR("invalid FLAC stream header");
+	snd_pcm_flac_dec_close(dec);
+	return err;
+}
+
+void snd_pcm_flac_dec_close(snd_pcm_flac_dec_t *dec)
+{
+	if (!dec)
+		return;
+	free(dec->in);
+	free(dec->samples);
+	free(dec->out);
+	free(dec);
+}
+
+/* the PCM format to decode to, which must carry the stream as it is */
+int snd_pcm_flac_dec_set_format(snd_pcm_flac_dec_t *dec,
+				snd_pcm_format_t format, unsigned int channels)
+{
+	struct flac_sfmt sfmt;
+	unsigned char *out;
+
+	if (flac_sfmt_init(&sfmt, format) < 0 || sfmt.bits != dec->bps ||
+	    channels != dec->channels) {
+		SNDERR("FLAC stream with %u channels of %u bits does not fit %s/%u",
+		       dec->channels, dec->bps, snd_pcm_format_name(format),
+		       channels);
+		return -EINVAL;
+	}
+	out = realloc(dec->out, (size_t)dec->max_block * channels * sfmt.bytes);
+	if (!out)
+		return -ENOMEM;
+	if (dec->out && sfmt.bytes != dec->sfmt.bytes)
+		dec->out_pos = dec->out_len = 0;	/* pending data is lost */
+	dec->out = out;
+	dec->sfmt = sfmt;
+	return 0;
+}
+
+/* decoded PCM bytes, 0 at the end of the stream */
+ssize_t snd_pcm_flac_dec_read(snd_pcm_flac_dec_t *dec, void *buf, size_t bytes)
+{
+	unsigned char *dst = buf;
+	size_t done = 0, n;
+	int err;
+
+	if (!dec->out)
+		return -EBADFD;
+	while (done < bytes) {
+		if (dec->out_pos == dec->out_len) {
+			if (dec->failed)
+				break;
+			err = dec_frame(dec);
+			if (err < 0)
+				dec->failed = 1;
+			if (err <= 0) {
+				if (done)
+					break;
+				return err;
+			}
+		}
+		n = dec->out_len - dec->out_pos;
+		if (n > bytes - done)
+			n = bytes - done;
+		memcpy(dst + done, dec->out + dec->out_pos, n);
+		dec->out_pos += n;
+		done += n;
+	}
+	return done;
+}
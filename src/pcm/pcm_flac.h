@@ -0,0 +1,77 @@
+/*
+ *  PCM - FLAC stream encoder and decoder for the file plugin
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* "fLaC" and the STREAMINFO metadata block */
+#define SND_PCM_FLAC_HEADER_SIZE	42
+#define SND_PCM_FLAC_STREAMINFO_OFFSET	8
+#define SND_PCM_FLAC_STREAMINFO_SIZE	34
+
+/* the FLAC frame header has no channel assignment beyond 8 */
+#define SND_PCM_FLAC_MAX_CHANNELS	8
+
+typedef struct snd_pcm_flac_enc snd_pcm_flac_enc_t;
+typedef struct snd_pcm_flac_dec snd_pcm_flac_dec_t;
+
+/* store len bytes of the encoded stream, returns 0 or a negative error */
+typedef int (*snd_pcm_flac_write_t)(void *private_data, const void *buf,
+				    size_t len);
+
+#define snd_pcm_flac_format_supported \
+	snd1_pcm_flac_format_supported
+#define snd_pcm_flac_enc_open \
+	snd1_pcm_flac_enc_open
+#define snd_pcm_flac_enc_close \
+	snd1_pcm_flac_enc_close
+#define snd_pcm_flac_enc_header \
+	snd1_pcm_flac_enc_header
+#define snd_pcm_flac_enc_streaminfo \
+	snd1_pcm_flac_enc_streaminfo
+#define snd_pcm_flac_enc_write \
+	snd1_pcm_flac_enc_write
+#define snd_pcm_flac_enc_finish \
+	snd1_pcm_flac_enc_finish
+#define snd_pcm_flac_enc_dump \
+	snd1_pcm_flac_enc_dump
+#define snd_pcm_flac_dec_open \
+	snd1_pcm_flac_dec_open
+#define snd_pcm_flac_dec_close \
+	snd1_pcm_flac_dec_close
+#define snd_pcm_flac_dec_set_format \
+	snd1_pcm_flac_dec_set_format
+#define snd_pcm_flac_dec_read \
+	snd1_pcm_flac_dec_read
+
+int snd_pcm_flac_format_supported(snd_pcm_format_t format);
+
+int snd_pcm_flac_enc_open(snd_pcm_flac_enc_t **encp, snd_pcm_format_t format,
+			  unsigned int channels, unsigned int rate);
+void snd_pcm_flac_enc_close(snd_pcm_flac_enc_t *enc);
+void snd_pcm_flac_enc_header(snd_pcm_flac_enc_t *enc, unsigned char *buf);
+void snd_pcm_flac_enc_streaminfo(snd_pcm_flac_enc_t *enc, unsigned char *buf);
+int snd_pcm_flac_enc_write(snd_pcm_flac_enc_t *enc, const void *buf,
+			   size_t bytes, snd_pcm_flac_write_t write,
+			   void *private_data);
+int snd_pcm_flac_enc_finish(snd_pcm_flac_enc_t *enc,
+			    snd_pcm_flac_write_t write, void *private_data);
+void snd_pcm_flac_enc_dump(snd_pcm_flac_enc_t *enc, snd_output_t *out);
+
+int snd_pcm_flac_dec_open(snd_pcm_flac_dec_t **decp, int fd);
+void snd_pcm_flac_dec_close(snd_pcm_flac_dec_t *dec);
+int snd_pcm_flac_dec_set_format(snd_pcm_flac_dec_t *dec,
+				snd_pcm_format_t format, unsigned int channels);
+ssize_t snd_pcm_flac_dec_read(snd_pcm_flac_dec_t *dec, void *buf, size_t bytes);
@@ -97,6 +97,7 @@ typedef struct {
 	bool mmap_status_fallbacked;
 	bool mmap_control_fallbacked;
 	struct snd_pcm_sync_ptr *sync_ptr;
+	unsigned long long sync_ptr_saved;	/* ioctls saved by batched commits */
 
 	int period_event;
 	snd_timer_t *period_timer;
@@ -1109,12 +1110,12 @@ static snd_pcm_sframes_t snd_pcm_hw_mmap_commit(snd_pcm_t *pcm,
 	return size;
 }
 
-static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm)
+/* check avail against the already synchronized status data */
+static snd_pcm_sframes_t snd_pcm_hw_check_avail(snd_pcm_t *pcm)
 {
 	snd_pcm_hw_t *hw = pcm->private_data;
 	snd_pcm_uframes_t avail;
 
-	query_status_data(hw);
 	avail = snd_pcm_mmap_avail(pcm);
 	switch (FAST_PCM_STATE(hw)) {
 	case SNDRV_PCM_STATE_RUNNING:
@@ -1136,6 +1137,59 @@ static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm)
 	return avail;
 }
 
+static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+
+	query_status_data(hw);
+	return snd_pcm_hw_check_avail(pcm);
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_mmap_commit_avail(snd_pcm_t *pcm,
+						      snd_pcm_uframes_t offset,
+						      snd_pcm_uframes_t size,
+						      snd_pcm_sframes_t *availp)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	snd_pcm_sframes_t avail;
+	unsigned int flags;
+	int err;
+
+	if (!hw->mmap_control_fallbacked && !hw->mmap_status_fallbacked) {
+		/* nothing to batch, the pointers are mmapped */
+		snd_pcm_hw_mmap_commit(pcm, offset, size);
+		err = snd_pcm_hw_hwsync(pcm);
+		if (err < 0)
+			return err;
+		avail = snd_pcm_hw_check_avail(pcm);
+		if (avail < 0)
+			return avail;
+		*availp = avail;
+		return size;
+	}
+
+	/*
+	 * Write appl_ptr and avail_min, sync hw_ptr and read back the
+	 * status in one SYNC_PTR instead of the separate applptr,
+	 * hwsync and status queries.  The control data must not be
+	 * written when it is mmapped, sync_ptr holds stale values then.
+	 */
+	snd_pcm_mmap_appl_forward(pcm, size);
+	flags = SNDRV_PCM_SYNC_PTR_HWSYNC;
+	if (!hw->mmap_control_fallbacked)
+		flags |= SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+	err = sync_ptr1(hw, flags);
+	if (err < 0)
+		return err;
+	hw->sync_ptr_saved += hw->mmap_control_fallbacked +
+			      hw->mmap_status_fallbacked;
+	avail = snd_pcm_hw_check_avail(pcm);
+	if (avail < 0)
+		return avail;
+	*availp = avail;
+	return size;
+}
+
 static int snd_pcm_hw_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail,
 				 snd_htimestamp_t *tstamp)
 {
@@ -1431,6 +1485,7 @@ static void snd_pcm_hw_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_pcm_dump_setup(pcm, out);
 		snd_output_printf(out, "  appl_ptr     : %li\n", hw->mmap_control->appl_ptr);
 		snd_output_printf(out, "  hw_ptr       : %li\n", hw->mmap_status->hw_ptr);
+		snd_output_printf(out, "  sync_ptr_saved: %llu\n", hw->sync_ptr_saved);
 	}
 }
 
@@ -1477,6 +1532,7 @@ static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops = {
 	.readn = snd_pcm_hw_readn,
 	.avail_update = snd_pcm_hw_avail_update,
 	.mmap_commit = snd_pcm_hw_mmap_commit,
+	.mmap_commit_avail = snd_pcm_hw_mmap_commit_avail,
 	.htimestamp = snd_pcm_hw_htimestamp,
 	.poll_descriptors = NULL,
 	.poll_descriptors_count = NULL,
@@ -1508,6 +1564,7 @@ static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops_timer = {
 	.readn = snd_pcm_hw_readn,
 	.avail_update = snd_pcm_hw_avail_update,
 	.mmap_commit = snd_pcm_hw_mmap_commit,
+	.mmap_commit_avail = snd_pcm_hw_mmap_commit_avail,
 	.htimestamp = snd_pcm_hw_htimestamp,
 	.poll_descriptors = snd_pcm_hw_poll_descriptors,
 	.poll_descriptors_count = snd_pcm_hw_poll_descriptors_count,
@@ -1635,6 +1692,7 @@ int snd_pcm_hw_open_fd(snd_pcm_t **pcmp, const char *name, int fd,
 	pcm->need_lock = 0;	/* hw plugin is thread-safe */
 #endif
 	pcm->own_state_check = 1; /* skip the common state check */
+	pcm->refine_volatile = 1; /* constraints are up to the driver */
 
 	ret = map_status_and_control_data(pcm, !!sync_ptr_ioctl);
 	if (ret < 0) {
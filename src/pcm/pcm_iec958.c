@@ -64,32 +64,14 @@ struct snd_pcm_iec958 {
 	unsigned char preamble[3];	/* B/M/W or Z/X/Y */
 	snd_pcm_fast_ops_t fops;
 	int hdmi_mode;
+	/* preamble and status bits for each frame of the block, even/odd sub frame */
+	uint32_t frame_bits[2][192];
 };
 
 enum { PREAMBLE_Z, PREAMBLE_X, PREAMBLE_Y };
 
 #endif /* DOC_HIDDEN */
 
-/*
- * Determine parity for time slots 4 upto 30
- * to be sure that bit 4 upt 31 will carry
- * an even number of ones and zeros.
- */
-static unsigned int iec958_parity(unsigned int data)
-{
-	unsigned int parity;
-	int bit;
-
-	data >>= 4;     /* start from bit 4 */
-	parity = 0;
-	for (bit = 4; bit <= 30; bit++) {
-		if (data & 1)
-			parity++;
-		data >>= 1;
-	}
-	return (parity & 1);
-}
-
 /*
  * Compose 32bit IEC958 subframe, two sub frames
  * build one frame with two channels.
@@ -101,38 +83,47 @@ static unsigned int iec958_parity(unsigned int data)
  *     29   = user data (0)
  *     30   = channel status (24 bytes for 192 frames)
  *     31   = parity
+ *
+ * The preamble and the channel status bit depend only on the position in
+ * the 192 frames block and on the sub frame, so they are looked up in
+ * iec->frame_bits; there bit 31 holds the parity of the status bit, and
+ * the parity of the sample bits 4-27 is folded in here.
  */
 
-static inline uint32_t iec958_subframe(snd_pcm_iec958_t *iec, uint32_t data, int channel)
+static inline uint32_t iec958_subframe(uint32_t data, uint32_t frame_bits,
+				       int byteswap)
 {
-	unsigned int byte = iec->counter >> 3;
-	unsigned int mask = 1 << (iec->counter - (byte << 3));
-
 	/* bit 4-27 */
 	data >>= 4;
 	data &= ~0xf;
 
-	/* set IEC status bits (up to 192 bits) */
-	if (iec->status[byte] & mask)
-		data |= 0x40000000;
-
-	if (iec958_parity(data))	/* parity bit 4-30 */
-		data |= 0x80000000;
-
-	/* Preamble */
-	if (channel)
-		data |= iec->preamble[PREAMBLE_Y];	/* odd sub frame, 'Y' */
-	else if (! iec->counter)
-		data |= iec->preamble[PREAMBLE_Z];	/* Block start, 'Z' */
-	else
-		data |= iec->preamble[PREAMBLE_X];	/* even sub frame, 'X' */
+	/* parity bit 4-30 */
+	data |= frame_bits ^ ((uint32_t)__builtin_parity(data) << 31);
 
-	if (iec->byteswap)
+	if (byteswap)
 		data = bswap_32(data);
 
 	return data;
 }
 
+/* build iec->frame_bits from the status bits and the preambles */
+static void iec958_build_frame_bits(snd_pcm_iec958_t *iec)
+{
+	unsigned int counter;
+
+	for (counter = 0; counter < 192; counter++) {
+		uint32_t status = 0;
+
+		/* IEC status bits (up to 192 bits), with their parity */
+		if (iec->status[counter >> 3] & (1 << (counter & 7)))
+			status = 0xc0000000;
+		/* Preamble: block start 'Z', even sub frame 'X', odd 'Y' */
+		iec->frame_bits[0][counter] = status |
+			iec->preamble[counter ? PREAMBLE_X : PREAMBLE_Z];
+		iec->frame_bits[1][counter] = status | iec->preamble[PREAMBLE_Y];
+	}
+}
+
 static inline int32_t iec958_to_s32(snd_pcm_iec958_t *iec, uint32_t data)
 {
 	if (iec->byteswap)
@@ -167,6 +158,14 @@ static void snd_pcm_iec958_decode(snd_pcm_iec958_t *iec,
 		src_step = snd_pcm_channel_area_step(src_area) / sizeof(uint32_t);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (iec->getput_idx == SND_PCM_LINEAR_S32_INDEX) {
+			while (frames1-- > 0) {
+				*(int32_t *)dst = iec958_to_s32(iec, *src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			int32_t sample = iec958_to_s32(iec, *src);
 			goto *put;
@@ -193,11 +192,12 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 	void *get = get32_labels[iec->getput_idx];
 	unsigned int channel;
 	int32_t sample = 0;
-	int counter = iec->counter;
+	unsigned int counter = iec->counter;
 	int single_stream = iec->hdmi_mode &&
 			    (iec->status[0] & IEC958_AES0_NONAUDIO) &&
 			    (channels == 8);
-	int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
+	unsigned int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
+	int byteswap = iec->byteswap;
 	for (channel = 0; channel < channels; ++channel) {
 		const char *src;
 		uint32_t *dst;
@@ -205,6 +205,8 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		snd_pcm_uframes_t frames1;
 		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
 		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
+		const uint32_t *frame_bits = iec->frame_bits[channel ? 1 : 0];
+		unsigned int pos;
 		src = snd_pcm_channel_area_addr(src_area, src_offset);
 		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
 		src_step = snd_pcm_channel_area_step(src_area);
@@ -212,9 +214,35 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		frames1 = frames;
 
 		if (single_stream)
-			iec->counter = (counter + (channel >> 1)) % 192;
+			pos = (counter + (channel >> 1)) % 192;
 		else
-			iec->counter = counter;
+			pos = counter;
+
+		/* native S16 and S32, the common cases */
+		if (iec->getput_idx == SND_PCM_LINEAR_S16_INDEX ||
+		    iec->getput_idx == SND_PCM_LINEAR_S32_INDEX) {
+			int s16 = iec->getput_idx == SND_PCM_LINEAR_S16_INDEX;
+			while (frames1 > 0) {
+				/* up to the end of the block, no wrap check inside */
+				snd_pcm_uframes_t n = (192 - pos + counter_step - 1) / counter_step;
+				if (n > frames1)
+					n = frames1;
+				frames1 -= n;
+				while (n-- > 0) {
+					uint32_t data;
+					if (s16)
+						data = (uint32_t)*(const uint16_t *)src << 16;
+					else
+						data = *(const uint32_t *)src;
+					*dst = iec958_subframe(data, frame_bits[pos], byteswap);
+					src += src_step;
+					dst += dst_step;
+					pos += counter_step;
+				}
+				pos %= 192;
+			}
+			continue;
+		}
 
 		while (frames1-- > 0) {
 			goto *get;
@@ -222,17 +250,16 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 #include "plugin_ops.h"
 #undef GET32_END
 		after:
-			sample = iec958_subframe(iec, sample, channel);
-			// fprintf(stderr, "%d:%08x\n", frames1, sample);
-			*dst = sample;
+			*dst = iec958_subframe(sample, frame_bits[pos], byteswap);
 			src += src_step;
 			dst += dst_step;
-			iec->counter += counter_step;
-			iec->counter %= 192;
+			pos += counter_step;
+			if (pos >= 192)
+				pos -= 192;
 		}
-		if (single_stream) /* set counter to ch0 value for next iteration */
-			iec->counter = (counter + frames * counter_step) % 192;
 	}
+	if (channels)
+		iec->counter = (counter + frames * counter_step) % 192;
 }
 #endif /* DOC_HIDDEN */
 
@@ -439,6 +466,7 @@ static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 			iec->status[4] |= ws;
 		}
 	}
+	iec958_build_frame_bits(iec);
 	return 0;
 }
 
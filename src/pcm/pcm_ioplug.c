@@ -45,6 +45,7 @@ typedef struct snd_pcm_ioplug_priv {
 	snd_pcm_uframes_t last_hw;
 	snd_pcm_uframes_t avail_max;
 	snd_htimestamp_t trigger_tstamp;
+	unsigned int own_buffer: 1;	/* mmap areas given by the plugin */
 } ioplug_priv_t;
 
 static int snd_pcm_ioplug_drop(snd_pcm_t *pcm);
@@ -649,6 +650,25 @@ static snd_pcm_sframes_t ioplug_priv_transfer_areas(snd_pcm_t *pcm,
 	return result;
 }
 
+/* called in lock */
+static snd_pcm_sframes_t ioplug_priv_commit_own(snd_pcm_t *pcm,
+						snd_pcm_uframes_t offset,
+						snd_pcm_uframes_t size)
+{
+	ioplug_priv_t *io = pcm->private_data;
+	snd_pcm_sframes_t result;
+
+	if (! size)
+		return 0;
+	if (io->data->callback->mmap_commit)
+		result = io->data->callback->mmap_commit(io->data, offset, size);
+	else
+		result = size;
+	if (result > 0)
+		snd_pcm_mmap_appl_forward(pcm, result);
+	return result;
+}
+
 static snd_pcm_sframes_t snd_pcm_ioplug_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size)
 {
 	if (pcm->mmap_rw)
@@ -709,7 +729,7 @@ static int snd_pcm_ioplug_mmap_begin_capture(snd_pcm_t *pcm,
 	if (err < 0)
 		return err;
 
-	if (io->data->callback->transfer &&
+	if (io->data->callback->transfer && !io->own_buffer &&
 	    pcm->access != SND_PCM_ACCESS_RW_INTERLEAVED &&
 	    pcm->access != SND_PCM_ACCESS_RW_NONINTERLEAVED) {
 		snd_pcm_sframes_t result;
@@ -733,6 +753,12 @@ static snd_pcm_sframes_t snd_pcm_ioplug_mmap_commit(snd_pcm_t *pcm,
 						    snd_pcm_uframes_t offset,
 						    snd_pcm_uframes_t size)
 {
+	ioplug_priv_t *io = pcm->private_data;
+
+	/* the data is already in place, just tell the plugin */
+	if (io->own_buffer)
+		return ioplug_priv_commit_own(pcm, offset, size);
+
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK &&
 	    pcm->access != SND_PCM_ACCESS_RW_INTERLEAVED &&
 	    pcm->access != SND_PCM_ACCESS_RW_NONINTERLEAVED) {
@@ -823,9 +849,52 @@ static int snd_pcm_ioplug_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsi
 	return err;
 }
 
-static int snd_pcm_ioplug_mmap(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+static int snd_pcm_ioplug_mmap(snd_pcm_t *pcm)
 {
+	ioplug_priv_t *io = pcm->private_data;
+	snd_pcm_channel_info_t *info;
+	snd_pcm_channel_area_t *areas;
+	unsigned int c;
+	int err;
+
+	if (io->data->version < 0x010003 ||
+	    !io->data->callback->mmap_areas)
+		return 0;
+
+	info = calloc(pcm->channels, sizeof(*info));
+	areas = calloc(pcm->channels, sizeof(*areas));
+	if (!info || !areas) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	err = io->data->callback->mmap_areas(io->data, areas);
+	if (err < 0)
+		goto _err;
+	for (c = 0; c < pcm->channels; c++) {
+		if (!areas[c].addr) {
+			SNDERR("ioplug: no mmap area for channel %u", c);
+			err = -EINVAL;
+			goto _err;
+		}
+		info[c].channel = c;
+		info[c].addr = areas[c].addr;
+		info[c].first = areas[c].first;
+		info[c].step = areas[c].step;
+		info[c].type = SND_PCM_AREA_LOCAL;
+	}
+	/* the buffer belongs to the plugin; don't let the generic
+	 * mmap code allocate or free it
+	 */
+	pcm->mmap_channels = info;
+	pcm->running_areas = areas;
+	pcm->mmap_shadow = 1;
+	io->own_buffer = 1;
 	return 0;
+
+ _err:
+	free(info);
+	free(areas);
+	return err == -ENXIO ? 0 : err;
 }
 
 static int snd_pcm_ioplug_async(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
@@ -835,8 +904,18 @@ static int snd_pcm_ioplug_async(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
 	return -ENOSYS;
 }
 
-static int snd_pcm_ioplug_munmap(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+static int snd_pcm_ioplug_munmap(snd_pcm_t *pcm)
 {
+	ioplug_priv_t *io = pcm->private_data;
+
+	if (io->own_buffer) {
+		free(pcm->mmap_channels);
+		free(pcm->running_areas);
+		pcm->mmap_channels = NULL;
+		pcm->running_areas = NULL;
+		pcm->mmap_shadow = 0;
+		io->own_buffer = 0;
+	}
 	return 0;
 }
 
@@ -1022,6 +1101,21 @@ receives the area array, offset and the size to transfer.  The area
 array contains the array of snd_pcm_channel_area_t with the elements
 of number of channels.
 
+A plugin having its own ring buffer (e.g. a shared memory region of a
+sound server or a transport buffer) can avoid the extra copy by giving
+the mmap_areas callback (since v1.0.3).  It is called after hw_params
+when the PCM gets mmapped, i.e. for the mmap access or when mmap_rw is
+set, and fills one channel area per channel covering buffer_size frames
+of the plugin's buffer.  #snd_pcm_mmap_begin() on the application side
+then returns this memory directly.  While the own buffer is in use, the
+transfer callback is no longer called; instead, the mmap_commit callback
+is notified with the offset and the number of frames committed by the
+application, i.e. written for playback or consumed for capture, and
+returns the number of frames it accepted.  For capture, the plugin
+writes the data to its buffer before reporting it via pointer callback.
+The buffer must stay valid until the hw_free callback.  Returning
+-ENXIO from mmap_areas falls back to the buffer allocated by alsa-lib.
+
 When the PCM is closed, close callback is called.  If the driver
 allocates any internal buffers, they should be released in this
 callback.  The hw_params and hw_free callbacks are called when
@@ -1218,12 +1312,15 @@ int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug)
  * \param ioplug the ioplug handle
  * \return the mmap channel areas if available, or NULL
  *
- * Returns the mmap channel areas if available.  When mmap_rw field is not set,
+ * Returns the mmap channel areas if available.  When mmap_rw field is not set
+ * and the plugin doesn't provide its own buffer via mmap_areas callback,
  * this function always returns NULL.
  */
 const snd_pcm_channel_area_t *snd_pcm_ioplug_mmap_areas(snd_pcm_ioplug_t *ioplug)
 {
-	if (ioplug->mmap_rw)
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
+	if (ioplug->mmap_rw || io->own_buffer)
 		return snd_pcm_mmap_areas(ioplug->pcm);
 	return NULL;
 }
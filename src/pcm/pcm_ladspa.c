@@ -32,11 +32,17 @@
  *   http://www.medianet.ag
  */
   
+#include "config.h"
 #include <dirent.h>
 #include <locale.h>
 #include <math.h>
 #include "pcm_local.h"
 #include "pcm_plugin.h"
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#endif
 
 #include "ladspa.h"
 
@@ -49,11 +55,24 @@ const char *_snd_module_pcm_ladspa = "";
 
 #define NO_ASSIGN	0xffffffff
 
+#define LADSPA_ALIGN	64		/* buffer alignment in bytes */
+
 typedef enum _snd_pcm_ladspa_policy {
 	SND_PCM_LADSPA_POLICY_NONE,		/* use bindings only */
 	SND_PCM_LADSPA_POLICY_DUPLICATE		/* duplicate bindings for all channels */
 } snd_pcm_ladspa_policy_t;
 
+struct snd_pcm_ladspa_instance;
+
+#ifdef HAVE_LIBPTHREAD
+typedef struct {
+	pthread_t thread;
+	sem_t request;				/* a depth is posted */
+	unsigned int index;			/* 1..threads, 0 is the caller */
+	void *ladspa;
+} snd_pcm_ladspa_worker_t;
+#endif
+
 typedef struct {
 	/* This field need to be the first */
 	snd_pcm_plugin_t plug;
@@ -63,6 +82,26 @@ typedef struct {
 	unsigned int channels;			/* forced input channels, 0 = auto */
 	unsigned int allocated;			/* count of allocated samples */
 	LADSPA_Data *zero[2];			/* zero input or dummy output */
+	LADSPA_Data **pool;			/* all allocated buffers */
+	unsigned int pool_count;
+	unsigned long long dsp_time;		/* ns spent in the plugins */
+	unsigned long long dsp_frames;		/* frames processed */
+	double dsp_peak;			/* worst load of one transfer */
+	struct snd_pcm_ladspa_instance **run_list; /* instances in run order */
+	unsigned int *depth_start;		/* run_list index per depth + end */
+	unsigned int depths;
+	unsigned int threads;			/* worker threads, 0 = serial */
+	unsigned int thread_min;		/* smaller runs stay serial */
+	int thread_priority;			/* SCHED_FIFO priority, 0 = none */
+#ifdef HAVE_LIBPTHREAD
+	snd_pcm_ladspa_worker_t *workers;	/* running workers or NULL */
+	int quit;
+	sem_t done;				/* a worker finished its share */
+	/* the job posted to the workers */
+	const snd_pcm_channel_area_t *job_in, *job_out;
+	snd_pcm_uframes_t job_in_offset, job_out_offset, job_size;
+	unsigned int job_first, job_end;
+#endif
 } snd_pcm_ladspa_t;
  
 typedef struct {
@@ -73,7 +112,6 @@ typedef struct {
 typedef struct {
         snd_pcm_ladspa_array_t channels;
         snd_pcm_ladspa_array_t ports;
-	LADSPA_Data **m_data;
         LADSPA_Data **data;
 } snd_pcm_ladspa_eps_t;
 
@@ -192,16 +230,23 @@ static void snd_pcm_ladspa_free_plugins(struct list_head *plugins)
 	}
 }
 
-static void snd_pcm_ladspa_free(snd_pcm_ladspa_t *ladspa)
+static void snd_pcm_ladspa_free_pool(snd_pcm_ladspa_t *ladspa)
 {
-        unsigned int idx;
+	unsigned int idx;
 
+	for (idx = 0; idx < ladspa->pool_count; idx++)
+		free(ladspa->pool[idx]);
+	free(ladspa->pool);
+	ladspa->pool = NULL;
+	ladspa->pool_count = 0;
+	ladspa->zero[0] = ladspa->zero[1] = NULL;
+}
+
+static void snd_pcm_ladspa_free(snd_pcm_ladspa_t *ladspa)
+{
 	snd_pcm_ladspa_free_plugins(&ladspa->pplugins);
 	snd_pcm_ladspa_free_plugins(&ladspa->cplugins);
-	for (idx = 0; idx < 2; idx++) {
-		free(ladspa->zero[idx]);
-                ladspa->zero[idx] = NULL;
-        }
+	snd_pcm_ladspa_free_pool(ladspa);
         ladspa->allocated = 0;
 }
 
@@ -297,9 +342,15 @@ static int snd_pcm_ladspa_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 				       snd_pcm_generic_hw_refine);
 }
 
+#ifdef HAVE_LIBPTHREAD
+static int snd_pcm_ladspa_workers_start(snd_pcm_ladspa_t *ladspa);
+#else
+#define snd_pcm_ladspa_workers_start(ladspa)	0
+#endif
+
 static int snd_pcm_ladspa_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 {
-	// snd_pcm_ladspa_t *ladspa = pcm->private_data;
+	snd_pcm_ladspa_t *ladspa = pcm->private_data;
 	int err = snd_pcm_hw_params_slave(pcm, params,
 					  snd_pcm_ladspa_hw_refine_cchange,
 					  snd_pcm_ladspa_hw_refine_sprepare,
@@ -307,6 +358,11 @@ static int snd_pcm_ladspa_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 					  snd_pcm_generic_hw_params);
 	if (err < 0)
 		return err;
+	err = snd_pcm_ladspa_workers_start(ladspa);
+	if (err < 0) {
+		snd_pcm_generic_hw_free(pcm);
+		return err;
+	}
 	return 0;
 }
 
@@ -319,7 +375,6 @@ static void snd_pcm_ladspa_free_eps(snd_pcm_ladspa_eps_t *eps)
 static void snd_pcm_ladspa_free_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa, int cleanup)
 {
 	struct list_head *list, *pos, *pos1, *next1;
-	unsigned int idx;
 	
 	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
 	list_for_each(pos, list) {
@@ -331,16 +386,6 @@ static void snd_pcm_ladspa_free_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			if (cleanup) {
 				if (plugin->desc->cleanup)
 					plugin->desc->cleanup(instance->handle);
-				if (instance->input.m_data) {
-				        for (idx = 0; idx < instance->input.channels.size; idx++)
-						free(instance->input.m_data[idx]);
-					free(instance->input.m_data);
-                                }
-				if (instance->output.m_data) {
-				        for (idx = 0; idx < instance->output.channels.size; idx++)
-						free(instance->output.m_data[idx]);
-					free(instance->output.m_data);
-                                }
                                 free(instance->input.data);
                                 free(instance->output.data);
 				list_del(&(instance->list));
@@ -356,6 +401,14 @@ static void snd_pcm_ladspa_free_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			assert(list_empty(&plugin->instances));
 		}
 	}
+	if (cleanup) {
+		snd_pcm_ladspa_free_pool(ladspa);
+		free(ladspa->run_list);
+		free(ladspa->depth_start);
+		ladspa->run_list = NULL;
+		ladspa->depth_start = NULL;
+		ladspa->depths = 0;
+	}
 }
 
 static int snd_pcm_ladspa_add_to_carray(snd_pcm_ladspa_array_t *array,
@@ -676,25 +729,62 @@ static int snd_pcm_ladspa_allocate_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *l
 	return 0;
 }
 
+/* a LADSPA_ALIGN aligned buffer of ladspa->allocated samples */
+static LADSPA_Data *snd_pcm_ladspa_allocate_buffer(snd_pcm_ladspa_t *ladspa)
+{
+	LADSPA_Data **pool;
+	void *buf;
+
+	pool = realloc(ladspa->pool, (ladspa->pool_count + 1) * sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+	ladspa->pool = pool;
+	if (posix_memalign(&buf, LADSPA_ALIGN,
+			   ladspa->allocated * sizeof(LADSPA_Data)))
+		return NULL;
+	memset(buf, 0, ladspa->allocated * sizeof(LADSPA_Data));
+	pool[ladspa->pool_count++] = buf;
+	return buf;
+}
+
 static LADSPA_Data *snd_pcm_ladspa_allocate_zero(snd_pcm_ladspa_t *ladspa, unsigned int idx)
 {
         if (ladspa->zero[idx] == NULL)
-                ladspa->zero[idx] = calloc(ladspa->allocated, sizeof(LADSPA_Data));
+                ladspa->zero[idx] = snd_pcm_ladspa_allocate_buffer(ladspa);
         return ladspa->zero[idx];
 }
 
+static int snd_pcm_ladspa_is_temp(snd_pcm_ladspa_t *ladspa, LADSPA_Data *buf)
+{
+	return buf != NULL && buf != ladspa->zero[0] && buf != ladspa->zero[1];
+}
+
+/*
+ * Connect the instances to intermediate buffers.  The run order of the
+ * instances is replayed: pchannels[chn] is the buffer which holds the
+ * channel so far and pslots[chn] the output port which wrote it.  A
+ * buffer nobody reads any longer goes to the spare list and is reused by
+ * an output of a later depth; if the plugin allows it, an output is
+ * connected in place to the input buffer of the same channel.
+ */
 static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
 {
 	struct list_head *list, *pos, *pos1;
 	snd_pcm_ladspa_instance_t *instance;
 	unsigned int channels = 16, nchannels;
 	unsigned int ichannels, ochannels;
-	void **pchannels, **npchannels;
-	unsigned int idx, chn;
-	
-        ladspa->allocated = 2048;
-        if (pcm->buffer_size > ladspa->allocated)
-                ladspa->allocated = pcm->buffer_size;
+	LADSPA_Data **pchannels = NULL, ***pslots = NULL;
+	LADSPA_Data **spare = NULL, **released = NULL;
+	unsigned int spare_count = 0, spare_ready = 0, released_count;
+	unsigned int idx, idx1, chn;
+	int err = -ENOMEM;
+
+	/* one period, rounded up to whole LADSPA_ALIGN blocks */
+	ladspa->allocated = pcm->period_size;
+	if (ladspa->allocated == 0)
+		ladspa->allocated = 1024;
+	idx = LADSPA_ALIGN / sizeof(LADSPA_Data);
+	ladspa->allocated = (ladspa->allocated + idx - 1) / idx * idx;
         if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
                 ichannels = pcm->channels;
                 ochannels = ladspa->plug.gen.slave->channels;
@@ -702,12 +792,17 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
                 ichannels = ladspa->plug.gen.slave->channels;
                 ochannels = pcm->channels;
         }
-	pchannels = calloc(1, sizeof(void *) * channels);
-	if (pchannels == NULL)
-	        return -ENOMEM;
+	pchannels = calloc(channels, sizeof(*pchannels));
+	pslots = calloc(channels, sizeof(*pslots));
+	if (pchannels == NULL || pslots == NULL)
+		goto _end;
 	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
 	list_for_each(pos, list) {
 		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		int inplace = !LADSPA_IS_INPLACE_BROKEN(plugin->desc->Properties);
+		/* the instances of one depth may run concurrently, so buffers */
+		/* released within a depth are reused by the next one only */
+		spare_ready = spare_count;
 		list_for_each(pos1, &plugin->instances) {
 			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
 			nchannels = channels;
@@ -724,30 +819,35 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
         			        nchannels = chn + 1;
                         }
                         if (nchannels != channels) {
-                                npchannels = realloc(pchannels, nchannels * sizeof(void *));
-                                if (npchannels == NULL) {
-                                        free(pchannels);
-                                        return -ENOMEM;
+				void *p;
+				p = realloc(pchannels, nchannels * sizeof(*pchannels));
+				if (p == NULL)
+					goto _end;
+				pchannels = p;
+				p = realloc(pslots, nchannels * sizeof(*pslots));
+				if (p == NULL)
+					goto _end;
+				pslots = p;
+                                for (idx = channels; idx < nchannels; idx++) {
+                                        pchannels[idx] = NULL;
+                                        pslots[idx] = NULL;
                                 }
-                                for (idx = channels; idx < nchannels; idx++)
-                                        npchannels[idx] = NULL;
-                                pchannels = npchannels;
+                                channels = nchannels;
                         }
                         assert(instance->input.data == NULL);
-                        assert(instance->input.m_data == NULL);
                         assert(instance->output.data == NULL);
-                        assert(instance->output.m_data == NULL);
                         instance->input.data = calloc(instance->input.channels.size, sizeof(void *));
-                        instance->input.m_data = calloc(instance->input.channels.size, sizeof(void *));
                         instance->output.data = calloc(instance->output.channels.size, sizeof(void *));
-                        instance->output.m_data = calloc(instance->output.channels.size, sizeof(void *));
                         if (instance->input.data == NULL ||
-                            instance->input.m_data == NULL ||
-                            instance->output.data == NULL ||
-                            instance->output.m_data == NULL) {
-                                free(pchannels);
-                                return -ENOMEM;
-                        }
+                            instance->output.data == NULL)
+				goto _end;
+			/* inputs and replaced outputs, released after the run */
+			released = malloc((instance->input.channels.size +
+					   instance->output.channels.size + 1) *
+					  sizeof(*released));
+			if (released == NULL)
+				goto _end;
+			released_count = 0;
 			for (idx = 0; idx < instance->input.channels.size; idx++) {
 			        chn = instance->input.channels.array[idx];
 			        if (pchannels[chn] == NULL && chn < ichannels) {
@@ -757,51 +857,78 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			        instance->input.data[idx] = pchannels[chn];
 			        if (instance->input.data[idx] == NULL) {
                                         instance->input.data[idx] = snd_pcm_ladspa_allocate_zero(ladspa, 0);
-                                        if (instance->input.data[idx] == NULL) {
-                                                free(pchannels);
-                                                return -ENOMEM;
-                                        }
+                                        if (instance->input.data[idx] == NULL)
+						goto _end;
                                 }
+				released[released_count++] = instance->input.data[idx];
                         }
                         for (idx = 0; idx < instance->output.channels.size; idx++) {
+				LADSPA_Data *buf = NULL;
 			        chn = instance->output.channels.array[idx];
-                                /* FIXME/OPTIMIZE: check if we can remove double alloc */
-                                /* if LADSPA plugin has no broken inplace */
-                                instance->output.data[idx] = malloc(sizeof(LADSPA_Data) * ladspa->allocated);
-                                if (instance->output.data[idx] == NULL) {
-                                        free(pchannels);
-                                        return -ENOMEM;
-                                }
-                                pchannels[chn] = instance->output.m_data[idx] = instance->output.data[idx];
+				if (inplace && snd_pcm_ladspa_is_temp(ladspa, pchannels[chn])) {
+					buf = pchannels[chn];
+					for (idx1 = 0; idx1 < idx; idx1++) {
+						if (instance->output.data[idx1] == buf)
+							buf = NULL;
+					}
+				}
+				if (buf == NULL && spare_ready > 0) {
+					buf = spare[--spare_ready];
+					spare[spare_ready] = spare[--spare_count];
+				}
+				if (buf == NULL)
+					buf = snd_pcm_ladspa_allocate_buffer(ladspa);
+				if (buf == NULL)
+					goto _end;
+				if (pchannels[chn] != buf)
+					released[released_count++] = pchannels[chn];
+                                instance->output.data[idx] = buf;
+                                pchannels[chn] = buf;
+                                pslots[chn] = &instance->output.data[idx];
                         }
+			/* buffers no channel refers to are free from now on */
+			for (idx = 0; idx < released_count; idx++) {
+				LADSPA_Data *buf = released[idx];
+				if (!snd_pcm_ladspa_is_temp(ladspa, buf))
+					continue;
+				for (idx1 = 0; idx1 < channels; idx1++) {
+					if (pchannels[idx1] == buf)
+						break;
+				}
+				if (idx1 < channels)
+					continue;
+				for (idx1 = 0; idx1 < spare_count; idx1++) {
+					if (spare[idx1] == buf)
+						break;
+				}
+				if (idx1 < spare_count)
+					continue;
+				if (spare_count == 0 || (spare_count & (spare_count - 1)) == 0) {
+					void *p = realloc(spare, (spare_count ? spare_count * 2 : 4) *
+							  sizeof(*spare));
+					if (p == NULL)
+						goto _end;
+					spare = p;
+				}
+				spare[spare_count++] = buf;
+			}
+			free(released);
+			released = NULL;
+		}
+	}
+	/* the last writers of the channels go straight to the ALSA areas (NULL) */
+	/* or to the dummy area ladspa->zero[1] */
+	for (chn = 0; chn < channels; chn++) {
+		if (pslots[chn] == NULL)
+			continue;
+		if (chn < ochannels) {
+			*pslots[chn] = NULL;
+		} else {
+			*pslots[chn] = snd_pcm_ladspa_allocate_zero(ladspa, 1);
+			if (*pslots[chn] == NULL)
+				goto _end;
 		}
 	}
-	/* OPTIMIZE: we have already allocated areas for ALSA output channels */
-	/* next loop deallocates the last output LADSPA areas and connects */
-	/* them to ALSA areas (NULL) or dummy area ladpsa->free[1] ; */
-	/* this algorithm might be optimized to not allocate the last LADSPA outputs */
-	list_for_each(pos, list) {
-		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-		list_for_each(pos1, &plugin->instances) {
-			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-                        for (idx = 0; idx < instance->output.channels.size; idx++) {
-        			chn = instance->output.channels.array[idx];
-                                if (instance->output.data[idx] == pchannels[chn]) {
-					free(instance->output.m_data[idx]);
-					instance->output.m_data[idx] = NULL;
-                                        if (chn < ochannels) {
-                                                instance->output.data[idx] = NULL;
-                                        } else {
-                                                instance->output.data[idx] = snd_pcm_ladspa_allocate_zero(ladspa, 1);
-                                                if (instance->output.data[idx] == NULL) {
-                                                        free(pchannels);
-                                                        return -ENOMEM;
-                                                }
-                                        }
-                                }
-                        }
-                }
-        }
 #if 0
         printf("zero[0] = %p\n", ladspa->zero[0]);
         printf("zero[1] = %p\n", ladspa->zero[1]);
@@ -810,13 +937,47 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 		list_for_each(pos1, &plugin->instances) {
 			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
                         for (idx = 0; idx < instance->input.channels.size; idx++)
-                                printf("%i:alloc-input%i:  data = %p, m_data = %p\n", instance->depth, idx, instance->input.data[idx], instance->input.m_data[idx]);
+                                printf("%i:alloc-input%i:  data = %p\n", instance->depth, idx, instance->input.data[idx]);
                         for (idx = 0; idx < instance->output.channels.size; idx++)
-                                printf("%i:alloc-output%i:  data = %p, m_data = %p\n", instance->depth, idx, instance->output.data[idx], instance->output.m_data[idx]);
+                                printf("%i:alloc-output%i:  data = %p\n", instance->depth, idx, instance->output.data[idx]);
 		}
 	}
 #endif
+	err = 0;
+ _end:
+	free(released);
+	free(spare);
 	free(pchannels);
+	free(pslots);
+	return err;
+}
+
+/* flatten the instances to run_list, grouped by depth */
+static int snd_pcm_ladspa_build_run_list(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
+{
+	struct list_head *list, *pos, *pos1;
+	unsigned int count = 0, depths = 0;
+
+	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		list_for_each(pos1, &plugin->instances)
+			count++;
+		depths++;
+	}
+	ladspa->run_list = calloc(count + 1, sizeof(*ladspa->run_list));
+	ladspa->depth_start = calloc(depths + 1, sizeof(*ladspa->depth_start));
+	if (ladspa->run_list == NULL || ladspa->depth_start == NULL)
+		return -ENOMEM;
+	count = depths = 0;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		ladspa->depth_start[depths++] = count;
+		list_for_each(pos1, &plugin->instances)
+			ladspa->run_list[count++] = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+	}
+	ladspa->depth_start[depths] = count;
+	ladspa->depths = depths;
 	return 0;
 }
 
@@ -826,6 +987,9 @@ static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 	int err;
 	
 	snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
+	ladspa->dsp_time = 0;
+	ladspa->dsp_frames = 0;
+	ladspa->dsp_peak = 0;
 	err = snd_pcm_ladspa_allocate_instances(pcm, ladspa);
 	if (err < 0) {
 		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
@@ -836,17 +1000,256 @@ static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 		return err;
 	}
+	err = snd_pcm_ladspa_build_run_list(pcm, ladspa);
+	if (err < 0) {
+		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
+		return err;
+	}
 	return 0;
 }
 
+static void snd_pcm_ladspa_run(snd_pcm_ladspa_instance_t *instance,
+			       const snd_pcm_channel_area_t *in_areas,
+			       snd_pcm_uframes_t in_offset,
+			       const snd_pcm_channel_area_t *out_areas,
+			       snd_pcm_uframes_t out_offset,
+			       snd_pcm_uframes_t size)
+{
+	LADSPA_Data *data;
+	unsigned int idx, chn;
+
+	for (idx = 0; idx < instance->input.channels.size; idx++) {
+		chn = instance->input.channels.array[idx];
+		data = instance->input.data[idx];
+		if (data == NULL) {
+			data = (LADSPA_Data *)((char *)in_areas[chn].addr + (in_areas[chn].first / 8));
+			data += in_offset;
+		}
+		instance->desc->connect_port(instance->handle, instance->input.ports.array[idx], data);
+	}
+	for (idx = 0; idx < instance->output.channels.size; idx++) {
+		chn = instance->output.channels.array[idx];
+		data = instance->output.data[idx];
+		if (data == NULL) {
+			data = (LADSPA_Data *)((char *)out_areas[chn].addr + (out_areas[chn].first / 8));
+			data += out_offset;
+		}
+		instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
+	}
+	instance->desc->run(instance->handle, size);
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* the share of worker index: every (threads + 1)-th instance of the job */
+static void snd_pcm_ladspa_run_share(snd_pcm_ladspa_t *ladspa, unsigned int index)
+{
+	unsigned int idx;
+
+	for (idx = ladspa->job_first + index; idx < ladspa->job_end;
+	     idx += ladspa->threads + 1)
+		snd_pcm_ladspa_run(ladspa->run_list[idx],
+				   ladspa->job_in, ladspa->job_in_offset,
+				   ladspa->job_out, ladspa->job_out_offset,
+				   ladspa->job_size);
+}
+
+static void *snd_pcm_ladspa_worker(void *data)
+{
+	snd_pcm_ladspa_worker_t *worker = data;
+	snd_pcm_ladspa_t *ladspa = worker->ladspa;
+
+	for (;;) {
+		while (sem_wait(&worker->request) < 0 && errno == EINTR)
+			;
+		if (ladspa->quit)
+			break;
+		snd_pcm_ladspa_run_share(ladspa, worker->index);
+		sem_post(&ladspa->done);
+	}
+	return NULL;
+}
+
+static void snd_pcm_ladspa_workers_stop(snd_pcm_ladspa_t *ladspa)
+{
+	unsigned int idx;
+
+	if (ladspa->workers == NULL)
+		return;
+	ladspa->quit = 1;
+	for (idx = 0; idx < ladspa->threads; idx++)
+		sem_post(&ladspa->workers[idx].request);
+	for (idx = 0; idx < ladspa->threads; idx++) {
+		pthread_join(ladspa->workers[idx].thread, NULL);
+		sem_destroy(&ladspa->workers[idx].request);
+	}
+	sem_destroy(&ladspa->done);
+	free(ladspa->workers);
+	ladspa->workers = NULL;
+}
+
+/* pin the worker to its own CPU and give it a real-time priority */
+static void snd_pcm_ladspa_worker_setup(snd_pcm_ladspa_t *ladspa,
+					snd_pcm_ladspa_worker_t *worker)
+{
+#ifdef __linux__
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 1) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->index % cpus, &set);
+		pthread_setaffinity_np(worker->thread, sizeof(set), &set);
+	}
+#endif
+	if (ladspa->thread_priority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = ladspa->thread_priority;
+		if (pthread_setschedparam(worker->thread, SCHED_FIFO, &param))
+			SNDERR("cannot set the real-time priority of the LADSPA worker %u",
+			       worker->index);
+	}
+}
+
+static int snd_pcm_ladspa_workers_start(snd_pcm_ladspa_t *ladspa)
+{
+	unsigned int idx;
+	int err;
+
+	if (ladspa->threads == 0 || ladspa->workers)
+		return 0;
+	ladspa->workers = calloc(ladspa->threads, sizeof(*ladspa->workers));
+	if (ladspa->workers == NULL)
+		return -ENOMEM;
+	if (sem_init(&ladspa->done, 0, 0) < 0) {
+		err = -errno;
+		free(ladspa->workers);
+		ladspa->workers = NULL;
+		return err;
+	}
+	ladspa->quit = 0;
+	for (idx = 0; idx < ladspa->threads; idx++) {
+		snd_pcm_ladspa_worker_t *worker = &ladspa->workers[idx];
+		worker->index = idx + 1;
+		worker->ladspa = ladspa;
+		if (sem_init(&worker->request, 0, 0) < 0) {
+			err = -errno;
+			goto _err;
+		}
+		err = pthread_create(&worker->thread, NULL, snd_pcm_ladspa_worker, worker);
+		if (err) {
+			SNDERR("cannot create the LADSPA worker thread");
+			sem_destroy(&worker->request);
+			err = -err;
+			goto _err;
+		}
+		snd_pcm_ladspa_worker_setup(ladspa, worker);
+	}
+	return 0;
+
+ _err:
+	ladspa->quit = 1;
+	while (idx-- > 0) {
+		sem_post(&ladspa->workers[idx].request);
+		pthread_join(ladspa->workers[idx].thread, NULL);
+		sem_destroy(&ladspa->workers[idx].request);
+	}
+	sem_destroy(&ladspa->done);
+	free(ladspa->workers);
+	ladspa->workers = NULL;
+	return err;
+}
+#else
+#define snd_pcm_ladspa_workers_stop(ladspa)	do { } while (0)
+#endif /* HAVE_LIBPTHREAD */
+
+/*
+ * Run the chain depth by depth.  The instances of one depth touch
+ * distinct channels and buffers, so with the workers running they are
+ * spread over the workers and the caller, with a barrier per depth.
+ */
+static void snd_pcm_ladspa_process(snd_pcm_ladspa_t *ladspa,
+				   const snd_pcm_channel_area_t *in_areas,
+				   snd_pcm_uframes_t in_offset,
+				   const snd_pcm_channel_area_t *out_areas,
+				   snd_pcm_uframes_t out_offset,
+				   snd_pcm_uframes_t size)
+{
+	snd_pcm_uframes_t size1;
+	unsigned int depth, idx, first, end;
+
+	while (size > 0) {
+		size1 = size;
+		if (size1 > ladspa->allocated)
+			size1 = ladspa->allocated;
+		for (depth = 0; depth < ladspa->depths; depth++) {
+			first = ladspa->depth_start[depth];
+			end = ladspa->depth_start[depth + 1];
+#ifdef HAVE_LIBPTHREAD
+			if (ladspa->workers && end - first > 1 &&
+			    size1 >= ladspa->thread_min) {
+				unsigned int posted = end - first - 1;
+				if (posted > ladspa->threads)
+					posted = ladspa->threads;
+				ladspa->job_in = in_areas;
+				ladspa->job_in_offset = in_offset;
+				ladspa->job_out = out_areas;
+				ladspa->job_out_offset = out_offset;
+				ladspa->job_size = size1;
+				ladspa->job_first = first;
+				ladspa->job_end = end;
+				for (idx = 0; idx < posted; idx++)
+					sem_post(&ladspa->workers[idx].request);
+				snd_pcm_ladspa_run_share(ladspa, 0);
+				for (idx = 0; idx < posted; idx++) {
+					while (sem_wait(&ladspa->done) < 0 && errno == EINTR)
+						;
+				}
+				continue;
+			}
+#endif
+			for (idx = first; idx < end; idx++)
+				snd_pcm_ladspa_run(ladspa->run_list[idx],
+						   in_areas, in_offset,
+						   out_areas, out_offset, size1);
+		}
+		in_offset += size1;
+		out_offset += size1;
+		size -= size1;
+	}
+}
+
 static int snd_pcm_ladspa_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
 
+	snd_pcm_ladspa_workers_stop(ladspa);
 	snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 	return snd_pcm_generic_hw_free(pcm);
 }
 
+/* processing time statistics, reported by dump */
+static void snd_pcm_ladspa_account(snd_pcm_t *pcm, const snd_htimestamp_t *t0,
+				   snd_pcm_uframes_t frames)
+{
+	snd_pcm_ladspa_t *ladspa = pcm->private_data;
+	snd_htimestamp_t t1;
+	long long ns;
+	double load;
+
+	if (frames == 0)
+		return;
+	gettimestamp(&t1, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	ns = (t1.tv_sec - t0->tv_sec) * 1000000000LL + t1.tv_nsec - t0->tv_nsec;
+	if (ns < 0)
+		ns = 0;
+	ladspa->dsp_time += ns;
+	ladspa->dsp_frames += frames;
+	/* share of the real time the frames stand for */
+	load = ns * 1e-9 * pcm->rate / frames;
+	if (load > ladspa->dsp_peak)
+		ladspa->dsp_peak = load;
+}
+
 static snd_pcm_uframes_t
 snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 			   const snd_pcm_channel_area_t *areas,
@@ -857,55 +1260,22 @@ snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 			   snd_pcm_uframes_t *slave_sizep)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
-	snd_pcm_ladspa_instance_t *instance;
-	struct list_head *pos, *pos1;
-	LADSPA_Data *data;
-	unsigned int idx, chn, size1, size2;
-	
+	snd_htimestamp_t t0;
+
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-        size2 = size;
+	gettimestamp(&t0, SND_PCM_TSTAMP_TYPE_MONOTONIC);
 #if 0	/* no processing - for testing purposes only */
 	snd_pcm_areas_copy(slave_areas, slave_offset,
 			   areas, offset,
 			   pcm->channels, size, pcm->format);
 #else
-        while (size > 0) {
-                size1 = size;
-                if (size1 > ladspa->allocated)
-                        size1 = ladspa->allocated;
-        	list_for_each(pos, &ladspa->pplugins) {
-        		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-        		list_for_each(pos1, &plugin->instances) {
-        			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-        			for (idx = 0; idx < instance->input.channels.size; idx++) {
-                                        chn = instance->input.channels.array[idx];
-                                        data = instance->input.data[idx];
-                                        if (data == NULL) {
-                                		data = (LADSPA_Data *)((char *)areas[chn].addr + (areas[chn].first / 8));
-                                       		data += offset;
-                                        }
-                                        instance->desc->connect_port(instance->handle, instance->input.ports.array[idx], data);
-        			}
-        			for (idx = 0; idx < instance->output.channels.size; idx++) {
-                                        chn = instance->output.channels.array[idx];
-                                        data = instance->output.data[idx];
-                                        if (data == NULL) {
-                                		data = (LADSPA_Data *)((char *)slave_areas[chn].addr + (areas[chn].first / 8));
-                                		data += slave_offset;
-                                        }
-					instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
-        			}
-        			instance->desc->run(instance->handle, size1);
-        		}
-        	}
-        	offset += size1;
-        	slave_offset += size1;
-        	size -= size1;
-	}
+	snd_pcm_ladspa_process(ladspa, areas, offset,
+			       slave_areas, slave_offset, size);
 #endif
-	*slave_sizep = size2;
-	return size2;
+	snd_pcm_ladspa_account(pcm, &t0, size);
+	*slave_sizep = size;
+	return size;
 }
 
 static snd_pcm_uframes_t
@@ -918,55 +1288,22 @@ snd_pcm_ladspa_read_areas(snd_pcm_t *pcm,
 			  snd_pcm_uframes_t *slave_sizep)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
-	snd_pcm_ladspa_instance_t *instance;
-	struct list_head *pos, *pos1;
-	LADSPA_Data *data;
-	unsigned int idx, chn, size1, size2;;
+	snd_htimestamp_t t0;
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-        size2 = size;
+	gettimestamp(&t0, SND_PCM_TSTAMP_TYPE_MONOTONIC);
 #if 0	/* no processing - for testing purposes only */
 	snd_pcm_areas_copy(areas, offset,
 			   slave_areas, slave_offset,
 			   pcm->channels, size, pcm->format);
 #else
-        while (size > 0) {
-                size1 = size;
-                if (size1 > ladspa->allocated)
-                        size1 = ladspa->allocated;
-        	list_for_each(pos, &ladspa->cplugins) {
-        		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-        		list_for_each(pos1, &plugin->instances) {
-        			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-        			for (idx = 0; idx < instance->input.channels.size; idx++) {
-                                        chn = instance->input.channels.array[idx];
-                                        data = instance->input.data[idx];
-                                        if (data == NULL) {
-                                		data = (LADSPA_Data *)((char *)slave_areas[chn].addr + (areas[chn].first / 8));
-                                		data += slave_offset;
-                                        }	
-                			instance->desc->connect_port(instance->handle, instance->input.ports.array[idx], data);
-        			}
-        			for (idx = 0; idx < instance->output.channels.size; idx++) {
-                                        chn = instance->output.channels.array[idx];
-                                        data = instance->output.data[idx];
-                                        if (data == NULL) {
-                                		data = (LADSPA_Data *)((char *)areas[chn].addr + (areas[chn].first / 8));
-                                       		data += offset;
-                                        }
-        		        	instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
-        			}
-        			instance->desc->run(instance->handle, size1);
-        		}
-        	}
-        	offset += size1;
-        	slave_offset += size1;
-        	size -= size1;
-	}
+	snd_pcm_ladspa_process(ladspa, slave_areas, slave_offset,
+			       areas, offset, size);
 #endif
-	*slave_sizep = size2;
-	return size2;
+	snd_pcm_ladspa_account(pcm, &t0, size);
+	*slave_sizep = size;
+	return size;
 }
 
 static void snd_pcm_ladspa_dump_direction(snd_pcm_ladspa_plugin_t *plugin,
@@ -1058,6 +1395,21 @@ static void snd_pcm_ladspa_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_output_printf(out, "  Capture:\n");
 	snd_pcm_ladspa_plugins_dump(&ladspa->cplugins, out);
 	if (pcm->setup) {
+		snd_output_printf(out, "  Buffers: %u x %u samples\n",
+				  ladspa->pool_count, ladspa->allocated);
+		if (ladspa->threads > 0)
+			snd_output_printf(out, "  Threads: %u workers, from %u frames, "
+					  "priority %d\n", ladspa->threads,
+					  ladspa->thread_min, ladspa->thread_priority);
+		if (ladspa->dsp_frames > 0) {
+			double per_period = (double)ladspa->dsp_time / ladspa->dsp_frames *
+					    pcm->period_size / 1000;
+			snd_output_printf(out, "  DSP time: %.1f us per period "
+					  "(%.2f%% load, peak %.2f%%), %llu frames\n",
+					  per_period,
+					  per_period * 1e-4 * pcm->rate / pcm->period_size,
+					  ladspa->dsp_peak * 100, ladspa->dsp_frames);
+		}
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
 	}
@@ -1684,6 +2036,9 @@ pcm.name {
         }
         [channels INT]		# count input channels (input to LADSPA plugin chain)
 	[path STR]		# Path (directory) with LADSPA plugins
+	[threads INT]		# Worker threads running the chain (default 0)
+	[thread_min INT]	# Smallest run in frames for the workers (default 128)
+	[thread_priority INT]	# SCHED_FIFO priority of the workers (default 0)
 	plugins |		# Definition for both directions
         playback_plugins |	# Definition for playback direction
 	capture_plugins {	# Definition for capture direction
@@ -1708,6 +2063,21 @@ pcm.name {
 }
 \endcode
 
+The chain runs on float buffers of one period, aligned to 64 bytes.  A
+buffer is reused as soon as no later plugin reads it, and plugins which
+don't declare LADSPA_PROPERTY_INPLACE_BROKEN write their output in place
+over their input.  The dump of the PCM shows the count of these buffers
+and the time spent in the plugins per period, so the DSP budget of the
+chain can be checked.
+
+With \c threads set, the instances of one plugin in the chain (e.g. the
+per channel instances of the \c duplicate policy) are spread over that
+many worker threads and the calling thread, with a barrier before the
+next plugin.  The workers are pinned to separate CPUs and, with
+\c thread_priority, run with SCHED_FIFO if permitted.  Runs shorter
+than \c thread_min frames are processed serially, as the wakeup of the
+workers would cost more than it saves.
+
 \subsection pcm_plugins_ladspa_funcref Function reference
 
 <UL>
@@ -1740,7 +2110,9 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	snd_config_t *slave = NULL, *sconf;
 	const char *path = NULL;
 	long channels = 0;
+	long threads = 0, thread_min = 128, thread_priority = 0;
 	snd_config_t *plugins = NULL, *pplugins = NULL, *cplugins = NULL;
+	snd_pcm_ladspa_t *ladspa;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1764,6 +2136,36 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
                                 channels = 0;
 			continue;
 		}
+		if (strcmp(id, "threads") == 0) {
+			err = snd_config_get_integer(n, &threads);
+			if (err < 0 || threads < 0 || threads > 64) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+#ifndef HAVE_LIBPTHREAD
+			if (threads > 0) {
+				SNDERR("The worker threads need pthread support");
+				return -EINVAL;
+			}
+#endif
+			continue;
+		}
+		if (strcmp(id, "thread_min") == 0) {
+			err = snd_config_get_integer(n, &thread_min);
+			if (err < 0 || thread_min < 0) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "thread_priority") == 0) {
+			err = snd_config_get_integer(n, &thread_priority);
+			if (err < 0 || thread_priority < 0 || thread_priority > 99) {
+				SNDERR("Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "plugins") == 0) {
 			plugins = n;
 			continue;
@@ -1799,9 +2201,15 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	err = snd_pcm_ladspa_open(pcmp, name, path, channels, pplugins, cplugins, spcm, 1);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	ladspa = (*pcmp)->private_data;
+	ladspa->threads = threads;
+	ladspa->thread_min = thread_min;
+	ladspa->thread_priority = thread_priority;
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_ladspa_open, SND_PCM_DLSYM_VERSION);
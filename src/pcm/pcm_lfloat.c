@@ -41,11 +41,25 @@ typedef double double_t;
 #define BUGGY_GCC
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LFLOAT_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifndef PIC
 /* entry for static linking */
 const char *_snd_module_pcm_lfloat = "";
 #endif
 
+/*
+ * conversion of contiguous native endian samples, steps are in bytes;
+ * seed is the TPDF dither generator state (one word per vector lane)
+ */
+typedef void (*snd_pcm_lfloat_kernel_t)(char *dst, int dst_step,
+					const char *src, int src_step,
+					snd_pcm_uframes_t samples,
+					uint32_t *seed);
+
 typedef struct {
 	/* This field need to be the first */
 	snd_pcm_plugin_t plug;
@@ -56,6 +70,9 @@ typedef struct {
 		     const snd_pcm_channel_area_t *src_areas, snd_pcm_uframes_t src_offset,
 		     unsigned int channels, snd_pcm_uframes_t frames,
 		     unsigned int get32idx, unsigned int put32floatidx);
+	snd_pcm_lfloat_kernel_t kernel;	/* NULL = label based func */
+	int dither;
+	uint32_t seed[4];
 } snd_pcm_lfloat_t;
 
 int snd_pcm_lfloat_get_s32_index(snd_pcm_format_t format)
@@ -183,8 +200,349 @@ void snd_pcm_lfloat_convert_float_integer(const snd_pcm_channel_area_t *dst_area
 	}
 }
 
+/*
+ * Native endian S16/S24/S32 <-> FLOAT/FLOAT64 kernels.  Without dither
+ * they give exactly the results of the label conversions above: the
+ * integer sample is left aligned to 32 bits and scaled by 2^-31 (exact,
+ * so equal to the division), the float sample is saturated to the
+ * [-1.0, 1.0) range and truncated.  With dither, a triangular (TPDF)
+ * noise of +-1 LSB of the 16 or 24 bit destination is added before the
+ * sample is rounded to the nearest integer.
+ */
+
+#define LFLOAT_SCALE	(1.0 / 0x80000000UL)
+
+/* xorshift32 */
+static inline uint32_t lfloat_random(uint32_t *seed)
+{
+	uint32_t x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+	return x;
+}
+
+/* sum of two uniform 16 bit values, -1.0 < result < 1.0 */
+static inline double lfloat_tpdf(uint32_t *seed)
+{
+	uint32_t x = lfloat_random(seed);
+
+	return ((int)(x & 0xffff) + (int)(x >> 16) - 0xffff) * (1.0 / 0x10000);
+}
+
+/* the same as get32f_1234F_1234 and get32f_1234D_1234 */
+static inline int32_t lfloat_saturate(double f)
+{
+	if (f >= 1.0)
+		return 0x7fffffff;
+	if (f <= -1.0)
+		return (int32_t)0x80000000;
+	return (int32_t)(f * 0x80000000UL);
+}
+
+/* returns the dithered sample of the given width, right aligned */
+static inline int32_t lfloat_dither(double f, unsigned int width,
+				    uint32_t *seed)
+{
+	double max = 1 << (width - 1);
+	double x = f * max + lfloat_tpdf(seed);
+
+	if (!(x >= -max))
+		x = -max;
+	else if (x > max - 1)
+		x = max - 1;
+	/* moved to positive values, so the truncation rounds to nearest */
+	return (int32_t)(x + max + 0.5) - (int32_t)max;
+}
+
+#define LFLOAT_TO_FLOAT(name, itype, shift, ftype) \
+static void name(char *dst, int dst_step, const char *src, int src_step, \
+		 snd_pcm_uframes_t samples, uint32_t *seed ATTRIBUTE_UNUSED) \
+{ \
+	for (; samples > 0; samples--, src += src_step, dst += dst_step) \
+		*(ftype *)dst = (ftype)(int32_t)((uint32_t)*(const itype *)src << shift) * \
+				(ftype)LFLOAT_SCALE; \
+}
+
+#define LFLOAT_FROM_FLOAT(name, ftype, itype, shift) \
+static void name(char *dst, int dst_step, const char *src, int src_step, \
+		 snd_pcm_uframes_t samples, uint32_t *seed ATTRIBUTE_UNUSED) \
+{ \
+	for (; samples > 0; samples--, src += src_step, dst += dst_step) \
+		*(itype *)dst = lfloat_saturate(*(const ftype *)src) >> shift; \
+}
+
+#define LFLOAT_FROM_FLOAT_DITHER(name, ftype, itype, width) \
+static void name(char *dst, int dst_step, const char *src, int src_step, \
+		 snd_pcm_uframes_t samples, uint32_t *seed) \
+{ \
+	for (; samples > 0; samples--, src += src_step, dst += dst_step) \
+		*(itype *)dst = lfloat_dither(*(const ftype *)src, width, seed); \
+}
+
+LFLOAT_TO_FLOAT(lfloat_s16_float, int16_t, 16, float_t)
+LFLOAT_TO_FLOAT(lfloat_s24_float, uint32_t, 8, float_t)
+LFLOAT_TO_FLOAT(lfloat_s32_float, uint32_t, 0, float_t)
+LFLOAT_TO_FLOAT(lfloat_s16_double, int16_t, 16, double_t)
+LFLOAT_TO_FLOAT(lfloat_s24_double, uint32_t, 8, double_t)
+LFLOAT_TO_FLOAT(lfloat_s32_double, uint32_t, 0, double_t)
+LFLOAT_FROM_FLOAT(lfloat_float_s16, float_t, int16_t, 16)
+LFLOAT_FROM_FLOAT(lfloat_float_s24, float_t, int32_t, 8)
+LFLOAT_FROM_FLOAT(lfloat_float_s32, float_t, int32_t, 0)
+LFLOAT_FROM_FLOAT(lfloat_double_s16, double_t, int16_t, 16)
+LFLOAT_FROM_FLOAT(lfloat_double_s24, double_t, int32_t, 8)
+LFLOAT_FROM_FLOAT(lfloat_double_s32, double_t, int32_t, 0)
+LFLOAT_FROM_FLOAT_DITHER(lfloat_float_s16_dither, float_t, int16_t, 16)
+LFLOAT_FROM_FLOAT_DITHER(lfloat_float_s24_dither, float_t, int32_t, 24)
+LFLOAT_FROM_FLOAT_DITHER(lfloat_double_s16_dither, double_t, int16_t, 16)
+LFLOAT_FROM_FLOAT_DITHER(lfloat_double_s24_dither, double_t, int32_t, 24)
+
+#ifdef LFLOAT_SSE2
+
+/*
+ * SSE2 versions of the FLOAT kernels; the vector loop runs only for
+ * contiguous samples, the rest is passed to the kernels above
+ */
+
+static inline __m128 sse2_s32_float(__m128i sample)
+{
+	return _mm_mul_ps(_mm_cvtepi32_ps(sample), _mm_set1_ps(LFLOAT_SCALE));
+}
+
+static inline __m128i sse2_float_s32(__m128 f)
+{
+	__m128i sample = _mm_cvttps_epi32(_mm_mul_ps(f, _mm_set1_ps(0x80000000UL)));
+
+	/* the overflow (f >= 1.0) gives 0x80000000, turn it to 0x7fffffff */
+	return _mm_xor_si128(sample,
+			     _mm_castps_si128(_mm_cmpge_ps(f, _mm_set1_ps(1.0f))));
+}
+
+/* four lanes of lfloat_tpdf() */
+static inline __m128 sse2_tpdf(__m128i *seed)
+{
+	__m128i x = *seed;
+
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	*seed = x;
+	x = _mm_add_epi32(_mm_and_si128(x, _mm_set1_epi32(0xffff)),
+			  _mm_srli_epi32(x, 16));
+	x = _mm_sub_epi32(x, _mm_set1_epi32(0xffff));
+	return _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / 0x10000));
+}
+
+/*
+ * 16 bit dithered sample, right aligned.  The steps of lfloat_dither(),
+ * but in single precision: the sum with the dither is rounded to 24 bits,
+ * so a sample may come out 1 LSB off the scalar (double) result, still
+ * within the dither range.
+ */
+static inline __m128i sse2_float_s16_dither(__m128 f, __m128i *seed)
+{
+	const __m128 max = _mm_set1_ps(32768.0f);
+	__m128 x = _mm_add_ps(_mm_mul_ps(f, max), sse2_tpdf(seed));
+
+	/* NaN gives the second operand of maxps, i.e. -max */
+	x = _mm_max_ps(x, _mm_set1_ps(-32768.0f));
+	x = _mm_min_ps(x, _mm_set1_ps(32767.0f));
+	x = _mm_add_ps(x, _mm_set1_ps(32768.5f));
+	return _mm_sub_epi32(_mm_cvttps_epi32(x), _mm_set1_epi32(32768));
+}
+
+static void lfloat_s16_float_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 2 && dst_step == 4) {
+		const __m128i zero = _mm_setzero_si128();
+		for (; samples >= 8; samples -= 8, src += 16, dst += 32) {
+			__m128i s = _mm_loadu_si128((const __m128i *)src);
+			/* 16h -> 32h is sample << 16 */
+			_mm_storeu_ps((float *)dst,
+				      sse2_s32_float(_mm_unpacklo_epi16(zero, s)));
+			_mm_storeu_ps((float *)dst + 4,
+				      sse2_s32_float(_mm_unpackhi_epi16(zero, s)));
+		}
+	}
+	lfloat_s16_float(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_s24_float_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 4) {
+		for (; samples >= 4; samples -= 4, src += 16, dst += 16) {
+			__m128i s = _mm_loadu_si128((const __m128i *)src);
+			_mm_storeu_ps((float *)dst,
+				      sse2_s32_float(_mm_slli_epi32(s, 8)));
+		}
+	}
+	lfloat_s24_float(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_s32_float_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 4) {
+		for (; samples >= 4; samples -= 4, src += 16, dst += 16) {
+			__m128i s = _mm_loadu_si128((const __m128i *)src);
+			_mm_storeu_ps((float *)dst, sse2_s32_float(s));
+		}
+	}
+	lfloat_s32_float(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_float_s16_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 2) {
+		for (; samples >= 8; samples -= 8, src += 32, dst += 16) {
+			__m128i lo = sse2_float_s32(_mm_loadu_ps((const float *)src));
+			__m128i hi = sse2_float_s32(_mm_loadu_ps((const float *)src + 4));
+			lo = _mm_srai_epi32(lo, 16);
+			hi = _mm_srai_epi32(hi, 16);
+			_mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(lo, hi));
+		}
+	}
+	lfloat_float_s16(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_float_s24_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 4) {
+		for (; samples >= 4; samples -= 4, src += 16, dst += 16) {
+			__m128i s = sse2_float_s32(_mm_loadu_ps((const float *)src));
+			_mm_storeu_si128((__m128i *)dst, _mm_srai_epi32(s, 8));
+		}
+	}
+	lfloat_float_s24(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_float_s32_sse2(char *dst, int dst_step,
+				  const char *src, int src_step,
+				  snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 4) {
+		for (; samples >= 4; samples -= 4, src += 16, dst += 16) {
+			__m128i s = sse2_float_s32(_mm_loadu_ps((const float *)src));
+			_mm_storeu_si128((__m128i *)dst, s);
+		}
+	}
+	lfloat_float_s32(dst, dst_step, src, src_step, samples, seed);
+}
+
+static void lfloat_float_s16_dither_sse2(char *dst, int dst_step,
+					 const char *src, int src_step,
+					 snd_pcm_uframes_t samples, uint32_t *seed)
+{
+	if (src_step == 4 && dst_step == 2 && samples >= 8) {
+		__m128i state = _mm_loadu_si128((const __m128i *)seed);
+		for (; samples >= 8; samples -= 8, src += 32, dst += 16) {
+			__m128 lo = _mm_loadu_ps((const float *)src);
+			__m128 hi = _mm_loadu_ps((const float *)src + 4);
+			_mm_storeu_si128((__m128i *)dst,
+					 _mm_packs_epi32(sse2_float_s16_dither(lo, &state),
+							 sse2_float_s16_dither(hi, &state)));
+		}
+		_mm_storeu_si128((__m128i *)seed, state);
+	}
+	lfloat_float_s16_dither(dst, dst_step, src, src_step, samples, seed);
+}
+
+#define LFLOAT_FAST(name)	name##_sse2
+#else
+#define LFLOAT_FAST(name)	name
+#endif /* LFLOAT_SSE2 */
+
+static const struct {
+	snd_pcm_format_t src_format;
+	snd_pcm_format_t dst_format;
+	int dither;
+	snd_pcm_lfloat_kernel_t kernel;
+} lfloat_kernels[] = {
+	{ SND_PCM_FORMAT_S16, SND_PCM_FORMAT_FLOAT, 0, LFLOAT_FAST(lfloat_s16_float) },
+	{ SND_PCM_FORMAT_S24, SND_PCM_FORMAT_FLOAT, 0, LFLOAT_FAST(lfloat_s24_float) },
+	{ SND_PCM_FORMAT_S32, SND_PCM_FORMAT_FLOAT, 0, LFLOAT_FAST(lfloat_s32_float) },
+	{ SND_PCM_FORMAT_S16, SND_PCM_FORMAT_FLOAT64, 0, lfloat_s16_double },
+	{ SND_PCM_FORMAT_S24, SND_PCM_FORMAT_FLOAT64, 0, lfloat_s24_double },
+	{ SND_PCM_FORMAT_S32, SND_PCM_FORMAT_FLOAT64, 0, lfloat_s32_double },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S16, 0, LFLOAT_FAST(lfloat_float_s16) },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S24, 0, LFLOAT_FAST(lfloat_float_s24) },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32, 0, LFLOAT_FAST(lfloat_float_s32) },
+	{ SND_PCM_FORMAT_FLOAT64, SND_PCM_FORMAT_S16, 0, lfloat_double_s16 },
+	{ SND_PCM_FORMAT_FLOAT64, SND_PCM_FORMAT_S24, 0, lfloat_double_s24 },
+	{ SND_PCM_FORMAT_FLOAT64, SND_PCM_FORMAT_S32, 0, lfloat_double_s32 },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S16, 1, LFLOAT_FAST(lfloat_float_s16_dither) },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S24, 1, lfloat_float_s24_dither },
+	{ SND_PCM_FORMAT_FLOAT64, SND_PCM_FORMAT_S16, 1, lfloat_double_s16_dither },
+	{ SND_PCM_FORMAT_FLOAT64, SND_PCM_FORMAT_S24, 1, lfloat_double_s24_dither },
+};
+
+/* NULL when there is no kernel for the formats; dither is ignored for S32 */
+static snd_pcm_lfloat_kernel_t snd_pcm_lfloat_kernel(snd_pcm_format_t src_format,
+						      snd_pcm_format_t dst_format,
+						      int dither)
+{
+	unsigned int k;
+
+	if (snd_pcm_format_width(dst_format) == 32)
+		dither = 0;
+	for (k = 0; k < sizeof(lfloat_kernels) / sizeof(lfloat_kernels[0]); k++) {
+		if (lfloat_kernels[k].src_format == src_format &&
+		    lfloat_kernels[k].dst_format == dst_format &&
+		    lfloat_kernels[k].dither == !!dither)
+			return lfloat_kernels[k].kernel;
+	}
+	return NULL;
+}
+
 #endif /* DOC_HIDDEN */
 
+static void snd_pcm_lfloat_convert(snd_pcm_lfloat_t *lfloat,
+				   const snd_pcm_channel_area_t *dst_areas,
+				   snd_pcm_uframes_t dst_offset,
+				   const snd_pcm_channel_area_t *src_areas,
+				   snd_pcm_uframes_t src_offset,
+				   unsigned int channels, snd_pcm_uframes_t frames)
+{
+	snd_pcm_channel_area_t dst_all, src_all;
+	unsigned int channel;
+
+	if (!lfloat->kernel) {
+		lfloat->func(dst_areas, dst_offset, src_areas, src_offset,
+			     channels, frames,
+			     lfloat->int32_idx, lfloat->float32_idx);
+		return;
+	}
+	if (snd_pcm_area_collapse(&dst_all, dst_areas, channels) &&
+	    snd_pcm_area_collapse(&src_all, src_areas, channels)) {
+		dst_areas = &dst_all;
+		src_areas = &src_all;
+		dst_offset *= channels;
+		src_offset *= channels;
+		frames *= channels;
+		channels = 1;
+	}
+	for (channel = 0; channel < channels; ++channel) {
+		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
+		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
+		lfloat->kernel(snd_pcm_channel_area_addr(dst_area, dst_offset),
+			       snd_pcm_channel_area_step(dst_area),
+			       snd_pcm_channel_area_addr(src_area, src_offset),
+			       snd_pcm_channel_area_step(src_area),
+			       frames, lfloat->seed);
+	}
+}
+
 static int snd_pcm_lfloat_hw_refine_cprepare(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 {
 	snd_pcm_lfloat_t *lfloat = pcm->private_data;
@@ -294,6 +652,8 @@ static int snd_pcm_lfloat_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		lfloat->float32_idx = snd_pcm_lfloat_get_s32_index(src_format);
 		lfloat->func = snd_pcm_lfloat_convert_float_integer;
 	}
+	lfloat->kernel = snd_pcm_lfloat_kernel(src_format, dst_format,
+					       lfloat->dither);
 	return 0;
 }
 
@@ -309,10 +669,9 @@ snd_pcm_lfloat_write_areas(snd_pcm_t *pcm,
 	snd_pcm_lfloat_t *lfloat = pcm->private_data;
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	lfloat->func(slave_areas, slave_offset,
-		     areas, offset, 
-		     pcm->channels, size,
-		     lfloat->int32_idx, lfloat->float32_idx);
+	snd_pcm_lfloat_convert(lfloat, slave_areas, slave_offset,
+			       areas, offset,
+			       pcm->channels, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -329,10 +688,9 @@ snd_pcm_lfloat_read_areas(snd_pcm_t *pcm,
 	snd_pcm_lfloat_t *lfloat = pcm->private_data;
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	lfloat->func(areas, offset, 
-		     slave_areas, slave_offset,
-		     pcm->channels, size,
-		     lfloat->int32_idx, lfloat->float32_idx);
+	snd_pcm_lfloat_convert(lfloat, areas, offset,
+			       slave_areas, slave_offset,
+			       pcm->channels, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -342,6 +700,8 @@ static void snd_pcm_lfloat_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_pcm_lfloat_t *lfloat = pcm->private_data;
 	snd_output_printf(out, "Linear Integer <-> Linear Float conversion PCM (%s)\n", 
 		snd_pcm_format_name(lfloat->sformat));
+	if (lfloat->dither)
+		snd_output_printf(out, "  TPDF dither\n");
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -395,6 +755,11 @@ int snd_pcm_lfloat_open(snd_pcm_t **pcmp, const char *name, snd_pcm_format_t sfo
 	}
 	snd_pcm_plugin_init(&lfloat->plug);
 	lfloat->sformat = sformat;
+	/* any non-zero xorshift state */
+	lfloat->seed[0] = 0x2545f491;
+	lfloat->seed[1] = 0x9e3779b9;
+	lfloat->seed[2] = 0x6c078965;
+	lfloat->seed[3] = 0x5851f42d;
 	lfloat->plug.read = snd_pcm_lfloat_read_areas;
 	lfloat->plug.write = snd_pcm_lfloat_write_areas;
 	lfloat->plug.undo_read = snd_pcm_plugin_undo_read_generic;
@@ -439,9 +804,18 @@ pcm.name {
                 pcm { }         # Slave PCM definition
                 format STR      # Slave format
         }
+        [dither BOOL]           # TPDF dither for float -> 16/24 bit
+                                # conversion (default false)
 }
 \endcode
 
+Native endian S16, S24 and S32 samples are converted from and to native
+endian FLOAT and FLOAT64 samples by dedicated (vectorized where available)
+loops; the other formats use the generic conversion.  The float samples
+are saturated to the -1.0 .. 1.0 range.  When \c dither is set, a
+triangular noise of +-1 LSB is added to the float samples converted to
+native endian S16 or S24 and the result is rounded instead of truncated.
+
 \subsection pcm_plugins_lfloat_funcref Function reference
 
 <UL>
@@ -473,6 +847,7 @@ int _snd_pcm_lfloat_open(snd_pcm_t **pcmp, const char *name,
 	snd_pcm_t *spcm;
 	snd_config_t *slave = NULL, *sconf;
 	snd_pcm_format_t sformat;
+	int dither = 0;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -484,6 +859,13 @@ int _snd_pcm_lfloat_open(snd_pcm_t **pcmp, const char *name,
 			slave = n;
 			continue;
 		}
+		if (strcmp(id, "dither") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			dither = err;
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -506,9 +888,12 @@ int _snd_pcm_lfloat_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	err = snd_pcm_lfloat_open(pcmp, name, sformat, spcm, 1);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	((snd_pcm_lfloat_t *)(*pcmp)->private_data)->dither = dither;
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_lfloat_open, SND_PCM_DLSYM_VERSION);
@@ -185,6 +185,7 @@ typedef struct {
 	int (*poll_revents)(snd_pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents); /* locked */
 	int (*may_wait_for_avail_min)(snd_pcm_t *pcm, snd_pcm_uframes_t avail);
 	int (*mmap_begin)(snd_pcm_t *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames); /* locked */
+	snd_pcm_sframes_t (*mmap_commit_avail)(snd_pcm_t *pcm, snd_pcm_uframes_t offset, snd_pcm_uframes_t size, snd_pcm_sframes_t *availp); /* locked */
 } snd_pcm_fast_ops_t;
 
 struct _snd_pcm {
@@ -237,6 +238,12 @@ struct _snd_pcm {
 					 */
 	unsigned int donot_close: 1;	/* don't close this PCM */
 	unsigned int own_state_check:1; /* plugin has own PCM state check */
+	unsigned int refine_volatile:1;	/* hw_refine depends on outside state,
+					 * don't cache it (see pcm_params.c)
+					 */
+	unsigned int refine_nocache:1;	/* $LIBASOUND_REFINE_CACHE=0 */
+	unsigned int refine_passes:1;	/* $LIBASOUND_REFINE_ENGINE=passes */
+	struct snd_pcm_refine_cache *refine_cache;
 	snd_pcm_channel_info_t *mmap_channels;
 	snd_pcm_channel_area_t *running_areas;
 	snd_pcm_channel_area_t *stopped_areas;
@@ -284,6 +291,12 @@ struct _snd_pcm {
 	snd1_pcm_wait_nocheck
 #define snd_pcm_rate_get_default_converter \
 	snd1_pcm_rate_get_default_converter
+#define snd_pcm_rate_set_native_sformat \
+	snd1_pcm_rate_set_native_sformat
+#define snd_pcm_rate_sinc_open \
+	snd1_pcm_rate_sinc_open
+#define snd_pcm_areas_transpose \
+	snd1_pcm_areas_transpose
 #define snd_pcm_set_hw_ptr \
 	snd1_pcm_set_hw_ptr
 #define snd_pcm_set_appl_ptr \
@@ -320,6 +333,10 @@ struct _snd_pcm {
 	snd1_pcm_hw_refine_soft
 #define snd_pcm_hw_refine_slave \
 	snd1_pcm_hw_refine_slave
+#define snd_pcm_hw_refine_invalidate \
+	snd1_pcm_hw_refine_invalidate
+#define snd_pcm_hw_refine_cache_free \
+	snd1_pcm_hw_refine_cache_free
 #define snd_pcm_hw_params_slave \
 	snd1_pcm_hw_params_slave
 #define snd_pcm_hw_param_refine_near \
@@ -371,6 +388,12 @@ int snd_pcm_free(snd_pcm_t *pcm);
 
 void snd_pcm_areas_from_buf(snd_pcm_t *pcm, snd_pcm_channel_area_t *areas, void *buf);
 void snd_pcm_areas_from_bufs(snd_pcm_t *pcm, snd_pcm_channel_area_t *areas, void **bufs);
+int snd_pcm_areas_transpose(const snd_pcm_channel_area_t *dst_areas,
+			    snd_pcm_uframes_t dst_offset,
+			    const snd_pcm_channel_area_t *src_areas,
+			    snd_pcm_uframes_t src_offset,
+			    unsigned int channels, snd_pcm_uframes_t frames,
+			    unsigned int width);
 
 int snd_pcm_async(snd_pcm_t *pcm, int sig, pid_t pid);
 int snd_pcm_mmap(snd_pcm_t *pcm);
@@ -645,6 +668,32 @@ static inline unsigned int snd_pcm_channel_area_step(const snd_pcm_channel_area_
 	return area->step / 8;
 }
 
+/*
+ * Collapse channels interleaved without gaps (the same buffer, the channel
+ * i sample at first + i * step / channels) into a single area of
+ * channels * frames samples.  Returns 0 when the layout does not allow it.
+ */
+static inline int snd_pcm_area_collapse(snd_pcm_channel_area_t *area,
+					const snd_pcm_channel_area_t *areas,
+					unsigned int channels)
+{
+	unsigned int c, step;
+
+	if (channels < 2 || areas->step % (channels * 8))
+		return 0;
+	step = areas->step / channels;
+	for (c = 1; c < channels; c++) {
+		if (areas[c].addr != areas->addr ||
+		    areas[c].step != areas->step ||
+		    areas[c].first != areas->first + c * step)
+			return 0;
+	}
+	area->addr = areas->addr;
+	area->first = areas->first;
+	area->step = step;
+	return 1;
+}
+
 static inline snd_pcm_sframes_t _snd_pcm_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size)
 {
 	/* lock handled in the callback */
@@ -718,6 +767,8 @@ int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
 int _snd_pcm_hw_params_internal(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
 #undef _snd_pcm_hw_params
 int snd_pcm_hw_refine_soft(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
+void snd_pcm_hw_refine_invalidate(void);
+void snd_pcm_hw_refine_cache_free(snd_pcm_t *pcm);
 int snd_pcm_hw_refine_slave(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
 			    int (*cprepare)(snd_pcm_t *pcm,
 					    snd_pcm_hw_params_t *params),
@@ -1019,6 +1070,7 @@ int __snd_pcm_mmap_emul_open(snd_pcm_t **pcmp, const char *name,
 int snd_pcm_wait_nocheck(snd_pcm_t *pcm, int timeout);
 
 const snd_config_t *snd_pcm_rate_get_default_converter(snd_config_t *root);
+int snd_pcm_rate_set_native_sformat(snd_pcm_t *pcm);
 
 #define SND_PCM_HW_PARBIT_ACCESS	(1U << SND_PCM_HW_PARAM_ACCESS)
 #define SND_PCM_HW_PARBIT_FORMAT	(1U << SND_PCM_HW_PARAM_FORMAT)
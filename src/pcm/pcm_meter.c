@@ -29,14 +29,17 @@
 
 #include "bswap.h"
 #include <time.h>
+#include <math.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <dlfcn.h>
 #include "pcm_local.h"
 #include "pcm_plugin.h"
 
 #define atomic_read(ptr)    __atomic_load_n(ptr, __ATOMIC_SEQ_CST )
+#define atomic_set(ptr, n)  __atomic_store_n(ptr, n, __ATOMIC_SEQ_CST)
+#define atomic_xchg(ptr, n) __atomic_exchange_n(ptr, n, __ATOMIC_SEQ_CST)
 #define atomic_add(ptr, n)  __atomic_add_fetch(ptr, n, __ATOMIC_SEQ_CST)
-#define atomic_dec(ptr)     __atomic_sub_fetch(ptr, 1, __ATOMIC_SEQ_CST)
 
 #ifndef PIC
 /* entry for static linking */
@@ -54,21 +57,31 @@ struct _snd_pcm_scope {
 	struct list_head list;
 };
 
+/*
+ * The stream copies the committed frames into buf, a ring of more than
+ * a second indexed by the frame position, and publishes the position in
+ * head.  The thread is the only consumer: it sleeps until head moves,
+ * updates the scopes up to head and waits 1/frequency before the next
+ * update.  Neither side takes a lock; wakeup is only posted when the
+ * thread went idle.
+ */
 typedef struct _snd_pcm_meter {
 	snd_pcm_generic_t gen;
-	snd_pcm_uframes_t rptr;
+	snd_pcm_uframes_t rptr;		/* stream: frames copied up to here */
+	snd_pcm_uframes_t head;		/* rptr as published to the thread */
 	snd_pcm_uframes_t buf_size;
 	snd_pcm_channel_area_t *buf_areas;
-	snd_pcm_uframes_t now;
+	snd_pcm_uframes_t now;		/* thread: scopes updated up to here */
 	unsigned char *buf;
 	struct list_head scopes;
+	int active;			/* the thread runs, frames are copied */
 	int closed;
 	int running;
-	int reset;
+	int reset;			/* the frame position jumped */
+	int stop;			/* the stream was stopped */
+	int idle;			/* the thread waits for wakeup */
 	pthread_t thread;
-	pthread_mutex_t update_mutex;
-	pthread_mutex_t running_mutex;
-	pthread_cond_t running_cond;
+	sem_t wakeup;
 	struct timespec delay;
 	void *dl_handle;
 } snd_pcm_meter_t;
@@ -101,59 +114,32 @@ static void snd_pcm_meter_add_frames(snd_pcm_t *pcm,
 	}
 }
 
-static void snd_pcm_meter_update_main(snd_pcm_t *pcm)
+/* wake the thread up if it sleeps */
+static void snd_pcm_meter_wakeup(snd_pcm_meter_t *meter)
 {
-	snd_pcm_meter_t *meter = pcm->private_data;
-	snd_pcm_sframes_t frames;
-	snd_pcm_uframes_t rptr, old_rptr;
-	const snd_pcm_channel_area_t *areas;
-	int locked;
-	locked = (pthread_mutex_trylock(&meter->update_mutex) >= 0);
-	areas = snd_pcm_mmap_areas(pcm);
-	rptr = *pcm->hw.ptr;
-	old_rptr = meter->rptr;
-	meter->rptr = rptr;
-	frames = rptr - old_rptr;
-	if (frames < 0)
-		frames += pcm->boundary;
-	if (frames > 0) {
-		assert((snd_pcm_uframes_t) frames <= pcm->buffer_size);
-		snd_pcm_meter_add_frames(pcm, areas, old_rptr,
-					 (snd_pcm_uframes_t) frames);
-	}
-	if (locked)
-		pthread_mutex_unlock(&meter->update_mutex);
+	if (atomic_xchg(&meter->idle, 0))
+		sem_post(&meter->wakeup);
+}
+
+/* hand the frames copied up to rptr over to the thread */
+static void snd_pcm_meter_publish(snd_pcm_meter_t *meter)
+{
+	atomic_set(&meter->head, meter->rptr);
+	snd_pcm_meter_wakeup(meter);
 }
 
-static int snd_pcm_meter_update_scope(snd_pcm_t *pcm)
+/* the application pointer moved without a commit; restart the scopes */
+static void snd_pcm_meter_resync(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
-	snd_pcm_sframes_t frames;
-	snd_pcm_uframes_t rptr, old_rptr;
-	const snd_pcm_channel_area_t *areas;
-	int reset = 0;
-	/* Wait main thread */
-	pthread_mutex_lock(&meter->update_mutex);
-	areas = snd_pcm_mmap_areas(pcm);
- _again:
-	rptr = *pcm->hw.ptr;
-	old_rptr = meter->rptr;
-	if (atomic_read(&meter->reset)) {
-		reset = 1;
-		atomic_dec(&meter->reset);
-		goto _again;
-	}
-	meter->rptr = rptr;
-	frames = rptr - old_rptr;
-	if (frames < 0)
-		frames += pcm->boundary;
-	if (frames > 0) {
-		assert((snd_pcm_uframes_t) frames <= pcm->buffer_size);
-		snd_pcm_meter_add_frames(pcm, areas, old_rptr,
-					 (snd_pcm_uframes_t) frames);
-	}
-	pthread_mutex_unlock(&meter->update_mutex);
-	return reset;
+
+	meter->rptr = *pcm->appl.ptr;
+	if (!meter->active)
+		return;
+	/* head first, the thread reads it after seeing reset */
+	atomic_set(&meter->head, meter->rptr);
+	atomic_add(&meter->reset, 1);
+	snd_pcm_meter_wakeup(meter);
 }
 
 static int snd_pcm_scope_remove(snd_pcm_scope_t *scope)
@@ -186,57 +172,24 @@ static void *snd_pcm_meter_thread(void *data)
 {
 	snd_pcm_t *pcm = data;
 	snd_pcm_meter_t *meter = pcm->private_data;
-	snd_pcm_t *spcm = meter->gen.slave;
 	struct list_head *pos;
 	snd_pcm_scope_t *scope;
-	int reset;
+	snd_pcm_uframes_t head;
 	list_for_each(pos, &meter->scopes) {
 		scope = list_entry(pos, snd_pcm_scope_t, list);
 		snd_pcm_scope_enable(scope);
 	}
-	while (!meter->closed) {
-		snd_pcm_sframes_t now;
-		snd_pcm_status_t status;
-		int err;
-		pthread_mutex_lock(&meter->running_mutex);
-		err = snd_pcm_status(spcm, &status);
-		assert(err >= 0);
-		if (status.state != SND_PCM_STATE_RUNNING &&
-		    (status.state != SND_PCM_STATE_DRAINING ||
-		     spcm->stream != SND_PCM_STREAM_PLAYBACK)) {
-			if (meter->running) {
-				list_for_each(pos, &meter->scopes) {
-					scope = list_entry(pos, snd_pcm_scope_t, list);
+	while (!atomic_read(&meter->closed)) {
+		if (atomic_xchg(&meter->stop, 0) && meter->running) {
+			list_for_each(pos, &meter->scopes) {
+				scope = list_entry(pos, snd_pcm_scope_t, list);
+				if (scope->enabled)
 					scope->ops->stop(scope);
-				}
-				meter->running = 0;
-			}
-			pthread_cond_wait(&meter->running_cond,
-					  &meter->running_mutex);
-			pthread_mutex_unlock(&meter->running_mutex);
-			continue;
-		}
-		pthread_mutex_unlock(&meter->running_mutex);
-		if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
-			now = status.appl_ptr - status.delay;
-			if (now < 0)
-				now += pcm->boundary;
-		} else {
-			now = status.appl_ptr + status.delay;
-			if ((snd_pcm_uframes_t) now >= pcm->boundary)
-				now -= pcm->boundary;
-		}
-		meter->now = now;
-		if (pcm->stream == SND_PCM_STREAM_CAPTURE)
-			reset = snd_pcm_meter_update_scope(pcm);
-		else {
-			reset = 0;
-			while (atomic_read(&meter->reset)) {
-				reset = 1;
-				atomic_dec(&meter->reset);
 			}
+			meter->running = 0;
 		}
-		if (reset) {
+		if (atomic_xchg(&meter->reset, 0)) {
+			meter->now = atomic_read(&meter->head);
 			list_for_each(pos, &meter->scopes) {
 				scope = list_entry(pos, snd_pcm_scope_t, list);
 				if (scope->enabled)
@@ -244,6 +197,18 @@ static void *snd_pcm_meter_thread(void *data)
 			}
 			continue;
 		}
+		head = atomic_read(&meter->head);
+		if (head == meter->now) {
+			/* nothing new, sleep until the stream commits */
+			atomic_set(&meter->idle, 1);
+			if (atomic_read(&meter->head) == head &&
+			    !atomic_read(&meter->reset) &&
+			    !atomic_read(&meter->stop) &&
+			    !atomic_read(&meter->closed))
+				sem_wait(&meter->wakeup);
+			atomic_set(&meter->idle, 0);
+			continue;
+		}
 		if (!meter->running) {
 			list_for_each(pos, &meter->scopes) {
 				scope = list_entry(pos, snd_pcm_scope_t, list);
@@ -252,12 +217,14 @@ static void *snd_pcm_meter_thread(void *data)
 			}
 			meter->running = 1;
 		}
+		meter->now = head;
 		list_for_each(pos, &meter->scopes) {
 			scope = list_entry(pos, snd_pcm_scope_t, list);
 			if (scope->enabled)
 				scope->ops->update(scope);
 		}
-	        nanosleep(&meter->delay, NULL);
+		/* at most frequency updates per second */
+		nanosleep(&meter->delay, NULL);
 	}
 	list_for_each(pos, &meter->scopes) {
 		scope = list_entry(pos, snd_pcm_scope_t, list);
@@ -272,9 +239,6 @@ static int snd_pcm_meter_close(snd_pcm_t *pcm)
 	snd_pcm_meter_t *meter = pcm->private_data;
 	struct list_head *pos, *npos;
 	int err = 0;
-	pthread_mutex_destroy(&meter->update_mutex);
-	pthread_mutex_destroy(&meter->running_mutex);
-	pthread_cond_destroy(&meter->running_cond);
 	if (meter->gen.close_slave)
 		err = snd_pcm_close(meter->gen.slave);
 	list_for_each_safe(pos, npos, &meter->scopes) {
@@ -291,15 +255,9 @@ static int snd_pcm_meter_close(snd_pcm_t *pcm)
 static int snd_pcm_meter_prepare(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
-	int err;
-	atomic_add(&meter->reset, 1);
-	err = snd_pcm_prepare(meter->gen.slave);
-	if (err >= 0) {
-		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
-			meter->rptr = *pcm->appl.ptr;
-		else
-			meter->rptr = *pcm->hw.ptr;
-	}
+	int err = snd_pcm_prepare(meter->gen.slave);
+	if (err >= 0)
+		snd_pcm_meter_resync(pcm);
 	return err;
 }
 
@@ -307,22 +265,30 @@ static int snd_pcm_meter_reset(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	int err = snd_pcm_reset(meter->gen.slave);
-	if (err >= 0) {
-		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
-			meter->rptr = *pcm->appl.ptr;
+	if (err >= 0)
+		snd_pcm_meter_resync(pcm);
+	return err;
+}
+
+static int snd_pcm_meter_drop(snd_pcm_t *pcm)
+{
+	snd_pcm_meter_t *meter = pcm->private_data;
+	int err = snd_pcm_drop(meter->gen.slave);
+	if (err >= 0 && meter->active) {
+		atomic_set(&meter->stop, 1);
+		snd_pcm_meter_wakeup(meter);
 	}
 	return err;
 }
 
-static int snd_pcm_meter_start(snd_pcm_t *pcm)
+static int snd_pcm_meter_drain(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
-	int err;
-	pthread_mutex_lock(&meter->running_mutex);
-	err = snd_pcm_start(meter->gen.slave);
-	if (err >= 0)
-		pthread_cond_signal(&meter->running_cond);
-	pthread_mutex_unlock(&meter->running_mutex);
+	int err = snd_pcm_drain(meter->gen.slave);
+	if (err >= 0 && meter->active) {
+		atomic_set(&meter->stop, 1);
+		snd_pcm_meter_wakeup(meter);
+	}
 	return err;
 }
 
@@ -330,8 +296,8 @@ static snd_pcm_sframes_t snd_pcm_meter_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_sframes_t err = snd_pcm_rewind(meter->gen.slave, frames);
-	if (err > 0 && pcm->stream == SND_PCM_STREAM_PLAYBACK)
-		meter->rptr = *pcm->appl.ptr;
+	if (err > 0)
+		snd_pcm_meter_resync(pcm);
 	return err;
 }
 
@@ -339,8 +305,8 @@ static snd_pcm_sframes_t snd_pcm_meter_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_sframes_t err = INTERNAL(snd_pcm_forward)(meter->gen.slave, frames);
-	if (err > 0 && pcm->stream == SND_PCM_STREAM_PLAYBACK)
-		meter->rptr = *pcm->appl.ptr;
+	if (err > 0)
+		snd_pcm_meter_resync(pcm);
 	return err;
 }
 
@@ -350,24 +316,17 @@ static snd_pcm_sframes_t snd_pcm_meter_mmap_commit(snd_pcm_t *pcm,
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_uframes_t old_rptr = *pcm->appl.ptr;
-	snd_pcm_sframes_t result = snd_pcm_mmap_commit(meter->gen.slave, offset, size);
-	if (result <= 0)
+	snd_pcm_sframes_t result;
+	/* the captured frames are valid until they are committed */
+	if (meter->active && pcm->stream == SND_PCM_STREAM_CAPTURE && size > 0)
+		snd_pcm_meter_add_frames(pcm, snd_pcm_mmap_areas(pcm), old_rptr, size);
+	result = snd_pcm_mmap_commit(meter->gen.slave, offset, size);
+	if (result <= 0 || !meter->active)
 		return result;
-	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+	if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
 		snd_pcm_meter_add_frames(pcm, snd_pcm_mmap_areas(pcm), old_rptr, result);
-		meter->rptr = *pcm->appl.ptr;
-	}
-	return result;
-}
-
-static snd_pcm_sframes_t snd_pcm_meter_avail_update(snd_pcm_t *pcm)
-{
-	snd_pcm_meter_t *meter = pcm->private_data;
-	snd_pcm_sframes_t result = snd_pcm_avail_update(meter->gen.slave);
-	if (result <= 0)
-		return result;
-	if (pcm->stream == SND_PCM_STREAM_CAPTURE)
-		snd_pcm_meter_update_main(pcm);
+	meter->rptr = *pcm->appl.ptr;
+	snd_pcm_meter_publish(meter);
 	return result;
 }
 
@@ -470,22 +429,46 @@ static int snd_pcm_meter_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 		a->first = 0;
 		a->step = slave->sample_bits;
 	}
-	meter->closed = 0;
+	/* without scopes nobody needs the frames */
+	if (list_empty(&meter->scopes))
+		return 0;
+	meter->rptr = meter->head = meter->now = *pcm->appl.ptr;
+	meter->closed = meter->running = 0;
+	meter->reset = meter->stop = meter->idle = 0;
+	if (sem_init(&meter->wakeup, 0, 0) < 0) {
+		err = -errno;
+		goto _err;
+	}
 	err = pthread_create(&meter->thread, NULL, snd_pcm_meter_thread, pcm);
-	assert(err == 0);
+	if (err) {
+		sem_destroy(&meter->wakeup);
+		err = -err;
+		goto _err;
+	}
+	meter->active = 1;
 	return 0;
+
+ _err:
+	free(meter->buf);
+	free(meter->buf_areas);
+	meter->buf = NULL;
+	meter->buf_areas = NULL;
+	snd_pcm_hw_free(slave);
+	return err;
 }
 
 static int snd_pcm_meter_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	int err;
-	meter->closed = 1;
-	pthread_mutex_lock(&meter->running_mutex);
-	pthread_cond_signal(&meter->running_cond);
-	pthread_mutex_unlock(&meter->running_mutex);
-	err = pthread_join(meter->thread, 0);
-	assert(err == 0);
+	if (meter->active) {
+		meter->active = 0;
+		atomic_set(&meter->closed, 1);
+		sem_post(&meter->wakeup);
+		err = pthread_join(meter->thread, 0);
+		assert(err == 0);
+		sem_destroy(&meter->wakeup);
+	}
 	free(meter->buf);
 	free(meter->buf_areas);
 	meter->buf = NULL;
@@ -530,9 +513,9 @@ static const snd_pcm_fast_ops_t snd_pcm_meter_fast_ops = {
 	.delay = snd_pcm_generic_delay,
 	.prepare = snd_pcm_meter_prepare,
 	.reset = snd_pcm_meter_reset,
-	.start = snd_pcm_meter_start,
-	.drop = snd_pcm_generic_drop,
-	.drain = snd_pcm_generic_drain,
+	.start = snd_pcm_generic_start,
+	.drop = snd_pcm_meter_drop,
+	.drain = snd_pcm_meter_drain,
 	.pause = snd_pcm_generic_pause,
 	.rewindable = snd_pcm_generic_rewindable,
 	.rewind = snd_pcm_meter_rewind,
@@ -543,7 +526,7 @@ static const snd_pcm_fast_ops_t snd_pcm_meter_fast_ops = {
 	.writen = snd_pcm_mmap_writen,
 	.readi = snd_pcm_mmap_readi,
 	.readn = snd_pcm_mmap_readn,
-	.avail_update = snd_pcm_meter_avail_update,
+	.avail_update = snd_pcm_generic_avail_update,
 	.mmap_commit = snd_pcm_meter_mmap_commit,
 	.htimestamp = snd_pcm_generic_htimestamp,
 	.poll_descriptors_count = snd_pcm_generic_poll_descriptors_count,
@@ -576,8 +559,8 @@ int snd_pcm_meter_open(snd_pcm_t **pcmp, const char *name, unsigned int frequenc
 		return -ENOMEM;
 	meter->gen.slave = slave;
 	meter->gen.close_slave = close_slave;
-	meter->delay.tv_sec = 0;
-	meter->delay.tv_nsec = 1000000000 / frequency;
+	meter->delay.tv_sec = 1 / frequency;
+	meter->delay.tv_nsec = 1000000000 / frequency % 1000000000;
 	INIT_LIST_HEAD(&meter->scopes);
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_METER, name, slave->stream, slave->mode);
@@ -596,10 +579,6 @@ int snd_pcm_meter_open(snd_pcm_t **pcmp, const char *name, unsigned int frequenc
 	snd_pcm_link_hw_ptr(pcm, slave);
 	snd_pcm_link_appl_ptr(pcm, slave);
 	*pcmp = pcm;
-
-	pthread_mutex_init(&meter->update_mutex, NULL);
-	pthread_mutex_init(&meter->running_mutex, NULL);
-	pthread_cond_init(&meter->running_cond, NULL);
 	return 0;
 }
 
@@ -702,6 +681,17 @@ static int snd_pcm_meter_add_scope_conf(snd_pcm_t *pcm, const char *name,
 
 Show meter (visual waveform representation).
 
+The frames are copied to the meter buffer when they are committed to
+the slave (played frames when they are written, captured frames when
+they are read), so "now" of the scopes is the application position,
+not the audible one.  A thread updates the scopes after each commit,
+at most frequency times per second, and sleeps while the stream does
+not move.  Without scopes no thread is started and no frame is copied.
+
+Besides the s16 pseudo scope, which converts the frames to 16 bit for
+the other scopes, the levels pseudo scope measures the peak, RMS and
+true peak of each channel (see snd_pcm_scope_levels_open()).
+
 \code
 pcm_scope_type.NAME {
 	[lib STR]		# Library file (default libasound.so)
@@ -722,7 +712,7 @@ pcm.name {
                 # or
                 pcm { }         # Slave PCM definition
         }
-	[frequency INT]		# Updates per second
+	[frequency INT]		# Maximum updates per second (default 50)
 	scopes {
 		ID STR		# Scope name (see pcm_scope)
 		# or
@@ -1102,9 +1092,10 @@ static void s16_update(snd_pcm_scope_t *scope)
 	size = meter->now - s16->old;
 	if (size < 0)
 		size += spcm->boundary;
+	/* convert the most recent frames when the thread fell behind */
 	if (size > (snd_pcm_sframes_t)s16->pcm->buffer_size)
 		size = s16->pcm->buffer_size;
-	offset = s16->old % meter->buf_size;
+	offset = (meter->now + spcm->boundary - size) % meter->buf_size;
 	while (size > 0) {
 		snd_pcm_uframes_t frames = size;
 		snd_pcm_uframes_t cont = meter->buf_size - offset;
@@ -1222,6 +1213,260 @@ int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 	return s16->buf_areas[channel].addr;
 }
 
+#ifndef DOC_HIDDEN
+/* 4x oversampling interpolator for the true peak, 12 taps per phase */
+#define LEVELS_PHASES 4
+#define LEVELS_TAPS 12
+
+typedef struct _snd_pcm_scope_levels_channel {
+	float peak;
+	float rms;
+	float true_peak;
+	float hist[LEVELS_TAPS - 1];	/* last samples of the previous update */
+} snd_pcm_scope_levels_channel_t;
+
+typedef struct _snd_pcm_scope_levels {
+	snd_pcm_t *pcm;
+	snd_pcm_scope_t *s16;
+	snd_pcm_uframes_t old;
+	unsigned int channels;
+	snd_pcm_scope_levels_channel_t *chan;
+	float *work;
+	float coef[LEVELS_PHASES][LEVELS_TAPS];
+} snd_pcm_scope_levels_t;
+
+/*
+ * Hann windowed sinc lowpass at the input Nyquist frequency, split in
+ * LEVELS_PHASES polyphase branches each normalized to unity DC gain.
+ * The branches interpolate between the input samples at 1/8, 3/8, 5/8
+ * and 7/8 of a sample period.
+ */
+static void levels_init_coef(snd_pcm_scope_levels_t *levels)
+{
+	const unsigned int len = LEVELS_PHASES * LEVELS_TAPS;
+	unsigned int p, k;
+	for (p = 0; p < LEVELS_PHASES; p++) {
+		float sum = 0;
+		for (k = 0; k < LEVELS_TAPS; k++) {
+			unsigned int m = p + k * LEVELS_PHASES;
+			double x = (m - (len - 1) / 2.0) / LEVELS_PHASES;
+			double w = 0.5 - 0.5 * cos(2 * M_PI * (m + 1) / (len + 1));
+			double h = w * sin(M_PI * x) / (M_PI * x);
+			levels->coef[p][k] = h;
+			sum += h;
+		}
+		for (k = 0; k < LEVELS_TAPS; k++)
+			levels->coef[p][k] /= sum;
+	}
+}
+
+static int levels_enable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_levels_t *levels = scope->private_data;
+	snd_pcm_meter_t *meter = levels->pcm->private_data;
+	/* the s16 scope is updated first and owns the converted frames */
+	if (!levels->s16->enabled)
+		return -EINVAL;
+	levels->channels = meter->gen.slave->channels;
+	levels->chan = calloc(levels->channels, sizeof(*levels->chan));
+	if (!levels->chan)
+		return -ENOMEM;
+	levels->work = malloc((meter->gen.slave->buffer_size + LEVELS_TAPS) *
+			      sizeof(*levels->work));
+	if (!levels->work) {
+		free(levels->chan);
+		levels->chan = NULL;
+		return -ENOMEM;
+	}
+	levels_init_coef(levels);
+	return 0;
+}
+
+static void levels_disable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_levels_t *levels = scope->private_data;
+	free(levels->chan);
+	levels->chan = NULL;
+	free(levels->work);
+	levels->work = NULL;
+}
+
+static void levels_close(snd_pcm_scope_t *scope)
+{
+	free(scope->private_data);
+}
+
+static void levels_start(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void levels_stop(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_levels_t *levels = scope->private_data;
+	memset(levels->chan, 0, levels->channels * sizeof(*levels->chan));
+}
+
+static void levels_update(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_levels_t *levels = scope->private_data;
+	snd_pcm_meter_t *meter = levels->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	snd_pcm_sframes_t size, n;
+	snd_pcm_uframes_t offset;
+	unsigned int c, p;
+	int k;
+	size = meter->now - levels->old;
+	if (size < 0)
+		size += spcm->boundary;
+	/* the same window as s16_update() */
+	if (size > (snd_pcm_sframes_t)levels->pcm->buffer_size)
+		size = levels->pcm->buffer_size;
+	levels->old = meter->now;
+	if (size == 0)
+		return;
+	offset = (meter->now + spcm->boundary - size) % meter->buf_size;
+	for (c = 0; c < levels->channels; c++) {
+		snd_pcm_scope_levels_channel_t *l = &levels->chan[c];
+		const int16_t *src = snd_pcm_scope_s16_get_channel_buffer(levels->s16, c);
+		float *x = levels->work;
+		float peak = 0, true_peak = 0;
+		double sum = 0;
+		snd_pcm_uframes_t pos = offset;
+		memcpy(x, l->hist, sizeof(l->hist));
+		x += LEVELS_TAPS - 1;
+		for (n = 0; n < size; n++) {
+			float v = src[pos] * (1.0f / 32768);
+			x[n] = v;
+			sum += v * v;
+			if (v < 0)
+				v = -v;
+			if (v > peak)
+				peak = v;
+			if (++pos == meter->buf_size)
+				pos = 0;
+		}
+		for (n = 0; n < size; n++) {
+			for (p = 0; p < LEVELS_PHASES; p++) {
+				const float *h = levels->coef[p];
+				float y = 0;
+				for (k = 0; k < LEVELS_TAPS; k++)
+					y += h[k] * x[n - k];
+				if (y < 0)
+					y = -y;
+				if (y > true_peak)
+					true_peak = y;
+			}
+		}
+		memcpy(l->hist, x + size - (LEVELS_TAPS - 1), sizeof(l->hist));
+		l->peak = peak;
+		l->rms = sqrt(sum / size);
+		l->true_peak = true_peak > peak ? true_peak : peak;
+	}
+}
+
+static void levels_reset(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_levels_t *levels = scope->private_data;
+	snd_pcm_meter_t *meter = levels->pcm->private_data;
+	memset(levels->chan, 0, levels->channels * sizeof(*levels->chan));
+	levels->old = meter->now;
+}
+
+static const snd_pcm_scope_ops_t levels_ops = {
+	.enable = levels_enable,
+	.disable = levels_disable,
+	.close = levels_close,
+	.start = levels_start,
+	.stop = levels_stop,
+	.update = levels_update,
+	.reset = levels_reset,
+};
+#endif
+
+/**
+ * \brief Add a levels pseudo scope to a #SND_PCM_TYPE_METER PCM
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param scopep Pointer to newly created and added scope
+ * \return 0 on success otherwise a negative error code
+ *
+ * levels pseudo scope measures the sample peak, the RMS and the true peak
+ * (4x oversampled) of each channel over the frames of the last update.
+ * It reads the frames of the "s16" scope, which is added first when it is
+ * not installed yet. The values are read with #snd_pcm_scope_levels_get,
+ * typically from the update callback of a scope added after this one.
+ */
+int snd_pcm_scope_levels_open(snd_pcm_t *pcm, const char *name,
+			      snd_pcm_scope_t **scopep)
+{
+	snd_pcm_meter_t *meter;
+	snd_pcm_scope_t *scope, *s16;
+	snd_pcm_scope_levels_t *levels;
+	int err;
+	assert(pcm->type == SND_PCM_TYPE_METER);
+	meter = pcm->private_data;
+	s16 = snd_pcm_meter_search_scope(pcm, "s16");
+	if (s16 && s16->ops != &s16_ops)
+		return -EINVAL;
+	scope = calloc(1, sizeof(*scope));
+	if (!scope)
+		return -ENOMEM;
+	levels = calloc(1, sizeof(*levels));
+	if (!levels) {
+		free(scope);
+		return -ENOMEM;
+	}
+	if (!s16) {
+		err = snd_pcm_scope_s16_open(pcm, "s16", &s16);
+		if (err < 0) {
+			free(levels);
+			free(scope);
+			return err;
+		}
+	}
+	if (name)
+		scope->name = strdup(name);
+	levels->pcm = pcm;
+	levels->s16 = s16;
+	scope->ops = &levels_ops;
+	scope->private_data = levels;
+	list_add_tail(&scope->list, &meter->scopes);
+	*scopep = scope;
+	return 0;
+}
+
+/**
+ * \brief Get the levels of a channel measured by a levels pseudo scope
+ * \param scope levels pseudo scope handle
+ * \param channel Channel
+ * \param peak Returned sample peak (or NULL)
+ * \param rms Returned RMS level (or NULL)
+ * \param true_peak Returned true peak (or NULL)
+ * \return 0 on success otherwise a negative error code
+ *
+ * All levels are linear, 1.0 is the digital full scale.
+ * The true peak may exceed 1.0 for clipped or intersample peaks.
+ * The values are valid until the next update of the scope.
+ */
+int snd_pcm_scope_levels_get(snd_pcm_scope_t *scope, unsigned int channel,
+			     float *peak, float *rms, float *true_peak)
+{
+	snd_pcm_scope_levels_t *levels;
+	assert(scope->ops == &levels_ops);
+	levels = scope->private_data;
+	if (!levels->chan)
+		return -EBADFD;
+	if (channel >= levels->channels)
+		return -EINVAL;
+	if (peak)
+		*peak = levels->chan[channel].peak;
+	if (rms)
+		*rms = levels->chan[channel].rms;
+	if (true_peak)
+		*true_peak = levels->chan[channel].true_peak;
+	return 0;
+}
+
 /**
  * \brief allocate an invalid #snd_pcm_scope_t using standard malloc
  * \param ptr returned pointer
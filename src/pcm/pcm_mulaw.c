@@ -29,6 +29,9 @@
 #include "bswap.h"
 #include "pcm_local.h"
 #include "pcm_plugin.h"
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "plugin_ops.h"
 
@@ -158,6 +161,55 @@ static int ulaw_to_s16(unsigned char u_val)
 
 #ifndef DOC_HIDDEN
 
+/*
+ * The conversions are done via tables built on the first use and shared
+ * by all instances.  The u-law code depends only on the sign and on the
+ * biased magnitude >> 3.  The indexes past 0x7fff >> 3 hold the clipped
+ * code, so the encoder does not need to test for clipping.
+ */
+static unsigned char ulaw_enc_table[((0x8000 + 0x84) >> 3) + 1];
+static int16_t ulaw_dec_table[256];
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_once_t ulaw_tables_once = PTHREAD_ONCE_INIT;
+#else
+static int ulaw_tables_ready;
+#endif
+
+static void ulaw_build_tables(void)
+{
+	int i;
+
+	/* the smallest biased magnitude is 0x84 */
+	for (i = 0x84 >> 3; i < (int)sizeof(ulaw_enc_table); i++) {
+		int pcm_val = (i << 3) - 0x84;
+		if (pcm_val < 0)
+			pcm_val = 0;
+		ulaw_enc_table[i] = s16_to_ulaw(pcm_val) ^ 0xff;
+	}
+	for (i = 0; i < 256; i++)
+		ulaw_dec_table[i] = ulaw_to_s16(i);
+}
+
+static inline void ulaw_init_tables(void)
+{
+#ifdef HAVE_LIBPTHREAD
+	pthread_once(&ulaw_tables_once, ulaw_build_tables);
+#else
+	if (!ulaw_tables_ready) {
+		ulaw_build_tables();
+		ulaw_tables_ready = 1;
+	}
+#endif
+}
+
+static inline unsigned char ulaw_encode_sample(int pcm_val)
+{
+	if (pcm_val < 0)
+		return ulaw_enc_table[(0x84 - pcm_val) >> 3] ^ 0x7f;
+	return ulaw_enc_table[(pcm_val + 0x84) >> 3] ^ 0xff;
+}
+
 void snd_pcm_mulaw_decode(const snd_pcm_channel_area_t *dst_areas,
 			  snd_pcm_uframes_t dst_offset,
 			  const snd_pcm_channel_area_t *src_areas,
@@ -169,7 +221,19 @@ void snd_pcm_mulaw_decode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
+	snd_pcm_channel_area_t dst_all, src_all;
 	unsigned int channel;
+
+	ulaw_init_tables();
+	if (snd_pcm_area_collapse(&dst_all, dst_areas, channels) &&
+	    snd_pcm_area_collapse(&src_all, src_areas, channels)) {
+		dst_areas = &dst_all;
+		src_areas = &src_all;
+		dst_offset *= channels;
+		src_offset *= channels;
+		frames *= channels;
+		channels = 1;
+	}
 	for (channel = 0; channel < channels; ++channel) {
 		const unsigned char *src;
 		char *dst;
@@ -182,8 +246,23 @@ void snd_pcm_mulaw_decode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (putidx == SND_PCM_LINEAR_S16_INDEX) {
+			if (src_step == 1 && dst_step == 2) {
+				int16_t *d = (int16_t *)dst;
+				snd_pcm_uframes_t i;
+				for (i = 0; i < frames1; i++)
+					d[i] = ulaw_dec_table[src[i]];
+				continue;
+			}
+			while (frames1-- > 0) {
+				*(int16_t *)dst = ulaw_dec_table[*src];
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
-			int16_t sample = ulaw_to_s16(*src);
+			int16_t sample = ulaw_dec_table[*src];
 			goto *put;
 #define PUT16_END after
 #include "plugin_ops.h"
@@ -206,8 +285,20 @@ void snd_pcm_mulaw_encode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef GET16_LABELS
 	void *get = get16_labels[getidx];
+	snd_pcm_channel_area_t dst_all, src_all;
 	unsigned int channel;
 	int16_t sample = 0;
+
+	ulaw_init_tables();
+	if (snd_pcm_area_collapse(&dst_all, dst_areas, channels) &&
+	    snd_pcm_area_collapse(&src_all, src_areas, channels)) {
+		dst_areas = &dst_all;
+		src_areas = &src_all;
+		dst_offset *= channels;
+		src_offset *= channels;
+		frames *= channels;
+		channels = 1;
+	}
 	for (channel = 0; channel < channels; ++channel) {
 		const char *src;
 		char *dst;
@@ -220,13 +311,28 @@ void snd_pcm_mulaw_encode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (getidx == SND_PCM_LINEAR_S16_INDEX) {
+			if (src_step == 2 && dst_step == 1) {
+				const int16_t *s = (const int16_t *)src;
+				snd_pcm_uframes_t i;
+				for (i = 0; i < frames1; i++)
+					dst[i] = ulaw_encode_sample(s[i]);
+				continue;
+			}
+			while (frames1-- > 0) {
+				*dst = ulaw_encode_sample(*(const int16_t *)src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			goto *get;
 #define GET16_END after
 #include "plugin_ops.h"
 #undef GET16_END
 		after:
-			*dst = s16_to_ulaw(sample);
+			*dst = ulaw_encode_sample(sample);
 			src += src_step;
 			dst += dst_step;
 		}
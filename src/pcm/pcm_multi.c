@@ -31,8 +31,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
 #include "pcm_local.h"
 #include "pcm_generic.h"
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <semaphore.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -41,11 +46,30 @@ const char *_snd_module_pcm_multi = "";
 
 #ifndef DOC_HIDDEN
 
+struct snd_pcm_multi;
+
 typedef struct {
 	snd_pcm_t *pcm;
 	unsigned int channels_count;
 	int close_slave;
 	snd_pcm_t *linked;
+	struct snd_pcm_multi *multi;
+	snd_pcm_sframes_t result;	/* result of the last job */
+	snd_pcm_sframes_t skew;		/* hw_ptr distance from the master */
+	snd_pcm_sframes_t skew_max;	/* largest |skew| since prepare */
+	int drift;			/* resample to follow the master clock */
+	snd_pcm_uframes_t drift_ptr;	/* next multi frame to resample */
+	char *drift_buf;		/* multi side buffer of a drift slave */
+	snd_pcm_channel_area_t *drift_areas;
+	float *drift_prev, *drift_next;	/* interpolated frame pair */
+	double drift_phase;		/* position between prev and next */
+	double drift_step;		/* input frames per output frame */
+	double drift_err;		/* filtered queue error in seconds */
+	double drift_integ;		/* integrated queue error */
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	sem_t request;			/* a job is posted for this slave */
+#endif
 } snd_pcm_multi_slave_t;
 
 typedef struct {
@@ -53,22 +77,384 @@ typedef struct {
 	unsigned int slave_channel;
 } snd_pcm_multi_channel_t;
 
-typedef struct {
+enum {
+	MULTI_JOB_QUIT,
+	MULTI_JOB_HWSYNC,
+	MULTI_JOB_AVAIL_UPDATE,
+	MULTI_JOB_MMAP_COMMIT,
+};
+
+typedef struct snd_pcm_multi {
 	snd_pcm_uframes_t appl_ptr, hw_ptr;
 	unsigned int slaves_count;
 	unsigned int master_slave;
 	snd_pcm_multi_slave_t *slaves;
 	unsigned int channels_count;
 	snd_pcm_multi_channel_t *channels;
+	int threads;			/* service slaves from worker threads */
+	int workers;			/* the worker threads are running */
+	int job;			/* MULTI_JOB_* posted to the slaves */
+	snd_pcm_uframes_t job_offset, job_size;
+	unsigned int drift_count;	/* slaves with drift compensation */
+	snd_pcm_uframes_t drift_hw_ptr;	/* master hw_ptr at the last update */
+#ifdef HAVE_LIBPTHREAD
+	sem_t done;			/* a worker finished its job */
+#endif
 } snd_pcm_multi_t;
 
+/*
+ * Drift compensation: the ratio is 1 + KP * (err + integ / TI), where err
+ * is the low-passed difference in seconds between the queued frames of
+ * the slave and of the master.  The loop settles in some tens of seconds
+ * and is damped (zeta ~ 0.6); the ratio never leaves +-DRIFT_MAX_RATIO.
+ */
+#define DRIFT_KP	0.1		/* 1/s */
+#define DRIFT_TI	16.0		/* s */
+#define DRIFT_TAU	1.0		/* s, error filter time constant */
+#define DRIFT_MAX_RATIO	1e-3
+
 #endif
 
+static float snd_pcm_multi_drift_get(const void *p, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		return *(const int16_t *)p * (1.0f / 0x8000);
+	case SND_PCM_FORMAT_S24:
+		return ((int32_t)(*(const uint32_t *)p << 8) >> 8) *
+			(1.0f / 0x800000);
+	case SND_PCM_FORMAT_S32:
+		return *(const int32_t *)p * (1.0f / 0x80000000U);
+	default:
+		return *(const float *)p;
+	}
+}
+
+static void snd_pcm_multi_drift_put(void *p, snd_pcm_format_t format, float v)
+{
+	if (format == SND_PCM_FORMAT_FLOAT) {
+		*(float *)p = v;
+		return;
+	}
+	if (v > 1.0f)
+		v = 1.0f;
+	else if (v < -1.0f)
+		v = -1.0f;
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		*(int16_t *)p = v >= 1.0f ? 0x7fff : lrintf(v * 0x8000);
+		break;
+	case SND_PCM_FORMAT_S24:
+		*(int32_t *)p = v >= 1.0f ? 0x7fffff : lrintf(v * 0x800000);
+		break;
+	default:
+		*(int32_t *)p = v >= 1.0f ? 0x7fffffff : lrint((double)v * 0x80000000U);
+		break;
+	}
+}
+
+/*
+ * Linear interpolation from the multi side buffer of the slave into the
+ * slave areas; consumes up to *in_frames and produces up to *out_frames.
+ */
+static void snd_pcm_multi_drift_resample(snd_pcm_multi_slave_t *slave,
+					 snd_pcm_uframes_t *in_frames,
+					 const snd_pcm_channel_area_t *dst,
+					 snd_pcm_uframes_t dst_offset,
+					 snd_pcm_uframes_t *out_frames)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_format_t format = spcm->format;
+	const snd_pcm_channel_area_t *src = slave->drift_areas;
+	float *prev = slave->drift_prev, *next = slave->drift_next;
+	unsigned int c, channels = slave->channels_count;
+	snd_pcm_uframes_t in = 0, out = 0;
+	snd_pcm_uframes_t pos = slave->drift_ptr % spcm->buffer_size;
+	double phase = slave->drift_phase;
+
+	for (;;) {
+		while (phase >= 1.0) {
+			if (in == *in_frames)
+				goto _done;
+			for (c = 0; c < channels; c++) {
+				prev[c] = next[c];
+				next[c] = snd_pcm_multi_drift_get(snd_pcm_channel_area_addr(&src[c], pos), format);
+			}
+			if (++pos == spcm->buffer_size)
+				pos = 0;
+			in++;
+			phase -= 1.0;
+		}
+		if (out == *out_frames)
+			break;
+		for (c = 0; c < channels; c++)
+			snd_pcm_multi_drift_put(snd_pcm_channel_area_addr(&dst[c], dst_offset + out),
+						format, prev[c] + (float)phase * (next[c] - prev[c]));
+		out++;
+		phase += slave->drift_step;
+	}
+ _done:
+	slave->drift_phase = phase;
+	*in_frames = in;
+	*out_frames = out;
+}
+
+/* frames committed to the multi but not yet resampled into the slave */
+static snd_pcm_uframes_t snd_pcm_multi_drift_backlog(snd_pcm_multi_t *multi,
+						     snd_pcm_multi_slave_t *slave)
+{
+	return pcm_frame_diff(multi->appl_ptr, slave->drift_ptr,
+			      slave->pcm->boundary);
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_drift_commit(snd_pcm_multi_t *multi,
+						    snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_uframes_t left;
+	snd_pcm_sframes_t avail, result;
+
+	left = snd_pcm_multi_drift_backlog(multi, slave) + multi->job_size;
+	avail = snd_pcm_avail_update(spcm);
+	if (avail < 0)
+		return avail;
+	while (left > 0 && avail > 0) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset, frames = avail, in = left;
+		int err;
+
+		err = snd_pcm_mmap_begin(spcm, &areas, &offset, &frames);
+		if (err < 0)
+			return err;
+		snd_pcm_multi_drift_resample(slave, &in, areas, offset, &frames);
+		result = snd_pcm_mmap_commit(spcm, offset, frames);
+		if (result < 0)
+			return result;
+		slave->drift_ptr = (slave->drift_ptr + in) % spcm->boundary;
+		left -= in;
+		avail -= frames;
+	}
+	/* a remainder, if any, is resampled on the next commit */
+	return multi->job_size;
+}
+
+/* PI step on the queue error, dt is the master progress in frames */
+static void snd_pcm_multi_drift_update(snd_pcm_t *pcm,
+				       snd_pcm_multi_slave_t *slave,
+				       snd_pcm_sframes_t err,
+				       snd_pcm_uframes_t dt)
+{
+	const double integ_max = DRIFT_MAX_RATIO * DRIFT_TI / DRIFT_KP;
+	double a = (double)dt / (DRIFT_TAU * pcm->rate);
+	double ratio;
+
+	if (a > 1.0)
+		a = 1.0;
+	slave->drift_err += ((double)err / pcm->rate - slave->drift_err) * a;
+	slave->drift_integ += slave->drift_err * dt / pcm->rate;
+	if (slave->drift_integ > integ_max)
+		slave->drift_integ = integ_max;
+	else if (slave->drift_integ < -integ_max)
+		slave->drift_integ = -integ_max;
+	ratio = DRIFT_KP * (slave->drift_err + slave->drift_integ / DRIFT_TI);
+	if (ratio > DRIFT_MAX_RATIO)
+		ratio = DRIFT_MAX_RATIO;
+	else if (ratio < -DRIFT_MAX_RATIO)
+		ratio = -DRIFT_MAX_RATIO;
+	/* more queued than the master: consume input faster */
+	slave->drift_step = 1.0 + ratio;
+}
+
+/*
+ * Restart the interpolation after prepare or reset.  The integrator and
+ * the ratio are kept, as the clock offset of a device doesn't change.
+ */
+static void snd_pcm_multi_drift_reset(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	multi->drift_hw_ptr = 0;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (!slave->drift)
+			continue;
+		slave->drift_ptr = 0;
+		slave->drift_phase = 1.0;
+		slave->drift_err = 0;
+		if (slave->drift_prev) {
+			memset(slave->drift_prev, 0, slave->channels_count * sizeof(float));
+			memset(slave->drift_next, 0, slave->channels_count * sizeof(float));
+		}
+	}
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_slave_job(snd_pcm_multi_t *multi,
+						 snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_sframes_t result;
+
+	switch (multi->job) {
+	case MULTI_JOB_HWSYNC:
+		return snd_pcm_hwsync(slave->pcm);
+	case MULTI_JOB_AVAIL_UPDATE:
+		result = snd_pcm_avail_update(slave->pcm);
+		if (result > 0 && slave->drift) {
+			snd_pcm_uframes_t backlog;
+			backlog = snd_pcm_multi_drift_backlog(multi, slave);
+			result = (snd_pcm_uframes_t)result > backlog ?
+				 result - (snd_pcm_sframes_t)backlog : 0;
+		}
+		return result;
+	case MULTI_JOB_MMAP_COMMIT:
+		if (slave->drift)
+			return snd_pcm_multi_drift_commit(multi, slave);
+		result = snd_pcm_mmap_commit(slave->pcm, multi->job_offset,
+					     multi->job_size);
+		if (result >= 0 && (snd_pcm_uframes_t)result != multi->job_size)
+			result = -EIO;
+		return result;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * Run a job on every slave and return the first error or the smallest
+ * non-negative result.  With the worker threads running, slave 0 is
+ * serviced by the caller and the others concurrently by their workers.
+ */
+static snd_pcm_sframes_t snd_pcm_multi_run(snd_pcm_multi_t *multi, int job,
+					   snd_pcm_uframes_t offset,
+					   snd_pcm_uframes_t size)
+{
+	snd_pcm_sframes_t result, ret = LONG_MAX;
+	unsigned int i;
+
+	multi->job = job;
+	multi->job_offset = offset;
+	multi->job_size = size;
+#ifdef HAVE_LIBPTHREAD
+	if (multi->workers) {
+		for (i = 1; i < multi->slaves_count; ++i)
+			sem_post(&multi->slaves[i].request);
+		multi->slaves[0].result = snd_pcm_multi_slave_job(multi, &multi->slaves[0]);
+		for (i = 1; i < multi->slaves_count; ++i) {
+			while (sem_wait(&multi->done) < 0 && errno == EINTR)
+				;
+		}
+		for (i = 0; i < multi->slaves_count; ++i) {
+			result = multi->slaves[i].result;
+			if (result < 0)
+				return result;
+			if (ret > result)
+				ret = result;
+		}
+		return ret;
+	}
+#endif
+	for (i = 0; i < multi->slaves_count; ++i) {
+		result = snd_pcm_multi_slave_job(multi, &multi->slaves[i]);
+		if (result < 0)
+			return result;
+		if (ret > result)
+			ret = result;
+	}
+	return ret;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void *snd_pcm_multi_worker(void *data)
+{
+	snd_pcm_multi_slave_t *slave = data;
+	snd_pcm_multi_t *multi = slave->multi;
+
+	for (;;) {
+		while (sem_wait(&slave->request) < 0 && errno == EINTR)
+			;
+		if (multi->job == MULTI_JOB_QUIT)
+			break;
+		slave->result = snd_pcm_multi_slave_job(multi, slave);
+		sem_post(&multi->done);
+	}
+	return NULL;
+}
+
+static void snd_pcm_multi_workers_stop(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	if (!multi->workers)
+		return;
+	multi->job = MULTI_JOB_QUIT;
+	for (i = 1; i < multi->slaves_count; ++i)
+		sem_post(&multi->slaves[i].request);
+	for (i = 1; i < multi->slaves_count; ++i) {
+		pthread_join(multi->slaves[i].thread, NULL);
+		sem_destroy(&multi->slaves[i].request);
+	}
+	sem_destroy(&multi->done);
+	multi->workers = 0;
+}
+
+/* one worker for each slave but the first, which the caller services */
+static int snd_pcm_multi_workers_start(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+	int err;
+
+	if (!multi->threads || multi->workers || multi->slaves_count < 2)
+		return 0;
+	if (sem_init(&multi->done, 0, 0) < 0)
+		return -errno;
+	for (i = 1; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (sem_init(&slave->request, 0, 0) < 0) {
+			err = -errno;
+			goto _err;
+		}
+		err = pthread_create(&slave->thread, NULL,
+				     snd_pcm_multi_worker, slave);
+		if (err) {
+			SNDERR("cannot create the worker thread for slave %u", i);
+			sem_destroy(&slave->request);
+			err = -err;
+			goto _err;
+		}
+	}
+	multi->workers = 1;
+	return 0;
+
+ _err:
+	multi->job = MULTI_JOB_QUIT;
+	while (--i > 0) {
+		sem_post(&multi->slaves[i].request);
+		pthread_join(multi->slaves[i].thread, NULL);
+		sem_destroy(&multi->slaves[i].request);
+	}
+	sem_destroy(&multi->done);
+	return err;
+}
+#else
+#define snd_pcm_multi_workers_start(multi)	0
+#define snd_pcm_multi_workers_stop(multi)	do { } while (0)
+#endif /* HAVE_LIBPTHREAD */
+
+static void snd_pcm_multi_skew_reset(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		multi->slaves[i].skew = 0;
+		multi->slaves[i].skew_max = 0;
+	}
+}
+
 static int snd_pcm_multi_close(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int ret = 0;
+	snd_pcm_multi_workers_stop(multi);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
 		if (slave->close_slave) {
@@ -351,7 +737,7 @@ static int snd_pcm_multi_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		}
 	}
 	reset_links(multi);
-	return 0;
+	return snd_pcm_multi_workers_start(multi);
 }
 
 static int snd_pcm_multi_hw_free(snd_pcm_t *pcm)
@@ -359,6 +745,7 @@ static int snd_pcm_multi_hw_free(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int err = 0;
+	snd_pcm_multi_workers_stop(multi);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave = multi->slaves[i].pcm;
 		int e = snd_pcm_hw_free(slave);
@@ -405,12 +792,17 @@ static snd_pcm_state_t snd_pcm_multi_state(snd_pcm_t *pcm)
 static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	snd_pcm_uframes_t hw_ptr = 0, slave_hw_ptr, avail, last_avail;
+	snd_pcm_multi_slave_t *master = &multi->slaves[multi->master_slave];
+	snd_pcm_uframes_t hw_ptr = 0, slave_hw_ptr, master_hw_ptr, avail, last_avail;
+	snd_pcm_uframes_t master_queued, dt;
 	unsigned int i;
 	/* the logic is really simple, choose the lowest hw_ptr from slaves */
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		last_avail = 0;
 		for (i = 0; i < multi->slaves_count; ++i) {
+			/* drift slaves run in their own frame domain */
+			if (multi->slaves[i].drift)
+				continue;
 			slave_hw_ptr = *multi->slaves[i].pcm->hw.ptr;
 			avail = __snd_pcm_playback_avail(pcm, multi->hw_ptr, slave_hw_ptr);
 			if (avail > last_avail) {
@@ -430,18 +822,53 @@ static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 		}
 	}
 	multi->hw_ptr = hw_ptr;
+
+	/*
+	 * How far each slave runs ahead (+) or behind (-) the master; for a
+	 * drift slave this is the difference of the queued frames, which is
+	 * also what its ratio controller works on.
+	 */
+	master_hw_ptr = *master->pcm->hw.ptr;
+	master_queued = pcm_frame_diff(*master->pcm->appl.ptr, master_hw_ptr,
+				       pcm->boundary);
+	dt = pcm_frame_diff(master_hw_ptr, multi->drift_hw_ptr, pcm->boundary);
+	multi->drift_hw_ptr = master_hw_ptr;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		snd_pcm_sframes_t skew;
+		if (slave->drift) {
+			snd_pcm_uframes_t queued;
+			queued = pcm_frame_diff(*slave->pcm->appl.ptr,
+						*slave->pcm->hw.ptr,
+						pcm->boundary) +
+				 snd_pcm_multi_drift_backlog(multi, slave);
+			skew = (snd_pcm_sframes_t)master_queued -
+			       (snd_pcm_sframes_t)queued;
+			/* only while the master is consuming */
+			if (dt > 0 && dt < pcm->buffer_size)
+				snd_pcm_multi_drift_update(pcm, slave, -skew, dt);
+		} else {
+			skew = *slave->pcm->hw.ptr - master_hw_ptr;
+			if (skew > (snd_pcm_sframes_t)(pcm->boundary / 2))
+				skew -= pcm->boundary;
+			else if (skew < -(snd_pcm_sframes_t)(pcm->boundary / 2))
+				skew += pcm->boundary;
+		}
+		slave->skew = skew;
+		if (skew < 0)
+			skew = -skew;
+		if (skew > slave->skew_max)
+			slave->skew_max = skew;
+	}
 }
 
 static int snd_pcm_multi_hwsync(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	unsigned int i;
-	int err;
-	for (i = 0; i < multi->slaves_count; ++i) {
-		err = snd_pcm_hwsync(multi->slaves[i].pcm);
-		if (err < 0)
-			return err;
-	}
+	snd_pcm_sframes_t err;
+	err = snd_pcm_multi_run(multi, MULTI_JOB_HWSYNC, 0, 0);
+	if (err < 0)
+		return err;
 	snd_pcm_multi_hwptr_update(pcm);
 	return 0;
 }
@@ -466,16 +893,10 @@ static int snd_pcm_multi_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 static snd_pcm_sframes_t snd_pcm_multi_avail_update(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	snd_pcm_sframes_t ret = LONG_MAX;
-	unsigned int i;
-	for (i = 0; i < multi->slaves_count; ++i) {
-		snd_pcm_sframes_t avail;
-		avail = snd_pcm_avail_update(multi->slaves[i].pcm);
-		if (avail < 0)
-			return avail;
-		if (ret > avail)
-			ret = avail;
-	}
+	snd_pcm_sframes_t ret;
+	ret = snd_pcm_multi_run(multi, MULTI_JOB_AVAIL_UPDATE, 0, 0);
+	if (ret < 0)
+		return ret;
 	snd_pcm_multi_hwptr_update(pcm);
 	return ret;
 }
@@ -502,6 +923,8 @@ static int snd_pcm_multi_prepare(snd_pcm_t *pcm)
 			result = err;
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	snd_pcm_multi_skew_reset(multi);
+	snd_pcm_multi_drift_reset(multi);
 	return result;
 }
 
@@ -517,6 +940,8 @@ static int snd_pcm_multi_reset(snd_pcm_t *pcm)
 			result = err;
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	snd_pcm_multi_skew_reset(multi);
+	snd_pcm_multi_drift_reset(multi);
 	return result;
 }
 
@@ -600,6 +1025,17 @@ static int snd_pcm_multi_channel_info(snd_pcm_t *pcm, snd_pcm_channel_info_t *in
 	int err;
 	if (c->slave_idx < 0)
 		return -ENXIO;
+	if (multi->slaves[c->slave_idx].drift) {
+		const snd_pcm_channel_area_t *a;
+		if (!multi->slaves[c->slave_idx].drift_areas)
+			return -EBADFD;
+		a = &multi->slaves[c->slave_idx].drift_areas[c->slave_channel];
+		info->addr = a->addr;
+		info->first = a->first;
+		info->step = a->step;
+		info->type = SND_PCM_AREA_LOCAL;
+		return 0;
+	}
 	info->channel = c->slave_channel;
 	err = snd_pcm_channel_info(multi->slaves[c->slave_idx].pcm, info);
 	info->channel = channel;
@@ -612,6 +1048,10 @@ static snd_pcm_sframes_t snd_pcm_multi_rewindable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	/* resampled data cannot be moved back and forth */
+	if (multi->drift_count)
+		return 0;
+
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_rewindable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -630,6 +1070,10 @@ static snd_pcm_sframes_t snd_pcm_multi_forwardable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	/* resampled data cannot be moved back and forth */
+	if (multi->drift_count)
+		return 0;
+
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_forwardable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -647,6 +1091,8 @@ static snd_pcm_sframes_t snd_pcm_multi_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift_count)
+		return 0;
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -677,6 +1123,8 @@ static snd_pcm_sframes_t snd_pcm_multi_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift_count)
+		return 0;
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -770,18 +1218,11 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 						   snd_pcm_uframes_t size)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	snd_pcm_t *slave;
-	unsigned int i;
 	snd_pcm_sframes_t result;
 
-	for (i = 0; i < multi->slaves_count; ++i) {
-		slave = multi->slaves[i].pcm;
-		result = snd_pcm_mmap_commit(slave, offset, size);
-		if (result < 0)
-			return result;
-		if ((snd_pcm_uframes_t)result != size)
-			return -EIO;
-	}
+	result = snd_pcm_multi_run(multi, MULTI_JOB_MMAP_COMMIT, offset, size);
+	if (result < 0)
+		return result;
 	multi->appl_ptr += size;
 	multi->appl_ptr %= pcm->boundary;
 	return size;
@@ -789,10 +1230,61 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 
 static int snd_pcm_multi_munmap(snd_pcm_t *pcm)
 {
+	snd_pcm_multi_t *multi = pcm->private_data;
+	unsigned int i;
 	free(pcm->mmap_channels);
 	free(pcm->running_areas);
 	pcm->mmap_channels = NULL;
 	pcm->running_areas = NULL;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		free(slave->drift_buf);
+		free(slave->drift_areas);
+		free(slave->drift_prev);
+		free(slave->drift_next);
+		slave->drift_buf = NULL;
+		slave->drift_areas = NULL;
+		slave->drift_prev = NULL;
+		slave->drift_next = NULL;
+	}
+	return 0;
+}
+
+/* drift slaves get a private buffer the application writes into */
+static int snd_pcm_multi_drift_mmap(snd_pcm_t *pcm, snd_pcm_multi_slave_t *slave)
+{
+	unsigned int c, width;
+	size_t size;
+
+	switch (pcm->format) {
+	case SND_PCM_FORMAT_S16:
+	case SND_PCM_FORMAT_S24:
+	case SND_PCM_FORMAT_S32:
+	case SND_PCM_FORMAT_FLOAT:
+		break;
+	default:
+		SNDERR("drift compensation does not support the %s format",
+		       snd_pcm_format_name(pcm->format));
+		return -EINVAL;
+	}
+	width = snd_pcm_format_physical_width(pcm->format);
+	size = (size_t)pcm->buffer_size * width / 8;
+	slave->drift_buf = calloc(slave->channels_count, size);
+	slave->drift_areas = calloc(slave->channels_count,
+				    sizeof(*slave->drift_areas));
+	slave->drift_prev = calloc(slave->channels_count, sizeof(float));
+	slave->drift_next = calloc(slave->channels_count, sizeof(float));
+	if (!slave->drift_buf || !slave->drift_areas ||
+	    !slave->drift_prev || !slave->drift_next)
+		return -ENOMEM;
+	for (c = 0; c < slave->channels_count; c++) {
+		slave->drift_areas[c].addr = slave->drift_buf + c * size;
+		slave->drift_areas[c].first = 0;
+		slave->drift_areas[c].step = width;
+	}
+	slave->drift_phase = 1.0;
+	if (slave->drift_step == 0)
+		slave->drift_step = 1.0;
 	return 0;
 }
 
@@ -810,6 +1302,17 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 		return -ENOMEM;
 	}
 
+	for (c = 0; c < multi->slaves_count; c++) {
+		int err;
+		if (!multi->slaves[c].drift)
+			continue;
+		err = snd_pcm_multi_drift_mmap(pcm, &multi->slaves[c]);
+		if (err < 0) {
+			snd_pcm_multi_munmap(pcm);
+			return err;
+		}
+	}
+
 	/* Copy the slave mmapped buffer data */
 	for (c = 0; c < pcm->channels; c++) {
 		snd_pcm_multi_channel_t *chan = &multi->channels[c];
@@ -818,6 +1321,17 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 			snd_pcm_multi_munmap(pcm);
 			return -ENXIO;
 		}
+		if (multi->slaves[chan->slave_idx].drift) {
+			const snd_pcm_channel_area_t *a;
+			a = &multi->slaves[chan->slave_idx].drift_areas[chan->slave_channel];
+			pcm->mmap_channels[c].channel = c;
+			pcm->mmap_channels[c].addr = a->addr;
+			pcm->mmap_channels[c].first = a->first;
+			pcm->mmap_channels[c].step = a->step;
+			pcm->mmap_channels[c].type = SND_PCM_AREA_LOCAL;
+			pcm->running_areas[c] = *a;
+			continue;
+		}
 		slave = multi->slaves[chan->slave_idx].pcm;
 		pcm->mmap_channels[c] =
 			slave->mmap_channels[chan->slave_channel];
@@ -984,7 +1498,19 @@ static void snd_pcm_multi_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_output_printf(out, "    %d: slave %d, channel %d\n", 
 			k, c->slave_idx, c->slave_channel);
 	}
+	snd_output_printf(out, "  Parallel slave I/O: %s\n",
+			  multi->workers ? "yes" : "no");
 	if (pcm->setup) {
+		snd_output_printf(out, "  Slave hw_ptr skew from the master (frames):\n");
+		for (k = 0; k < multi->slaves_count; ++k) {
+			snd_pcm_multi_slave_t *s = &multi->slaves[k];
+			snd_output_printf(out, "    %d: last %ld, max %ld", k,
+					  (long)s->skew, (long)s->skew_max);
+			if (s->drift)
+				snd_output_printf(out, ", ratio %+.1f ppm",
+						  (s->drift_step - 1.0) * 1e6);
+			snd_output_printf(out, "\n");
+		}
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
 	}
@@ -1106,6 +1632,7 @@ int snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 		slave->pcm = slaves_pcm[i];
 		slave->channels_count = schannels_count[i];
 		slave->close_slave = close_slaves;
+		slave->multi = multi;
 	}
 	for (i = 0; i < channels_count; ++i) {
 		snd_pcm_multi_channel_t *bind = &multi->channels[i];
@@ -1166,9 +1693,36 @@ pcm.name {
 		}
 	}
 	[master INT]		# Define the master slave
+	[threads BOOL]		# Service the slaves from worker threads
+	[drift STR]		# Slave key to resample to the master clock
+	# or
+	[drift [ STR ... ]]	# Slave keys to resample to the master clock
 }
 \endcode
 
+With \c threads enabled, every slave but the first gets its own worker
+thread while the PCM is set up.  The pointer syncs, avail updates and
+mmap commits are then issued to all slaves at once instead of one after
+the other, so the time spent per call stays close to that of the slowest
+slave when many devices are aggregated.  It costs a thread wakeup per
+slave and call, and pays off only when the slave calls themselves are
+expensive (e.g. hw slaves doing ioctls); it is off by default.
+
+The dump of the PCM shows, for each slave, the last and the largest
+distance in frames between its hardware pointer and that of the master
+slave since the last prepare.
+
+Slaves which don't share the clock of the master (e.g. separate USB
+devices) drift apart and sooner or later one of them runs into an xrun.
+The playback slaves listed in \c drift are fed through a linear
+interpolating resampler with a ratio close to one: a PI controller
+compares the frames queued in the slave with those queued in the master
+and steers the ratio, within +-1000 ppm, so that both stay aligned
+without dropping or repeating frames.  Such slaves take the S16, S24, S32
+or FLOAT format, cannot be rewound or forwarded, and the dump shows the
+current ratio.  For them the reported skew is the difference of the
+queued frames.
+
 For example, to bind two PCM streams with two-channel stereo (hw:0,0 and
 hw:0,1) as one 4-channel stereo PCM stream, define like this:
 \code
@@ -1215,6 +1769,61 @@ pcm.quad2 {
 
 */
 
+#ifndef DOC_HIDDEN
+static int snd_pcm_multi_drift_slave(snd_config_t *n, const char **slaves_id,
+				     unsigned int slaves_count,
+				     unsigned int master_slave, char *slaves_drift)
+{
+	const char *str;
+	unsigned int k;
+
+	if (snd_config_get_string(n, &str) < 0) {
+		SNDERR("Invalid slave name for drift");
+		return -EINVAL;
+	}
+	for (k = 0; k < slaves_count; ++k) {
+		if (strcmp(slaves_id[k], str) == 0)
+			break;
+	}
+	if (k == slaves_count) {
+		SNDERR("Unknown drift slave %s", str);
+		return -EINVAL;
+	}
+	if (k == master_slave) {
+		SNDERR("The master slave %s cannot drift", str);
+		return -EINVAL;
+	}
+	slaves_drift[k] = 1;
+	return 0;
+}
+
+/* drift STR or drift [ STR ... ]: the slaves to resample */
+static int snd_pcm_multi_parse_drift(snd_config_t *conf, const char **slaves_id,
+				     unsigned int slaves_count,
+				     unsigned int master_slave,
+				     snd_pcm_stream_t stream, char *slaves_drift)
+{
+	snd_config_iterator_t i, next;
+	int err;
+
+	if (stream != SND_PCM_STREAM_PLAYBACK) {
+		SNDERR("drift compensation is supported only for playback");
+		return -EINVAL;
+	}
+	if (snd_config_get_type(conf) != SND_CONFIG_TYPE_COMPOUND)
+		return snd_pcm_multi_drift_slave(conf, slaves_id, slaves_count,
+						 master_slave, slaves_drift);
+	snd_config_for_each(i, next, conf) {
+		err = snd_pcm_multi_drift_slave(snd_config_iterator_entry(i),
+						slaves_id, slaves_count,
+						master_slave, slaves_drift);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+#endif
+
 /**
  * \brief Creates a new Multi PCM
  * \param pcmp Returns created PCM handle
@@ -1235,6 +1844,7 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	snd_config_iterator_t i, inext, j, jnext;
 	snd_config_t *slaves = NULL;
 	snd_config_t *bindings = NULL;
+	snd_config_t *drift = NULL;
 	int err;
 	unsigned int idx;
 	const char **slaves_id = NULL;
@@ -1243,9 +1853,11 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	unsigned int *slaves_channels = NULL;
 	int *channels_sidx = NULL;
 	unsigned int *channels_schannel = NULL;
+	char *slaves_drift = NULL;
 	unsigned int slaves_count = 0;
 	long master_slave = 0;
 	unsigned int channels_count = 0;
+	int threads = 0;
 	snd_config_for_each(i, inext, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1276,6 +1888,23 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "drift") == 0) {
+			drift = n;
+			continue;
+		}
+		if (strcmp(id, "threads") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return -EINVAL;
+#ifndef HAVE_LIBPTHREAD
+			if (err) {
+				SNDERR("The worker threads need pthread support");
+				return -EINVAL;
+			}
+#endif
+			threads = err;
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1318,8 +1947,9 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	slaves_channels = calloc(slaves_count, sizeof(*slaves_channels));
 	channels_sidx = calloc(channels_count, sizeof(*channels_sidx));
 	channels_schannel = calloc(channels_count, sizeof(*channels_schannel));
+	slaves_drift = calloc(slaves_count, sizeof(*slaves_drift));
 	if (!slaves_id || !slaves_conf || !slaves_pcm || !slaves_channels ||
-	    !channels_sidx || !channels_schannel) {
+	    !channels_sidx || !channels_schannel || !slaves_drift) {
 		err = -ENOMEM;
 		goto _free;
 	}
@@ -1341,6 +1971,13 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 		++idx;
 	}
 
+	if (drift) {
+		err = snd_pcm_multi_parse_drift(drift, slaves_id, slaves_count,
+						master_slave, stream, slaves_drift);
+		if (err < 0)
+			goto _free;
+	}
+
 	snd_config_for_each(i, inext, bindings) {
 		snd_config_t *m = snd_config_iterator_entry(i);
 		long cchannel = -1;
@@ -1424,6 +2061,14 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 				 channels_count,
 				 channels_sidx, channels_schannel,
 				 1);
+	if (err >= 0) {
+		snd_pcm_multi_t *multi = (*pcmp)->private_data;
+		multi->threads = threads;
+		for (idx = 0; idx < slaves_count; ++idx) {
+			multi->slaves[idx].drift = slaves_drift[idx];
+			multi->drift_count += slaves_drift[idx];
+		}
+	}
 _free:
 	if (err < 0) {
 		for (idx = 0; idx < slaves_count; ++idx) {
@@ -1442,6 +2087,7 @@ _free:
 	free(slaves_channels);
 	free(channels_sidx);
 	free(channels_schannel);
+	free(slaves_drift);
 	free(slaves_id);
 	return err;
 }
@@ -143,8 +143,9 @@ int snd_pcm_hw_param_get(const snd_pcm_hw_params_t *params, snd_pcm_hw_param_t v
 		const snd_interval_t *i = hw_param_interval_c(params, var);
 		if (snd_interval_empty(i) || !snd_interval_single(i))
 			return -EINVAL;
+		/* the value of (x x+1] is x+1 itself, not above it */
 		if (dir)
-			*dir = i->openmin;
+			*dir = i->openmin && i->openmax;
 		if (val)
 			*val = snd_interval_value(i);
 		return 0;
@@ -2068,42 +2069,48 @@ static const snd_interval_t refine_intervals[SND_PCM_HW_PARAM_LAST_INTERVAL - SN
 #define RULES_DEBUG
 #endif
 
-int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t *params)
+/* apply one rule, returns the rule function's result */
+static int snd_pcm_hw_rule_apply(snd_pcm_hw_params_t *params, unsigned int k)
 {
-	unsigned int k;
-	snd_interval_t *i;
-	unsigned int rstamps[RULES];
-	unsigned int vstamps[SND_PCM_HW_PARAM_LAST_INTERVAL + 1];
-	unsigned int stamp = 2;
-	int changed, again;
+	const snd_pcm_hw_rule_t *r = &refine_rules[k];
+	int changed;
 #ifdef RULES_DEBUG
+	unsigned int d;
 	snd_output_t *log;
 	snd_output_stdio_attach(&log, stderr, 0);
-	snd_output_printf(log, "refine_soft '%s' (begin)\n", pcm->name);
-	snd_pcm_hw_params_dump(params, log);
+	snd_output_printf(log, "Rule %d (%p): ", k, r->func);
+	if (r->var >= 0) {
+		snd_output_printf(log, "%s=", snd_pcm_hw_param_name(r->var));
+		snd_pcm_hw_param_dump(params, r->var, log);
+		snd_output_puts(log, " -> ");
+	}
 #endif
-
-	for (k = SND_PCM_HW_PARAM_FIRST_MASK; k <= SND_PCM_HW_PARAM_LAST_MASK; k++) {
-		if (!(params->rmask & (1 << k)))
-			continue;
-		changed = snd_mask_refine(hw_param_mask(params, k),
-					  &refine_masks[k - SND_PCM_HW_PARAM_FIRST_MASK]);
-		if (changed)
-			params->cmask |= 1 << k;
-		if (changed < 0)
-			goto _err;
+	changed = r->func(params, r);
+#ifdef RULES_DEBUG
+	if (r->var >= 0)
+		snd_pcm_hw_param_dump(params, r->var, log);
+	for (d = 0; r->deps[d] >= 0; d++) {
+		snd_output_printf(log, " %s=", snd_pcm_hw_param_name(r->deps[d]));
+		snd_pcm_hw_param_dump(params, r->deps[d], log);
 	}
+	snd_output_putc(log, '\n');
+	snd_output_close(log);
+#endif
+	return changed;
+}
 
-	for (k = SND_PCM_HW_PARAM_FIRST_INTERVAL; k <= SND_PCM_HW_PARAM_LAST_INTERVAL; k++) {
-		if (!(params->rmask & (1 << k)))
-			continue;
-		changed = snd_interval_refine(hw_param_interval(params, k),
-				      &refine_intervals[k - SND_PCM_HW_PARAM_FIRST_INTERVAL]);
-		if (changed)
-			params->cmask |= 1 << k;
-		if (changed < 0)
-			goto _err;
-	}
+/*
+ * Original engine: evaluate all rules in passes until nothing changes;
+ * a rule is re-run when any of its dependencies got a newer stamp than
+ * the rule itself.
+ */
+static int snd_pcm_hw_rules_passes(snd_pcm_hw_params_t *params)
+{
+	unsigned int k;
+	unsigned int rstamps[RULES];
+	unsigned int vstamps[SND_PCM_HW_PARAM_LAST_INTERVAL + 1];
+	unsigned int stamp = 2;
+	int changed, again;
 
 	for (k = 0; k < RULES; k++)
 		rstamps[k] = 0;
@@ -2123,24 +2130,7 @@ int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t
 			}
 			if (!doit)
 				continue;
-#ifdef RULES_DEBUG
-			snd_output_printf(log, "Rule %d (%p): ", k, r->func);
-			if (r->var >= 0) {
-				snd_output_printf(log, "%s=", snd_pcm_hw_param_name(r->var));
-				snd_pcm_hw_param_dump(params, r->var, log);
-				snd_output_puts(log, " -> ");
-			}
-#endif
-			changed = r->func(params, r);
-#ifdef RULES_DEBUG
-			if (r->var >= 0)
-				snd_pcm_hw_param_dump(params, r->var, log);
-			for (d = 0; r->deps[d] >= 0; d++) {
-				snd_output_printf(log, " %s=", snd_pcm_hw_param_name(r->deps[d]));
-				snd_pcm_hw_param_dump(params, r->deps[d], log);
-			}
-			snd_output_putc(log, '\n');
-#endif
+			changed = snd_pcm_hw_rule_apply(params, k);
 			rstamps[k] = stamp;
 			if (changed && r->var >= 0) {
 				params->cmask |= 1 << r->var;
@@ -2148,10 +2138,99 @@ int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t
 				again = 1;
 			}
 			if (changed < 0)
-				goto _err;
+				return changed;
 			stamp++;
 		}
 	} while (again);
+	return 0;
+}
+
+/*
+ * Worklist engine: keep the set of rules whose dependencies changed
+ * since their last run as a bitmask and visit only those, in the same
+ * order as the passes above.  This runs exactly the same sequence of
+ * rules as snd_pcm_hw_rules_passes(), hence gives identical results,
+ * without scanning the dependencies of every rule on every pass.
+ */
+static int snd_pcm_hw_rules_worklist(snd_pcm_hw_params_t *params)
+{
+	uint32_t users[SND_PCM_HW_PARAM_LAST_INTERVAL + 1];
+	uint32_t pending = 0;
+	unsigned int k, d;
+	int changed;
+
+	assert(RULES <= 32);
+	memset(users, 0, sizeof(users));
+	for (k = 0; k < RULES; k++) {
+		const snd_pcm_hw_rule_t *r = &refine_rules[k];
+		for (d = 0; r->deps[d] >= 0; d++) {
+			users[r->deps[d]] |= 1U << k;
+			if (params->rmask & (1 << r->deps[d]))
+				pending |= 1U << k;
+		}
+	}
+	k = 0;
+	while (pending) {
+		const snd_pcm_hw_rule_t *r;
+		uint32_t ahead = pending & (~0U << k);
+
+		/* next pending rule in this pass, or restart the pass */
+		k = __builtin_ctz(ahead ? ahead : pending);
+		r = &refine_rules[k];
+		changed = snd_pcm_hw_rule_apply(params, k);
+		if (changed && r->var >= 0) {
+			params->cmask |= 1 << r->var;
+			pending |= users[r->var];
+		}
+		pending &= ~(1U << k);
+		if (changed < 0)
+			return changed;
+		if (++k >= RULES)
+			k = 0;
+	}
+	return 0;
+}
+
+int snd_pcm_hw_refine_soft(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+	unsigned int k;
+	snd_interval_t *i;
+	int changed;
+#ifdef RULES_DEBUG
+	snd_output_t *log;
+	snd_output_stdio_attach(&log, stderr, 0);
+	snd_output_printf(log, "refine_soft '%s' (begin)\n", pcm->name);
+	snd_pcm_hw_params_dump(params, log);
+#endif
+
+	for (k = SND_PCM_HW_PARAM_FIRST_MASK; k <= SND_PCM_HW_PARAM_LAST_MASK; k++) {
+		if (!(params->rmask & (1 << k)))
+			continue;
+		changed = snd_mask_refine(hw_param_mask(params, k),
+					  &refine_masks[k - SND_PCM_HW_PARAM_FIRST_MASK]);
+		if (changed)
+			params->cmask |= 1 << k;
+		if (changed < 0)
+			goto _err;
+	}
+
+	for (k = SND_PCM_HW_PARAM_FIRST_INTERVAL; k <= SND_PCM_HW_PARAM_LAST_INTERVAL; k++) {
+		if (!(params->rmask & (1 << k)))
+			continue;
+		changed = snd_interval_refine(hw_param_interval(params, k),
+				      &refine_intervals[k - SND_PCM_HW_PARAM_FIRST_INTERVAL]);
+		if (changed)
+			params->cmask |= 1 << k;
+		if (changed < 0)
+			goto _err;
+	}
+
+	if (pcm && pcm->refine_passes)
+		changed = snd_pcm_hw_rules_passes(params);
+	else
+		changed = snd_pcm_hw_rules_worklist(params);
+	if (changed < 0)
+		goto _err;
 	if (!params->msbits) {
 		i = hw_param_interval(params, SND_PCM_HW_PARAM_SAMPLE_BITS);
 		if (snd_interval_single(i))
@@ -2344,6 +2423,242 @@ static int snd_pcm_sw_params_default(snd_pcm_t *pcm, snd_pcm_sw_params_t *params
 #define REFINE_DEBUG
 #endif
 
+/*
+ * Refinement cache
+ *
+ * The result of hw_refine depends only on the given params for most
+ * plugins, so each PCM handle in a chain memoizes the refinements that
+ * come again, keyed by the used fields of the input params (the reserved
+ * ones are left out).  A miss costs the hashing of these fields only: a
+ * key is copied and stored when it is seen for the second time, and the
+ * entries are allocated on the first store, so a one-off sequence (open,
+ * negotiate, close) doesn't pay for a cache it never hits.
+ * PCMs whose constraints depend on an outside state (the kernel driver,
+ * other clients of a shared slave) are marked with refine_volatile; a
+ * refinement that touched such a PCM anywhere down the chain is never
+ * stored, and the PCM above it turns volatile as well.
+ * snd_pcm_hw_refine_invalidate() drops all cached results, e.g. when an
+ * external plugin changes its constraints.  Setting $LIBASOUND_REFINE_CACHE
+ * to 0 disables the cache for the PCMs opened afterwards.
+ * The cache of a PCM is accessed under __snd_pcm_lock(), as the plugins
+ * declared thread-safe (hw, share...) skip snd_pcm_lock().
+ */
+#define REFINE_CACHE_SIZE	16
+#define REFINE_SEEN_SIZE	16
+
+/* the used parts of snd_pcm_hw_params_t: flags and masks, intervals,
+ * and rmask up to fifo_size */
+#define REFINE_KEY1_OFS	offsetof(snd_pcm_hw_params_t, flags)
+#define REFINE_KEY1_LEN	(offsetof(snd_pcm_hw_params_t, mres) - REFINE_KEY1_OFS)
+#define REFINE_KEY2_OFS	offsetof(snd_pcm_hw_params_t, intervals)
+#define REFINE_KEY2_LEN	(offsetof(snd_pcm_hw_params_t, ires) - REFINE_KEY2_OFS)
+#define REFINE_KEY3_OFS	offsetof(snd_pcm_hw_params_t, rmask)
+#define REFINE_KEY3_LEN	(offsetof(snd_pcm_hw_params_t, reserved) - REFINE_KEY3_OFS)
+#define REFINE_KEY_LEN	(REFINE_KEY1_LEN + REFINE_KEY2_LEN + REFINE_KEY3_LEN)
+
+typedef struct {
+	unsigned int hash;
+	unsigned int generation;
+	int result;
+	unsigned char in[REFINE_KEY_LEN];
+	unsigned char out[REFINE_KEY_LEN];
+} snd_pcm_refine_entry_t;
+
+struct snd_pcm_refine_cache {
+	unsigned int seen[REFINE_SEEN_SIZE];	/* hashes of recent misses */
+	unsigned int seen_next;
+	unsigned int next;
+	unsigned int count;
+	snd_pcm_refine_entry_t *entry;		/* allocated on first store */
+};
+
+/* bumped by snd_pcm_hw_refine_invalidate() */
+static unsigned int refine_generation;
+/* bumped by each refinement of a volatile PCM */
+static unsigned int refine_volatile_serial;
+
+static void refine_key_get(unsigned char *key, const snd_pcm_hw_params_t *params)
+{
+	const unsigned char *p = (const unsigned char *)params;
+
+	memcpy(key, p + REFINE_KEY1_OFS, REFINE_KEY1_LEN);
+	key += REFINE_KEY1_LEN;
+	memcpy(key, p + REFINE_KEY2_OFS, REFINE_KEY2_LEN);
+	key += REFINE_KEY2_LEN;
+	memcpy(key, p + REFINE_KEY3_OFS, REFINE_KEY3_LEN);
+}
+
+static void refine_key_put(snd_pcm_hw_params_t *params, const unsigned char *key)
+{
+	unsigned char *p = (unsigned char *)params;
+
+	memcpy(p + REFINE_KEY1_OFS, key, REFINE_KEY1_LEN);
+	key += REFINE_KEY1_LEN;
+	memcpy(p + REFINE_KEY2_OFS, key, REFINE_KEY2_LEN);
+	key += REFINE_KEY2_LEN;
+	memcpy(p + REFINE_KEY3_OFS, key, REFINE_KEY3_LEN);
+}
+
+static int refine_key_equal(const unsigned char *key,
+			    const snd_pcm_hw_params_t *params)
+{
+	const unsigned char *p = (const unsigned char *)params;
+
+	return !memcmp(key, p + REFINE_KEY1_OFS, REFINE_KEY1_LEN) &&
+	       !memcmp(key + REFINE_KEY1_LEN, p + REFINE_KEY2_OFS,
+		       REFINE_KEY2_LEN) &&
+	       !memcmp(key + REFINE_KEY1_LEN + REFINE_KEY2_LEN,
+		       p + REFINE_KEY3_OFS, REFINE_KEY3_LEN);
+}
+
+/* FNV-1a over 32 bit words */
+static unsigned int refine_hash_range(unsigned int hash, const void *data,
+				      size_t len)
+{
+	const uint32_t *w = data;
+
+	for (len /= 4; len > 0; len--, w++)
+		hash = (hash ^ *w) * 16777619U;
+	return hash;
+}
+
+static unsigned int refine_hash(const snd_pcm_hw_params_t *params)
+{
+	const unsigned char *p = (const unsigned char *)params;
+	unsigned int hash = 2166136261U;
+
+	hash = refine_hash_range(hash, p + REFINE_KEY1_OFS, REFINE_KEY1_LEN);
+	hash = refine_hash_range(hash, p + REFINE_KEY2_OFS, REFINE_KEY2_LEN);
+	return refine_hash_range(hash, p + REFINE_KEY3_OFS, REFINE_KEY3_LEN);
+}
+
+static snd_pcm_refine_entry_t *refine_cache_lookup(struct snd_pcm_refine_cache *cache,
+						   const snd_pcm_hw_params_t *params,
+						   unsigned int hash,
+						   unsigned int generation)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->count; i++) {
+		snd_pcm_refine_entry_t *e = &cache->entry[i];
+		if (e->hash == hash && e->generation == generation &&
+		    refine_key_equal(e->in, params))
+			return e;
+	}
+	return NULL;
+}
+
+/* remember the hash of a miss, returns 1 if it was seen already */
+static int refine_cache_seen(struct snd_pcm_refine_cache *cache,
+			     unsigned int hash)
+{
+	unsigned int i;
+
+	for (i = 0; i < REFINE_SEEN_SIZE; i++)
+		if (cache->seen[i] == hash)
+			return 1;
+	cache->seen[cache->seen_next] = hash;
+	cache->seen_next = (cache->seen_next + 1) % REFINE_SEEN_SIZE;
+	return 0;
+}
+
+static snd_pcm_refine_entry_t *refine_cache_slot(struct snd_pcm_refine_cache *cache)
+{
+	snd_pcm_refine_entry_t *e;
+
+	if (!cache->entry) {
+		cache->entry = malloc(REFINE_CACHE_SIZE * sizeof(*cache->entry));
+		if (!cache->entry)
+			return NULL;
+	}
+	e = &cache->entry[cache->next];
+	cache->next = (cache->next + 1) % REFINE_CACHE_SIZE;
+	if (cache->count < REFINE_CACHE_SIZE)
+		cache->count++;
+	return e;
+}
+
+/*
+ * refine with the per-PCM cache; the cache and refine_volatile are
+ * guarded by the PCM lock, which is not held over the refinement itself
+ */
+static int snd_pcm_hw_refine_cached(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+	struct snd_pcm_refine_cache *cache;
+	unsigned char in[REFINE_KEY_LEN];
+	snd_pcm_refine_entry_t *e;
+	unsigned int hash, generation, serial;
+	int res, store;
+
+	__snd_pcm_lock(pcm);
+	if (pcm->refine_volatile) {
+		__snd_pcm_unlock(pcm);
+		__atomic_add_fetch(&refine_volatile_serial, 1, __ATOMIC_RELEASE);
+		return pcm->ops->hw_refine(pcm->op_arg, params);
+	}
+	cache = pcm->refine_cache;
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache) {
+			__snd_pcm_unlock(pcm);
+			return pcm->ops->hw_refine(pcm->op_arg, params);
+		}
+		pcm->refine_cache = cache;
+	}
+	generation = __atomic_load_n(&refine_generation, __ATOMIC_ACQUIRE);
+	hash = refine_hash(params);
+	e = refine_cache_lookup(cache, params, hash, generation);
+	if (e) {
+		refine_key_put(params, e->out);
+		res = e->result;
+		__snd_pcm_unlock(pcm);
+		return res;
+	}
+	store = refine_cache_seen(cache, hash);
+	__snd_pcm_unlock(pcm);
+
+	if (store)
+		refine_key_get(in, params);
+	serial = __atomic_load_n(&refine_volatile_serial, __ATOMIC_ACQUIRE);
+	res = pcm->ops->hw_refine(pcm->op_arg, params);
+	if (serial != __atomic_load_n(&refine_volatile_serial, __ATOMIC_ACQUIRE)) {
+		/* depends on a volatile slave, so does this PCM */
+		__snd_pcm_lock(pcm);
+		pcm->refine_volatile = 1;
+		__snd_pcm_unlock(pcm);
+		return res;
+	}
+	/* transient errors (-EBUSY, -ENOMEM...) aren't worth remembering */
+	if (store && (res >= 0 || res == -EINVAL)) {
+		__snd_pcm_lock(pcm);
+		e = refine_cache_slot(cache);
+		if (e) {
+			e->hash = hash;
+			e->generation = generation;
+			e->result = res;
+			memcpy(e->in, in, REFINE_KEY_LEN);
+			refine_key_get(e->out, params);
+		}
+		__snd_pcm_unlock(pcm);
+	}
+	return res;
+}
+
+/* drop all cached refinements of all PCMs */
+void snd_pcm_hw_refine_invalidate(void)
+{
+	__atomic_add_fetch(&refine_generation, 1, __ATOMIC_RELEASE);
+}
+
+/* release the refinement cache of the PCM */
+void snd_pcm_hw_refine_cache_free(snd_pcm_t *pcm)
+{
+	if (pcm->refine_cache)
+		free(pcm->refine_cache->entry);
+	free(pcm->refine_cache);
+	pcm->refine_cache = NULL;
+}
+
 int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 {
 	int res;
@@ -2356,10 +2671,15 @@ int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	snd_output_printf(log, "REFINE called:\n");
 	snd_pcm_hw_params_dump(params, log);
 #endif
-	if (pcm->ops->hw_refine)
-		res = pcm->ops->hw_refine(pcm->op_arg, params);
-	else
+	if (!pcm->ops->hw_refine)
 		res = -ENOSYS;
+	else if (pcm->refine_nocache) {
+		/* without a cache, refine_volatile changes only at open */
+		if (pcm->refine_volatile)
+			__atomic_add_fetch(&refine_volatile_serial, 1, __ATOMIC_RELEASE);
+		res = pcm->ops->hw_refine(pcm->op_arg, params);
+	} else
+		res = snd_pcm_hw_refine_cached(pcm, params);
 #ifdef REFINE_DEBUG
 	snd_output_printf(log, "refine done - result = %i\n", res);
 	snd_pcm_hw_params_dump(params, log);
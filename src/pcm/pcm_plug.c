@@ -379,6 +379,12 @@ static int snd_pcm_plug_change_rate(snd_pcm_t *pcm, snd_pcm_t **new, snd_pcm_plu
 				plug->gen.slave, plug->gen.slave != plug->req_slave);
 	if (err < 0)
 		return err;
+	/* a route plugin below converts the format in its own pass,
+	 * so feed it the converter output directly
+	 */
+	if (plug->gen.slave != plug->req_slave &&
+	    snd_pcm_type(plug->gen.slave) == SND_PCM_TYPE_ROUTE)
+		snd_pcm_rate_set_native_sformat(*new);
 	slv->access = clt->access;
 	slv->rate = clt->rate;
 	if (snd_pcm_format_linear(clt->format))
@@ -950,6 +956,10 @@ static int snd_pcm_plug_hw_refine_cchange(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
 		int rate_mindir, srate_mindir;
 		
 		/* This is a temporary hack, waiting for a better solution */
+		/* after a failed srefine the slave rate may be empty */
+		if (snd_pcm_hw_param_empty(params, SND_PCM_HW_PARAM_RATE) ||
+		    snd_pcm_hw_param_empty(sparams, SND_PCM_HW_PARAM_RATE))
+			return -EINVAL;
 		err = snd_pcm_hw_param_get_min(params, SND_PCM_HW_PARAM_RATE, &rate_min, &rate_mindir);
 		if (err < 0)
 			return err;
@@ -1166,6 +1176,13 @@ int snd_pcm_plug_open(snd_pcm_t **pcmp,
 
 This plugin converts channels, rate and format on request.
 
+The conversions are done by a chain of plugins, each making its own pass
+over the data.  A route plugin converts the linear sample format along
+with the channels, so when a rate conversion is followed by a route
+plugin, the output of the converter is handed to it in the converter
+format: this saves the format conversion pass of the rate plugin, the
+rate and route passes remain.
+
 \code
 pcm.name {
         type plug               # Automatic conversion PCM
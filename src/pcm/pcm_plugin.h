@@ -96,6 +96,14 @@ snd_pcm_sframes_t snd_pcm_plugin_undo_write_generic
 #define snd_pcm_mulaw_encode	snd1_pcm_mulaw_encode
 #define snd_pcm_adpcm_decode	snd1_pcm_adpcm_decode
 #define snd_pcm_adpcm_encode	snd1_pcm_adpcm_encode
+#define snd_pcm_lfloat_get_s32_index	snd1_pcm_lfloat_get_s32_index
+#define snd_pcm_lfloat_put_s32_index	snd1_pcm_lfloat_put_s32_index
+#define snd_pcm_lfloat_convert_integer_float	snd1_pcm_lfloat_convert_integer_float
+#define snd_pcm_lfloat_convert_float_integer	snd1_pcm_lfloat_convert_float_integer
+
+/* get/put index of the native endian S16/S32 formats (16h -> 16h, 32h -> 32h) */
+#define SND_PCM_LINEAR_S16_INDEX	4
+#define SND_PCM_LINEAR_S32_INDEX	12
 
 int snd_pcm_linear_get_index(snd_pcm_format_t src_format, snd_pcm_format_t dst_format);
 int snd_pcm_linear_put_index(snd_pcm_format_t src_format, snd_pcm_format_t dst_format);
@@ -153,3 +161,13 @@ void snd_pcm_adpcm_encode(const snd_pcm_channel_area_t *dst_areas,
 			  unsigned int channels, snd_pcm_uframes_t frames,
 			  unsigned int getidx,
 			  snd_pcm_adpcm_state_t *states);
+int snd_pcm_lfloat_get_s32_index(snd_pcm_format_t format);
+int snd_pcm_lfloat_put_s32_index(snd_pcm_format_t format);
+void snd_pcm_lfloat_convert_integer_float(const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_t dst_offset,
+					  const snd_pcm_channel_area_t *src_areas, snd_pcm_uframes_t src_offset,
+					  unsigned int channels, snd_pcm_uframes_t frames,
+					  unsigned int get32idx, unsigned int put32floatidx);
+void snd_pcm_lfloat_convert_float_integer(const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_t dst_offset,
+					  const snd_pcm_channel_area_t *src_areas, snd_pcm_uframes_t src_offset,
+					  unsigned int channels, snd_pcm_uframes_t frames,
+					  unsigned int put32idx, unsigned int get32floatidx);
@@ -70,18 +70,40 @@ struct _snd_pcm_rate {
 	snd_htimestamp_t trigger_tstamp;
 	unsigned int plugin_version;
 	unsigned int rate_min, rate_max;
+	snd_pcm_format_t native_format;	/* format the converter works in */
+	uint64_t in_formats, out_formats;	/* formats handled by convert */
+	unsigned int format_flags;
+	snd_pcm_format_t orig_in_format, orig_out_format;	/* stream formats */
+	snd_pcm_channel_area_t *in_areas;	/* converter input, when the */
+	snd_pcm_channel_area_t *out_areas;	/* stream format differs */
+	void *format_buf;	/* areas and samples of in_areas/out_areas */
 };
 
 #define SND_PCM_RATE_PLUGIN_VERSION_OLD	0x010001	/* old rate plugin */
 
+/* builtin polyphase sinc converter (pcm_rate_sinc.c) */
+int snd_pcm_rate_sinc_open(const char *type, unsigned int version,
+			   void **objp, snd_pcm_rate_ops_t *ops,
+			   const snd_config_t *conf);
+
 #endif /* DOC_HIDDEN */
 
-static int snd_pcm_rate_hw_refine_cprepare(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t *params)
+static int snd_pcm_rate_hw_refine_cprepare(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 {
 	snd_pcm_rate_t *rate = pcm->private_data;
 	int err;
 	snd_pcm_access_mask_t access_mask = { SND_PCM_ACCBIT_SHM };
 	snd_pcm_format_mask_t format_mask = { SND_PCM_FMTBIT_LINEAR };
+	uint64_t cformats;
+	snd_pcm_format_t f;
+
+	/* float formats are accepted only when the converter takes them */
+	cformats = pcm->stream == SND_PCM_STREAM_PLAYBACK ?
+		rate->in_formats : rate->out_formats;
+	for (f = 0; f <= SND_PCM_FORMAT_LAST; f++) {
+		if ((cformats & (1ULL << f)) && snd_pcm_format_float(f) == 1)
+			snd_pcm_format_mask_set(&format_mask, f);
+	}
 	err = _snd_pcm_hw_param_set_mask(params, SND_PCM_HW_PARAM_ACCESS,
 					 &access_mask);
 	if (err < 0)
@@ -235,6 +257,121 @@ static int snd_pcm_rate_hw_refine(snd_pcm_t *pcm,
 				       snd_pcm_generic_hw_refine);
 }
 
+/* whether samples can be converted between the two formats */
+static int format_convertible(snd_pcm_format_t from, snd_pcm_format_t to)
+{
+	int from_float = snd_pcm_format_float(from) == 1;
+	int to_float = snd_pcm_format_float(to) == 1;
+
+	if (from == to || (!from_float && !to_float))
+		return 1;
+#ifdef BUILD_PCM_PLUGIN_LFLOAT
+	/* integer <-> float through the lfloat helpers */
+	return from_float != to_float;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * pick the format the converter works in for a stream side: the stream
+ * format itself when the converter handles it, otherwise the widest one
+ * the stream can be converted to
+ */
+static snd_pcm_format_t choose_converter_format(uint64_t mask,
+						snd_pcm_format_t format)
+{
+	static const snd_pcm_format_t preferred[] = {
+		SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S24, SND_PCM_FORMAT_S16,
+		SND_PCM_FORMAT_FLOAT,
+	};
+	unsigned int i;
+
+	if (mask & (1ULL << format))
+		return format;
+	for (i = 0; i < ARRAY_SIZE(preferred); i++) {
+		if ((mask & (1ULL << preferred[i])) &&
+		    format_convertible(format, preferred[i]))
+			return preferred[i];
+	}
+	return SND_PCM_FORMAT_UNKNOWN;
+}
+
+static int choose_converter_formats(snd_pcm_rate_t *rate)
+{
+	snd_pcm_format_t in, out;
+
+	if (rate->format_flags & SND_PCM_RATE_FLAG_SYNC_FORMATS) {
+		in = choose_converter_format(rate->in_formats & rate->out_formats,
+					     rate->orig_in_format);
+		out = in;
+		if (!format_convertible(out, rate->orig_out_format))
+			out = SND_PCM_FORMAT_UNKNOWN;
+	} else {
+		in = choose_converter_format(rate->in_formats,
+					     rate->orig_in_format);
+		out = choose_converter_format(rate->out_formats,
+					      rate->orig_out_format);
+	}
+	if (in == SND_PCM_FORMAT_UNKNOWN || out == SND_PCM_FORMAT_UNKNOWN) {
+		SNDERR("rate converter cannot handle %s -> %s",
+		       snd_pcm_format_name(rate->orig_in_format),
+		       snd_pcm_format_name(rate->orig_out_format));
+		return -EINVAL;
+	}
+	rate->info.in.format = in;
+	rate->info.out.format = out;
+	return 0;
+}
+
+static void free_format_areas(snd_pcm_rate_t *rate)
+{
+	free(rate->format_buf);
+	rate->format_buf = NULL;
+	rate->in_areas = rate->out_areas = NULL;
+}
+
+/* planar period buffers for the sides converted to another format */
+static int alloc_format_areas(snd_pcm_rate_t *rate)
+{
+	unsigned int channels = rate->info.channels;
+	unsigned int in_width = 0, out_width = 0, chn;
+	size_t in_size = 0, out_size = 0;
+	snd_pcm_channel_area_t *areas;
+	char *buf;
+
+	if (rate->info.in.format != rate->orig_in_format) {
+		in_width = snd_pcm_format_physical_width(rate->info.in.format);
+		in_size = in_width * rate->info.in.period_size / 8;
+	}
+	if (rate->info.out.format != rate->orig_out_format) {
+		out_width = snd_pcm_format_physical_width(rate->info.out.format);
+		out_size = out_width * rate->info.out.period_size / 8;
+	}
+	if (!in_size && !out_size)
+		return 0;
+
+	areas = malloc(2 * channels * sizeof(*areas) +
+		       channels * (in_size + out_size));
+	if (!areas)
+		return -ENOMEM;
+	rate->format_buf = areas;
+	buf = (char *)(areas + 2 * channels);
+	for (chn = 0; chn < channels; chn++) {
+		areas[chn].addr = buf + chn * in_size;
+		areas[chn].first = 0;
+		areas[chn].step = in_width;
+		areas[channels + chn].addr = buf + channels * in_size + chn * out_size;
+		areas[channels + chn].first = 0;
+		areas[channels + chn].step = out_width;
+	}
+	if (in_size)
+		rate->in_areas = areas;
+	if (out_size)
+		rate->out_areas = areas + channels;
+	return 0;
+}
+
 static int snd_pcm_rate_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 {
 	snd_pcm_rate_t *rate = pcm->private_data;
@@ -282,16 +419,32 @@ static int snd_pcm_rate_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 		SNDMSG("rate plugin already in use");
 		return -EBUSY;
 	}
+	rate->orig_in_format = rate->info.in.format;
+	rate->orig_out_format = rate->info.out.format;
+	if (rate->ops.convert) {
+		err = choose_converter_formats(rate);
+		if (err < 0)
+			return err;
+	}
 	err = rate->ops.init(rate->obj, &rate->info);
 	if (err < 0)
 		return err;
 
+	if (alloc_format_areas(rate) < 0)
+		goto error;
+
 	rate->pareas = malloc(2 * channels * sizeof(*rate->pareas));
 	if (rate->pareas == NULL)
 		goto error;
 
-	cwidth = snd_pcm_format_physical_width(cinfo->format);
-	swidth = snd_pcm_format_physical_width(sinfo->format);
+	/* period copies are in the stream formats, not the converter ones */
+	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+		cwidth = snd_pcm_format_physical_width(rate->orig_in_format);
+		swidth = snd_pcm_format_physical_width(rate->orig_out_format);
+	} else {
+		cwidth = snd_pcm_format_physical_width(rate->orig_out_format);
+		swidth = snd_pcm_format_physical_width(rate->orig_in_format);
+	}
 	rate->pareas[0].addr = malloc(((cwidth * channels * cinfo->period_size) / 8) +
 				      ((swidth * channels * sinfo->period_size) / 8));
 	if (rate->pareas[0].addr == NULL)
@@ -327,6 +480,7 @@ static int snd_pcm_rate_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 		free(rate->pareas);
 		rate->pareas = NULL;
 	}
+	free_format_areas(rate);
 	if (rate->ops.free)
 		rate->ops.free(rate->obj);
 	return -ENOMEM;
@@ -341,6 +495,7 @@ static int snd_pcm_rate_hw_free(snd_pcm_t *pcm)
 		rate->pareas = NULL;
 		rate->sareas = NULL;
 	}
+	free_format_areas(rate);
 	if (rate->ops.free)
 		rate->ops.free(rate->obj);
 	free(rate->src_buf);
@@ -502,6 +657,61 @@ static void convert_from_s16(snd_pcm_rate_t *rate, const int16_t *buf,
 	}
 }
 
+/* whether the areas are a plain interleaved S16 buffer */
+static int is_s16_interleaved(const snd_pcm_channel_area_t *areas,
+			      unsigned int channels)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		if (areas[c].addr != areas[0].addr ||
+		    areas[c].first != c * 16 ||
+		    areas[c].step != channels * 16)
+			return 0;
+	}
+	return 1;
+}
+
+static void convert_format(const snd_pcm_channel_area_t *dst_areas,
+			   snd_pcm_uframes_t dst_offset,
+			   snd_pcm_format_t dst_format,
+			   const snd_pcm_channel_area_t *src_areas,
+			   snd_pcm_uframes_t src_offset,
+			   snd_pcm_format_t src_format,
+			   unsigned int channels, snd_pcm_uframes_t frames)
+{
+#ifdef BUILD_PCM_PLUGIN_LFLOAT
+	if (snd_pcm_format_float(dst_format) == 1) {
+		snd_pcm_lfloat_convert_integer_float(dst_areas, dst_offset,
+				src_areas, src_offset, channels, frames,
+				snd_pcm_linear_get_index(src_format, SND_PCM_FORMAT_S32),
+				snd_pcm_lfloat_put_s32_index(dst_format));
+		return;
+	}
+	if (snd_pcm_format_float(src_format) == 1) {
+		snd_pcm_lfloat_convert_float_integer(dst_areas, dst_offset,
+				src_areas, src_offset, channels, frames,
+				snd_pcm_linear_put_index(SND_PCM_FORMAT_S32, dst_format),
+				snd_pcm_lfloat_get_s32_index(src_format));
+		return;
+	}
+#endif
+	/* packed 24 and 20 bit samples through S32, as the linear plugin */
+	if (snd_pcm_format_physical_width(src_format) == 24 ||
+	    snd_pcm_format_physical_width(dst_format) == 24 ||
+	    snd_pcm_format_width(src_format) == 20 ||
+	    snd_pcm_format_width(dst_format) == 20) {
+		snd_pcm_linear_getput(dst_areas, dst_offset, src_areas, src_offset,
+				      channels, frames,
+				      snd_pcm_linear_get_index(src_format, SND_PCM_FORMAT_S32),
+				      snd_pcm_linear_put_index(SND_PCM_FORMAT_S32, dst_format));
+		return;
+	}
+	snd_pcm_linear_convert(dst_areas, dst_offset, src_areas, src_offset,
+			       channels, frames,
+			       snd_pcm_linear_convert_index(src_format, dst_format));
+}
+
 static void do_convert(const snd_pcm_channel_area_t *dst_areas,
 		       snd_pcm_uframes_t dst_offset, unsigned int dst_frames,
 		       const snd_pcm_channel_area_t *src_areas,
@@ -512,24 +722,46 @@ static void do_convert(const snd_pcm_channel_area_t *dst_areas,
 	if (rate->ops.convert_s16) {
 		const int16_t *src;
 		int16_t *dst;
-		if (! rate->src_buf)
+		int dst_direct;
+		if (rate->info.in.format == SND_PCM_FORMAT_S16 &&
+		    is_s16_interleaved(src_areas, channels))
 			src = (int16_t *)src_areas->addr + src_offset * channels;
 		else {
 			convert_to_s16(rate, rate->src_buf, src_areas, src_offset,
 				       src_frames, channels);
 			src = rate->src_buf;
 		}
-		if (! rate->dst_buf)
+		dst_direct = rate->info.out.format == SND_PCM_FORMAT_S16 &&
+			is_s16_interleaved(dst_areas, channels);
+		if (dst_direct)
 			dst = (int16_t *)dst_areas->addr + dst_offset * channels;
 		else
 			dst = rate->dst_buf;
 		rate->ops.convert_s16(rate->obj, dst, dst_frames, src, src_frames);
-		if (dst == rate->dst_buf)
+		if (!dst_direct)
 			convert_from_s16(rate, rate->dst_buf, dst_areas, dst_offset,
 					 dst_frames, channels);
 	} else {
-		rate->ops.convert(rate->obj, dst_areas, dst_offset, dst_frames,
-				   src_areas, src_offset, src_frames);
+		const snd_pcm_channel_area_t *in = src_areas, *out = dst_areas;
+		snd_pcm_uframes_t in_offset = src_offset, out_offset = dst_offset;
+
+		if (rate->in_areas) {
+			convert_format(rate->in_areas, 0, rate->info.in.format,
+				       src_areas, src_offset, rate->orig_in_format,
+				       channels, src_frames);
+			in = rate->in_areas;
+			in_offset = 0;
+		}
+		if (rate->out_areas) {
+			out = rate->out_areas;
+			out_offset = 0;
+		}
+		rate->ops.convert(rate->obj, out, out_offset, dst_frames,
+				  in, in_offset, src_frames);
+		if (rate->out_areas)
+			convert_format(dst_areas, dst_offset, rate->orig_out_format,
+				       rate->out_areas, 0, rate->info.out.format,
+				       channels, dst_frames);
 	}
 }
 
@@ -1178,6 +1410,10 @@ static void snd_pcm_rate_dump(snd_pcm_t *pcm, snd_output_t *out)
 	if (rate->ops.dump)
 		rate->ops.dump(rate->obj, out);
 	snd_output_printf(out, "Protocol version: %x\n", rate->plugin_version);
+	if (pcm->setup && (rate->in_areas || rate->out_areas))
+		snd_output_printf(out, "Converter formats: %s -> %s\n",
+				  snd_pcm_format_name(rate->info.in.format),
+				  snd_pcm_format_name(rate->info.out.format));
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -1258,12 +1494,46 @@ const snd_config_t *snd_pcm_rate_get_default_converter(snd_config_t *root)
 	return NULL;
 }
 
-#ifdef PIC
+/*
+ * Switch the slave format to the format the converter works in.
+ *
+ * Used by plug when the slave is a route plugin which converts the sample
+ * format in its own pass anyway: the converter output is then handed to
+ * the route plugin as is, instead of being converted to the slave format
+ * here first.  Returns 1 when the slave format was changed.
+ */
+int snd_pcm_rate_set_native_sformat(snd_pcm_t *pcm)
+{
+	snd_pcm_rate_t *rate = pcm->private_data;
+
+	if (rate->native_format == SND_PCM_FORMAT_UNKNOWN ||
+	    rate->sformat == rate->native_format)
+		return 0;
+	rate->sformat = rate->native_format;
+	return 1;
+}
+
+/* the formats a converter without get_supported_formats handles */
+static uint64_t linear_formats_mask(void)
+{
+	snd_pcm_format_mask_t linear = { SND_PCM_FMTBIT_LINEAR };
+	uint64_t mask = 0;
+	snd_pcm_format_t f;
+
+	for (f = 0; f <= SND_PCM_FORMAT_LAST; f++) {
+		if (snd_pcm_format_mask_test(&linear, f))
+			mask |= 1ULL << f;
+	}
+	return mask;
+}
+
 static int is_builtin_plugin(const char *type)
 {
-	return strcmp(type, "linear") == 0;
+	return strcmp(type, "linear") == 0 ||
+	       strcmp(type, "sinc") == 0 || strncmp(type, "sinc_", 5) == 0;
 }
 
+#ifdef PIC
 static const char *const default_rate_plugins[] = {
 	"speexrate", "linear", NULL
 };
@@ -1287,6 +1557,11 @@ static int rate_open_func(snd_pcm_rate_t *rate, const char *type, const snd_conf
 	rate->rate_max = SND_PCM_PLUGIN_RATE_MAX;
 	rate->plugin_version = SND_PCM_RATE_PLUGIN_VERSION;
 
+	err = snd_pcm_rate_sinc_open(type, SND_PCM_RATE_PLUGIN_VERSION,
+				     &rate->obj, &rate->ops, converter_conf);
+	if (err != -ENOENT)
+		return err;
+
 	open_conf_func = snd_dlobj_cache_get(lib, open_conf_name, NULL, verbose && converter_conf != NULL);
 	if (open_conf_func) {
 		err = open_conf_func(SND_PCM_RATE_PLUGIN_VERSION,
@@ -1388,7 +1663,8 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 
 	assert(pcmp && slave);
 	if (sformat != SND_PCM_FORMAT_UNKNOWN &&
-	    snd_pcm_format_linear(sformat) != 1)
+	    snd_pcm_format_linear(sformat) != 1 &&
+	    snd_pcm_format_float(sformat) != 1)
 		return -EINVAL;
 	rate = calloc(1, sizeof(snd_pcm_rate_t));
 	if (!rate) {
@@ -1460,9 +1736,16 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 		return -ENOENT;
 	}
 #else
-	type = "linear";
-	open_func = SND_PCM_RATE_PLUGIN_ENTRY(linear);
-	err = open_func(SND_PCM_RATE_PLUGIN_VERSION, &rate->obj, &rate->ops);
+	rate->plugin_version = SND_PCM_RATE_PLUGIN_VERSION;
+	err = -ENOENT;
+	if (converter && !snd_config_get_string(converter, &type))
+		err = snd_pcm_rate_sinc_open(type, SND_PCM_RATE_PLUGIN_VERSION,
+					     &rate->obj, &rate->ops, NULL);
+	if (err == -ENOENT) {
+		type = "linear";
+		open_func = SND_PCM_RATE_PLUGIN_ENTRY(linear);
+		err = open_func(SND_PCM_RATE_PLUGIN_VERSION, &rate->obj, &rate->ops);
+	}
 	if (err < 0) {
 		snd_pcm_free(pcm);
 		free(rate);
@@ -1478,6 +1761,34 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 		return err;
 	}
 
+	rate->in_formats = rate->out_formats = linear_formats_mask();
+	if (rate->plugin_version >= 0x010003 && rate->ops.get_supported_formats) {
+		err = rate->ops.get_supported_formats(rate->obj,
+						      &rate->in_formats,
+						      &rate->out_formats,
+						      &rate->format_flags);
+		if (err < 0) {
+			SNDERR("rate plugin %s cannot report its formats", type);
+			if (rate->ops.close)
+				rate->ops.close(rate->obj);
+			if (rate->open_func)
+				snd_dlobj_cache_put(rate->open_func);
+			snd_pcm_free(pcm);
+			free(rate);
+			return err;
+		}
+	}
+
+	/* the builtin linear converter interpolates in S16, too;
+	 * the sinc one reads and writes S32
+	 */
+	if (rate->ops.convert_s16 || strcmp(type, "linear") == 0)
+		rate->native_format = SND_PCM_FORMAT_S16;
+	else if (is_builtin_plugin(type))
+		rate->native_format = SND_PCM_FORMAT_S32;
+	else
+		rate->native_format = SND_PCM_FORMAT_UNKNOWN;
+
 	pcm->ops = &snd_pcm_rate_ops;
 	pcm->fast_ops = &snd_pcm_rate_fast_ops;
 	pcm->private_data = rate;
@@ -1496,7 +1807,17 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 
 \section pcm_plugins_rate Plugin: Rate
 
-This plugin converts a stream rate. The input and output formats must be linear.
+This plugin converts a stream rate. The input and output formats must be linear,
+or float when the converter handles float samples.
+
+Converters with the convert callback may report the sample formats they
+take and produce (get_supported_formats, protocol version 0x010003).
+The stream samples are passed to the converter as they are when their
+format is listed; otherwise they are converted to the widest listed
+format (S32, S24, S16, then FLOAT) for the converter and back.  Converters
+without the callback take any linear format.  Converters with the
+convert_s16 callback work on interleaved S16; interleaved S16 streams are
+passed to them without an intermediate copy.
 
 \code
 pcm.name {
@@ -1523,6 +1844,23 @@ pcm.name {
 }
 \endcode
 
+Besides the external converters, two converters are built in:
+
+<UL>
+  <LI>linear - linear interpolation on S16 samples
+  <LI>sinc - polyphase windowed-sinc filter working on S32 samples in
+      float precision, or directly on FLOAT samples; the quality presets are selected as sinc_fastest,
+      sinc_medium (same as sinc) and sinc_best, or with the quality
+      field (fastest, medium or best) of the converter compound
+</UL>
+
+\code
+	converter {
+		name "sinc"
+		quality "best"
+	}
+\endcode
+
 \subsection pcm_plugins_rate_funcref Function reference
 
 <UL>
@@ -1586,9 +1924,10 @@ int _snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	if (sformat != SND_PCM_FORMAT_UNKNOWN &&
-	    snd_pcm_format_linear(sformat) != 1) {
+	    snd_pcm_format_linear(sformat) != 1 &&
+	    snd_pcm_format_float(sformat) != 1) {
 	    	snd_config_delete(sconf);
-		SNDERR("slave format is not linear");
+		SNDERR("slave format is not linear or float");
 		return -EINVAL;
 	}
 	err = snd_pcm_open_slave(&spcm, root, sconf, stream, mode, conf);
@@ -0,0 +1,633 @@
+/*
+ *  Polyphase windowed-sinc rate converter plugin
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The converter works on the exact ratio of the input and output period
+ * sizes (den output frames for each num input frames, reduced).  The
+ * output frame n is taken at the input position n * num / den; its
+ * fractional part selects one of the precomputed filter phases, so one
+ * output sample costs a single dot product of taps coefficients.
+ * When den is larger than MAX_PHASES, the nearest of MAX_PHASES phases
+ * is used.
+ *
+ * The samples are read as S32 from any linear format and filtered in
+ * float, so 24 and 32-bit streams keep their resolution; native-endian
+ * FLOAT streams are taken and returned as they are.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include "bswap.h"
+#include "pcm_local.h"
+#include "pcm_plugin.h"
+#include "pcm_rate.h"
+
+#include "plugin_ops.h"
+
+#if defined(__GNUC__) && defined(__SSE__)
+#define SINC_SIMD_SSE
+#include <xmmintrin.h>
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define SINC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#define MAX_PHASES	1024
+#define MAX_TAPS	1024
+
+struct sinc_preset {
+	const char *name;
+	unsigned int taps;	/* filter length at unity ratio */
+	double beta;		/* Kaiser window shape */
+	double rolloff;		/* cutoff relative to the lower Nyquist */
+};
+
+static const struct sinc_preset sinc_presets[] = {
+	{ "fastest", 16, 5.0, 0.85 },
+	{ "medium", 32, 7.0, 0.91 },
+	{ "best", 64, 9.5, 0.945 },
+};
+
+struct rate_sinc {
+	const struct sinc_preset *preset;
+	unsigned int channels;
+	unsigned int get_idx;
+	unsigned int put_idx;
+	int in_float, out_float;
+	snd_pcm_format_t out_format;
+	/* ratio: den output frames for num input frames */
+	unsigned int num, den;
+	unsigned int taps;
+	unsigned int phases;
+	float *coefs;		/* (phases + 1) rows of taps coefficients */
+	/* history + one input period for each channel */
+	float **hist;
+	unsigned int hist_size;
+	unsigned int hist_len;	/* valid samples in hist */
+	unsigned int pos;	/* integer input position in hist */
+	unsigned int frac;	/* fractional input position, 0..den-1 */
+	snd_pcm_uframes_t in_period;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* zeroth order modified Bessel function of the first kind */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, q = x * x / 4.0;
+	unsigned int k;
+
+	for (k = 1; k < 64; k++) {
+		term *= q / ((double)k * k);
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static float sinc_dot(const float *x, const float *h, unsigned int taps)
+{
+#if defined(SINC_SIMD_SSE)
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	float r[4];
+	unsigned int i;
+
+	/* taps is a multiple of 8; h rows are 16 bytes aligned */
+	for (i = 0; i < taps; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i),
+						   _mm_load_ps(h + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4),
+						   _mm_load_ps(h + i + 4)));
+	}
+	_mm_storeu_ps(r, _mm_add_ps(acc0, acc1));
+	return (r[0] + r[1]) + (r[2] + r[3]);
+#elif defined(SINC_SIMD_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+	float32x4_t acc;
+	unsigned int i;
+
+	for (i = 0; i < taps; i += 8) {
+		acc0 = vmlaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(h + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+	}
+	acc = vaddq_f32(acc0, acc1);
+	return (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) +
+	       (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+	float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	unsigned int i;
+
+	for (i = 0; i < taps; i += 4) {
+		s0 += x[i] * h[i];
+		s1 += x[i + 1] * h[i + 1];
+		s2 += x[i + 2] * h[i + 2];
+		s3 += x[i + 3] * h[i + 3];
+	}
+	return (s0 + s1) + (s2 + s3);
+#endif
+}
+
+static void sinc_free_tables(struct rate_sinc *rate)
+{
+	unsigned int c;
+
+	free(rate->coefs);
+	rate->coefs = NULL;
+	if (rate->hist) {
+		for (c = 0; c < rate->channels; c++)
+			free(rate->hist[c]);
+		free(rate->hist);
+		rate->hist = NULL;
+	}
+}
+
+static void sinc_reset(void *obj)
+{
+	struct rate_sinc *rate = obj;
+	unsigned int c;
+
+	if (!rate->hist)
+		return;
+	/* taps - 1 samples of silence before the first input sample */
+	for (c = 0; c < rate->channels; c++)
+		memset(rate->hist[c], 0, (rate->taps - 1) * sizeof(float));
+	rate->hist_len = rate->taps - 1;
+	rate->pos = 0;
+	rate->frac = 0;
+}
+
+/*
+ * half the transition band of a Kaiser windowed filter of the given
+ * length, relative to the Nyquist frequency (Kaiser's design formulas)
+ */
+static double kaiser_half_band(double beta, unsigned int taps)
+{
+	double atten = beta / 0.1102 + 8.7;
+
+	return (atten - 7.95) / (2.285 * (taps - 1) * 2 * M_PI);
+}
+
+/* compute the filter for the current ratio and allocate the history */
+static int sinc_setup(struct rate_sinc *rate)
+{
+	const struct sinc_preset *p = rate->preset;
+	double cutoff, ratio = (double)rate->den / rate->num;
+	unsigned int taps, phase, i, c;
+	int err;
+
+	/* widen the filter when decimating to keep the transition band */
+	cutoff = p->rolloff * (ratio < 1.0 ? ratio : 1.0);
+	taps = p->taps;
+	if (ratio < 1.0)
+		taps = ceil(taps / ratio);
+	taps = (taps + 7) & ~7U;
+	if (taps > MAX_TAPS) {
+		/* the transition band widens as the filter shortens: lower
+		 * the cutoff to keep the stopband edge where the full length
+		 * filter has it, so the clamp costs passband, not aliasing
+		 */
+		double edge = cutoff + kaiser_half_band(p->beta, taps);
+		taps = MAX_TAPS;
+		cutoff = edge - kaiser_half_band(p->beta, taps);
+		/* too short for that at the extreme ratios, keep half of
+		 * the passband and let the top of the stopband alias
+		 */
+		if (cutoff < p->rolloff * ratio / 2)
+			cutoff = p->rolloff * ratio / 2;
+	}
+
+	sinc_free_tables(rate);
+	rate->taps = taps;
+	rate->phases = rate->den < MAX_PHASES ? rate->den : MAX_PHASES;
+	err = posix_memalign((void **)&rate->coefs, 16,
+			     (rate->phases + 1) * taps * sizeof(float));
+	if (err) {
+		rate->coefs = NULL;
+		return -ENOMEM;
+	}
+	for (phase = 0; phase <= rate->phases; phase++) {
+		float *h = rate->coefs + phase * taps;
+		double frac = (double)phase / rate->phases;
+		double sum = 0;
+
+		for (i = 0; i < taps; i++) {
+			/* distance from the output position in input samples */
+			double t = (double)i - (taps / 2 - 1) - frac;
+			double x = t / (taps / 2);
+			double v;
+
+			if (x <= -1.0 || x >= 1.0) {
+				v = 0;
+			} else {
+				v = cutoff;
+				if (t != 0)
+					v = sin(M_PI * cutoff * t) / (M_PI * t);
+				v *= bessel_i0(p->beta * sqrt(1.0 - x * x)) /
+				     bessel_i0(p->beta);
+			}
+			h[i] = v;
+			sum += v;
+		}
+		/* unity gain for DC */
+		for (i = 0; i < taps; i++)
+			h[i] /= sum;
+	}
+
+	rate->hist_size = taps + rate->in_period + (rate->num + rate->den - 1) / rate->den + 1;
+	rate->hist = calloc(rate->channels, sizeof(*rate->hist));
+	if (!rate->hist)
+		goto error;
+	for (c = 0; c < rate->channels; c++) {
+		rate->hist[c] = calloc(rate->hist_size, sizeof(float));
+		if (!rate->hist[c])
+			goto error;
+	}
+	sinc_reset(rate);
+	return 0;
+
+ error:
+	sinc_free_tables(rate);
+	return -ENOMEM;
+}
+
+static int sinc_set_ratio(struct rate_sinc *rate, unsigned int in, unsigned int out)
+{
+	unsigned int g = gcd(in, out);
+
+	if (!g)
+		return -EINVAL;
+	in /= g;
+	out /= g;
+	if (rate->coefs && rate->num == in && rate->den == out)
+		return 0;
+	rate->num = in;
+	rate->den = out;
+	return sinc_setup(rate);
+}
+
+static snd_pcm_uframes_t input_frames(void *obj, snd_pcm_uframes_t frames)
+{
+	struct rate_sinc *rate = obj;
+	if (frames == 0)
+		return 0;
+	return muldiv_near(frames, rate->num, rate->den);
+}
+
+static snd_pcm_uframes_t output_frames(void *obj, snd_pcm_uframes_t frames)
+{
+	struct rate_sinc *rate = obj;
+	if (frames == 0)
+		return 0;
+	return muldiv_near(frames, rate->den, rate->num);
+}
+
+static void sinc_read(struct rate_sinc *rate,
+		      const snd_pcm_channel_area_t *src_areas,
+		      snd_pcm_uframes_t src_offset, unsigned int frames)
+{
+#define GET32_LABELS
+#include "plugin_ops.h"
+#undef GET32_LABELS
+	void *get = get32_labels[rate->get_idx];
+	unsigned int c, n;
+	uint32_t sample = 0;
+
+	for (c = 0; c < rate->channels; c++) {
+		const snd_pcm_channel_area_t *area = &src_areas[c];
+		const char *src = snd_pcm_channel_area_addr(area, src_offset);
+		int src_step = snd_pcm_channel_area_step(area);
+		float *dst = rate->hist[c] + rate->hist_len;
+
+		if (rate->in_float) {
+			for (n = 0; n < frames; n++) {
+				dst[n] = *(const float *)src;
+				src += src_step;
+			}
+			continue;
+		}
+		for (n = 0; n < frames; n++) {
+			goto *get;
+#define GET32_END after_get
+#include "plugin_ops.h"
+#undef GET32_END
+		after_get:
+			dst[n] = (float)(int32_t)sample * (1.0f / 2147483648.0f);
+			src += src_step;
+		}
+	}
+	rate->hist_len += frames;
+}
+
+static void sinc_write(struct rate_sinc *rate, const float *buf,
+		       const snd_pcm_channel_area_t *dst_area,
+		       snd_pcm_uframes_t dst_offset, unsigned int frames)
+{
+#define PUT32_LABELS
+#include "plugin_ops.h"
+#undef PUT32_LABELS
+	void *put = put32_labels[rate->put_idx];
+	char *dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
+	int dst_step = snd_pcm_channel_area_step(dst_area);
+	unsigned int n;
+	uint32_t sample;
+
+	if (rate->out_float) {
+		for (n = 0; n < frames; n++) {
+			*(float *)dst = buf[n];
+			dst += dst_step;
+		}
+		return;
+	}
+	for (n = 0; n < frames; n++) {
+		float v = buf[n] * 2147483648.0f;
+		if (v >= 2147483647.0f)
+			sample = 0x7fffffff;
+		else if (v <= -2147483648.0f)
+			sample = 0x80000000;
+		else
+			sample = (int32_t)lrintf(v);
+		goto *put;
+#define PUT32_END after_put
+#include "plugin_ops.h"
+#undef PUT32_END
+	after_put:
+		dst += dst_step;
+	}
+}
+
+/* filter as many output frames as the buffered input allows */
+static unsigned int sinc_filter(struct rate_sinc *rate,
+				const snd_pcm_channel_area_t *dst_areas,
+				snd_pcm_uframes_t dst_offset, unsigned int dst_frames)
+{
+	unsigned int step_int = rate->num / rate->den;
+	unsigned int step_frac = rate->num % rate->den;
+	unsigned int done = 0;
+	float out[256];
+
+	while (done < dst_frames) {
+		unsigned int pos = rate->pos, frac = rate->frac;
+		unsigned int c, n, cnt = 0;
+
+		/* frames of this block */
+		while (cnt < ARRAY_SIZE(out) && done + cnt < dst_frames &&
+		       pos + rate->taps <= rate->hist_len) {
+			cnt++;
+			pos += step_int;
+			frac += step_frac;
+			if (frac >= rate->den) {
+				frac -= rate->den;
+				pos++;
+			}
+		}
+		if (!cnt)
+			break;
+		for (c = 0; c < rate->channels; c++) {
+			pos = rate->pos;
+			frac = rate->frac;
+			for (n = 0; n < cnt; n++) {
+				unsigned int phase = frac;
+
+				if (rate->phases != rate->den)
+					phase = ((uint64_t)frac * rate->phases +
+						 rate->den / 2) / rate->den;
+				out[n] = sinc_dot(rate->hist[c] + pos,
+						  rate->coefs + phase * rate->taps,
+						  rate->taps);
+				pos += step_int;
+				frac += step_frac;
+				if (frac >= rate->den) {
+					frac -= rate->den;
+					pos++;
+				}
+			}
+			sinc_write(rate, out, &dst_areas[c], dst_offset + done, cnt);
+		}
+		rate->pos = pos;
+		rate->frac = frac;
+		done += cnt;
+	}
+	return done;
+}
+
+/* drop the consumed input */
+static void sinc_shift(struct rate_sinc *rate)
+{
+	unsigned int c, keep;
+
+	if (rate->pos == 0)
+		return;
+	keep = rate->pos < rate->hist_len ? rate->hist_len - rate->pos : 0;
+	for (c = 0; c < rate->channels; c++)
+		memmove(rate->hist[c], rate->hist[c] + rate->hist_len - keep,
+			keep * sizeof(float));
+	rate->pos -= rate->hist_len - keep;
+	rate->hist_len = keep;
+}
+
+static void sinc_convert(void *obj,
+			 const snd_pcm_channel_area_t *dst_areas,
+			 snd_pcm_uframes_t dst_offset, unsigned int dst_frames,
+			 const snd_pcm_channel_area_t *src_areas,
+			 snd_pcm_uframes_t src_offset, unsigned int src_frames)
+{
+	struct rate_sinc *rate = obj;
+	unsigned int chunk, done;
+
+	/* with the ratio set from the period sizes, one period of input
+	 * fits the history buffer and gives exactly one output period
+	 */
+	while (dst_frames > 0) {
+		chunk = rate->hist_size - rate->hist_len;
+		if (chunk > src_frames)
+			chunk = src_frames;
+		sinc_read(rate, src_areas, src_offset, chunk);
+		src_offset += chunk;
+		src_frames -= chunk;
+		done = sinc_filter(rate, dst_areas, dst_offset, dst_frames);
+		dst_offset += done;
+		dst_frames -= done;
+		sinc_shift(rate);
+		if (!done && !chunk) {
+			/* input exhausted */
+			snd_pcm_areas_silence(dst_areas, dst_offset, rate->channels,
+					      dst_frames, rate->out_format);
+			break;
+		}
+	}
+}
+
+static void sinc_free(void *obj)
+{
+	sinc_free_tables(obj);
+}
+
+static int sinc_init(void *obj, snd_pcm_rate_info_t *info)
+{
+	struct rate_sinc *rate = obj;
+
+	sinc_free_tables(rate);
+	rate->channels = info->channels;
+	rate->in_float = info->in.format == SND_PCM_FORMAT_FLOAT;
+	rate->out_float = info->out.format == SND_PCM_FORMAT_FLOAT;
+	rate->out_format = info->out.format;
+	if (!rate->in_float)
+		rate->get_idx = snd_pcm_linear_get_index(info->in.format, SND_PCM_FORMAT_S32);
+	if (!rate->out_float)
+		rate->put_idx = snd_pcm_linear_put_index(SND_PCM_FORMAT_S32, info->out.format);
+	rate->in_period = info->in.period_size;
+	return sinc_set_ratio(rate, info->in.rate, info->out.rate);
+}
+
+static int sinc_adjust_pitch(void *obj, snd_pcm_rate_info_t *info)
+{
+	struct rate_sinc *rate = obj;
+
+	/* each period maps exactly to a slave period */
+	return sinc_set_ratio(rate, info->in.period_size, info->out.period_size);
+}
+
+static void sinc_close(void *obj)
+{
+	sinc_free_tables(obj);
+	free(obj);
+}
+
+static int get_supported_rates(ATTRIBUTE_UNUSED void *rate,
+			       unsigned int *rate_min, unsigned int *rate_max)
+{
+	*rate_min = SND_PCM_PLUGIN_RATE_MIN;
+	*rate_max = SND_PCM_PLUGIN_RATE_MAX;
+	return 0;
+}
+
+static int get_supported_formats(ATTRIBUTE_UNUSED void *obj,
+				 uint64_t *in_formats, uint64_t *out_formats,
+				 unsigned int *flags)
+{
+	snd_pcm_format_mask_t linear = { SND_PCM_FMTBIT_LINEAR };
+	uint64_t mask = 1ULL << SND_PCM_FORMAT_FLOAT;
+	snd_pcm_format_t f;
+
+	for (f = 0; f <= SND_PCM_FORMAT_LAST; f++) {
+		if (snd_pcm_format_mask_test(&linear, f))
+			mask |= 1ULL << f;
+	}
+	*in_formats = *out_formats = mask;
+	*flags = 0;
+	return 0;
+}
+
+static void sinc_dump(void *obj, snd_output_t *out)
+{
+	struct rate_sinc *rate = obj;
+
+	snd_output_printf(out, "Converter: polyphase windowed-sinc (%s)\n",
+			  rate->preset->name);
+	if (rate->coefs)
+		snd_output_printf(out, "  ratio %u/%u, %u taps, %u phases\n",
+				  rate->den, rate->num, rate->taps, rate->phases);
+}
+
+static const snd_pcm_rate_ops_t sinc_ops = {
+	.close = sinc_close,
+	.init = sinc_init,
+	.free = sinc_free,
+	.reset = sinc_reset,
+	.adjust_pitch = sinc_adjust_pitch,
+	.convert = sinc_convert,
+	.input_frames = input_frames,
+	.output_frames = output_frames,
+	.version = SND_PCM_RATE_PLUGIN_VERSION,
+	.get_supported_rates = get_supported_rates,
+	.dump = sinc_dump,
+	.get_supported_formats = get_supported_formats,
+};
+
+/*
+ * open the builtin converter named type: "sinc" (the medium preset)
+ * or "sinc_<preset>"; the preset can be also given as the quality field
+ * of the converter compound
+ *
+ * returns -ENOENT when type is not a sinc converter
+ */
+int snd_pcm_rate_sinc_open(const char *type, unsigned int version,
+			   void **objp, snd_pcm_rate_ops_t *ops,
+			   const snd_config_t *conf)
+{
+	const struct sinc_preset *preset = NULL;
+	const char *quality = "medium";
+	struct rate_sinc *rate;
+	unsigned int i;
+
+	if (strncmp(type, "sinc", 4))
+		return -ENOENT;
+	if (type[4] == '_')
+		quality = type + 5;
+	else if (type[4])
+		return -ENOENT;
+	if (conf && snd_config_get_type(conf) == SND_CONFIG_TYPE_COMPOUND) {
+		snd_config_iterator_t it, next;
+		snd_config_for_each(it, next, conf) {
+			snd_config_t *n = snd_config_iterator_entry(it);
+			const char *id;
+			if (snd_config_get_id(n, &id) < 0)
+				continue;
+			if (strcmp(id, "name") == 0)
+				continue;
+			if (strcmp(id, "quality") == 0) {
+				if (snd_config_get_string(n, &quality) < 0) {
+					SNDERR("Invalid type for %s", id);
+					return -EINVAL;
+				}
+				continue;
+			}
+			SNDERR("Unknown field %s", id);
+			return -EINVAL;
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(sinc_presets); i++) {
+		if (strcmp(sinc_presets[i].name, quality) == 0) {
+			preset = &sinc_presets[i];
+			break;
+		}
+	}
+	if (!preset) {
+		SNDERR("Unknown sinc converter quality %s", quality);
+		return -EINVAL;
+	}
+	if (version < SND_PCM_RATE_PLUGIN_VERSION)
+		return -EINVAL;
+
+	rate = calloc(1, sizeof(*rate));
+	if (!rate)
+		return -ENOMEM;
+	rate->preset = preset;
+	*objp = rate;
+	*ops = sinc_ops;
+	return 0;
+}
@@ -58,6 +58,7 @@ typedef struct {
 } snd_pcm_route_ttable_src_t;
 
 typedef struct snd_pcm_route_ttable_dst snd_pcm_route_ttable_dst_t;
+typedef struct snd_pcm_route_matrix snd_pcm_route_matrix_t;
 
 typedef struct {
 	enum {UINT64, FLOAT} sum_idx;
@@ -70,6 +71,7 @@ typedef struct {
 	unsigned int nsrcs;
 	unsigned int ndsts;
 	snd_pcm_route_ttable_dst_t *dsts;
+	snd_pcm_route_matrix_t *matrix;
 } snd_pcm_route_params_t;
 
 
@@ -87,6 +89,7 @@ struct snd_pcm_route_ttable_dst {
 	unsigned int nsrcs;
 	snd_pcm_route_ttable_src_t* srcs;
 	route_f func;
+	int in_matrix;	/* mixed by the compiled matrix */
 };
 
 typedef union {
@@ -105,8 +108,40 @@ typedef struct {
 	snd_pcm_route_params_t params;
 	snd_pcm_chmap_t *chmap;
 	snd_pcm_chmap_query_t **chmap_override;
+	int use_matrix;
 } snd_pcm_route_t;
 
+/*
+ * The mixing destinations (more than one source or attenuation) can be
+ * compiled at hw_params into a sparse matrix: each row lists the source
+ * samples and coefficients of one destination channel.  The sources are
+ * read into a block of ROUTE_BLOCK frames per channel, then every row is
+ * accumulated over the whole block at once, which the compiler turns
+ * into vector multiply-adds.  The accumulator is float, or Q4 integer
+ * (SND_PCM_PLUGIN_ROUTE_RESOLUTION) without an FPU; the arithmetic is
+ * the same as in snd_pcm_route_convert1_many().
+ */
+#define ROUTE_BLOCK	64
+
+#if SND_PCM_PLUGIN_ROUTE_FLOAT
+typedef float route_acc_t;
+#else
+typedef int64_t route_acc_t;
+#endif
+
+struct snd_pcm_route_matrix {
+	snd_pcm_format_t src_format, dst_format;
+	unsigned int nins;		/* source channels read into block */
+	unsigned int *ins;		/* their channel numbers */
+	unsigned int nrows;
+	unsigned int *row_dst;		/* destination channel of each row */
+	unsigned int *row_start;	/* first term of each row, nrows + 1 */
+	unsigned int *term_in;		/* index in ins of each term */
+	route_acc_t *term_coef;
+	route_acc_t *block;		/* nins * ROUTE_BLOCK input samples */
+	route_acc_t *acc;		/* ROUTE_BLOCK output samples */
+};
+
 #endif /* DOC_HIDDEN */
 
 static void snd_pcm_route_convert1_zero(const snd_pcm_channel_area_t *dst_area,
@@ -375,7 +410,8 @@ static void snd_pcm_route_convert1_many(const snd_pcm_channel_area_t *dst_area,
 #if SND_PCM_PLUGIN_ROUTE_FLOAT
 	norm_float:
 		sum.as_float = rint(sum.as_float);
-		if (sum.as_float > (int64_t)0x7fffffff)
+		/* 0x7fffffff is 2^31 as a float, which does not fit */
+		if (sum.as_float >= (int64_t)0x7fffffff)
 			sample = 0x7fffffff;	/* maximum positive value */
 		else if (sum.as_float < -(int64_t)0x80000000)
 			sample = 0x80000000;	/* maximum negative value */
@@ -396,6 +432,286 @@ static void snd_pcm_route_convert1_many(const snd_pcm_channel_area_t *dst_area,
 	}
 }
 
+/* read one source channel into the block */
+static void route_matrix_get(route_acc_t *dst,
+			     const snd_pcm_channel_area_t *src_area,
+			     snd_pcm_uframes_t src_offset,
+			     snd_pcm_uframes_t frames,
+			     snd_pcm_format_t format,
+			     unsigned int get_idx)
+{
+#define GET32_LABELS
+#include "plugin_ops.h"
+#undef GET32_LABELS
+	void *get = get32_labels[get_idx];
+	const char *src = snd_pcm_channel_area_addr(src_area, src_offset);
+	int src_step = snd_pcm_channel_area_step(src_area);
+	int32_t sample = 0;
+
+	/* the common formats without the label dispatch */
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		for (; frames > 0; frames--, src += src_step)
+			*dst++ = (int32_t)((uint32_t)*(const uint16_t *)src << 16);
+		return;
+	case SND_PCM_FORMAT_S32:
+		for (; frames > 0; frames--, src += src_step)
+			*dst++ = *(const int32_t *)src;
+		return;
+	default:
+		break;
+	}
+	while (frames-- > 0) {
+		goto *get;
+#define GET32_END after_get
+#include "plugin_ops.h"
+#undef GET32_END
+	after_get:
+		*dst++ = sample;
+		src += src_step;
+	}
+}
+
+/* accumulate the terms of one row over the whole block */
+static void route_matrix_row(route_acc_t *restrict acc,
+			     const route_acc_t *restrict block,
+			     const unsigned int *term_in,
+			     const route_acc_t *term_coef,
+			     unsigned int nterms)
+{
+	const route_acc_t *in = block + term_in[0] * ROUTE_BLOCK;
+	route_acc_t coef = term_coef[0];
+	unsigned int t, k;
+
+	for (k = 0; k < ROUTE_BLOCK; k++)
+		acc[k] = in[k] * coef;
+	for (t = 1; t < nterms; t++) {
+		in = block + term_in[t] * ROUTE_BLOCK;
+		coef = term_coef[t];
+		for (k = 0; k < ROUTE_BLOCK; k++)
+			acc[k] += in[k] * coef;
+	}
+}
+
+static inline int32_t route_matrix_clip(route_acc_t v)
+{
+	if (v >= (route_acc_t)0x7fffffff)
+		return 0x7fffffff;	/* maximum positive value */
+	if (v < -(route_acc_t)0x80000000)
+		return 0x80000000;	/* maximum negative value */
+	return v;
+}
+
+/* normalize, clip and store one row */
+static void route_matrix_put(const snd_pcm_channel_area_t *dst_area,
+			     snd_pcm_uframes_t dst_offset,
+			     route_acc_t *acc,
+			     snd_pcm_uframes_t frames,
+			     snd_pcm_format_t format,
+			     unsigned int put_idx)
+{
+#define PUT32_LABELS
+#include "plugin_ops.h"
+#undef PUT32_LABELS
+	void *put = put32_labels[put_idx];
+	char *dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
+	int dst_step = snd_pcm_channel_area_step(dst_area);
+	int32_t sample;
+	unsigned int k;
+
+#if SND_PCM_PLUGIN_ROUTE_FLOAT
+	/* rint() for the default rounding mode: below 2^23 the magnitude
+	 * is rounded by the addition of 2^23, floats of 2^23 and above are
+	 * integers already
+	 */
+	for (k = 0; k < ROUTE_BLOCK; k++) {
+		float v = acc[k];
+		float a = fabsf(v);
+		float r = (a + 8388608.0f) - 8388608.0f;
+		acc[k] = a < 8388608.0f ? copysignf(r, v) : v;
+	}
+#else
+	for (k = 0; k < ROUTE_BLOCK; k++)
+		div(acc[k]);
+#endif
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		for (k = 0; k < frames; k++, dst += dst_step)
+			*(int16_t *)dst = route_matrix_clip(acc[k]) >> 16;
+		return;
+	case SND_PCM_FORMAT_S32:
+		for (k = 0; k < frames; k++, dst += dst_step)
+			*(int32_t *)dst = route_matrix_clip(acc[k]);
+		return;
+	default:
+		break;
+	}
+	for (k = 0; k < frames; k++) {
+		sample = route_matrix_clip(acc[k]);
+		goto *put;
+#define PUT32_END after_put
+#include "plugin_ops.h"
+#undef PUT32_END
+	after_put:
+		dst += dst_step;
+	}
+}
+
+static void snd_pcm_route_convert_matrix(const snd_pcm_channel_area_t *dst_areas,
+					 snd_pcm_uframes_t dst_offset,
+					 const snd_pcm_channel_area_t *src_areas,
+					 snd_pcm_uframes_t src_offset,
+					 snd_pcm_uframes_t frames,
+					 const snd_pcm_route_params_t *params)
+{
+	const snd_pcm_route_matrix_t *m = params->matrix;
+	unsigned int i, r;
+
+	while (frames > 0) {
+		snd_pcm_uframes_t n = frames < ROUTE_BLOCK ? frames : ROUTE_BLOCK;
+
+		for (i = 0; i < m->nins; i++)
+			route_matrix_get(m->block + i * ROUTE_BLOCK,
+					 &src_areas[m->ins[i]], src_offset, n,
+					 m->src_format, params->get_idx);
+		for (r = 0; r < m->nrows; r++) {
+			unsigned int start = m->row_start[r];
+			route_matrix_row(m->acc, m->block,
+					 m->term_in + start, m->term_coef + start,
+					 m->row_start[r + 1] - start);
+			route_matrix_put(&dst_areas[m->row_dst[r]], dst_offset,
+					 m->acc, n, m->dst_format, params->put_idx);
+		}
+		src_offset += n;
+		dst_offset += n;
+		frames -= n;
+	}
+}
+
+static void route_matrix_free(snd_pcm_route_params_t *params)
+{
+	snd_pcm_route_matrix_t *m = params->matrix;
+	unsigned int dst;
+
+	if (!m)
+		return;
+	free(m->ins);
+	free(m->row_dst);
+	free(m->row_start);
+	free(m->term_in);
+	free(m->term_coef);
+	free(m->block);
+	free(m->acc);
+	free(m);
+	params->matrix = NULL;
+	for (dst = 0; dst < params->ndsts; dst++)
+		params->dsts[dst].in_matrix = 0;
+}
+
+/*
+ * the number of terms of a mixing destination, 0 for a plain copy or a
+ * silent channel
+ */
+static unsigned int route_matrix_row_terms(const snd_pcm_route_ttable_dst_t *d,
+					   unsigned int src_channels)
+{
+	unsigned int src, n = 0;
+	int full = 1;
+
+	for (src = 0; src < d->nsrcs; src++) {
+		if ((unsigned int)d->srcs[src].channel >= src_channels)
+			continue;
+		if (d->srcs[src].as_int != SND_PCM_PLUGIN_ROUTE_RESOLUTION)
+			full = 0;
+		n++;
+	}
+	if (n > 1 || (n == 1 && !full))
+		return n;
+	return 0;
+}
+
+/*
+ * compile the mixing destinations for the given channel counts;
+ * the plain copies and the silent channels keep their own functions
+ */
+static int route_matrix_compile(snd_pcm_route_params_t *params,
+				snd_pcm_format_t src_format,
+				unsigned int src_channels,
+				snd_pcm_format_t dst_format,
+				unsigned int dst_channels)
+{
+	snd_pcm_route_matrix_t *m;
+	unsigned int dst, src, nterms = 0, nrows = 0;
+	unsigned int ndsts = params->ndsts < dst_channels ?
+		params->ndsts : dst_channels;
+	int in_index[src_channels];
+
+	for (dst = 0; dst < ndsts; dst++) {
+		unsigned int n = route_matrix_row_terms(&params->dsts[dst],
+							src_channels);
+		if (n) {
+			nterms += n;
+			nrows++;
+		}
+	}
+	if (!nrows)
+		return 0;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return -ENOMEM;
+	params->matrix = m;
+	m->src_format = src_format;
+	m->dst_format = dst_format;
+	m->ins = malloc(src_channels * sizeof(*m->ins));
+	m->row_dst = malloc(nrows * sizeof(*m->row_dst));
+	m->row_start = malloc((nrows + 1) * sizeof(*m->row_start));
+	m->term_in = malloc(nterms * sizeof(*m->term_in));
+	m->term_coef = malloc(nterms * sizeof(*m->term_coef));
+	m->acc = calloc(ROUTE_BLOCK, sizeof(*m->acc));
+	if (!m->ins || !m->row_dst || !m->row_start || !m->term_in ||
+	    !m->term_coef || !m->acc)
+		goto error;
+
+	for (src = 0; src < src_channels; src++)
+		in_index[src] = -1;
+	nterms = 0;
+	for (dst = 0; dst < ndsts; dst++) {
+		snd_pcm_route_ttable_dst_t *d = &params->dsts[dst];
+		if (!route_matrix_row_terms(d, src_channels))
+			continue;
+		m->row_dst[m->nrows] = dst;
+		m->row_start[m->nrows++] = nterms;
+		d->in_matrix = 1;
+		for (src = 0; src < d->nsrcs; src++) {
+			const snd_pcm_route_ttable_src_t *s = &d->srcs[src];
+			unsigned int channel = s->channel;
+			if (channel >= src_channels)
+				continue;
+			if (in_index[channel] < 0) {
+				in_index[channel] = m->nins;
+				m->ins[m->nins++] = channel;
+			}
+			m->term_in[nterms] = in_index[channel];
+#if SND_PCM_PLUGIN_ROUTE_FLOAT
+			m->term_coef[nterms] = d->att ? s->as_float : 1.0f;
+#else
+			m->term_coef[nterms] = s->as_int;
+#endif
+			nterms++;
+		}
+	}
+	m->row_start[m->nrows] = nterms;
+	m->block = calloc(m->nins * ROUTE_BLOCK, sizeof(*m->block));
+	if (!m->block)
+		goto error;
+	return 0;
+
+ error:
+	route_matrix_free(params);
+	return -ENOMEM;
+}
+
 #endif /* DOC_HIDDEN */
 
 static void snd_pcm_route_convert(const snd_pcm_channel_area_t *dst_areas,
@@ -411,6 +727,10 @@ static void snd_pcm_route_convert(const snd_pcm_channel_area_t *dst_areas,
 	snd_pcm_route_ttable_dst_t *dstp;
 	const snd_pcm_channel_area_t *dst_area;
 
+	if (params->matrix)
+		snd_pcm_route_convert_matrix(dst_areas, dst_offset,
+					     src_areas, src_offset,
+					     frames, params);
 	dstp = params->dsts;
 	dst_area = dst_areas;
 	for (dst_channel = 0; dst_channel < dst_channels; ++dst_channel) {
@@ -419,7 +739,7 @@ static void snd_pcm_route_convert(const snd_pcm_channel_area_t *dst_areas,
 						    src_areas, src_offset,
 						    src_channels,
 						    frames, dstp, params);
-		else
+		else if (!dstp->in_matrix)
 			dstp->func(dst_area, dst_offset,
 				   src_areas, src_offset,
 				   src_channels,
@@ -435,6 +755,7 @@ static int snd_pcm_route_close(snd_pcm_t *pcm)
 	snd_pcm_route_params_t *params = &route->params;
 	unsigned int dst_channel;
 
+	route_matrix_free(params);
 	if (params->dsts) {
 		for (dst_channel = 0; dst_channel < params->ndsts; ++dst_channel) {
 			free(params->dsts[dst_channel].srcs);
@@ -583,9 +904,34 @@ static int snd_pcm_route_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 #else
 	route->params.sum_idx = UINT64;
 #endif
+	route_matrix_free(&route->params);
+	if (route->use_matrix) {
+		unsigned int channels;
+		err = INTERNAL(snd_pcm_hw_params_get_channels)(params, &channels);
+		if (err < 0)
+			return err;
+		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+			err = route_matrix_compile(&route->params,
+						   src_format, channels,
+						   dst_format, slave->channels);
+		else
+			err = route_matrix_compile(&route->params,
+						   src_format, slave->channels,
+						   dst_format, channels);
+		if (err < 0)
+			return err;
+	}
 	return 0;
 }
 
+static int snd_pcm_route_hw_free(snd_pcm_t *pcm)
+{
+	snd_pcm_route_t *route = pcm->private_data;
+
+	route_matrix_free(&route->params);
+	return snd_pcm_generic_hw_free(pcm);
+}
+
 static snd_pcm_uframes_t
 snd_pcm_route_write_areas(snd_pcm_t *pcm,
 			  const snd_pcm_channel_area_t *areas,
@@ -716,6 +1062,11 @@ static void snd_pcm_route_dump(snd_pcm_t *pcm, snd_output_t *out)
 		}
 		snd_output_putc(out, '\n');
 	}
+	if (route->params.matrix)
+		snd_output_printf(out, "  Mixing matrix: %u rows, %u sources, %u terms\n",
+				  route->params.matrix->nrows,
+				  route->params.matrix->nins,
+				  route->params.matrix->row_start[route->params.matrix->nrows]);
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -913,7 +1264,7 @@ static const snd_pcm_ops_t snd_pcm_route_ops = {
 	.info = snd_pcm_generic_info,
 	.hw_refine = snd_pcm_route_hw_refine,
 	.hw_params = snd_pcm_route_hw_params,
-	.hw_free = snd_pcm_generic_hw_free,
+	.hw_free = snd_pcm_route_hw_free,
 	.sw_params = snd_pcm_generic_sw_params,
 	.channel_info = snd_pcm_generic_channel_info,
 	.dump = snd_pcm_route_dump,
@@ -1034,6 +1385,7 @@ int snd_pcm_route_open(snd_pcm_t **pcmp, const char *name,
 	snd_pcm_plugin_init(&route->plug);
 	route->sformat = sformat;
 	route->schannels = schannels;
+	route->use_matrix = 1;
 	route->plug.read = snd_pcm_route_read_areas;
 	route->plug.write = snd_pcm_route_write_areas;
 	route->plug.undo_read = snd_pcm_plugin_undo_read_generic;
@@ -1261,9 +1613,17 @@ pcm.name {
                 }
         }
         [chmap MAP]             # Override channel maps; MAP is a string array
+        [matrix BOOL]           # Mix through the compiled matrix (default yes)
 }
 \endcode
 
+The destination channels which mix several source channels or attenuate
+one are compiled at hw_params into a sparse matrix.  The matrix is applied
+to blocks of frames with float multiply-adds (Q4 integer ones on machines
+without FPU), with the same results as the per-sample path used
+with \c matrix \c no.  Plain copies and silent channels are not
+affected.
+
 \subsection pcm_plugins_route_funcref Function reference
 
 <UL>
@@ -1302,6 +1662,7 @@ int _snd_pcm_route_open(snd_pcm_t **pcmp, const char *name,
 	unsigned int csize, ssize;
 	unsigned int cused, sused;
 	snd_pcm_chmap_query_t **chmaps = NULL;
+	int use_matrix = 1;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1330,7 +1691,17 @@ int _snd_pcm_route_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "matrix") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0) {
+				snd_pcm_free_chmaps(chmaps);
+				return err;
+			}
+			use_matrix = err;
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
+		snd_pcm_free_chmaps(chmaps);
 		return -EINVAL;
 	}
 	if (!slave) {
@@ -1425,6 +1796,7 @@ int _snd_pcm_route_open(snd_pcm_t **pcmp, const char *name,
 
 		route->chmap = chmap;
 		route->chmap_override = chmaps;
+		route->use_matrix = use_matrix;
 	}
 
 	return err;
@@ -45,6 +45,13 @@ const char *_snd_module_pcm_share = "";
 
 #ifndef DOC_HIDDEN
 
+#define atomic_read(ptr)    __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define atomic_set(ptr, n)  __atomic_store_n(ptr, n, __ATOMIC_SEQ_CST)
+#define atomic_xchg(ptr, n) __atomic_exchange_n(ptr, n, __ATOMIC_SEQ_CST)
+
+/* no pending commit in snd_pcm_share_t.pending_appl_ptr */
+#define NO_PENDING_PTR	((snd_pcm_uframes_t)-1)
+
 static LIST_HEAD(snd_pcm_share_slaves);
 static pthread_mutex_t snd_pcm_share_slaves_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -87,7 +94,9 @@ typedef struct {
 	snd_pcm_uframes_t safety_threshold;
 	snd_pcm_uframes_t silence_frames;
 	snd_pcm_sw_params_t sw_params;
-	snd_pcm_uframes_t hw_ptr;
+	snd_pcm_uframes_t hw_ptr;	/* atomic, only moves forward while running */
+	int lockless;			/* the slave handle serializes its own calls */
+	int commit_pending;		/* a client committed while the mutex was busy */
 	int poll[2];
 	int polling;
 	pthread_t thread;
@@ -106,9 +115,10 @@ typedef struct {
 	unsigned int *slave_channels;
 	int drain_silenced;
 	snd_htimestamp_t trigger_tstamp;
-	snd_pcm_state_t state;
-	snd_pcm_uframes_t hw_ptr;
-	snd_pcm_uframes_t appl_ptr;
+	snd_pcm_state_t state;		/* changed with the mutex, read atomically */
+	snd_pcm_uframes_t hw_ptr;	/* atomic */
+	snd_pcm_uframes_t appl_ptr;	/* stored by its client, read with acquire */
+	snd_pcm_uframes_t pending_appl_ptr; /* atomic, appl_ptr before the pending commits */
 	int ready;
 	int client_socket;
 	int slave_socket;
@@ -117,6 +127,85 @@ typedef struct {
 #endif /* DOC_HIDDEN */
 
 static void _snd_pcm_share_stop(snd_pcm_t *pcm, snd_pcm_state_t state);
+static void _snd_pcm_share_update(snd_pcm_t *pcm);
+static void snd_pcm_share_slave_unlock(snd_pcm_share_slave_t *slave);
+
+/*
+ * Locking
+ *
+ * slave->mutex serializes the state changes of the clients and the
+ * transfers to the slave.  The queries (avail_update, delay, status,
+ * hwsync, htimestamp, rewindable, forwardable) do not take it when the
+ * slave handle is thread-safe by itself: they read the client state and
+ * the hw pointers atomically and call the slave directly.  A commit
+ * which finds the mutex busy only moves the client appl_ptr forward, with
+ * a release store paired with the acquire loads of the holder reading the
+ * client appl_ptrs (snd_pcm_share_appl_ptr), and leaves the transfer to the slave to the mutex holder, which looks for
+ * pending commits before releasing it (see snd_pcm_share_slave_unlock),
+ * so every release of the mutex goes through snd_pcm_share_slave_unlock.
+ * The appl_ptr of the client before its first pending commit is kept for
+ * the latecomer check done when the commit is finally transferred.
+ * The thread is left with the xrun, drain and poll bookkeeping.
+ */
+
+/* move *ptr forward to val, never backward (ptr is shared by threads) */
+static void snd_pcm_share_ptr_advance(snd_pcm_uframes_t *ptr,
+				      snd_pcm_uframes_t val,
+				      snd_pcm_uframes_t boundary)
+{
+	snd_pcm_uframes_t old = atomic_read(ptr);
+	snd_pcm_sframes_t diff;
+	do {
+		diff = val - old;
+		if (diff < 0)
+			diff += boundary;
+		if (diff == 0 || (snd_pcm_uframes_t)diff >= boundary / 2)
+			return;
+	} while (!__atomic_compare_exchange_n(ptr, &old, val, 0,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+}
+
+/*
+ * appl_ptr of a client as seen by the mutex holder: a client committing
+ * without the mutex publishes it with a release store (see
+ * snd_pcm_share_mmap_commit), so the frames written before are visible
+ */
+static inline snd_pcm_uframes_t snd_pcm_share_appl_ptr(snd_pcm_share_t *share)
+{
+	return __atomic_load_n(&share->appl_ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline snd_pcm_uframes_t snd_pcm_share_client_avail(snd_pcm_t *pcm)
+{
+	snd_pcm_share_t *share = pcm->private_data;
+	return __snd_pcm_avail(pcm, atomic_read(&share->hw_ptr),
+			       snd_pcm_share_appl_ptr(share));
+}
+
+/* refresh slave->hw_ptr from the slave */
+static snd_pcm_sframes_t snd_pcm_share_slave_hwsync(snd_pcm_share_slave_t *slave)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(spcm);
+	if (avail >= 0)
+		snd_pcm_share_ptr_advance(&slave->hw_ptr, *spcm->hw.ptr,
+					  spcm->boundary);
+	return avail;
+}
+
+/* take the mutex for a query unless the slave handle is thread-safe */
+static inline void snd_pcm_share_query_lock(snd_pcm_share_slave_t *slave)
+{
+	if (!slave->lockless)
+		Pthread_mutex_lock(&slave->mutex);
+}
+
+static inline void snd_pcm_share_query_unlock(snd_pcm_share_slave_t *slave)
+{
+	if (!slave->lockless)
+		snd_pcm_share_slave_unlock(slave);
+}
 
 static snd_pcm_uframes_t snd_pcm_share_slave_avail(snd_pcm_share_slave_t *slave)
 {
@@ -133,6 +222,27 @@ static snd_pcm_uframes_t snd_pcm_share_slave_avail(snd_pcm_share_slave_t *slave)
 }
 
 /* Warning: take the mutex before to call this */
+/* Commit frames to the slave, in pieces contiguous in its buffer */
+static snd_pcm_sframes_t snd_pcm_share_slave_mmap_commit(snd_pcm_t *spcm,
+							 snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t xfer = 0;
+	while (xfer < frames) {
+		snd_pcm_uframes_t offset = snd_pcm_mmap_offset(spcm);
+		snd_pcm_uframes_t cont = spcm->buffer_size - offset;
+		snd_pcm_sframes_t err;
+		if (cont > frames - xfer)
+			cont = frames - xfer;
+		err = snd_pcm_mmap_commit(spcm, offset, cont);
+		if (err < 0)
+			return xfer > 0 ? (snd_pcm_sframes_t)xfer : err;
+		xfer += err;
+		if ((snd_pcm_uframes_t)err < cont)
+			break;
+	}
+	return xfer;
+}
+
 /* Return number of frames to mmap_commit the slave */
 static snd_pcm_uframes_t _snd_pcm_share_slave_forward(snd_pcm_share_slave_t *slave)
 {
@@ -159,7 +269,7 @@ static snd_pcm_uframes_t _snd_pcm_share_slave_forward(snd_pcm_share_slave_t *sla
 		default:
 			continue;
 		}
-		avail = snd_pcm_mmap_avail(pcm);
+		avail = snd_pcm_share_client_avail(pcm);
 		frames = slave_avail - avail;
 		if (frames > max_frames)
 			max_frames = frames;
@@ -216,8 +326,9 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	default:
 		return INT_MAX;
 	}
-	share->hw_ptr = slave->hw_ptr;
-	avail = snd_pcm_mmap_avail(pcm);
+	snd_pcm_share_ptr_advance(&share->hw_ptr, atomic_read(&slave->hw_ptr),
+				  spcm->boundary);
+	avail = snd_pcm_share_client_avail(pcm);
 	if (avail >= pcm->stop_threshold) {
 		_snd_pcm_share_stop(pcm, share->state == SND_PCM_STATE_DRAINING ? SND_PCM_STATE_SETUP : SND_PCM_STATE_XRUN);
 		goto update_poll;
@@ -235,7 +346,7 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 				frames = -safety_missing;
 				missing = 1;
 			}
-			err = snd_pcm_mmap_commit(spcm, snd_pcm_mmap_offset(spcm), frames);
+			err = snd_pcm_share_slave_mmap_commit(spcm, frames);
 			if (err < 0) {
 				SYSMSG("snd_pcm_mmap_commit error");
 				return INT_MAX;
@@ -308,7 +419,7 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	    !share->drain_silenced) {
 		/* drain silencing */
 		if (avail >= slave->silence_frames) {
-			snd_pcm_uframes_t offset = share->appl_ptr % buffer_size;
+			snd_pcm_uframes_t offset = snd_pcm_share_appl_ptr(share) % buffer_size;
 			snd_pcm_uframes_t xfer = 0;
 			snd_pcm_uframes_t size = slave->silence_frames;
 			while (xfer < size) {
@@ -338,8 +449,7 @@ static snd_pcm_uframes_t _snd_pcm_share_slave_missing(snd_pcm_share_slave_t *sla
 {
 	snd_pcm_uframes_t missing = INT_MAX;
 	struct list_head *i;
-	/* snd_pcm_sframes_t avail = */ snd_pcm_avail_update(slave->pcm);
-	slave->hw_ptr = *slave->pcm->hw.ptr;
+	snd_pcm_share_slave_hwsync(slave);
 	list_for_each(i, &slave->clients) {
 		snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
 		snd_pcm_t *pcm = share->pcm;
@@ -368,7 +478,7 @@ static void *snd_pcm_share_thread(void *data)
 	err = pipe(slave->poll);
 	if (err < 0) {
 		SYSERR("can't create a pipe");
-		Pthread_mutex_unlock(&slave->mutex);
+		snd_pcm_share_slave_unlock(slave);
 		return NULL;
 	}
 	while (slave->open_count > 0) {
@@ -395,12 +505,12 @@ static void *snd_pcm_share_thread(void *data)
 				err = snd_pcm_sw_params(spcm, &slave->sw_params);
 				if (err < 0) {
 					SYSERR("snd_pcm_sw_params error");
-					Pthread_mutex_unlock(&slave->mutex);
+					snd_pcm_share_slave_unlock(slave);
 					return NULL;
 				}
 			}
 			slave->polling = 1;
-			Pthread_mutex_unlock(&slave->mutex);
+			snd_pcm_share_slave_unlock(slave);
 			err = poll(pfd, 2, -1);
 			Pthread_mutex_lock(&slave->mutex);
 			if (pfd[0].revents & POLLIN) {
@@ -412,7 +522,7 @@ static void *snd_pcm_share_thread(void *data)
 			pthread_cond_wait(&slave->poll_cond, &slave->mutex);
 		}
 	}
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return NULL;
 }
 
@@ -422,8 +532,7 @@ static void _snd_pcm_share_update(snd_pcm_t *pcm)
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_t *spcm = slave->pcm;
 	snd_pcm_uframes_t missing;
-	/* snd_pcm_sframes_t avail = */ snd_pcm_avail_update(spcm);
-	slave->hw_ptr = *slave->pcm->hw.ptr;
+	snd_pcm_share_slave_hwsync(slave);
 	missing = _snd_pcm_share_missing(pcm);
 	// printf("missing %ld\n", missing);
 	if (!slave->polling) {
@@ -455,6 +564,79 @@ static void _snd_pcm_share_update(snd_pcm_t *pcm)
 	}
 }
 
+/* Warning: take the mutex before to call this */
+/* Transfer what the running clients have committed to the slave */
+static snd_pcm_sframes_t _snd_pcm_share_slave_commit(snd_pcm_share_slave_t *slave)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_sframes_t frames, err;
+	frames = _snd_pcm_share_slave_forward(slave);
+	if (frames <= 0)
+		return 0;
+	err = snd_pcm_share_slave_mmap_commit(spcm, frames);
+	if (err < 0) {
+		SYSMSG("snd_pcm_mmap_commit error");
+		return err;
+	}
+	if (err != frames)
+		SYSMSG("commit returns %ld for size %ld", err, frames);
+	return err;
+}
+
+/* Call it with mutex held, appl_ptr is the client position before the commit */
+static snd_pcm_sframes_t _snd_pcm_share_rewind_latecomer(snd_pcm_t *pcm,
+							 snd_pcm_uframes_t appl_ptr)
+{
+	snd_pcm_share_t *share = pcm->private_data;
+	snd_pcm_t *spcm = share->slave->pcm;
+	snd_pcm_sframes_t frames;
+	if (pcm->stream != SND_PCM_STREAM_PLAYBACK ||
+	    share->state != SND_PCM_STATE_RUNNING)
+		return 0;
+	frames = *spcm->appl.ptr - appl_ptr;
+	if (frames > (snd_pcm_sframes_t)pcm->buffer_size)
+		frames -= pcm->boundary;
+	else if (frames < -(snd_pcm_sframes_t)pcm->buffer_size)
+		frames += pcm->boundary;
+	if (frames <= 0)
+		return 0;
+	/* Latecomer PCM */
+	return snd_pcm_rewind(spcm, frames);
+}
+
+/* Release the mutex, transferring the commits made while it was held */
+static void snd_pcm_share_slave_unlock(snd_pcm_share_slave_t *slave)
+{
+	struct list_head *i;
+	for (;;) {
+		if (atomic_xchg(&slave->commit_pending, 0)) {
+			list_for_each(i, &slave->clients) {
+				snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
+				snd_pcm_uframes_t appl_ptr;
+				appl_ptr = atomic_xchg(&share->pending_appl_ptr,
+						       NO_PENDING_PTR);
+				if (appl_ptr != NO_PENDING_PTR)
+					_snd_pcm_share_rewind_latecomer(share->pcm,
+									appl_ptr);
+			}
+			/* even without a slave transfer, the committing
+			   clients must update their poll status */
+			if (_snd_pcm_share_slave_commit(slave) >= 0) {
+				list_for_each(i, &slave->clients) {
+					snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
+					if (atomic_read(&share->state) == SND_PCM_STATE_RUNNING)
+						_snd_pcm_share_update(share->pcm);
+				}
+			}
+		}
+		Pthread_mutex_unlock(&slave->mutex);
+		/* a commit may have failed to get the mutex in between */
+		if (!atomic_read(&slave->commit_pending) ||
+		    pthread_mutex_trylock(&slave->mutex))
+			return;
+	}
+}
+
 static int snd_pcm_share_nonblock(snd_pcm_t *pcm ATTRIBUTE_UNUSED, int nonblock ATTRIBUTE_UNUSED)
 {
 	return 0;
@@ -652,6 +834,7 @@ static int snd_pcm_share_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		if (err < 0)
 			goto _end;
 		snd_pcm_sw_params_current(slave->pcm, &slave->sw_params);
+		atomic_set(&slave->hw_ptr, *slave->pcm->hw.ptr);
 		/* >= 30 ms */
 		slave->safety_threshold = slave->pcm->rate * 30 / 1000;
 		slave->safety_threshold += slave->pcm->period_size - 1;
@@ -663,7 +846,7 @@ static int snd_pcm_share_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	share->state = SND_PCM_STATE_SETUP;
 	slave->setup_count++;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -677,7 +860,7 @@ static int snd_pcm_share_hw_free(snd_pcm_t *pcm)
 	if (slave->setup_count == 0)
 		err = snd_pcm_hw_free(slave->pcm);
 	share->state = SND_PCM_STATE_OPEN;
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -692,16 +875,18 @@ static int snd_pcm_share_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
 	snd_pcm_sframes_t sd = 0, d = 0;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_state_t state;
+	snd_pcm_share_query_lock(slave);
+	state = atomic_read(&share->state);
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		status->avail = snd_pcm_mmap_playback_avail(pcm);
-		if (share->state != SND_PCM_STATE_RUNNING &&
-		    share->state != SND_PCM_STATE_DRAINING)
+		if (state != SND_PCM_STATE_RUNNING &&
+		    state != SND_PCM_STATE_DRAINING)
 			goto _notrunning;
 		d = pcm->buffer_size - status->avail;
 	} else {
 		status->avail = snd_pcm_mmap_capture_avail(pcm);
-		if (share->state != SND_PCM_STATE_RUNNING)
+		if (state != SND_PCM_STATE_RUNNING)
 			goto _notrunning;
 		d = status->avail;
 	}
@@ -710,26 +895,26 @@ static int snd_pcm_share_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
 		goto _end;
  _notrunning:
 	status->delay = sd + d;
-	status->state = share->state;
+	status->state = state;
 	status->appl_ptr = *pcm->appl.ptr;
-	status->hw_ptr = *pcm->hw.ptr;
+	status->hw_ptr = atomic_read(&share->hw_ptr);
 	status->trigger_tstamp = share->trigger_tstamp;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return err;
 }
 
 static snd_pcm_state_t snd_pcm_share_state(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
-	return share->state;
+	return atomic_read(&share->state);
 }
 
 static int _snd_pcm_share_hwsync(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
-	switch (share->state) {
+	switch (atomic_read(&share->state)) {
 	case SND_PCM_STATE_XRUN:
 		return -EPIPE;
 	default:
@@ -743,9 +928,9 @@ static int snd_pcm_share_hwsync(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_query_lock(slave);
 	err = _snd_pcm_share_hwsync(pcm);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return err;
 }
 
@@ -753,7 +938,7 @@ static int _snd_pcm_share_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 {
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
-	switch (share->state) {
+	switch (atomic_read(&share->state)) {
 	case SND_PCM_STATE_XRUN:
 		return -EPIPE;
 	case SND_PCM_STATE_RUNNING:
@@ -773,9 +958,9 @@ static int snd_pcm_share_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_query_lock(slave);
 	err = _snd_pcm_share_delay(pcm, delayp);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return err;
 }
 
@@ -784,16 +969,26 @@ static snd_pcm_sframes_t snd_pcm_share_avail_update(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t avail;
-	Pthread_mutex_lock(&slave->mutex);
-	if (share->state == SND_PCM_STATE_RUNNING) {
-		avail = snd_pcm_avail_update(slave->pcm);
+	snd_pcm_share_query_lock(slave);
+	if (atomic_read(&share->state) == SND_PCM_STATE_RUNNING) {
+		/* the hw_ptr published by the other users may be enough */
+		snd_pcm_share_ptr_advance(&share->hw_ptr,
+					  atomic_read(&slave->hw_ptr),
+					  slave->pcm->boundary);
+		avail = snd_pcm_mmap_avail(pcm);
+		if (slave->lockless && (snd_pcm_uframes_t)avail >= pcm->avail_min &&
+		    (snd_pcm_uframes_t)avail <= pcm->buffer_size)
+			return avail;
+		avail = snd_pcm_share_slave_hwsync(slave);
 		if (avail < 0) {
-			Pthread_mutex_unlock(&slave->mutex);
+			snd_pcm_share_query_unlock(slave);
 			return avail;
 		}
-		share->hw_ptr = *slave->pcm->hw.ptr;
+		snd_pcm_share_ptr_advance(&share->hw_ptr,
+					  atomic_read(&slave->hw_ptr),
+					  slave->pcm->boundary);
 	}
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	avail = snd_pcm_mmap_avail(pcm);
 	if ((snd_pcm_uframes_t)avail > pcm->buffer_size)
 		return -EPIPE;
@@ -806,9 +1001,9 @@ static int snd_pcm_share_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail,
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_query_lock(slave);
 	err = snd_pcm_htimestamp(slave->pcm, avail, tstamp);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return err;
 }
 
@@ -819,38 +1014,20 @@ static snd_pcm_sframes_t _snd_pcm_share_mmap_commit(snd_pcm_t *pcm,
 {
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
-	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_uframes_t appl_ptr;
 	snd_pcm_sframes_t ret;
-	snd_pcm_sframes_t frames;
-	if (pcm->stream == SND_PCM_STREAM_PLAYBACK &&
-	    share->state == SND_PCM_STATE_RUNNING) {
-		frames = *spcm->appl.ptr - share->appl_ptr;
-		if (frames > (snd_pcm_sframes_t)pcm->buffer_size)
-			frames -= pcm->boundary;
-		else if (frames < -(snd_pcm_sframes_t)pcm->buffer_size)
-			frames += pcm->boundary;
-		if (frames > 0) {
-			/* Latecomer PCM */
-			ret = snd_pcm_rewind(spcm, frames);
-			if (ret < 0)
-				return ret;
-		}
-	}
+	/* a commit of ours may still be pending */
+	appl_ptr = atomic_xchg(&share->pending_appl_ptr, NO_PENDING_PTR);
+	if (appl_ptr == NO_PENDING_PTR)
+		appl_ptr = share->appl_ptr;
+	ret = _snd_pcm_share_rewind_latecomer(pcm, appl_ptr);
+	if (ret < 0)
+		return ret;
 	snd_pcm_mmap_appl_forward(pcm, size);
 	if (share->state == SND_PCM_STATE_RUNNING) {
-		frames = _snd_pcm_share_slave_forward(slave);
-		if (frames > 0) {
-			snd_pcm_sframes_t err;
-			err = snd_pcm_mmap_commit(spcm, snd_pcm_mmap_offset(spcm), frames);
-			if (err < 0) {
-				SYSMSG("snd_pcm_mmap_commit error");
-				return err;
-			}
-			if (err != frames) {
-				SYSMSG("commit returns %ld for size %ld", err, frames);
-				return err;
-			}
-		}
+		ret = _snd_pcm_share_slave_commit(slave);
+		if (ret < 0)
+			return ret;
 		_snd_pcm_share_update(pcm);
 	}
 	return size;
@@ -862,11 +1039,36 @@ static snd_pcm_sframes_t snd_pcm_share_mmap_commit(snd_pcm_t *pcm,
 {
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
+	snd_pcm_uframes_t appl_ptr;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
-	ret = _snd_pcm_share_mmap_commit(pcm, offset, size);
-	Pthread_mutex_unlock(&slave->mutex);
-	return ret;
+	/* a client left below avail_min waits for its poll status anyway,
+	   which only the mutex holder updates, so let it wait for the mutex */
+	if (!slave->lockless ||
+	    snd_pcm_mmap_avail(pcm) < size + pcm->avail_min) {
+		Pthread_mutex_lock(&slave->mutex);
+		ret = _snd_pcm_share_mmap_commit(pcm, offset, size);
+		snd_pcm_share_slave_unlock(slave);
+		return ret;
+	}
+	if (pthread_mutex_trylock(&slave->mutex) == 0) {
+		ret = _snd_pcm_share_mmap_commit(pcm, offset, size);
+		snd_pcm_share_slave_unlock(slave);
+		return ret;
+	}
+	/* the mutex holder transfers the frames to the slave */
+	appl_ptr = NO_PENDING_PTR;
+	__atomic_compare_exchange_n(&share->pending_appl_ptr, &appl_ptr,
+				    share->appl_ptr, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	/* the holder may be reading it, publish with the frames written */
+	appl_ptr = share->appl_ptr + size;
+	if (appl_ptr >= pcm->boundary)
+		appl_ptr -= pcm->boundary;
+	__atomic_store_n(&share->appl_ptr, appl_ptr, __ATOMIC_RELEASE);
+	atomic_set(&slave->commit_pending, 1);
+	if (pthread_mutex_trylock(&slave->mutex) == 0)
+		snd_pcm_share_slave_unlock(slave);
+	return size;
 }
 
 static int snd_pcm_share_prepare(snd_pcm_t *pcm)
@@ -892,13 +1094,14 @@ static int snd_pcm_share_prepare(snd_pcm_t *pcm)
 		err = snd_pcm_prepare(slave->pcm);
 		if (err < 0)
 			goto _end;
+		atomic_set(&slave->hw_ptr, *slave->pcm->hw.ptr);
 	}
 	slave->prepared_count++;
 	share->hw_ptr = 0;
 	share->appl_ptr = 0;
 	share->state = SND_PCM_STATE_PREPARED;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -912,7 +1115,7 @@ static int snd_pcm_share_reset(snd_pcm_t *pcm)
 	snd_pcm_areas_silence(pcm->running_areas, 0, pcm->channels, pcm->buffer_size, pcm->format);
 	share->hw_ptr = *slave->pcm->hw.ptr;
 	share->appl_ptr = share->hw_ptr;
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -947,7 +1150,8 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 		share->appl_ptr = *spcm->appl.ptr;
 		while (xfer < hw_avail) {
 			snd_pcm_uframes_t frames = hw_avail - xfer;
-			snd_pcm_uframes_t offset = snd_pcm_mmap_offset(pcm);
+			snd_pcm_uframes_t offset = (snd_pcm_mmap_offset(pcm) + xfer) %
+						   pcm->buffer_size;
 			snd_pcm_uframes_t cont = pcm->buffer_size - offset;
 			if (cont < frames)
 				frames = cont;
@@ -961,7 +1165,7 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 		snd_pcm_mmap_appl_forward(pcm, hw_avail);
 		if (slave->running_count == 0) {
 			snd_pcm_sframes_t res;
-			res = snd_pcm_mmap_commit(spcm, snd_pcm_mmap_offset(spcm), hw_avail);
+			res = snd_pcm_share_slave_mmap_commit(spcm, hw_avail);
 			if (res < 0) {
 				err = res;
 				goto _end;
@@ -978,7 +1182,9 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 	_snd_pcm_share_update(pcm);
 	gettimestamp(&share->trigger_tstamp, pcm->tstamp_type);
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	if (err < 0)
+		share->state = SND_PCM_STATE_PREPARED;
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -1046,9 +1252,9 @@ static snd_pcm_sframes_t snd_pcm_share_rewindable(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_query_lock(slave);
 	ret = snd_pcm_rewindable(slave->pcm);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return ret;
 }
 
@@ -1059,7 +1265,7 @@ static snd_pcm_sframes_t snd_pcm_share_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_sframes_t ret;
 	Pthread_mutex_lock(&slave->mutex);
 	ret = _snd_pcm_share_rewind(pcm, frames);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return ret;
 }
 
@@ -1103,9 +1309,9 @@ static snd_pcm_sframes_t snd_pcm_share_forwardable(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_query_lock(slave);
 	ret = snd_pcm_forwardable(slave->pcm);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_query_unlock(slave);
 	return ret;
 }
 
@@ -1116,7 +1322,7 @@ static snd_pcm_sframes_t snd_pcm_share_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_sframes_t ret;
 	Pthread_mutex_lock(&slave->mutex);
 	ret = _snd_pcm_share_forward(pcm, frames);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return ret;
 }
 
@@ -1153,6 +1359,13 @@ static void _snd_pcm_share_stop(snd_pcm_t *pcm, snd_pcm_state_t state)
 	if (slave->running_count == 0) {
 		int err = snd_pcm_drop(slave->pcm);
 		assert(err >= 0);
+		/* the other clients wait for the slave to start again */
+		if (slave->prepared_count > 0) {
+			err = snd_pcm_prepare(slave->pcm);
+			if (err < 0)
+				SNDERR("slave prepare error %d", err);
+			atomic_set(&slave->hw_ptr, *slave->pcm->hw.ptr);
+		}
 	}
 }
 
@@ -1183,7 +1396,7 @@ static int snd_pcm_share_drain(snd_pcm_t *pcm)
 		case SND_PCM_STATE_RUNNING:
 			share->state = SND_PCM_STATE_DRAINING;
 			_snd_pcm_share_update(pcm);
-			Pthread_mutex_unlock(&slave->mutex);
+			snd_pcm_share_slave_unlock(slave);
 			if (!(pcm->mode & SND_PCM_NONBLOCK))
 				snd_pcm_wait(pcm, -1);
 			return 0;
@@ -1210,7 +1423,7 @@ static int snd_pcm_share_drain(snd_pcm_t *pcm)
 		}
 	}
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -1247,7 +1460,7 @@ static int snd_pcm_share_drop(snd_pcm_t *pcm)
 	
 	share->appl_ptr = share->hw_ptr = 0;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 	return err;
 }
 
@@ -1262,18 +1475,18 @@ static int snd_pcm_share_close(snd_pcm_t *pcm)
 	slave->open_count--;
 	if (slave->open_count == 0) {
 		pthread_cond_signal(&slave->poll_cond);
-		Pthread_mutex_unlock(&slave->mutex);
+		snd_pcm_share_slave_unlock(slave);
 		err = pthread_join(slave->thread, 0);
 		assert(err == 0);
 		err = snd_pcm_close(slave->pcm);
 		pthread_mutex_destroy(&slave->mutex);
 		pthread_cond_destroy(&slave->poll_cond);
+		list_del(&share->list);
 		list_del(&slave->list);
 		free(slave);
-		list_del(&share->list);
 	} else {
 		list_del(&share->list);
-		Pthread_mutex_unlock(&slave->mutex);
+		snd_pcm_share_slave_unlock(slave);
 	}
 	Pthread_mutex_unlock(&snd_pcm_share_slaves_mutex);
 	close(share->client_socket);
@@ -1283,13 +1496,61 @@ static int snd_pcm_share_close(snd_pcm_t *pcm)
 	return err;
 }
 
-static int snd_pcm_share_mmap(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+static int snd_pcm_share_munmap(snd_pcm_t *pcm)
 {
+	if (pcm->stopped_areas)
+		free(pcm->stopped_areas[0].addr);
+	free(pcm->stopped_areas);
+	free(pcm->mmap_channels);
+	free(pcm->running_areas);
+	pcm->stopped_areas = NULL;
+	pcm->mmap_channels = NULL;
+	pcm->running_areas = NULL;
 	return 0;
 }
 
-static int snd_pcm_share_munmap(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+static int snd_pcm_share_mmap(snd_pcm_t *pcm)
 {
+	snd_pcm_share_t *share = pcm->private_data;
+	snd_pcm_t *spcm = share->slave->pcm;
+	unsigned int c;
+	char *buf;
+
+	if (!spcm->mmap_channels || !spcm->running_areas)
+		return -EBADFD;
+	pcm->mmap_channels = calloc(pcm->channels,
+				    sizeof(pcm->mmap_channels[0]));
+	pcm->running_areas = calloc(pcm->channels,
+				    sizeof(pcm->running_areas[0]));
+	pcm->stopped_areas = calloc(pcm->channels,
+				    sizeof(pcm->stopped_areas[0]));
+	buf = calloc(1, snd_pcm_frames_to_bytes(pcm, pcm->buffer_size));
+	if (pcm->stopped_areas)
+		pcm->stopped_areas[0].addr = buf;
+	if (!pcm->mmap_channels || !pcm->running_areas ||
+	    !pcm->stopped_areas || !buf) {
+		if (!pcm->stopped_areas)
+			free(buf);
+		snd_pcm_share_munmap(pcm);
+		return -ENOMEM;
+	}
+	/* the slave plays the channels of the clients not running yet,
+	 * so they write in a buffer of their own until the start
+	 */
+	for (c = 0; c < pcm->channels; c++) {
+		pcm->stopped_areas[c].addr = buf;
+		pcm->stopped_areas[c].first = c * pcm->sample_bits;
+		pcm->stopped_areas[c].step = pcm->frame_bits;
+	}
+	/* Copy the slave mmapped buffer data, the clients live in the
+	 * same process, whatever the slave buffer is
+	 */
+	for (c = 0; c < pcm->channels; c++) {
+		unsigned int sc = share->slave_channels[c];
+		pcm->mmap_channels[c] = spcm->mmap_channels[sc];
+		pcm->mmap_channels[c].channel = c;
+		pcm->running_areas[c] = spcm->running_areas[sc];
+	}
 	return 0;
 }
 
@@ -1380,7 +1641,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	snd_pcm_share_t *share;
 	int err;
 	struct list_head *i;
-	char slave_map[32] = { 0 };
+	char *slave_map;
 	unsigned int k;
 	snd_pcm_share_slave_t *slave = NULL;
 	int sd[2];
@@ -1388,8 +1649,10 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	assert(pcmp);
 	assert(channels > 0 && sname && channels_map);
 
+	slave_map = alloca(schannels);
+	memset(slave_map, 0, schannels);
 	for (k = 0; k < channels; ++k) {
-		if (channels_map[k] >= sizeof(slave_map) / sizeof(slave_map[0])) {
+		if (channels_map[k] >= schannels) {
 			SNDERR("Invalid slave channel (%d) in binding", channels_map[k]);
 			return -EINVAL;
 		}
@@ -1398,7 +1661,6 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 			return -EINVAL;
 		}
 		slave_map[channels_map[k]] = 1;
-		assert((unsigned)channels_map[k] < schannels);
 	}
 
 	share = calloc(1, sizeof(snd_pcm_share_t));
@@ -1406,6 +1668,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		return -ENOMEM;
 
 	share->channels = channels;
+	share->pending_appl_ptr = NO_PENDING_PTR;
 	share->slave_channels = calloc(channels, sizeof(*share->slave_channels));
 	if (!share->slave_channels) {
 		free(share);
@@ -1473,9 +1736,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 			free(share);
 			return err;
 		}
-		/* FIXME: bellow is a real ugly hack to get things working */
-		/* there is a memory leak somewhere, but I'm unable to trace it --jk */
-		slave = calloc(1, sizeof(snd_pcm_share_slave_t) * 8);
+		slave = calloc(1, sizeof(snd_pcm_share_slave_t));
 		if (!slave) {
 			Pthread_mutex_unlock(&snd_pcm_share_slaves_mutex);
 			snd_pcm_close(spcm);
@@ -1484,7 +1745,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 			snd_pcm_free(pcm);
 			free(share->slave_channels);
 			free(share);
-			return err;
+			return -ENOMEM;
 		}
 		INIT_LIST_HEAD(&slave->clients);
 		slave->pcm = spcm;
@@ -1493,6 +1754,10 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		slave->rate = srate;
 		slave->period_time = speriod_time;
 		slave->buffer_time = sbuffer_time;
+#ifdef THREAD_SAFE_API
+		/* hw is thread-safe, the other slaves are locked by themselves */
+		slave->lockless = !spcm->need_lock || spcm->lock_enabled;
+#endif
 		pthread_mutex_init(&slave->mutex, NULL);
 		pthread_cond_init(&slave->poll_cond, NULL);
 		list_add_tail(&slave->list, &snd_pcm_share_slaves);
@@ -1506,9 +1771,10 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		list_for_each(i, &slave->clients) {
 			snd_pcm_share_t *sh = list_entry(i, snd_pcm_share_t, list);
 			for (k = 0; k < sh->channels; ++k) {
-				if (slave_map[sh->slave_channels[k]]) {
+				if (sh->slave_channels[k] < schannels &&
+				    slave_map[sh->slave_channels[k]]) {
 					SNDERR("Slave channel %d is already in use", sh->slave_channels[k]);
-					Pthread_mutex_unlock(&slave->mutex);
+					snd_pcm_share_slave_unlock(slave);
 					close(sd[0]);
 					close(sd[1]);
 					snd_pcm_free(pcm);
@@ -1526,9 +1792,12 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	share->slave_socket = sd[1];
 	
 	pcm->mmap_rw = 1;
+	pcm->mmap_shadow = 1; /* has own mmap method */
 	pcm->ops = &snd_pcm_share_ops;
 	pcm->fast_ops = &snd_pcm_share_fast_ops;
 	pcm->private_data = share;
+	/* constrained by the setup of the other clients */
+	pcm->refine_volatile = 1;
 	pcm->poll_fd = share->client_socket;
 	pcm->poll_events = stream == SND_PCM_STREAM_PLAYBACK ? POLLOUT : POLLIN;
 	pcm->tstamp_type = slave->pcm->tstamp_type;
@@ -1538,7 +1807,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	slave->open_count++;
 	list_add_tail(&share->list, &slave->clients);
 
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_slave_unlock(slave);
 
 	*pcmp = pcm;
 	return 0;
@@ -1558,6 +1827,12 @@ The difference from \ref pcm_plugins_dshare "dshare plugin" is that
 share plugin requires the server program "aserver", while dshare plugin
 doesn't need the explicit server but access to the shared buffer.
 
+The clients of one slave share a helper thread, which handles the xruns,
+the draining and the poll descriptors.  When the slave PCM is thread-safe
+(see \ref pcm_thread_safety), the status queries of the clients don't take
+the slave lock and a transfer never waits for another client: whoever holds
+the lock forwards the frames committed meanwhile to the slave.
+
 \code
 pcm.name {
         type share              # Share PCM
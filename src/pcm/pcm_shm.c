@@ -747,6 +747,7 @@ int snd_pcm_shm_open(snd_pcm_t **pcmp, const char *name,
 		goto _err;
 	}
 	pcm->mmap_rw = 1;
+	pcm->refine_volatile = 1; /* refined by the server */
 	pcm->ops = &snd_pcm_shm_ops;
 	pcm->fast_ops = &snd_pcm_shm_fast_ops;
 	pcm->private_data = shm;
@@ -53,10 +53,30 @@ typedef struct {
 	double min_dB;
 	double max_dB;
 	unsigned int *dB_value;
+	int ramp;		  /* SOFTVOL_RAMP_* */
+	unsigned int ramp_time;	  /* ramp duration in ms */
+	/* set up at hw_params */
+	unsigned int channels;
+	snd_pcm_uframes_t ramp_frames;
+	snd_pcm_uframes_t ramp_left;
+	unsigned int applied_vol[2]; /* cur_vol the gains were built for */
+	int mute, unity, boost;
+	unsigned int *pattern;	  /* interleaved gains, channels * 8 */
+	unsigned int *chan_pattern; /* per channel gains, 8 each */
+	double *gain;		  /* gain reached by the ramp */
+	double *ramp_step;	  /* increment or factor per frame */
 } snd_pcm_softvol_t;
 
 #define VOL_SCALE_SHIFT		16
-#define VOL_SCALE_MASK          ((1 << VOL_SCALE_SHIFT) - 1)
+
+#define SOFTVOL_RAMP_NONE	0
+#define SOFTVOL_RAMP_LINEAR	1
+#define SOFTVOL_RAMP_EXPONENTIAL 2
+#define DEFAULT_RAMP_TIME	10	/* ms */
+
+#define PATTERN_LANES		8
+#define UNITY_GAIN		(1 << VOL_SCALE_SHIFT)
+#define RAMP_EXP_FLOOR		(1.0 / UNITY_GAIN)
 
 #define PRESET_RESOLUTION	256
 #define PRESET_MIN_DB		-51.0
@@ -102,328 +122,574 @@ static const unsigned int preset_dB_value[PRESET_RESOLUTION] = {
 	0xd9e3, 0xdef6, 0xe428, 0xe978, 0xeee8, 0xf479, 0xfa2b, 0xffff,
 };
 
-/* (32bit x 16bit) >> 16 */
-typedef union {
-	int i;
-	short s[2];
-} val_t;
-static inline int MULTI_DIV_32x16(int a, unsigned short b)
-{
-	val_t v, x, y;
-	v.i = a;
-	y.i = 0;
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	x.i = (unsigned short)v.s[0];
-	x.i *= b;
-	y.s[0] = x.s[1];
-	y.i += (int)v.s[1] * b;
-#else
-	x.i = (unsigned int)v.s[1] * b;
-	y.s[1] = x.s[0];
-	y.i += (int)v.s[0] * b;
+#endif /* DOC_HIDDEN */
+
+/*
+ * apply volume attenuation
+ *
+ * The gains are kept as 16.16 fixed point values per sample position:
+ * an interleaved buffer uses a pattern of (channels * 8) entries, each
+ * channel buffer of a non-interleaved layout its own 8 entries, so that
+ * a vector of 4 or 8 samples always finds its gains at the same offset.
+ * The 0 dB value 0xffff is stored as 0x10000 so that unity is exact.
+ */
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SOFTVOL_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define SOFTVOL_SIMD_NEON
+#include <arm_neon.h>
 #endif
-	return y.i;
+
+static inline long long softvol_clip(long long v, long long min, long long max)
+{
+	if (v > max)
+		return max;
+	if (v < min)
+		return min;
+	return v;
 }
 
-static inline int MULTI_DIV_int(int a, unsigned int b, int swap)
+#ifdef SOFTVOL_SIMD_SSE2
+/* (s16 * gain) >> 16 for gains up to 0x10000, in 8 lanes */
+static snd_pcm_uframes_t simd_scale_s16(int16_t *dst, const int16_t *src,
+					snd_pcm_uframes_t n,
+					const unsigned int *gain,
+					unsigned int period)
 {
-	unsigned int gain = (b >> VOL_SCALE_SHIFT);
-	int fraction;
-	a = swap ? (int)bswap_32(a) : a;
-	fraction = MULTI_DIV_32x16(a, b & VOL_SCALE_MASK);
-	if (gain) {
-		long long amp = (long long)a * gain + fraction;
-		if (amp > (int)0x7fffffff)
-			amp = (int)0x7fffffff;
-		else if (amp < (int)0x80000000)
-			amp = (int)0x80000000;
-		return swap ? (int)bswap_32((int)amp) : (int)amp;
+	const __m128i mask = _mm_set1_epi32(0xffff);
+	const __m128i bias = _mm_set1_epi32(0x8000);
+	const __m128i sign = _mm_set1_epi16((short)0x8000);
+	const __m128i half = _mm_set1_epi32(0x7fff);
+	snd_pcm_uframes_t i;
+	unsigned int j = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i p0 = _mm_loadu_si128((const __m128i *)(gain + j));
+		__m128i p1 = _mm_loadu_si128((const __m128i *)(gain + j + 4));
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo, carry;
+		/* the low halves as signed 16 bit; a gain with the bit 15
+		 * (or 16) set is done as a * (lo - 0x10000) + a * 0x10000
+		 */
+		lo = _mm_packs_epi32(_mm_sub_epi32(_mm_and_si128(p0, mask), bias),
+				     _mm_sub_epi32(_mm_and_si128(p1, mask), bias));
+		lo = _mm_xor_si128(lo, sign);
+		carry = _mm_packs_epi32(_mm_cmpgt_epi32(p0, half),
+					_mm_cmpgt_epi32(p1, half));
+		a = _mm_add_epi16(_mm_mulhi_epi16(a, lo), _mm_and_si128(a, carry));
+		_mm_storeu_si128((__m128i *)(dst + i), a);
+		j += 8;
+		if (j == period)
+			j = 0;
 	}
-	return swap ? (int)bswap_32(fraction) : fraction;
+	return i;
 }
 
-/* always little endian */
-static inline int MULTI_DIV_24(int a, unsigned int b)
+#define simd_scale_s32(dst, src, n, gain, period)	0
+
+static snd_pcm_uframes_t simd_scale_float(float *dst, const float *src,
+					  snd_pcm_uframes_t n,
+					  const unsigned int *gain,
+					  unsigned int period)
 {
-	unsigned int gain = b >> VOL_SCALE_SHIFT;
-	int fraction;
-	fraction = MULTI_DIV_32x16(a, b & VOL_SCALE_MASK);
-	if (gain) {
-		long long amp = (long long)a * gain + fraction;
-		if (amp > (int)0x7fffff)
-			amp = (int)0x7fffff;
-		else if (amp < (int)0x800000)
-			amp = (int)0x800000;
-		return (int)amp;
+	const __m128 scale = _mm_set1_ps(1.0f / UNITY_GAIN);
+	snd_pcm_uframes_t i;
+	unsigned int j = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(gain + j));
+		__m128 g = _mm_mul_ps(_mm_cvtepi32_ps(p), scale);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		j += 4;
+		if (j == period)
+			j = 0;
 	}
-	return fraction;
+	return i;
 }
 
-static inline short MULTI_DIV_short(short a, unsigned int b, int swap)
+#elif defined(SOFTVOL_SIMD_NEON)
+
+static snd_pcm_uframes_t simd_scale_s16(int16_t *dst, const int16_t *src,
+					snd_pcm_uframes_t n,
+					const unsigned int *gain,
+					unsigned int period)
 {
-	unsigned int gain = b >> VOL_SCALE_SHIFT;
-	int fraction;
-	a = swap ? (short)bswap_16(a) : a;
-	fraction = (int)(a * (b & VOL_SCALE_MASK)) >> VOL_SCALE_SHIFT;
-	if (gain) {
-		int amp = a * gain + fraction;
-		if (abs(amp) > 0x7fff)
-			amp = (a<0) ? (short)0x8000 : (short)0x7fff;
-		return swap ? (short)bswap_16((short)amp) : (short)amp;
+	snd_pcm_uframes_t i;
+	unsigned int j = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		int16x8_t a = vld1q_s16(src + i);
+		int32x4_t p0 = vreinterpretq_s32_u32(vld1q_u32(gain + j));
+		int32x4_t p1 = vreinterpretq_s32_u32(vld1q_u32(gain + j + 4));
+		/* |a| <= 0x8000 and gain <= 0x10000 fit in 32 bits */
+		int32x4_t l = vmulq_s32(vmovl_s16(vget_low_s16(a)), p0);
+		int32x4_t h = vmulq_s32(vmovl_s16(vget_high_s16(a)), p1);
+		vst1q_s16(dst + i, vcombine_s16(vmovn_s32(vshrq_n_s32(l, 16)),
+						vmovn_s32(vshrq_n_s32(h, 16))));
+		j += 8;
+		if (j == period)
+			j = 0;
 	}
-	return swap ? (short)bswap_16((short)fraction) : (short)fraction;
+	return i;
 }
 
-#endif /* DOC_HIDDEN */
-
-/*
- * apply volumue attenuation
- *
- * TODO: use SIMD operations
- */
+static snd_pcm_uframes_t simd_scale_s32(int32_t *dst, const int32_t *src,
+					snd_pcm_uframes_t n,
+					const unsigned int *gain,
+					unsigned int period)
+{
+	snd_pcm_uframes_t i;
+	unsigned int j = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		int32x4_t a = vld1q_s32(src + i);
+		int32x4_t p = vreinterpretq_s32_u32(vld1q_u32(gain + j));
+		int64x2_t l = vmull_s32(vget_low_s32(a), vget_low_s32(p));
+		int64x2_t h = vmull_s32(vget_high_s32(a), vget_high_s32(p));
+		vst1q_s32(dst + i, vcombine_s32(vqmovn_s64(vshrq_n_s64(l, 16)),
+						vqmovn_s64(vshrq_n_s64(h, 16))));
+		j += 4;
+		if (j == period)
+			j = 0;
+	}
+	return i;
+}
 
-#ifndef DOC_HIDDEN
-#define CONVERT_AREA(TYPE, swap) do {	\
-	unsigned int ch, fr; \
-	TYPE *src, *dst; \
-	for (ch = 0; ch < channels; ch++) { \
-		src_area = &src_areas[ch]; \
-		dst_area = &dst_areas[ch]; \
-		src = snd_pcm_channel_area_addr(src_area, src_offset); \
-		dst = snd_pcm_channel_area_addr(dst_area, dst_offset); \
-		src_step = snd_pcm_channel_area_step(src_area) / sizeof(TYPE); \
-		dst_step = snd_pcm_channel_area_step(dst_area) / sizeof(TYPE); \
-		GET_VOL_SCALE; \
-		fr = frames; \
-		if (! vol_scale) { \
-			while (fr--) { \
-				*dst = 0; \
-				dst += dst_step; \
-			} \
-		} else if (vol_scale == 0xffff) { \
-			while (fr--) { \
-				*dst = *src; \
-				src += src_step; \
-				dst += dst_step; \
-			} \
-		} else { \
-			while (fr--) { \
-				*dst = (TYPE) MULTI_DIV_##TYPE(*src, vol_scale, swap); \
-				src += src_step; \
-				dst += dst_step; \
-			} \
-		} \
-	} \
-} while (0)
-
-#define CONVERT_AREA_S24_3LE() do {					\
-	unsigned int ch, fr;						\
-	unsigned char *src, *dst;					\
-	int tmp;							\
-	for (ch = 0; ch < channels; ch++) {				\
-		src_area = &src_areas[ch];				\
-		dst_area = &dst_areas[ch];				\
-		src = snd_pcm_channel_area_addr(src_area, src_offset);	\
-		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);	\
-		src_step = snd_pcm_channel_area_step(src_area);		\
-		dst_step = snd_pcm_channel_area_step(dst_area);		\
-		GET_VOL_SCALE;						\
-		fr = frames;						\
-		if (! vol_scale) {					\
-			while (fr--) {					\
-				dst[0] = dst[1] = dst[2] = 0;		\
-				dst += dst_step;			\
-			}						\
-		} else if (vol_scale == 0xffff) {			\
-			while (fr--) {					\
-				dst[0] = src[0];			\
-				dst[1] = src[1];			\
-				dst[2] = src[2];			\
-				src += dst_step;			\
-				dst += src_step;			\
-			}						\
-		} else {						\
-			while (fr--) {					\
-				tmp = src[0] |				\
-				      (src[1] << 8) |			\
-				      (((signed char *) src)[2] << 16);	\
-				tmp = MULTI_DIV_24(tmp, vol_scale);	\
-				dst[0] = tmp;				\
-				dst[1] = tmp >> 8;			\
-				dst[2] = tmp >> 16;			\
-				src += dst_step;			\
-				dst += src_step;			\
-			}						\
-		}							\
-	}								\
-} while (0)
-
-#define CONVERT_AREA_S24_LE() do {					\
-	unsigned int ch, fr;						\
-	int *src, *dst;							\
-	int tmp;							\
-	for (ch = 0; ch < channels; ch++) {				\
-		src_area = &src_areas[ch];				\
-		dst_area = &dst_areas[ch];				\
-		src = snd_pcm_channel_area_addr(src_area, src_offset);	\
-		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);	\
-		src_step = snd_pcm_channel_area_step(src_area)		\
-				/ sizeof(int);				\
-		dst_step = snd_pcm_channel_area_step(dst_area)		\
-				/ sizeof(int);				\
-		GET_VOL_SCALE;						\
-		fr = frames;						\
-		if (! vol_scale) {					\
-			while (fr--) {					\
-				*dst = 0;				\
-				dst += dst_step;			\
-			}						\
-		} else if (vol_scale == 0xffff) {			\
-			while (fr--) {					\
-				*dst = *src;				\
-				src += dst_step;			\
-				dst += src_step;			\
-			}						\
-		} else {						\
-			while (fr--) {					\
-				tmp = *src << 8;			\
-				tmp = (signed int) tmp >> 8;		\
-				*dst = MULTI_DIV_24(tmp, vol_scale);	\
-				src += dst_step;			\
-				dst += src_step;			\
-			}						\
-		}							\
-	}								\
-} while (0)
-		
-#define GET_VOL_SCALE \
-	switch (ch) { \
-	case 0: \
-	case 2: \
-		vol_scale = (channels == ch + 1) ? vol_c : vol[0]; \
-		break; \
-	case 4: \
-	case 5: \
-		vol_scale = vol_c; \
-		break; \
-	default: \
-		vol_scale = vol[ch & 1]; \
-		break; \
+static snd_pcm_uframes_t simd_scale_float(float *dst, const float *src,
+					  snd_pcm_uframes_t n,
+					  const unsigned int *gain,
+					  unsigned int period)
+{
+	snd_pcm_uframes_t i;
+	unsigned int j = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		float32x4_t g = vmulq_n_f32(vcvtq_f32_u32(vld1q_u32(gain + j)),
+					    1.0f / UNITY_GAIN);
+		vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), g));
+		j += 4;
+		if (j == period)
+			j = 0;
 	}
+	return i;
+}
 
-#endif /* DOC_HIDDEN */
+#else
 
-/* 2-channel stereo control */
-static void softvol_convert_stereo_vol(snd_pcm_softvol_t *svol,
-				       const snd_pcm_channel_area_t *dst_areas,
-				       snd_pcm_uframes_t dst_offset,
-				       const snd_pcm_channel_area_t *src_areas,
-				       snd_pcm_uframes_t src_offset,
-				       unsigned int channels,
-				       snd_pcm_uframes_t frames)
-{
-	const snd_pcm_channel_area_t *dst_area, *src_area;
-	unsigned int src_step, dst_step;
-	unsigned int vol_scale, vol[2], vol_c;
+#define simd_scale_s16(dst, src, n, gain, period)	0
+#define simd_scale_s32(dst, src, n, gain, period)	0
+#define simd_scale_float(dst, src, n, gain, period)	0
 
-	if (svol->cur_vol[0] == 0 && svol->cur_vol[1] == 0) {
-		snd_pcm_areas_silence(dst_areas, dst_offset, channels, frames,
-				      svol->sformat);
-		return;
-	} else if (svol->zero_dB_val && svol->cur_vol[0] == svol->zero_dB_val &&
-		   svol->cur_vol[1] == svol->zero_dB_val) {
-		snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
-				   channels, frames, svol->sformat);
-		return;
-	}
+#endif
 
-	if (svol->max_val == 1) {
-		vol[0] = svol->cur_vol[0] ? 0xffff : 0;
-		vol[1] = svol->cur_vol[1] ? 0xffff : 0;
-		vol_c = vol[0] | vol[1];
-	} else {
-		vol[0] = svol->dB_value[svol->cur_vol[0]];
-		vol[1] = svol->dB_value[svol->cur_vol[1]];
-		vol_c = svol->dB_value[(svol->cur_vol[0] + svol->cur_vol[1]) / 2];
+/*
+ * scale n samples, src_step and dst_step in bytes;
+ * gain[] is cycled with the given period (a multiple of PATTERN_LANES)
+ */
+static void softvol_scale(snd_pcm_softvol_t *svol,
+			  char *dst, int dst_step,
+			  const char *src, int src_step,
+			  snd_pcm_uframes_t n,
+			  const unsigned int *gain, unsigned int period)
+{
+	int width = snd_pcm_format_physical_width(svol->sformat) / 8;
+	int swap = !snd_pcm_format_cpu_endian(svol->sformat);
+	snd_pcm_uframes_t i = 0;
+	unsigned int j;
+
+	if (src_step == width && dst_step == width && !swap) {
+		switch (svol->sformat) {
+		case SND_PCM_FORMAT_S16_LE:
+		case SND_PCM_FORMAT_S16_BE:
+			if (!svol->boost)
+				i = simd_scale_s16((int16_t *)dst, (const int16_t *)src,
+						   n, gain, period);
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+		case SND_PCM_FORMAT_S32_BE:
+			i = simd_scale_s32((int32_t *)dst, (const int32_t *)src,
+					   n, gain, period);
+			break;
+		case SND_PCM_FORMAT_FLOAT_LE:
+		case SND_PCM_FORMAT_FLOAT_BE:
+			i = simd_scale_float((float *)dst, (const float *)src,
+					     n, gain, period);
+			break;
+		default:
+			break;
+		}
+		src += i * width;
+		dst += i * width;
 	}
+	j = i % period;
+
+#define NEXT_GAIN() do { \
+		src += src_step; \
+		dst += dst_step; \
+		if (++j == period) \
+			j = 0; \
+	} while (0)
+
 	switch (svol->sformat) {
 	case SND_PCM_FORMAT_S16_LE:
 	case SND_PCM_FORMAT_S16_BE:
-		/* 16bit samples */
-		CONVERT_AREA(short, 
-			     !snd_pcm_format_cpu_endian(svol->sformat));
+		for (; i < n; i++) {
+			int16_t a = *(const int16_t *)src;
+			long long v;
+			if (swap)
+				a = (int16_t)bswap_16(a);
+			v = ((long long)a * gain[j]) >> VOL_SCALE_SHIFT;
+			a = (int16_t)softvol_clip(v, -0x8000, 0x7fff);
+			*(int16_t *)dst = swap ? (int16_t)bswap_16(a) : a;
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S32_LE:
 	case SND_PCM_FORMAT_S32_BE:
-		/* 32bit samples */
-		CONVERT_AREA(int,
-			     !snd_pcm_format_cpu_endian(svol->sformat));
+		for (; i < n; i++) {
+			int32_t a = *(const int32_t *)src;
+			long long v;
+			if (swap)
+				a = (int32_t)bswap_32(a);
+			v = ((long long)a * gain[j]) >> VOL_SCALE_SHIFT;
+			a = (int32_t)softvol_clip(v, -0x7fffffffLL - 1, 0x7fffffff);
+			*(int32_t *)dst = swap ? (int32_t)bswap_32(a) : a;
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S24_LE:
-		/* 24bit samples */
-		CONVERT_AREA_S24_LE();
+		for (; i < n; i++) {
+			int32_t a = (int32_t)((uint32_t)*(const int32_t *)src << 8) >> 8;
+			long long v = ((long long)a * gain[j]) >> VOL_SCALE_SHIFT;
+			*(int32_t *)dst = svol->boost ?
+				(int32_t)softvol_clip(v, -0x800000, 0x7fffff) : (int32_t)v;
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S24_3LE:
-		CONVERT_AREA_S24_3LE();
+		for (; i < n; i++) {
+			const unsigned char *s = (const unsigned char *)src;
+			unsigned char *d = (unsigned char *)dst;
+			int32_t a = s[0] | (s[1] << 8) | (((const signed char *)s)[2] << 16);
+			long long v = ((long long)a * gain[j]) >> VOL_SCALE_SHIFT;
+			a = svol->boost ?
+				(int32_t)softvol_clip(v, -0x800000, 0x7fffff) : (int32_t)v;
+			d[0] = a;
+			d[1] = a >> 8;
+			d[2] = a >> 16;
+			NEXT_GAIN();
+		}
+		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+	case SND_PCM_FORMAT_FLOAT_BE:
+		for (; i < n; i++) {
+			union { uint32_t i; float f; } a;
+			a.i = *(const uint32_t *)src;
+			if (swap)
+				a.i = bswap_32(a.i);
+			a.f *= (float)gain[j] * (1.0f / UNITY_GAIN);
+			*(uint32_t *)dst = swap ? bswap_32(a.i) : a.i;
+			NEXT_GAIN();
+		}
 		break;
 	default:
 		break;
 	}
+#undef NEXT_GAIN
 }
 
-#undef GET_VOL_SCALE
-#define GET_VOL_SCALE
-
-/* mono control */
-static void softvol_convert_mono_vol(snd_pcm_softvol_t *svol,
-				     const snd_pcm_channel_area_t *dst_areas,
-				     snd_pcm_uframes_t dst_offset,
-				     const snd_pcm_channel_area_t *src_areas,
-				     snd_pcm_uframes_t src_offset,
-				     unsigned int channels,
-				     snd_pcm_uframes_t frames)
+/* the areas describe one interleaved buffer, byte aligned */
+static int softvol_areas_interleaved(const snd_pcm_channel_area_t *areas,
+				     unsigned int channels, unsigned int width)
 {
-	const snd_pcm_channel_area_t *dst_area, *src_area;
-	unsigned int src_step, dst_step;
-	unsigned int vol_scale;
+	unsigned int c;
 
-	if (svol->cur_vol[0] == 0) {
-		snd_pcm_areas_silence(dst_areas, dst_offset, channels, frames,
-				      svol->sformat);
-		return;
-	} else if (svol->zero_dB_val && svol->cur_vol[0] == svol->zero_dB_val) {
-		snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
-				   channels, frames, svol->sformat);
+	if (areas[0].first % 8 || areas[0].step != channels * width)
+		return 0;
+	for (c = 1; c < channels; c++) {
+		if (areas[c].addr != areas[0].addr ||
+		    areas[c].step != areas[0].step ||
+		    areas[c].first != areas[0].first + c * width)
+			return 0;
+	}
+	return 1;
+}
+
+static void softvol_convert_areas(snd_pcm_softvol_t *svol,
+				  const snd_pcm_channel_area_t *dst_areas,
+				  snd_pcm_uframes_t dst_offset,
+				  const snd_pcm_channel_area_t *src_areas,
+				  snd_pcm_uframes_t src_offset,
+				  unsigned int channels,
+				  snd_pcm_uframes_t frames)
+{
+	unsigned int width = snd_pcm_format_physical_width(svol->sformat);
+	unsigned int ch;
+
+	if (channels == svol->channels &&
+	    softvol_areas_interleaved(dst_areas, channels, width) &&
+	    softvol_areas_interleaved(src_areas, channels, width)) {
+		softvol_scale(svol,
+			      snd_pcm_channel_area_addr(dst_areas, dst_offset),
+			      width / 8,
+			      snd_pcm_channel_area_addr(src_areas, src_offset),
+			      width / 8, frames * channels,
+			      svol->pattern, channels * PATTERN_LANES);
 		return;
 	}
+	for (ch = 0; ch < channels; ch++) {
+		const snd_pcm_channel_area_t *dst_area = &dst_areas[ch];
+		const snd_pcm_channel_area_t *src_area = &src_areas[ch];
+		softvol_scale(svol,
+			      snd_pcm_channel_area_addr(dst_area, dst_offset),
+			      snd_pcm_channel_area_step(dst_area),
+			      snd_pcm_channel_area_addr(src_area, src_offset),
+			      snd_pcm_channel_area_step(src_area), frames,
+			      svol->chan_pattern + (ch % svol->channels) * PATTERN_LANES,
+			      PATTERN_LANES);
+	}
+}
+
+/*
+ * ramp one channel from the gain g, d being the linear increment or
+ * the exponential factor per frame; returns the reached gain
+ */
+static double softvol_ramp_area(snd_pcm_softvol_t *svol,
+				const snd_pcm_channel_area_t *dst_area,
+				snd_pcm_uframes_t dst_offset,
+				const snd_pcm_channel_area_t *src_area,
+				snd_pcm_uframes_t src_offset,
+				snd_pcm_uframes_t frames, double g, double d)
+{
+	char *dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
+	const char *src = snd_pcm_channel_area_addr(src_area, src_offset);
+	int dst_step = snd_pcm_channel_area_step(dst_area);
+	int src_step = snd_pcm_channel_area_step(src_area);
+	int expo = svol->ramp == SOFTVOL_RAMP_EXPONENTIAL;
+	int swap = !snd_pcm_format_cpu_endian(svol->sformat);
+
+#define NEXT_GAIN() do { \
+		src += src_step; \
+		dst += dst_step; \
+	} while (0)
+#define STEP_GAIN() do { \
+		if (expo) \
+			g *= d; \
+		else \
+			g += d; \
+	} while (0)
 
-	if (svol->max_val == 1)
-		vol_scale = svol->cur_vol[0] ? 0xffff : 0;
-	else
-		vol_scale = svol->dB_value[svol->cur_vol[0]];
 	switch (svol->sformat) {
 	case SND_PCM_FORMAT_S16_LE:
 	case SND_PCM_FORMAT_S16_BE:
-		/* 16bit samples */
-		CONVERT_AREA(short, 
-			     !snd_pcm_format_cpu_endian(svol->sformat));
+		while (frames--) {
+			int16_t a = *(const int16_t *)src;
+			STEP_GAIN();
+			if (swap)
+				a = (int16_t)bswap_16(a);
+			a = (int16_t)softvol_clip(llrint(a * g), -0x8000, 0x7fff);
+			*(int16_t *)dst = swap ? (int16_t)bswap_16(a) : a;
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S32_LE:
 	case SND_PCM_FORMAT_S32_BE:
-		/* 32bit samples */
-		CONVERT_AREA(int,
-			     !snd_pcm_format_cpu_endian(svol->sformat));
+		while (frames--) {
+			int32_t a = *(const int32_t *)src;
+			STEP_GAIN();
+			if (swap)
+				a = (int32_t)bswap_32(a);
+			a = (int32_t)softvol_clip(llrint(a * g),
+						  -0x7fffffffLL - 1, 0x7fffffff);
+			*(int32_t *)dst = swap ? (int32_t)bswap_32(a) : a;
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S24_LE:
-		/* 24bit samples */
-		CONVERT_AREA_S24_LE();
+		while (frames--) {
+			int32_t a = (int32_t)((uint32_t)*(const int32_t *)src << 8) >> 8;
+			STEP_GAIN();
+			*(int32_t *)dst = (int32_t)softvol_clip(llrint(a * g),
+								-0x800000, 0x7fffff);
+			NEXT_GAIN();
+		}
 		break;
 	case SND_PCM_FORMAT_S24_3LE:
-		CONVERT_AREA_S24_3LE();
+		while (frames--) {
+			const unsigned char *s = (const unsigned char *)src;
+			unsigned char *p = (unsigned char *)dst;
+			int32_t a = s[0] | (s[1] << 8) | (((const signed char *)s)[2] << 16);
+			STEP_GAIN();
+			a = (int32_t)softvol_clip(llrint(a * g), -0x800000, 0x7fffff);
+			p[0] = a;
+			p[1] = a >> 8;
+			p[2] = a >> 16;
+			NEXT_GAIN();
+		}
+		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+	case SND_PCM_FORMAT_FLOAT_BE:
+		while (frames--) {
+			union { uint32_t i; float f; } a;
+			a.i = *(const uint32_t *)src;
+			STEP_GAIN();
+			if (swap)
+				a.i = bswap_32(a.i);
+			a.f *= (float)g;
+			*(uint32_t *)dst = swap ? bswap_32(a.i) : a.i;
+			NEXT_GAIN();
+		}
 		break;
 	default:
 		break;
 	}
+#undef STEP_GAIN
+#undef NEXT_GAIN
+	return g;
+}
+
+static void softvol_convert(snd_pcm_softvol_t *svol,
+			    const snd_pcm_channel_area_t *dst_areas,
+			    snd_pcm_uframes_t dst_offset,
+			    const snd_pcm_channel_area_t *src_areas,
+			    snd_pcm_uframes_t src_offset,
+			    unsigned int channels,
+			    snd_pcm_uframes_t frames)
+{
+	if (svol->ramp_left) {
+		snd_pcm_uframes_t n = frames;
+		unsigned int ch;
+
+		if (n > svol->ramp_left)
+			n = svol->ramp_left;
+		for (ch = 0; ch < channels; ch++) {
+			unsigned int c = ch % svol->channels;
+			svol->gain[c] = softvol_ramp_area(svol, &dst_areas[ch],
+							  dst_offset,
+							  &src_areas[ch],
+							  src_offset, n,
+							  svol->gain[c],
+							  svol->ramp_step[c]);
+		}
+		svol->ramp_left -= n;
+		if (!svol->ramp_left) {
+			/* land exactly on the target */
+			for (ch = 0; ch < svol->channels; ch++)
+				svol->gain[ch] = (double)svol->pattern[ch] /
+						 UNITY_GAIN;
+		}
+		frames -= n;
+		if (!frames)
+			return;
+		dst_offset += n;
+		src_offset += n;
+	}
+
+	if (svol->mute)
+		snd_pcm_areas_silence(dst_areas, dst_offset, channels, frames,
+				      svol->sformat);
+	else if (svol->unity)
+		snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
+				   channels, frames, svol->sformat);
+	else
+		softvol_convert_areas(svol, dst_areas, dst_offset,
+				      src_areas, src_offset, channels, frames);
+}
+
+/* gain of a channel for the given control values */
+static unsigned int softvol_channel_gain(snd_pcm_softvol_t *svol,
+					 unsigned int ch, unsigned int channels)
+{
+	unsigned int vol[2], vol_c;
+
+	if (svol->cchannels == 1) {
+		if (svol->max_val == 1)
+			return svol->cur_vol[0] ? 0xffff : 0;
+		return svol->dB_value[svol->cur_vol[0]];
+	}
+	if (svol->max_val == 1) {
+		vol[0] = svol->cur_vol[0] ? 0xffff : 0;
+		vol[1] = svol->cur_vol[1] ? 0xffff : 0;
+		vol_c = vol[0] | vol[1];
+	} else {
+		vol[0] = svol->dB_value[svol->cur_vol[0]];
+		vol[1] = svol->dB_value[svol->cur_vol[1]];
+		vol_c = svol->dB_value[(svol->cur_vol[0] + svol->cur_vol[1]) / 2];
+	}
+	/* mono, 2.0, 2.1, 4.0, 4.1, 5.1 or 7.1 */
+	switch (ch) {
+	case 0:
+	case 2:
+		return (channels == ch + 1) ? vol_c : vol[0];
+	case 4:
+	case 5:
+		return vol_c;
+	default:
+		return vol[ch & 1];
+	}
+}
+
+/*
+ * rebuild the gain patterns after the control values changed and
+ * start a ramp from the gains reached so far
+ */
+static void softvol_update_gain(snd_pcm_softvol_t *svol)
+{
+	unsigned int ch, i, vol;
+
+	if (svol->applied_vol[0] == svol->cur_vol[0] &&
+	    svol->applied_vol[1] == svol->cur_vol[1])
+		return;
+	svol->applied_vol[0] = svol->cur_vol[0];
+	svol->applied_vol[1] = svol->cur_vol[1];
+
+	svol->mute = svol->cur_vol[0] == 0 &&
+		(svol->cchannels == 1 || svol->cur_vol[1] == 0);
+	svol->unity = svol->zero_dB_val &&
+		svol->cur_vol[0] == svol->zero_dB_val &&
+		(svol->cchannels == 1 || svol->cur_vol[1] == svol->zero_dB_val);
+	svol->boost = 0;
+	for (ch = 0; ch < svol->channels; ch++) {
+		if (svol->mute)
+			vol = 0;
+		else {
+			vol = softvol_channel_gain(svol, ch, svol->channels);
+			if (vol == 0xffff)
+				vol = UNITY_GAIN;
+			else if (vol > UNITY_GAIN)
+				svol->boost = 1;
+		}
+		for (i = 0; i < PATTERN_LANES; i++) {
+			svol->pattern[i * svol->channels + ch] = vol;
+			svol->chan_pattern[ch * PATTERN_LANES + i] = vol;
+		}
+	}
+
+	if (!svol->ramp_frames) {
+		for (ch = 0; ch < svol->channels; ch++)
+			svol->gain[ch] = (double)svol->pattern[ch] / UNITY_GAIN;
+		return;
+	}
+#ifndef HAVE_SOFT_FLOAT
+	for (ch = 0; ch < svol->channels; ch++) {
+		double from = svol->gain[ch];
+		double to = (double)svol->pattern[ch] / UNITY_GAIN;
+		if (svol->ramp == SOFTVOL_RAMP_EXPONENTIAL) {
+			/* no way down to zero, start or stop at one LSB */
+			if (from < RAMP_EXP_FLOOR)
+				from = svol->gain[ch] = RAMP_EXP_FLOOR;
+			if (to < RAMP_EXP_FLOOR)
+				to = RAMP_EXP_FLOOR;
+			svol->ramp_step[ch] = pow(to / from,
+						  1.0 / svol->ramp_frames);
+		} else {
+			svol->ramp_step[ch] = (to - from) / svol->ramp_frames;
+		}
+	}
+	svol->ramp_left = svol->ramp_frames;
+#endif
 }
 
 /*
@@ -446,8 +712,36 @@ static void get_current_volume(snd_pcm_softvol_t *svol)
 	}
 }
 
+static int softvol_format_supported(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S16_BE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S32_BE:
+	case SND_PCM_FORMAT_FLOAT_LE:
+	case SND_PCM_FORMAT_FLOAT_BE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void softvol_free_gain(snd_pcm_softvol_t *svol)
+{
+	free(svol->pattern);
+	svol->pattern = NULL;
+	svol->chan_pattern = NULL;
+	svol->gain = NULL;
+	svol->ramp_step = NULL;
+	svol->channels = 0;
+}
+
 static void softvol_free(snd_pcm_softvol_t *svol)
 {
+	softvol_free_gain(svol);
 	if (svol->plug.gen.close_slave)
 		snd_pcm_close(svol->plug.gen.slave);
 	if (svol->ctl)
@@ -476,7 +770,9 @@ static int snd_pcm_softvol_hw_refine_cprepare(snd_pcm_t *pcm,
 			(1ULL << SND_PCM_FORMAT_S16_BE) |
 			(1ULL << SND_PCM_FORMAT_S24_LE) |
 			(1ULL << SND_PCM_FORMAT_S32_LE) |
- 			(1ULL << SND_PCM_FORMAT_S32_BE),
+ 			(1ULL << SND_PCM_FORMAT_S32_BE) |
+			(1ULL << SND_PCM_FORMAT_FLOAT_LE) |
+			(1ULL << SND_PCM_FORMAT_FLOAT_BE),
 			(1ULL << (SND_PCM_FORMAT_S24_3LE - 32))
 		}
 	};
@@ -625,22 +921,55 @@ static int snd_pcm_softvol_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * param
 					  snd_pcm_softvol_hw_refine_sprepare,
 					  snd_pcm_softvol_hw_refine_schange,
 					  snd_pcm_generic_hw_params);
+	unsigned int channels, rate;
+	char *buf;
+
 	if (err < 0)
 		return err;
-	if (slave->format != SND_PCM_FORMAT_S16_LE &&
-	    slave->format != SND_PCM_FORMAT_S16_BE &&
-	    slave->format != SND_PCM_FORMAT_S24_3LE && 
-	    slave->format != SND_PCM_FORMAT_S24_LE &&
-	    slave->format != SND_PCM_FORMAT_S32_LE &&
-	    slave->format != SND_PCM_FORMAT_S32_BE) {
+	if (!softvol_format_supported(slave->format)) {
 		SNDERR("softvol supports only S16_LE, S16_BE, S24_LE, S24_3LE, "
-		       "S32_LE or S32_BE");
+		       "S32_LE, S32_BE, FLOAT_LE or FLOAT_BE");
 		return -EINVAL;
 	}
 	svol->sformat = slave->format;
+
+	/* pcm->channels is not set up yet */
+	err = INTERNAL(snd_pcm_hw_params_get_channels)(params, &channels);
+	if (err < 0)
+		return err;
+	err = INTERNAL(snd_pcm_hw_params_get_rate)(params, &rate, 0);
+	if (err < 0)
+		return err;
+	softvol_free_gain(svol);
+	buf = malloc(channels * (2 * PATTERN_LANES * sizeof(unsigned int) +
+				 2 * sizeof(double)));
+	if (!buf)
+		return -ENOMEM;
+	svol->gain = (double *)buf;
+	svol->ramp_step = svol->gain + channels;
+	svol->pattern = (unsigned int *)(svol->ramp_step + channels);
+	svol->chan_pattern = svol->pattern + channels * PATTERN_LANES;
+	svol->channels = channels;
+
+	/* start at the current volume without a ramp */
+	get_current_volume(svol);
+	svol->applied_vol[0] = svol->applied_vol[1] = ~0U;
+	svol->ramp_frames = 0;
+	svol->ramp_left = 0;
+	softvol_update_gain(svol);
+	if (svol->ramp != SOFTVOL_RAMP_NONE)
+		svol->ramp_frames = (snd_pcm_uframes_t)rate * svol->ramp_time / 1000;
 	return 0;
 }
 
+static int snd_pcm_softvol_hw_free(snd_pcm_t *pcm)
+{
+	snd_pcm_softvol_t *svol = pcm->private_data;
+
+	softvol_free_gain(svol);
+	return snd_pcm_generic_hw_free(pcm);
+}
+
 static snd_pcm_uframes_t
 snd_pcm_softvol_write_areas(snd_pcm_t *pcm,
 			    const snd_pcm_channel_area_t *areas,
@@ -654,12 +983,9 @@ snd_pcm_softvol_write_areas(snd_pcm_t *pcm,
 	if (size > *slave_sizep)
 		size = *slave_sizep;
 	get_current_volume(svol);
-	if (svol->cchannels == 1)
-		softvol_convert_mono_vol(svol, slave_areas, slave_offset,
-					 areas, offset, pcm->channels, size);
-	else
-		softvol_convert_stereo_vol(svol, slave_areas, slave_offset,
-					   areas, offset, pcm->channels, size);
+	softvol_update_gain(svol);
+	softvol_convert(svol, slave_areas, slave_offset,
+			areas, offset, pcm->channels, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -677,12 +1003,9 @@ snd_pcm_softvol_read_areas(snd_pcm_t *pcm,
 	if (size > *slave_sizep)
 		size = *slave_sizep;
 	get_current_volume(svol);
-	if (svol->cchannels == 1)
-		softvol_convert_mono_vol(svol, areas, offset, slave_areas,
-					 slave_offset, pcm->channels, size);
-	else
-		softvol_convert_stereo_vol(svol, areas, offset, slave_areas,
-					   slave_offset, pcm->channels, size);
+	softvol_update_gain(svol);
+	softvol_convert(svol, areas, offset, slave_areas,
+			slave_offset, pcm->channels, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -699,6 +1022,10 @@ static void snd_pcm_softvol_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_output_printf(out, "max_dB: %g\n", svol->max_dB);
 		snd_output_printf(out, "resolution: %d\n", svol->max_val + 1);
 	}
+	if (svol->ramp != SOFTVOL_RAMP_NONE)
+		snd_output_printf(out, "ramp: %s %u ms\n",
+				  svol->ramp == SOFTVOL_RAMP_LINEAR ?
+				  "linear" : "exponential", svol->ramp_time);
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -872,7 +1199,7 @@ static const snd_pcm_ops_t snd_pcm_softvol_ops = {
 	.info = snd_pcm_generic_info,
 	.hw_refine = snd_pcm_softvol_hw_refine,
 	.hw_params = snd_pcm_softvol_hw_params,
-	.hw_free = snd_pcm_generic_hw_free,
+	.hw_free = snd_pcm_softvol_hw_free,
 	.sw_params = snd_pcm_generic_sw_params,
 	.channel_info = snd_pcm_generic_channel_info,
 	.dump = snd_pcm_softvol_dump,
@@ -915,12 +1242,7 @@ int snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 	int err;
 	assert(pcmp && slave);
 	if (sformat != SND_PCM_FORMAT_UNKNOWN &&
-	    sformat != SND_PCM_FORMAT_S16_LE &&
-	    sformat != SND_PCM_FORMAT_S16_BE &&
-	    sformat != SND_PCM_FORMAT_S24_3LE && 
-	    sformat != SND_PCM_FORMAT_S24_LE &&
-	    sformat != SND_PCM_FORMAT_S32_LE &&
-	    sformat != SND_PCM_FORMAT_S32_BE)
+	    !softvol_format_supported(sformat))
 		return -EINVAL;
 	svol = calloc(1, sizeof(*svol));
 	if (! svol)
@@ -984,6 +1306,14 @@ int snd_pcm_parse_control_id(snd_config_t *conf, snd_ctl_elem_id_t *ctl_id, int
 
 This plugin applies the software volume attenuation.
 The format, rate and channels must match for both of source and destination.
+The supported formats are S16, S24 (in 3 or 4 bytes), S32 and FLOAT in
+either byte order.
+
+A volume change is normally applied from the next transferred block on.
+With the ramp option the gain moves from the old to the new value over
+ramp_time milliseconds instead, either in equal steps (linear) or in
+equal dB steps (exponential), which avoids the zipper noise of abrupt
+changes.  Muting ramps down to silence the same way.
 
 When the control is stereo (count=2), the channels are assumed to be either
 mono, 2.0, 2.1, 4.0, 4.1, 5.1 or 7.1.
@@ -1016,6 +1346,9 @@ pcm.name {
 	[max_dB REAL]           # maximal dB value (default:   0.0)
 	[resolution INT]        # resolution (default: 256)
 				# resolution = 2 means a mute switch
+	[ramp STR]		# gain ramp: none, linear or exponential
+				# (default: none)
+	[ramp_time INT]		# ramp duration in ms (default: 10)
 }
 \endcode
 
@@ -1056,6 +1389,8 @@ int _snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 	double min_dB = PRESET_MIN_DB;
 	double max_dB = ZERO_DB;
 	int card = -1, cchannels = 2;
+	int ramp = SOFTVOL_RAMP_NONE;
+	long ramp_time = DEFAULT_RAMP_TIME;
 
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1098,6 +1433,33 @@ int _snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "ramp") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				SNDERR("Invalid ramp type");
+				return err;
+			}
+			if (strcmp(str, "none") == 0)
+				ramp = SOFTVOL_RAMP_NONE;
+			else if (strcmp(str, "linear") == 0)
+				ramp = SOFTVOL_RAMP_LINEAR;
+			else if (strcmp(str, "exponential") == 0)
+				ramp = SOFTVOL_RAMP_EXPONENTIAL;
+			else {
+				SNDERR("Invalid ramp type %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "ramp_time") == 0) {
+			err = snd_config_get_integer(n, &ramp_time);
+			if (err < 0) {
+				SNDERR("Invalid ramp_time value");
+				return err;
+			}
+			continue;
+		}
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1122,6 +1484,16 @@ int _snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 		SNDERR("Invalid resolution value %d", resolution);
 		return -EINVAL;
 	}
+	if (ramp_time <= 0 || ramp_time > 1000) {
+		SNDERR("Invalid ramp_time value %ld", ramp_time);
+		return -EINVAL;
+	}
+#ifdef HAVE_SOFT_FLOAT
+	if (ramp != SOFTVOL_RAMP_NONE) {
+		SNDERR("Cannot ramp the volume without floating point");
+		return -EINVAL;
+	}
+#endif
 	if (mode & SND_PCM_NO_SOFTVOL) {
 		err = snd_pcm_slave_conf(root, slave, &sconf, 0);
 		if (err < 0)
@@ -1135,13 +1507,8 @@ int _snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 		if (err < 0)
 			return err;
 		if (sformat != SND_PCM_FORMAT_UNKNOWN &&
-		    sformat != SND_PCM_FORMAT_S16_LE &&
-		    sformat != SND_PCM_FORMAT_S16_BE &&
-		    sformat != SND_PCM_FORMAT_S24_3LE && 
-		    sformat != SND_PCM_FORMAT_S24_LE &&
-		    sformat != SND_PCM_FORMAT_S32_LE &&
-		    sformat != SND_PCM_FORMAT_S32_BE) {
-			SNDERR("only S16_LE, S16_BE, S24_LE, S24_3LE, S32_LE or S32_BE format is supported");
+		    !softvol_format_supported(sformat)) {
+			SNDERR("only S16_LE, S16_BE, S24_LE, S24_3LE, S32_LE, S32_BE, FLOAT_LE or FLOAT_BE format is supported");
 			snd_config_delete(sconf);
 			return -EINVAL;
 		}
@@ -1160,6 +1527,11 @@ int _snd_pcm_softvol_open(snd_pcm_t **pcmp, const char *name,
 					   resolution, spcm, 1);
 		if (err < 0)
 			snd_pcm_close(spcm);
+		else if (*pcmp != spcm) {
+			snd_pcm_softvol_t *svol = (*pcmp)->private_data;
+			svol->ramp = ramp;
+			svol->ramp_time = ramp_time;
+		}
 	}
 	return err;
 }
@@ -23,20 +23,20 @@
 #include <alsa/asoundlib.h>
 
 #define BAR_WIDTH 70
-/* milliseconds to go from 32767 to 0 */
+/* milliseconds to go from full scale to 0 */
 #define DECAY_MS 400
 /* milliseconds for peak to disappear */
 #define PEAK_MS 800
 
 typedef struct _snd_pcm_scope_level_channel {
-	int16_t level;
-	int16_t peak;
+	float level;
+	float peak;
 	unsigned int peak_age;
 } snd_pcm_scope_level_channel_t;
 
 typedef struct _snd_pcm_scope_level {
 	snd_pcm_t *pcm;
-	snd_pcm_scope_t *s16;
+	snd_pcm_scope_t *levels;
 	snd_pcm_scope_level_channel_t *channels;
 	snd_pcm_uframes_t old;
 	int top;
@@ -92,69 +92,53 @@ static void level_stop(snd_pcm_scope_t *scope)
 	refresh();
 }
 
+/* '#' up to the RMS, '=' up to the decaying sample peak, '|' at the true peak */
 static void level_update(snd_pcm_scope_t *scope)
 {
 	snd_pcm_scope_level_t *level = snd_pcm_scope_get_callback_private(scope);
 	snd_pcm_t *pcm = level->pcm;
 	snd_pcm_sframes_t size;
-	snd_pcm_uframes_t size1, size2;
-	snd_pcm_uframes_t offset, cont;
 	unsigned int c, channels;
 	unsigned int ms;
 	static char bar[256] = { [0 ... 255] = '#' };
-	int max_decay;
+	static char fill[256] = { [0 ... 255] = '=' };
+	float max_decay;
 	size = snd_pcm_meter_get_now(pcm) - level->old;
 	if (size < 0)
 		size += snd_pcm_meter_get_boundary(pcm);
-	offset = level->old % snd_pcm_meter_get_bufsize(pcm);
-	cont = snd_pcm_meter_get_bufsize(pcm) - offset;
-	size1 = size;
-	if (size1 > cont)
-		size1 = cont;
-	size2 = size - size1;
 	ms = size * 1000 / snd_pcm_meter_get_rate(pcm);
-	max_decay = 32768 * ms / level->decay_ms;
+	max_decay = (float)ms / level->decay_ms;
 	channels = snd_pcm_meter_get_channels(pcm);
 	for (c = 0; c < channels; c++) {
-		int16_t *ptr;
-		int s, lev = 0;
-		snd_pcm_uframes_t n;
 		snd_pcm_scope_level_channel_t *l;
-		unsigned int lev_pos, peak_pos;
+		float lev, rms, true_peak;
+		unsigned int rms_pos, lev_pos, peak_pos;
 		l = &level->channels[c];
-		ptr = snd_pcm_scope_s16_get_channel_buffer(level->s16, c) + offset;
-		for (n = size1; n > 0; n--) {
-			s = *ptr;
-			if (s < 0)
-				s = -s;
-			if (s > lev)
-				lev = s;
-			ptr++;
-		}
-		ptr = snd_pcm_scope_s16_get_channel_buffer(level->s16, c);
-		for (n = size2; n > 0; n--) {
-			s = *ptr;
-			if (s < 0)
-				s = -s;
-			if (s > lev)
-				lev = s;
-			ptr++;
-		}
-		l->level = lev;
+		if (snd_pcm_scope_levels_get(level->levels, c, &lev, &rms,
+					     &true_peak) < 0)
+			continue;
+		if (true_peak > 1.0f)
+			true_peak = 1.0f;
 		l->peak_age += ms;
 		if (l->peak_age >= level->peak_ms ||
-		    lev >= l->peak) {
-			l->peak = lev;
+		    true_peak >= l->peak) {
+			l->peak = true_peak;
 			l->peak_age = 0;
 		}
 		if (lev < l->level - max_decay)
 			lev = l->level - max_decay;
+		l->level = lev;
 		move(level->top + c, 0);
-		lev_pos = lev * level->bar_width / 32768;
-		peak_pos = l->peak * level->bar_width / 32768;
-		addnstr(bar, lev_pos);
+		rms_pos = rms * level->bar_width;
+		lev_pos = lev * level->bar_width;
+		peak_pos = l->peak * level->bar_width;
+		if (lev_pos < rms_pos)
+			lev_pos = rms_pos;
+		addnstr(bar, rms_pos);
+		addnstr(fill, lev_pos - rms_pos);
 		clrtoeol();
-		mvaddch(level->top + c, peak_pos - 1, '#');
+		if (peak_pos > 0)
+			mvaddch(level->top + c, peak_pos - 1, '|');
 	}
 	move(level->top, 0);
 	refresh();
@@ -184,7 +168,7 @@ int snd_pcm_scope_level_open(snd_pcm_t *pcm, const char *name,
 			     unsigned int peak_ms,
 			     snd_pcm_scope_t **scopep)
 {
-	snd_pcm_scope_t *scope, *s16;
+	snd_pcm_scope_t *scope, *levels;
 	snd_pcm_scope_level_t *level;
 	int err = snd_pcm_scope_malloc(&scope);
 	if (err < 0)
@@ -198,16 +182,16 @@ int snd_pcm_scope_level_open(snd_pcm_t *pcm, const char *name,
 	level->bar_width = bar_width;
 	level->decay_ms = decay_ms;
 	level->peak_ms = peak_ms;
-	s16 = snd_pcm_meter_search_scope(pcm, "s16");
-	if (!s16) {
-		err = snd_pcm_scope_s16_open(pcm, "s16", &s16);
+	levels = snd_pcm_meter_search_scope(pcm, "levels");
+	if (!levels) {
+		err = snd_pcm_scope_levels_open(pcm, "levels", &levels);
 		if (err < 0) {
 			free(scope);
 			free(level);
 			return err;
 		}
 	}
-	level->s16 = s16;
+	level->levels = levels;
 	snd_pcm_scope_set_ops(scope, &level_ops);
 	snd_pcm_scope_set_callback_private(scope, level);
 	if (name)
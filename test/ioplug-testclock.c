@@ -0,0 +1,257 @@
+/*
+ *  Clocked playback sink for the tests
+ *
+ *  An ioplug PCM which consumes the committed frames at the nominal rate
+ *  against CLOCK_MONOTONIC and drops them.  It never runs ahead of the
+ *  application: when the buffer runs dry the position waits for more
+ *  frames instead of reporting an xrun, so a test can check the data flow
+ *  above it without depending on the scheduling.  The poll descriptor is
+ *  a timerfd firing every period while running, and always ready when
+ *  stopped.
+ *
+ *  Load it with ALSA_PLUGIN_DIR pointing to the directory of
+ *  libasound_module_pcm_testclock.so, e.g. as the slave of pcm-share-stress.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "../include/asoundlib.h"
+#include "../include/pcm_external.h"
+
+struct testclock {
+	snd_pcm_ioplug_t io;
+	int timer_fd;
+	struct timespec start;		/* trigger time */
+	snd_pcm_uframes_t clock;	/* frames elapsed at the last update */
+	snd_pcm_uframes_t pos;		/* position in the buffer */
+};
+
+static int testclock_arm(struct testclock *tc, int running)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 1 } };
+	uint64_t period_ns;
+
+	if (running) {
+		period_ns = (uint64_t)tc->io.period_size * 1000000000ULL /
+			tc->io.rate;
+		its.it_interval.tv_sec = period_ns / 1000000000ULL;
+		its.it_interval.tv_nsec = period_ns % 1000000000ULL;
+		its.it_value = its.it_interval;
+	}
+	if (timerfd_settime(tc->timer_fd, 0, &its, NULL) < 0)
+		return -errno;
+	return 0;
+}
+
+static int testclock_start(snd_pcm_ioplug_t *io)
+{
+	struct testclock *tc = io->private_data;
+
+	clock_gettime(CLOCK_MONOTONIC, &tc->start);
+	tc->clock = 0;
+	return testclock_arm(tc, 1);
+}
+
+static int testclock_stop(snd_pcm_ioplug_t *io)
+{
+	return testclock_arm(io->private_data, 0);
+}
+
+static int testclock_prepare(snd_pcm_ioplug_t *io)
+{
+	struct testclock *tc = io->private_data;
+
+	tc->pos = 0;
+	return testclock_arm(tc, 0);
+}
+
+static snd_pcm_sframes_t testclock_pointer(snd_pcm_ioplug_t *io)
+{
+	struct testclock *tc = io->private_data;
+	struct timespec now;
+	snd_pcm_uframes_t clock, delta, queued;
+	uint64_t ns, expirations;
+
+	/* hwsync and status get here in any state, the clock runs only after start */
+	if (io->state != SND_PCM_STATE_RUNNING &&
+	    io->state != SND_PCM_STATE_DRAINING)
+		return tc->pos;
+
+	/* acknowledge the timer, the caller is looking at the position now */
+	if (read(tc->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		return -errno;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (uint64_t)(now.tv_sec - tc->start.tv_sec) * 1000000000ULL +
+		now.tv_nsec - tc->start.tv_nsec;
+	clock = ns * io->rate / 1000000000ULL;
+	delta = clock - tc->clock;
+	tc->clock = clock;
+
+	/* wait for the application rather than xrun, keep delta unambiguous */
+	queued = snd_pcm_ioplug_hw_avail(io, io->hw_ptr, io->appl_ptr);
+	if (delta > queued)
+		delta = queued;
+	if (delta >= io->buffer_size)
+		delta = io->buffer_size - 1;
+	tc->pos = (tc->pos + delta) % io->buffer_size;
+	return tc->pos;
+}
+
+static snd_pcm_sframes_t testclock_transfer(snd_pcm_ioplug_t *io ATTRIBUTE_UNUSED,
+					    const snd_pcm_channel_area_t *areas ATTRIBUTE_UNUSED,
+					    snd_pcm_uframes_t offset ATTRIBUTE_UNUSED,
+					    snd_pcm_uframes_t size)
+{
+	return size;
+}
+
+static int testclock_poll_revents(snd_pcm_ioplug_t *io ATTRIBUTE_UNUSED,
+				  struct pollfd *pfd, unsigned int nfds,
+				  unsigned short *revents)
+{
+	if (nfds != 1)
+		return -EINVAL;
+	*revents = (pfd->revents & POLLIN) ? POLLOUT : 0;
+	if (pfd->revents & (POLLERR | POLLNVAL))
+		*revents |= POLLERR;
+	return 0;
+}
+
+static int testclock_close(snd_pcm_ioplug_t *io)
+{
+	struct testclock *tc = io->private_data;
+
+	close(tc->timer_fd);
+	free(tc);
+	return 0;
+}
+
+static const snd_pcm_ioplug_callback_t testclock_ops = {
+	.start = testclock_start,
+	.stop = testclock_stop,
+	.pointer = testclock_pointer,
+	.transfer = testclock_transfer,
+	.prepare = testclock_prepare,
+	.poll_revents = testclock_poll_revents,
+	.close = testclock_close,
+};
+
+static int testclock_set_constraints(snd_pcm_ioplug_t *io)
+{
+	static const unsigned int accesses[] = {
+		SND_PCM_ACCESS_MMAP_INTERLEAVED,
+		SND_PCM_ACCESS_MMAP_NONINTERLEAVED,
+		SND_PCM_ACCESS_RW_INTERLEAVED,
+		SND_PCM_ACCESS_RW_NONINTERLEAVED,
+	};
+	unsigned int formats[SND_PCM_FORMAT_LAST + 1];
+	unsigned int nformats = 0;
+	int format, err;
+
+	for (format = 0; format <= SND_PCM_FORMAT_LAST; format++)
+		if (snd_pcm_format_physical_width(format) > 0)
+			formats[nformats++] = format;
+
+	err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_ACCESS,
+					    sizeof(accesses) / sizeof(accesses[0]), accesses);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_FORMAT,
+					    nformats, formats);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_CHANNELS,
+					      1, 1024);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_RATE,
+					      4000, 768000);
+	if (err < 0)
+		return err;
+	err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+					      64, 16 * 1024 * 1024);
+	if (err < 0)
+		return err;
+	return snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIODS,
+					       2, 1024);
+}
+
+SND_PCM_PLUGIN_DEFINE_FUNC(testclock)
+{
+	snd_config_iterator_t i, next;
+	struct testclock *tc;
+	int err;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 ||
+		    strcmp(id, "hint") == 0)
+			continue;
+		SNDERR("Unknown field %s", id);
+		return -EINVAL;
+	}
+	if (stream != SND_PCM_STREAM_PLAYBACK) {
+		SNDERR("testclock is a playback sink");
+		return -EINVAL;
+	}
+
+	tc = calloc(1, sizeof(*tc));
+	if (!tc)
+		return -ENOMEM;
+	tc->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tc->timer_fd < 0) {
+		err = -errno;
+		free(tc);
+		return err;
+	}
+
+	tc->io.version = SND_PCM_IOPLUG_VERSION;
+	tc->io.name = "Clocked test sink";
+	tc->io.poll_fd = tc->timer_fd;
+	tc->io.poll_events = POLLIN;
+	tc->io.callback = &testclock_ops;
+	tc->io.private_data = tc;
+
+	err = snd_pcm_ioplug_create(&tc->io, name, stream, mode);
+	if (err < 0) {
+		close(tc->timer_fd);
+		free(tc);
+		return err;
+	}
+	err = testclock_set_constraints(&tc->io);
+	if (err < 0) {
+		snd_pcm_ioplug_delete(&tc->io);
+		return err;
+	}
+	*pcmp = tc->io.pcm;
+	return 0;
+}
+SND_PCM_PLUGIN_SYMBOL(testclock);
@@ -0,0 +1,209 @@
+/*
+ *  snd_pcm_areas_copy() / snd_pcm_areas_silence() throughput
+ *
+ *  Copies a buffer between the interleaved and non-interleaved layouts
+ *  for the common channel counts and sample widths, checks the result
+ *  against a sample-by-sample reference and prints the throughput
+ *  in GB/s (bytes of one buffer per second).
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static snd_pcm_uframes_t frames = 4096;
+static unsigned int loops = 2000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_interleaved(snd_pcm_channel_area_t *areas, void *buf,
+			    unsigned int channels, unsigned int width)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		areas[c].addr = buf;
+		areas[c].first = c * width;
+		areas[c].step = channels * width;
+	}
+}
+
+static void set_planar(snd_pcm_channel_area_t *areas, void *buf,
+		       unsigned int channels, unsigned int width)
+{
+	unsigned int c;
+
+	for (c = 0; c < channels; c++) {
+		areas[c].addr = (char *)buf + c * frames * width / 8;
+		areas[c].first = 0;
+		areas[c].step = width;
+	}
+}
+
+/* compare every sample of two area sets */
+static int check(const snd_pcm_channel_area_t *a, const snd_pcm_channel_area_t *b,
+		 unsigned int channels, unsigned int width)
+{
+	snd_pcm_uframes_t f;
+	unsigned int c, bytes = width / 8;
+
+	for (c = 0; c < channels; c++)
+		for (f = 0; f < frames; f++)
+			if (memcmp((char *)a[c].addr + (a[c].first + f * a[c].step) / 8,
+				   (char *)b[c].addr + (b[c].first + f * b[c].step) / 8,
+				   bytes))
+				return -1;
+	return 0;
+}
+
+static int bench(unsigned int channels, snd_pcm_format_t format, int to_interleaved)
+{
+	snd_pcm_channel_area_t inter[8], planar[8];
+	const snd_pcm_channel_area_t *src, *dst;
+	unsigned int width = snd_pcm_format_physical_width(format);
+	size_t size = frames * channels * width / 8;
+	unsigned char *sbuf, *dbuf;
+	unsigned int i;
+	double t;
+	int err = 0;
+
+	sbuf = malloc(size);
+	dbuf = malloc(size);
+	if (!sbuf || !dbuf) {
+		free(sbuf);
+		free(dbuf);
+		return -ENOMEM;
+	}
+	for (i = 0; i < size; i++)
+		sbuf[i] = rand();
+	memset(dbuf, 0, size);
+	if (to_interleaved) {
+		set_planar(planar, sbuf, channels, width);
+		set_interleaved(inter, dbuf, channels, width);
+		src = planar;
+		dst = inter;
+	} else {
+		set_interleaved(inter, sbuf, channels, width);
+		set_planar(planar, dbuf, channels, width);
+		src = inter;
+		dst = planar;
+	}
+	snd_pcm_areas_copy(dst, 0, src, 0, channels, frames, format);
+	if (check(dst, src, channels, width) < 0) {
+		printf("%-8s %uch %-16s MISMATCH\n", snd_pcm_format_name(format),
+		       channels, to_interleaved ? "planar->inter" : "inter->planar");
+		err = -EINVAL;
+		goto __end;
+	}
+	t = now();
+	for (i = 0; i < loops; i++)
+		snd_pcm_areas_copy(dst, 0, src, 0, channels, frames, format);
+	t = now() - t;
+	printf("%-8s %uch %-16s %8.2f GB/s\n", snd_pcm_format_name(format),
+	       channels, to_interleaved ? "planar->inter" : "inter->planar",
+	       (double)size * loops / t / 1e9);
+ __end:
+	free(sbuf);
+	free(dbuf);
+	return err;
+}
+
+static void bench_silence(snd_pcm_format_t format)
+{
+	snd_pcm_channel_area_t inter[2];
+	unsigned int width = snd_pcm_format_physical_width(format);
+	size_t size = frames * 2 * width / 8;
+	unsigned int i;
+	void *buf;
+	double t;
+
+	buf = malloc(size);
+	if (!buf)
+		return;
+	set_interleaved(inter, buf, 2, width);
+	t = now();
+	for (i = 0; i < loops; i++)
+		snd_pcm_areas_silence(inter, 0, 2, frames, format);
+	t = now() - t;
+	printf("%-8s 2ch %-16s %8.2f GB/s\n", snd_pcm_format_name(format),
+	       "silence", (double)size * loops / t / 1e9);
+	free(buf);
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-areas-bench [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-f,--frames    frames per copy (default %lu)\n"
+	       "-l,--loops     copies per layout (default %u)\n",
+	       frames, loops);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"help", 0, NULL, 'h'},
+		{"frames", 1, NULL, 'f'},
+		{"loops", 1, NULL, 'l'},
+		{NULL, 0, NULL, 0},
+	};
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S32,
+	};
+	static const unsigned int channels[] = { 2, 4, 6, 8 };
+	unsigned int f, c;
+	int dir, err = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hf:l:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (frames == 0 || loops == 0) {
+		usage();
+		return 1;
+	}
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+		for (c = 0; c < sizeof(channels) / sizeof(channels[0]); c++)
+			for (dir = 0; dir < 2; dir++)
+				if (bench(channels[c], formats[f], dir) < 0)
+					err = 1;
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+		bench_silence(formats[f]);
+	return err;
+}
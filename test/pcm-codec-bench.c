@@ -0,0 +1,247 @@
+/*
+ *  A-law / mu-law / IMA-ADPCM conversion throughput benchmark
+ *
+ *  Opens the alaw, mulaw and adpcm plugins over a null slave using the
+ *  coded format and moves linear samples through them for a while:
+ *  playback runs the encoders, capture the decoders.  The throughput of
+ *  each codec and direction is printed in mega samples per second.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static unsigned int channels = 2;
+static unsigned int rate = 8000;
+static snd_pcm_uframes_t period_size = 1024;
+static snd_pcm_format_t format = SND_PCM_FORMAT_S16;
+static double seconds = 1.0;
+
+static const struct codec {
+	const char *name;
+	const char *type;
+	const char *sformat;
+} codecs[] = {
+	{ "A-law", "alaw", "A_LAW" },
+	{ "mu-law", "mulaw", "MU_LAW" },
+	{ "IMA-ADPCM", "adpcm", "IMA_ADPCM" },
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* pcm.bench: the codec plugin over a null slave */
+static int open_codec(snd_pcm_t **pcm, const struct codec *codec,
+		      snd_pcm_stream_t stream)
+{
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char buf[256];
+	int err;
+
+	snprintf(buf, sizeof(buf),
+		 "pcm.bench {\n"
+		 "\ttype %s\n"
+		 "\tslave { pcm { type null } format %s }\n"
+		 "}\n", codec->type, codec->sformat);
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, strlen(buf));
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "bench", stream, 0, lconf);
+ __end:
+	snd_config_delete(lconf);
+	return err;
+}
+
+static int setup(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_params_t *params;
+	unsigned int val = rate;
+	snd_pcm_uframes_t size = period_size;
+	int err;
+
+	snd_pcm_hw_params_alloca(&params);
+	err = snd_pcm_hw_params_any(pcm, params);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_access(pcm, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_format(pcm, params, format);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_channels(pcm, params, channels);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_rate_near(pcm, params, &val, 0);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_period_size_near(pcm, params, &size, 0);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_set_periods(pcm, params, 4, 0);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params(pcm, params);
+	if (err < 0)
+		return err;
+	period_size = size;
+	return 0;
+}
+
+static int run(const struct codec *codec, snd_pcm_stream_t stream,
+	       double *msamples)
+{
+	unsigned long long samples = 0;
+	snd_pcm_t *pcm;
+	snd_pcm_sframes_t n, bytes;
+	double t, elapsed = 0;
+	char *buf;
+	int err;
+
+	err = open_codec(&pcm, codec, stream);
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", codec->name,
+			snd_strerror(err));
+		return err;
+	}
+	err = setup(pcm);
+	if (err < 0) {
+		fprintf(stderr, "%s: cannot setup: %s\n", codec->name,
+			snd_strerror(err));
+		goto __end;
+	}
+	bytes = snd_pcm_frames_to_bytes(pcm, period_size);
+	buf = malloc(bytes);
+	if (!buf) {
+		err = -ENOMEM;
+		goto __end;
+	}
+	/* random samples, so all the segments are used */
+	for (n = 0; n < bytes; n++)
+		buf[n] = rand();
+	if (stream == SND_PCM_STREAM_CAPTURE)
+		snd_pcm_start(pcm);
+	t = now();
+	do {
+		if (stream == SND_PCM_STREAM_PLAYBACK)
+			n = snd_pcm_writei(pcm, buf, period_size);
+		else
+			n = snd_pcm_readi(pcm, buf, period_size);
+		if (n < 0) {
+			n = snd_pcm_recover(pcm, n, 0);
+			if (n < 0) {
+				fprintf(stderr, "%s: %s\n", codec->name,
+					snd_strerror(n));
+				err = n;
+				break;
+			}
+			continue;
+		}
+		samples += n * channels;
+		elapsed = now() - t;
+	} while (elapsed < seconds);
+	*msamples = samples / elapsed / 1e6;
+	free(buf);
+ __end:
+	snd_pcm_close(pcm);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-codec-bench [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-c,--channels  channels (default %u)\n"
+	       "-f,--format    linear format (default %s)\n"
+	       "-p,--period    period size in frames (default %lu)\n"
+	       "-s,--seconds   time per codec and direction (default %.1f)\n",
+	       channels, snd_pcm_format_name(format), period_size, seconds);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"channels", 1, NULL, 'c'},
+		{"format", 1, NULL, 'f'},
+		{"period", 1, NULL, 'p'},
+		{"seconds", 1, NULL, 's'},
+		{NULL, 0, NULL, 0},
+	};
+	unsigned int i;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "hc:f:p:s:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			channels = atoi(optarg);
+			if (!channels)
+				channels = 1;
+			break;
+		case 'f':
+			format = snd_pcm_format_value(optarg);
+			if (format == SND_PCM_FORMAT_UNKNOWN ||
+			    !snd_pcm_format_linear(format)) {
+				fprintf(stderr, "invalid format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			period_size = atol(optarg);
+			if (!period_size)
+				period_size = 1;
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	printf("%s %u ch, period %lu\n", snd_pcm_format_name(format),
+	       channels, period_size);
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		double enc, dec;
+		if (run(&codecs[i], SND_PCM_STREAM_PLAYBACK, &enc) < 0 ||
+		    run(&codecs[i], SND_PCM_STREAM_CAPTURE, &dec) < 0)
+			return 1;
+		printf("%-10s encode %8.2f Msamples/s  decode %8.2f Msamples/s\n",
+		       codecs[i].name, enc, dec);
+	}
+	return 0;
+}
@@ -0,0 +1,395 @@
+/*
+ *  FLAC encode/decode roundtrip test
+ *
+ *  Writes random sample data in odd sized chunks through a file plugin
+ *  with format "flac" (over a null slave), then reads the stream back
+ *  through a capture file plugin with the FLAC file as infile, and checks
+ *  that every frame comes back unchanged.  This is done for all sample
+ *  widths and several channel counts the encoder accepts, with the plain,
+ *  the threaded and the threaded direct I/O writer.  The data is a mix of
+ *  silence, full range and low level noise, tones, wasted low bits and
+ *  correlated channels, so that all the subframe types are used.  The
+ *  STREAMINFO block must carry the number of frames, channels and bits.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "../include/asoundlib.h"
+
+#define RATE		44100
+#define MAX_CHUNK	1999
+
+static unsigned int runs_per_case = 3;
+static unsigned int seed = 1;
+static char path[] = "/tmp/pcm-flac.XXXXXX";
+
+static const snd_pcm_format_t formats[] = {
+	SND_PCM_FORMAT_S8,
+	SND_PCM_FORMAT_U8,
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_S16_BE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S24_BE,
+	SND_PCM_FORMAT_S24_3LE,
+	SND_PCM_FORMAT_S24_3BE,
+};
+
+static const unsigned int channel_counts[] = { 1, 2, 3, 6, 8 };
+
+/* writer options of the file plugin */
+static const char *const modes[] = {
+	"",
+	"thread true",
+	"thread true direct true",
+};
+
+/* a signed value of the format width to the stored sample */
+static void put_sample(snd_pcm_format_t format, unsigned char *p, int32_t v)
+{
+	int bytes = snd_pcm_format_physical_width(format) / 8;
+	uint32_t u = v;
+	int b;
+
+	if (snd_pcm_format_unsigned(format) == 1)
+		u ^= 1U << (snd_pcm_format_width(format) - 1);
+	if (snd_pcm_format_big_endian(format) == 1)
+		for (b = bytes; b-- > 0; u >>= 8)
+			p[b] = u;
+	else
+		for (b = 0; b < bytes; b++, u >>= 8)
+			p[b] = u;
+}
+
+static int32_t clip(int32_t v, unsigned int bits)
+{
+	int32_t max = (1U << (bits - 1)) - 1;
+
+	if (v > max)
+		return max;
+	if (v < -max - 1)
+		return -max - 1;
+	return v;
+}
+
+static int32_t noise(unsigned int bits)
+{
+	uint32_t u = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+	return (int32_t)(u << (32 - bits)) >> (32 - bits);
+}
+
+/* fill frames with a randomly chosen kind of signal */
+static void fill(snd_pcm_format_t format, unsigned int channels,
+		 unsigned char *buf, snd_pcm_uframes_t frames)
+{
+	unsigned int bits = snd_pcm_format_width(format);
+	unsigned int bps = snd_pcm_format_physical_width(format) / 8;
+	snd_pcm_uframes_t i, len;
+	unsigned int c, kind, shift;
+	double w, a;
+	int32_t v;
+
+	while (frames > 0) {
+		len = 1 + rand() % 3000;
+		if (len > frames)
+			len = frames;
+		kind = rand() % 6;
+		shift = rand() % (bits - 1);
+		w = 2 * M_PI * (20 + rand() % 8000) / RATE;
+		a = ldexp(1.0, bits - 1 - rand() % 4);
+		for (i = 0; i < len; i++) {
+			for (c = 0; c < channels; c++) {
+				switch (kind) {
+				case 0:	/* digital silence */
+					v = 0;
+					break;
+				case 1:	/* full range noise */
+					v = noise(bits);
+					break;
+				case 2:	/* low level noise */
+					v = noise(1 + shift % 6);
+					break;
+				case 3:	/* tone with some noise */
+					v = clip(lrint(a * 0.9 * sin(w * i + c)) +
+						 noise(1 + shift % 4), bits);
+					break;
+				case 4:	/* wasted low bits */
+					v = noise(bits - shift) * (1 << shift);
+					break;
+				default: /* channels close to each other */
+					v = clip(lrint(a * 0.7 * sin(w * i)) +
+						 noise(3) * (int32_t)c, bits);
+					break;
+				}
+				put_sample(format, buf, v);
+				buf += bps;
+			}
+		}
+		frames -= len;
+	}
+}
+
+static int open_file(snd_pcm_t **pcm, snd_pcm_stream_t stream,
+		     const char *mode, snd_pcm_format_t format,
+		     unsigned int channels)
+{
+	snd_pcm_hw_params_t *params;
+	snd_pcm_uframes_t period = 1024, buffer = 4096;
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char buf[512];
+	int err;
+
+	if (stream == SND_PCM_STREAM_PLAYBACK)
+		snprintf(buf, sizeof(buf),
+			 "pcm.check {\n"
+			 "\ttype file\n"
+			 "\tfile \"%s\"\n"
+			 "\tformat flac\n"
+			 "\t%s\n"
+			 "\tslave.pcm { type null }\n"
+			 "}\n", path, mode);
+	else
+		snprintf(buf, sizeof(buf),
+			 "pcm.check {\n"
+			 "\ttype file\n"
+			 "\tfile \"/dev/null\"\n"
+			 "\tinfile \"%s\"\n"
+			 "\tslave.pcm { type null }\n"
+			 "}\n", path);
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, strlen(buf));
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "check", stream, 0, lconf);
+	if (err < 0)
+		goto __end;
+
+	snd_pcm_hw_params_alloca(&params);
+	snd_pcm_hw_params_any(*pcm, params);
+	err = snd_pcm_hw_params_set_access(*pcm, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_format(*pcm, params, format);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_channels(*pcm, params, channels);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_rate(*pcm, params, RATE, 0);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_period_size_near(*pcm, params,
+							     &period, 0);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_buffer_size_near(*pcm, params,
+							     &buffer);
+	if (err >= 0)
+		err = snd_pcm_hw_params(*pcm, params);
+	if (err < 0)
+		snd_pcm_close(*pcm);
+ __end:
+	snd_config_delete(lconf);
+	return err;
+}
+
+/* frames, channels and bits in STREAMINFO */
+static int check_streaminfo(snd_pcm_format_t format, unsigned int channels,
+			    snd_pcm_uframes_t frames)
+{
+	unsigned char h[42];
+	unsigned long long total;
+	unsigned int rate, ch, bits;
+	int fd, r;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	r = read(fd, h, sizeof(h));
+	close(fd);
+	if (r != (int)sizeof(h) || memcmp(h, "fLaC", 4) || (h[4] & 0x7f) != 0) {
+		printf("no FLAC stream header\n");
+		return -EINVAL;
+	}
+	/* 20 bits rate, 3 bits channels - 1, 5 bits bits - 1, 36 bits frames */
+	rate = (h[18] << 12) | (h[19] << 4) | (h[20] >> 4);
+	ch = ((h[20] >> 1) & 7) + 1;
+	bits = (((h[20] & 1) << 4) | (h[21] >> 4)) + 1;
+	total = ((unsigned long long)(h[21] & 0x0f) << 32) |
+		((unsigned long long)h[22] << 24) | (h[23] << 16) |
+		(h[24] << 8) | h[25];
+	if (rate != RATE || ch != channels ||
+	    bits != (unsigned int)snd_pcm_format_width(format) ||
+	    total != frames) {
+		printf("STREAMINFO %u Hz, %u channels, %u bits, %llu frames, "
+		       "expected %u, %u, %d, %lu\n", rate, ch, bits, total,
+		       RATE, channels, snd_pcm_format_width(format), frames);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int run_check(const char *mode, snd_pcm_format_t format,
+		     unsigned int channels, snd_pcm_uframes_t frames)
+{
+	snd_pcm_t *pcm;
+	unsigned char *data, *back;
+	size_t frame_bytes = snd_pcm_format_physical_width(format) / 8 * channels;
+	snd_pcm_uframes_t pos, n, i;
+	snd_pcm_sframes_t r;
+	int err;
+
+	data = malloc(frames * frame_bytes + 1);
+	back = malloc(frames * frame_bytes + 1);
+	if (!data || !back) {
+		err = -ENOMEM;
+		goto __end;
+	}
+	fill(format, channels, data, frames);
+
+	err = open_file(&pcm, SND_PCM_STREAM_PLAYBACK, mode, format, channels);
+	if (err < 0)
+		goto __end;
+	for (pos = 0; pos < frames; pos += r) {
+		n = 1 + rand() % MAX_CHUNK;
+		if (n > frames - pos)
+			n = frames - pos;
+		r = snd_pcm_writei(pcm, data + pos * frame_bytes, n);
+		if (r < 0) {
+			err = r;
+			break;
+		}
+	}
+	snd_pcm_close(pcm);
+	if (err < 0)
+		goto __end;
+	err = check_streaminfo(format, channels, frames);
+	if (err < 0)
+		goto __end;
+
+	err = open_file(&pcm, SND_PCM_STREAM_CAPTURE, mode, format, channels);
+	if (err < 0)
+		goto __end;
+	for (pos = 0; pos < frames; pos += r) {
+		n = 1 + rand() % MAX_CHUNK;
+		if (n > frames - pos)
+			n = frames - pos;
+		r = snd_pcm_readi(pcm, back + pos * frame_bytes, n);
+		if (r < 0) {
+			err = r;
+			break;
+		}
+	}
+	snd_pcm_close(pcm);
+	if (err < 0)
+		goto __end;
+	for (i = 0; i < frames; i++) {
+		if (memcmp(data + i * frame_bytes, back + i * frame_bytes,
+			   frame_bytes)) {
+			printf("MISMATCH at frame %lu of %lu\n", i, frames);
+			err = -EINVAL;
+			break;
+		}
+	}
+ __end:
+	free(data);
+	free(back);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-flac [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-r,--runs      runs per format, channels and writer (default %u)\n"
+	       "-s,--seed      random seed (default %u)\n",
+	       runs_per_case, seed);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"runs", 1, NULL, 'r'},
+		{"seed", 1, NULL, 's'},
+		{NULL, 0, NULL, 0},
+	};
+	unsigned int f, c, m, k, runs = 0;
+	snd_pcm_uframes_t frames;
+	int fd, err = 0;
+
+	while ((c = getopt_long(argc, argv, "hr:s:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			runs_per_case = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	srand(seed);
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]) && !err; f++) {
+		for (c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]) && !err; c++) {
+			for (m = 0; m < sizeof(modes) / sizeof(modes[0]) && !err; m++) {
+				for (k = 0; k < runs_per_case && !err; k++) {
+					/* a short stream first, then longer
+					 * ones ending in a partial block
+					 */
+					frames = k ? 1 + rand() % 40000 :
+						 1 + rand() % 20;
+					err = run_check(modes[m], formats[f],
+							channel_counts[c], frames);
+					if (err < 0)
+						printf("FAILED %s, %u channels, "
+						       "%lu frames, writer \"%s\": "
+						       "%s\n",
+						       snd_pcm_format_name(formats[f]),
+						       channel_counts[c], frames,
+						       modes[m], snd_strerror(err));
+					runs++;
+				}
+			}
+		}
+	}
+	unlink(path);
+	if (err < 0)
+		return 1;
+	printf("OK, %u runs\n", runs);
+	return 0;
+}
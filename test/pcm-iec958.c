@@ -0,0 +1,387 @@
+/*
+ *  IEC958 subframe conversion regression test
+ *
+ *  Plays random samples through the iec958 plugin into a file plugin over
+ *  a null slave and compares the written subframes with the reference
+ *  encoder below (the former bit by bit implementation of the plugin):
+ *  random status bits and preambles, 1, 2 and 8 channels, HDMI single
+ *  stream mode, several linear formats and random write sizes across the
+ *  192 frames block.  The opposite direction (subframes to linear samples)
+ *  is checked the same way.  IEC958_SUBFRAME_BE is not available over the
+ *  null slave, so only little endian subframes are covered.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static unsigned int loops = 20;
+static snd_pcm_uframes_t total_frames = 5000;
+static unsigned int seed;
+static char path[] = "/tmp/pcm-iec958.XXXXXX";
+
+static const snd_pcm_format_t formats[] = {
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_S16_BE,
+	SND_PCM_FORMAT_U16_LE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S32_BE,
+};
+
+struct check {
+	snd_pcm_format_t format;	/* linear format */
+	unsigned int channels;
+	int hdmi_mode;
+	int decode;			/* subframes to linear */
+	unsigned char status[24];
+	unsigned char preamble[3];	/* Z, X, Y */
+};
+
+/* reference encoder */
+
+static unsigned int ref_parity(unsigned int data)
+{
+	unsigned int parity;
+	int bit;
+
+	data >>= 4;     /* start from bit 4 */
+	parity = 0;
+	for (bit = 4; bit <= 30; bit++) {
+		if (data & 1)
+			parity++;
+		data >>= 1;
+	}
+	return (parity & 1);
+}
+
+static uint32_t ref_subframe(const struct check *chk, uint32_t data,
+			     unsigned int counter, unsigned int channel)
+{
+	unsigned int byte = counter >> 3;
+	unsigned int mask = 1 << (counter - (byte << 3));
+
+	data >>= 4;
+	data &= ~0xf;
+	if (chk->status[byte] & mask)
+		data |= 0x40000000;
+	if (ref_parity(data))
+		data |= 0x80000000;
+	if (channel)
+		data |= chk->preamble[2];
+	else if (! counter)
+		data |= chk->preamble[0];
+	else
+		data |= chk->preamble[1];
+	return data;
+}
+
+static uint32_t load(const unsigned char *p, unsigned int bytes, int be)
+{
+	uint32_t v = 0;
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++)
+		v |= (uint32_t)p[be ? bytes - 1 - i : i] << (8 * i);
+	return v;
+}
+
+static void store(unsigned char *p, uint32_t v, unsigned int bytes, int be)
+{
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++)
+		p[be ? bytes - 1 - i : i] = v >> (8 * i);
+}
+
+/* the linear sample as the plugin sees it, left aligned in 32 bits */
+static uint32_t linear_to_s32(snd_pcm_format_t format, const unsigned char *p)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	uint32_t v = load(p, bytes, snd_pcm_format_big_endian(format) == 1);
+
+	v <<= 32 - snd_pcm_format_width(format);
+	if (snd_pcm_format_unsigned(format) == 1)
+		v ^= 0x80000000;
+	return v;
+}
+
+static void expected_encode(const struct check *chk, const unsigned char *in,
+			    unsigned char *out, snd_pcm_uframes_t frames)
+{
+	unsigned int width = snd_pcm_format_physical_width(chk->format) / 8;
+	int single_stream = chk->hdmi_mode && chk->channels == 8 &&
+			    (chk->status[0] & IEC958_AES0_NONAUDIO);
+	unsigned int step = single_stream ? 4 : 1;
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	for (f = 0; f < frames; f++) {
+		for (c = 0; c < chk->channels; c++) {
+			unsigned int counter = f * step;
+			uint32_t v;
+			if (single_stream)
+				counter += c >> 1;
+			v = linear_to_s32(chk->format,
+					  in + (f * chk->channels + c) * width);
+			v = ref_subframe(chk, v, counter % 192, c);
+			store(out + (f * chk->channels + c) * 4, v, 4, 0);
+		}
+	}
+}
+
+static void expected_decode(const struct check *chk, const unsigned char *in,
+			    unsigned char *out, snd_pcm_uframes_t frames)
+{
+	unsigned int width = snd_pcm_format_physical_width(chk->format) / 8;
+	snd_pcm_uframes_t i;
+
+	for (i = 0; i < frames * chk->channels; i++) {
+		uint32_t v = load(in + i * 4, 4, 0);
+		v = (v & ~0xf) << 4;
+		store(out + i * width, v >> (32 - width * 8), width,
+		      snd_pcm_format_big_endian(chk->format) == 1);
+	}
+}
+
+static int open_check(snd_pcm_t **pcm, const struct check *chk)
+{
+	snd_pcm_format_t subframe = SND_PCM_FORMAT_IEC958_SUBFRAME_LE;
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char buf[1024], *p = buf;
+	unsigned int i;
+	int err;
+
+	p += sprintf(p, "pcm.check {\n"
+		     "\ttype iec958\n"
+		     "\tslave {\n"
+		     "\t\tpcm { type file file \"%s\" slave.pcm { type null } }\n"
+		     "\t\tformat %s\n"
+		     "\t}\n"
+		     "\tstatus [", path,
+		     snd_pcm_format_name(chk->decode ? chk->format : subframe));
+	for (i = 0; i < sizeof(chk->status); i++)
+		p += sprintf(p, " 0x%02x", chk->status[i]);
+	p += sprintf(p, " ]\n"
+		     "\tpreamble { z 0x%02x x 0x%02x y 0x%02x }\n"
+		     "\thdmi_mode %s\n"
+		     "}\n", chk->preamble[0], chk->preamble[1], chk->preamble[2],
+		     chk->hdmi_mode ? "true" : "false");
+
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, p - buf);
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "check", SND_PCM_STREAM_PLAYBACK, 0, lconf);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_set_params(*pcm, chk->decode ? subframe : chk->format,
+				 SND_PCM_ACCESS_RW_INTERLEAVED, chk->channels,
+				 48000, 0, 100000);
+	if (err < 0)
+		snd_pcm_close(*pcm);
+ __end:
+	snd_config_delete(lconf);
+	return err;
+}
+
+static int run_check(const struct check *chk)
+{
+	unsigned int in_width = chk->decode ? 4 :
+		snd_pcm_format_physical_width(chk->format) / 8;
+	unsigned int out_width = chk->decode ?
+		snd_pcm_format_physical_width(chk->format) / 8 : 4;
+	size_t in_bytes = total_frames * chk->channels * in_width;
+	size_t out_bytes = total_frames * chk->channels * out_width;
+	unsigned char *in, *out, *expected;
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_t *pcm;
+	FILE *fp;
+	size_t i;
+	int err;
+
+	in = malloc(in_bytes);
+	out = malloc(out_bytes);
+	expected = malloc(out_bytes);
+	if (!in || !out || !expected) {
+		err = -ENOMEM;
+		goto __end;
+	}
+	for (i = 0; i < in_bytes; i++)
+		in[i] = rand();
+
+	err = open_check(&pcm, chk);
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s %s %u ch: %s\n",
+			chk->decode ? "decode" : "encode",
+			snd_pcm_format_name(chk->format), chk->channels,
+			snd_strerror(err));
+		goto __end;
+	}
+	while (done < total_frames) {
+		snd_pcm_uframes_t size = 1 + rand() % 600;
+		snd_pcm_sframes_t n;
+		if (size > total_frames - done)
+			size = total_frames - done;
+		n = snd_pcm_writei(pcm, in + done * chk->channels * in_width,
+				   size);
+		if (n < 0) {
+			fprintf(stderr, "write error: %s\n", snd_strerror(n));
+			err = n;
+			break;
+		}
+		done += n;
+	}
+	snd_pcm_close(pcm);
+	if (err < 0)
+		goto __end;
+
+	fp = fopen(path, "rb");
+	if (!fp || fread(out, 1, out_bytes, fp) != out_bytes) {
+		fprintf(stderr, "cannot read back %s\n", path);
+		if (fp)
+			fclose(fp);
+		err = -EIO;
+		goto __end;
+	}
+	fclose(fp);
+
+	if (chk->decode)
+		expected_decode(chk, in, expected, total_frames);
+	else
+		expected_encode(chk, in, expected, total_frames);
+	for (i = 0; i < out_bytes; i++) {
+		if (out[i] != expected[i]) {
+			printf("MISMATCH %s %s %u ch%s at byte %zu: "
+			       "%02x, expected %02x\n",
+			       chk->decode ? "decode" : "encode",
+			       snd_pcm_format_name(chk->format), chk->channels,
+			       chk->hdmi_mode ? " hdmi" : "", i, out[i],
+			       expected[i]);
+			err = -EINVAL;
+			break;
+		}
+	}
+ __end:
+	free(in);
+	free(out);
+	free(expected);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-iec958 [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-l,--loops     random configurations per case (default %u)\n"
+	       "-f,--frames    frames per run (default %lu)\n"
+	       "-S,--seed      random seed (default: time)\n",
+	       loops, total_frames);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"loops", 1, NULL, 'l'},
+		{"frames", 1, NULL, 'f'},
+		{"seed", 1, NULL, 'S'},
+		{NULL, 0, NULL, 0},
+	};
+	static const unsigned int channels[] = { 1, 2, 8 };
+	unsigned int f, c, l, runs = 0;
+	int fd, ch, err = 0;
+
+	seed = time(NULL);
+	while ((ch = getopt_long(argc, argv, "hl:f:S:", long_option, NULL)) != -1) {
+		switch (ch) {
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'f':
+			total_frames = atol(optarg);
+			if (!total_frames)
+				total_frames = 1;
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage();
+			return ch != 'h';
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	printf("seed %u\n", seed);
+	srand(seed);
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]) && !err; f++) {
+		for (c = 0; c < sizeof(channels) / sizeof(channels[0]) && !err; c++) {
+			for (l = 0; l < loops && !err; l++) {
+				struct check chk;
+				unsigned int i;
+
+				chk.format = formats[f];
+				chk.channels = channels[c];
+				chk.decode = l & 1;
+				chk.hdmi_mode = rand() & 1;
+				/* not touched in hw_params when professional */
+				for (i = 0; i < sizeof(chk.status); i++)
+					chk.status[i] = rand();
+				chk.status[0] |= IEC958_AES0_PROFESSIONAL;
+				if (chk.hdmi_mode)
+					chk.status[0] |= IEC958_AES0_NONAUDIO;
+				for (i = 0; i < 3; i++)
+					chk.preamble[i] = rand();
+				/* the decoder stores 16 and 32 bit samples only */
+				if (chk.decode &&
+				    snd_pcm_format_physical_width(chk.format) !=
+				    snd_pcm_format_width(chk.format))
+					continue;
+				if (chk.decode &&
+				    snd_pcm_format_unsigned(chk.format) == 1)
+					continue;
+				err = run_check(&chk);
+				runs++;
+			}
+		}
+	}
+	unlink(path);
+	if (err < 0)
+		return 1;
+	printf("OK, %u runs\n", runs);
+	return 0;
+}
@@ -0,0 +1,487 @@
+/*
+ *  Linear integer <-> float conversion regression test and benchmark
+ *
+ *  Plays random samples through the lfloat plugin into a file plugin over
+ *  a null slave and compares the written samples with the reference
+ *  conversion below (the semantics of the generic conversion): integer
+ *  to float and float to integer, native and swapped endian formats,
+ *  1, 2 and 8 channels and random write sizes.  The float samples include
+ *  values out of the -1.0 .. 1.0 range and infinities.  With dither, the
+ *  result is only checked to be within the dither range.  Then the
+ *  throughput of each conversion over a null slave is printed.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static unsigned int loops = 6;
+static snd_pcm_uframes_t total_frames = 5000;
+static unsigned int seed;
+static double seconds = 0.5;
+static char path[] = "/tmp/pcm-lfloat.XXXXXX";
+
+static const snd_pcm_format_t int_formats[] = {
+	SND_PCM_FORMAT_S16,
+	SND_PCM_FORMAT_S24,
+	SND_PCM_FORMAT_S32,
+	SND_PCM_FORMAT_S16_BE,
+	SND_PCM_FORMAT_U16_LE,
+	SND_PCM_FORMAT_S24_3LE,
+};
+
+static const snd_pcm_format_t float_formats[] = {
+	SND_PCM_FORMAT_FLOAT,
+	SND_PCM_FORMAT_FLOAT64,
+};
+
+struct check {
+	snd_pcm_format_t format;	/* client format */
+	snd_pcm_format_t sformat;	/* slave format */
+	unsigned int channels;
+	int dither;
+};
+
+static uint32_t load(const unsigned char *p, unsigned int bytes, int be)
+{
+	uint32_t v = 0;
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++)
+		v |= (uint32_t)p[be ? bytes - 1 - i : i] << (8 * i);
+	return v;
+}
+
+static void store(unsigned char *p, uint32_t v, unsigned int bytes, int be)
+{
+	unsigned int i;
+
+	for (i = 0; i < bytes; i++)
+		p[be ? bytes - 1 - i : i] = v >> (8 * i);
+}
+
+static double load_float(snd_pcm_format_t format, const unsigned char *p)
+{
+	if (snd_pcm_format_physical_width(format) == 32) {
+		float f;
+		memcpy(&f, p, sizeof(f));
+		return f;
+	} else {
+		double d;
+		memcpy(&d, p, sizeof(d));
+		return d;
+	}
+}
+
+/* integer sample left aligned in 32 bits */
+static int32_t load_int(snd_pcm_format_t format, const unsigned char *p)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	uint32_t v = load(p, bytes, snd_pcm_format_big_endian(format) == 1);
+
+	v <<= 32 - snd_pcm_format_width(format);
+	if (snd_pcm_format_unsigned(format) == 1)
+		v ^= 0x80000000;
+	return v;
+}
+
+static void store_int(snd_pcm_format_t format, unsigned char *p, int32_t v)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	unsigned int width = snd_pcm_format_width(format);
+
+	if (snd_pcm_format_unsigned(format) == 1)
+		v ^= 0x80000000;
+	/* sign extended to the physical width */
+	store(p, (uint32_t)(v >> (32 - width)), bytes,
+	      snd_pcm_format_big_endian(format) == 1);
+}
+
+/* random samples with some special values */
+static void fill_float(snd_pcm_format_t format, unsigned char *p, size_t samples)
+{
+	static const double special[] = {
+		0.0, -0.0, 1.0, -1.0, 0.999999, -0.999999, 1.5, -1.5,
+		1e30, -1e30, INFINITY, -INFINITY, 1e-40, 0.5, -0.5,
+	};
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	size_t i;
+
+	for (i = 0; i < samples; i++, p += bytes) {
+		double d;
+		if (rand() % 8 == 0)
+			d = special[rand() % (sizeof(special) / sizeof(special[0]))];
+		else
+			d = (rand() / (double)RAND_MAX) * 2.4 - 1.2;
+		if (bytes == 4) {
+			float f = d;
+			memcpy(p, &f, sizeof(f));
+		} else {
+			memcpy(p, &d, sizeof(d));
+		}
+	}
+}
+
+static int32_t ref_saturate(double f)
+{
+	if (f >= 1.0)
+		return 0x7fffffff;
+	if (f <= -1.0)
+		return (int32_t)0x80000000;
+	return (int32_t)(f * 2147483648.0);
+}
+
+static void expected(const struct check *chk, const unsigned char *in,
+		     unsigned char *out, size_t samples)
+{
+	unsigned int in_bytes = snd_pcm_format_physical_width(chk->format) / 8;
+	unsigned int out_bytes = snd_pcm_format_physical_width(chk->sformat) / 8;
+	size_t i;
+
+	for (i = 0; i < samples; i++, in += in_bytes, out += out_bytes) {
+		if (snd_pcm_format_float(chk->format) == 1) {
+			double f = load_float(chk->format, in);
+			store_int(chk->sformat, out, ref_saturate(f));
+		} else {
+			int32_t v = load_int(chk->format, in);
+			if (out_bytes == 4) {
+				float f = (float)v / (float)2147483648.0;
+				memcpy(out, &f, sizeof(f));
+			} else {
+				double d = (double)v / 2147483648.0;
+				memcpy(out, &d, sizeof(d));
+			}
+		}
+	}
+}
+
+/* the dithered sample is rounded from within +-1 LSB of the exact value */
+static int dither_ok(const struct check *chk, const unsigned char *in,
+		     const unsigned char *out)
+{
+	unsigned int width = snd_pcm_format_width(chk->sformat);
+	double max = 1 << (width - 1);
+	double x = load_float(chk->format, in) * max;
+	double v = load_int(chk->sformat, out) >> (32 - width);
+
+	if (x < -max)
+		x = -max;
+	else if (x > max - 1)
+		x = max - 1;
+	return fabs(v - x) <= 1.5;
+}
+
+static int open_lfloat(snd_pcm_t **pcm, const char *slave,
+		       snd_pcm_format_t sformat, int dither)
+{
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char buf[512];
+	int err;
+
+	snprintf(buf, sizeof(buf),
+		 "pcm.check {\n"
+		 "\ttype lfloat\n"
+		 "\tslave { pcm { %s } format %s }\n"
+		 "%s"
+		 "}\n", slave, snd_pcm_format_name(sformat),
+		 dither ? "\tdither true\n" : "");
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, strlen(buf));
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "check", SND_PCM_STREAM_PLAYBACK, 0, lconf);
+ __end:
+	snd_config_delete(lconf);
+	return err;
+}
+
+static int run_check(const struct check *chk)
+{
+	unsigned int in_width = snd_pcm_format_physical_width(chk->format) / 8;
+	unsigned int out_width = snd_pcm_format_physical_width(chk->sformat) / 8;
+	size_t samples = total_frames * chk->channels;
+	size_t in_bytes = samples * in_width;
+	size_t out_bytes = samples * out_width;
+	unsigned char *in, *out, *ref;
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_t *pcm;
+	char slave[256];
+	FILE *fp;
+	size_t i;
+	int err;
+
+	in = malloc(in_bytes);
+	out = malloc(out_bytes);
+	ref = malloc(out_bytes);
+	if (!in || !out || !ref) {
+		err = -ENOMEM;
+		goto __end;
+	}
+	if (snd_pcm_format_float(chk->format) == 1)
+		fill_float(chk->format, in, samples);
+	else
+		for (i = 0; i < in_bytes; i++)
+			in[i] = rand();
+
+	snprintf(slave, sizeof(slave),
+		 "type file file \"%s\" slave.pcm { type null }", path);
+	err = open_lfloat(&pcm, slave, chk->sformat, chk->dither);
+	if (err >= 0) {
+		err = snd_pcm_set_params(pcm, chk->format,
+					 SND_PCM_ACCESS_RW_INTERLEAVED,
+					 chk->channels, 48000, 0, 100000);
+		if (err < 0)
+			snd_pcm_close(pcm);
+	}
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s -> %s %u ch: %s\n",
+			snd_pcm_format_name(chk->format),
+			snd_pcm_format_name(chk->sformat), chk->channels,
+			snd_strerror(err));
+		goto __end;
+	}
+	while (done < total_frames) {
+		snd_pcm_uframes_t size = 1 + rand() % 600;
+		snd_pcm_sframes_t n;
+		if (size > total_frames - done)
+			size = total_frames - done;
+		n = snd_pcm_writei(pcm, in + done * chk->channels * in_width,
+				   size);
+		if (n < 0) {
+			fprintf(stderr, "write error: %s\n", snd_strerror(n));
+			err = n;
+			break;
+		}
+		done += n;
+	}
+	snd_pcm_close(pcm);
+	if (err < 0)
+		goto __end;
+
+	fp = fopen(path, "rb");
+	if (!fp || fread(out, 1, out_bytes, fp) != out_bytes) {
+		fprintf(stderr, "cannot read back %s\n", path);
+		if (fp)
+			fclose(fp);
+		err = -EIO;
+		goto __end;
+	}
+	fclose(fp);
+
+	expected(chk, in, ref, samples);
+	for (i = 0; i < samples; i++) {
+		const unsigned char *o = out + i * out_width;
+		if (chk->dither ? dither_ok(chk, in + i * in_width, o) :
+		    !memcmp(o, ref + i * out_width, out_width))
+			continue;
+		printf("MISMATCH %s -> %s %u ch%s at sample %zu\n",
+		       snd_pcm_format_name(chk->format),
+		       snd_pcm_format_name(chk->sformat), chk->channels,
+		       chk->dither ? " dither" : "", i);
+		err = -EINVAL;
+		break;
+	}
+ __end:
+	free(in);
+	free(out);
+	free(ref);
+	return err;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(snd_pcm_format_t format, snd_pcm_format_t sformat,
+		 int dither, double *msamples)
+{
+	const snd_pcm_uframes_t period_size = 1024;
+	const unsigned int channels = 2;
+	unsigned long long samples = 0;
+	snd_pcm_t *pcm;
+	double t, elapsed = 0;
+	size_t bytes;
+	unsigned char *buf;
+	int err;
+
+	err = open_lfloat(&pcm, "type null", sformat, dither);
+	if (err < 0)
+		return err;
+	err = snd_pcm_set_params(pcm, format, SND_PCM_ACCESS_RW_INTERLEAVED,
+				 channels, 48000, 0, 100000);
+	if (err < 0)
+		goto __end;
+	bytes = snd_pcm_frames_to_bytes(pcm, period_size);
+	buf = malloc(bytes);
+	if (!buf) {
+		err = -ENOMEM;
+		goto __end;
+	}
+	if (snd_pcm_format_float(format) == 1)
+		fill_float(format, buf, period_size * channels);
+	else
+		memset(buf, 0x5a, bytes);
+	t = now();
+	do {
+		snd_pcm_sframes_t n = snd_pcm_writei(pcm, buf, period_size);
+		if (n < 0) {
+			n = snd_pcm_recover(pcm, n, 0);
+			if (n < 0) {
+				err = n;
+				break;
+			}
+			continue;
+		}
+		samples += n * channels;
+		elapsed = now() - t;
+	} while (elapsed < seconds);
+	*msamples = samples / elapsed / 1e6;
+	free(buf);
+ __end:
+	snd_pcm_close(pcm);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-lfloat [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-l,--loops     random runs per case (default %u)\n"
+	       "-f,--frames    frames per run (default %lu)\n"
+	       "-s,--seconds   benchmark time per conversion, 0 = none (default %.1f)\n"
+	       "-S,--seed      random seed (default: time)\n",
+	       loops, total_frames, seconds);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"loops", 1, NULL, 'l'},
+		{"frames", 1, NULL, 'f'},
+		{"seconds", 1, NULL, 's'},
+		{"seed", 1, NULL, 'S'},
+		{NULL, 0, NULL, 0},
+	};
+	static const unsigned int channels[] = { 1, 2, 8 };
+	unsigned int i, f, c, l, runs = 0;
+	int fd, ch, err = 0;
+
+	seed = time(NULL);
+	while ((ch = getopt_long(argc, argv, "hl:f:s:S:", long_option, NULL)) != -1) {
+		switch (ch) {
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'f':
+			total_frames = atol(optarg);
+			if (!total_frames)
+				total_frames = 1;
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage();
+			return ch != 'h';
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	printf("seed %u\n", seed);
+	srand(seed);
+	for (i = 0; i < sizeof(int_formats) / sizeof(int_formats[0]) && !err; i++) {
+		for (f = 0; f < sizeof(float_formats) / sizeof(float_formats[0]) && !err; f++) {
+			for (c = 0; c < sizeof(channels) / sizeof(channels[0]) && !err; c++) {
+				for (l = 0; l < loops && !err; l++) {
+					struct check chk;
+
+					chk.channels = channels[c];
+					chk.dither = 0;
+					if (l & 1) {
+						chk.format = float_formats[f];
+						chk.sformat = int_formats[i];
+						/* dither for 16 and 24 bit only */
+						chk.dither = (l & 2) &&
+							snd_pcm_format_width(chk.sformat) < 32;
+					} else {
+						chk.format = int_formats[i];
+						chk.sformat = float_formats[f];
+					}
+					err = run_check(&chk);
+					runs++;
+				}
+			}
+		}
+	}
+	unlink(path);
+	if (err < 0)
+		return 1;
+	printf("OK, %u runs\n", runs);
+
+	for (i = 0; i < 3 && seconds > 0; i++) {
+		for (f = 0; f < sizeof(float_formats) / sizeof(float_formats[0]); f++) {
+			snd_pcm_format_t ifmt = int_formats[i];
+			snd_pcm_format_t ffmt = float_formats[f];
+			double to_float, to_int, dither = 0;
+			if (bench(ifmt, ffmt, 0, &to_float) < 0 ||
+			    bench(ffmt, ifmt, 0, &to_int) < 0 ||
+			    (i < 2 && bench(ffmt, ifmt, 1, &dither) < 0)) {
+				fprintf(stderr, "benchmark %s <-> %s failed\n",
+					snd_pcm_format_name(ifmt),
+					snd_pcm_format_name(ffmt));
+				return 1;
+			}
+			printf("%-8s <-> %-10s to float %8.2f  to int %8.2f  ",
+			       snd_pcm_format_name(ifmt), snd_pcm_format_name(ffmt),
+			       to_float, to_int);
+			/* no dither for S32 */
+			if (i < 2)
+				printf("dither %8.2f Msamples/s\n", dither);
+			else
+				printf("dither      n/a\n");
+		}
+	}
+	return 0;
+}
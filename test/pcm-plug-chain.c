@@ -0,0 +1,275 @@
+/*
+ *  plug conversion chain check and benchmark
+ *
+ *  Plays the same random S24_3LE 48000 Hz stereo stream through a plug
+ *  PCM converting to S32_LE 44100 Hz 8 channels, and through the chain
+ *  plug built before the rate converter output was handed to the route
+ *  plugin directly (rate to S24_3LE, then route to S32_LE), both over a
+ *  file plugin on a null slave.  The written streams must be identical,
+ *  the linear converter interpolating in S16 either way.  The time spent
+ *  in snd_pcm_writei() is printed for both chains; the plug one saves a
+ *  format conversion pass, not the rate and route passes.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+#define CHANNELS	2
+#define FRAME_BYTES	(CHANNELS * 3)
+#define OUT_FRAME_BYTES	(8 * 4)
+
+static const char ttable[] =
+	"ttable { 0.0 1 1.1 1 0.2 0.5 1.3 0.5 0.4 1 1.5 1 0.6 0.7 1.7 0.7 }";
+
+static snd_pcm_uframes_t total_frames = 480000;
+static unsigned int seed;
+static int verbose;
+static char path[2][32] = { "/tmp/pcm-plug-chain.XXXXXX",
+			    "/tmp/pcm-plug-chain.XXXXXX" };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_chains(snd_config_t **lconf)
+{
+	snd_input_t *in;
+	char buf[1024];
+	int len, err;
+
+	len = snprintf(buf, sizeof(buf),
+		       "pcm.plug_chain {\n"
+		       "\ttype plug\n"
+		       "\tslave {\n"
+		       "\t\tpcm { type file file \"%s\" format raw"
+		       " slave.pcm { type null } }\n"
+		       "\t\tformat S32_LE rate 44100 channels 8\n"
+		       "\t}\n"
+		       "\trate_converter \"linear\"\n"
+		       "\t%s\n"
+		       "}\n"
+		       "pcm.old_chain {\n"
+		       "\ttype rate\n"
+		       "\tslave {\n"
+		       "\t\tpcm {\n"
+		       "\t\t\ttype route\n"
+		       "\t\t\tslave {\n"
+		       "\t\t\t\tpcm { type file file \"%s\" format raw"
+		       " slave.pcm { type null } }\n"
+		       "\t\t\t\tformat S32_LE channels 8\n"
+		       "\t\t\t}\n"
+		       "\t\t\t%s\n"
+		       "\t\t}\n"
+		       "\t\tformat S24_3LE rate 44100\n"
+		       "\t}\n"
+		       "\tconverter \"linear\"\n"
+		       "}\n", path[0], ttable, path[1], ttable);
+	err = snd_config_top(lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, len);
+	if (err < 0)
+		return err;
+	err = snd_config_load(*lconf, in);
+	snd_input_close(in);
+	return err;
+}
+
+static int play(snd_config_t *lconf, const char *name,
+		const unsigned char *data, double *elapsed)
+{
+	snd_output_t *out;
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t done = 0;
+	double t;
+	int err;
+
+	err = snd_pcm_open_lconf(&pcm, name, SND_PCM_STREAM_PLAYBACK, 0, lconf);
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", name, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S24_3LE,
+				 SND_PCM_ACCESS_RW_INTERLEAVED, CHANNELS,
+				 48000, 1, 100000);
+	if (err < 0) {
+		fprintf(stderr, "cannot setup %s: %s\n", name,
+			snd_strerror(err));
+		goto __close;
+	}
+	if (verbose && snd_output_stdio_attach(&out, stdout, 0) >= 0) {
+		snd_pcm_dump(pcm, out);
+		snd_output_close(out);
+	}
+	*elapsed = 0;
+	while (done < total_frames) {
+		snd_pcm_uframes_t size = 1 + rand() % 2000;
+		snd_pcm_sframes_t n;
+		if (size > total_frames - done)
+			size = total_frames - done;
+		t = now();
+		n = snd_pcm_writei(pcm, data + done * FRAME_BYTES, size);
+		*elapsed += now() - t;
+		if (n < 0) {
+			fprintf(stderr, "%s: write error: %s\n", name,
+				snd_strerror(n));
+			err = n;
+			break;
+		}
+		done += n;
+	}
+ __close:
+	snd_pcm_close(pcm);
+	return err;
+}
+
+static unsigned char *read_back(const char *file, size_t *size)
+{
+	unsigned char *buf;
+	FILE *fp;
+	long len;
+
+	fp = fopen(file, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	buf = malloc(len > 0 ? len : 1);
+	if (buf && fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	*size = len;
+	return buf;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-plug-chain [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-f,--frames    frames to play (default %lu)\n"
+	       "-S,--seed      random seed (default: time)\n"
+	       "-v,--verbose   dump both chains\n",
+	       (unsigned long)total_frames);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"frames", 1, NULL, 'f'},
+		{"seed", 1, NULL, 'S'},
+		{"verbose", 0, NULL, 'v'},
+		{NULL, 0, NULL, 0},
+	};
+	static const char *const names[2] = { "plug_chain", "old_chain" };
+	snd_config_t *lconf = NULL;
+	unsigned char *data, *out[2] = { NULL, NULL };
+	size_t i, out_size[2];
+	double elapsed[2];
+	int c, fd, err = 0;
+
+	seed = time(NULL);
+	while ((c = getopt_long(argc, argv, "hf:S:v", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			total_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+	printf("seed %u, %lu frames\n", seed, (unsigned long)total_frames);
+	srand(seed);
+
+	data = malloc(total_frames * FRAME_BYTES);
+	if (!data)
+		return 1;
+	for (i = 0; i < total_frames * FRAME_BYTES; i++)
+		data[i] = rand();
+	for (c = 0; c < 2; c++) {
+		fd = mkstemp(path[c]);
+		if (fd < 0) {
+			perror("mkstemp");
+			return 1;
+		}
+		close(fd);
+	}
+	err = open_chains(&lconf);
+	if (err < 0) {
+		fprintf(stderr, "cannot load the chains: %s\n",
+			snd_strerror(err));
+		goto __end;
+	}
+	for (c = 0; c < 2; c++) {
+		err = play(lconf, names[c], data, &elapsed[c]);
+		if (err < 0)
+			goto __end;
+		out[c] = read_back(path[c], &out_size[c]);
+		if (!out[c]) {
+			fprintf(stderr, "cannot read back %s\n", path[c]);
+			err = -EIO;
+			goto __end;
+		}
+		printf("%-10s %8.3f ms  %zu frames written\n", names[c],
+		       elapsed[c] * 1000, out_size[c] / OUT_FRAME_BYTES);
+	}
+	if (out_size[0] != out_size[1]) {
+		printf("MISMATCH: %zu bytes against %zu\n", out_size[0],
+		       out_size[1]);
+		err = -EINVAL;
+		goto __end;
+	}
+	for (i = 0; i < out_size[0]; i++) {
+		if (out[0][i] != out[1][i]) {
+			printf("MISMATCH at frame %zu channel %zu\n",
+			       i / OUT_FRAME_BYTES, i % OUT_FRAME_BYTES / 4);
+			err = -EINVAL;
+			goto __end;
+		}
+	}
+	printf("OK, plug chain x%.2f\n", elapsed[1] / elapsed[0]);
+ __end:
+	if (lconf)
+		snd_config_delete(lconf);
+	unlink(path[0]);
+	unlink(path[1]);
+	free(out[0]);
+	free(out[1]);
+	free(data);
+	return err < 0;
+}
@@ -0,0 +1,473 @@
+/*
+ *  sinc rate converter test
+ *
+ *  Plays a sine tone through the rate plugin with the builtin "sinc"
+ *  converter into a file plugin over a null slave, for several ratios,
+ *  period sizes and sample formats, and checks the written output.  The
+ *  client and slave formats differ in some cases (8 bit, 24 bit packed,
+ *  swapped endian and float <-> integer), so that the samples are passed
+ *  to the converter in the formats it reads and writes itself:
+ *
+ *  - full periods only: the converter works on the ratio of the period
+ *    sizes, so K input periods must give K equal output periods of the
+ *    size nearest to period * ratio;
+ *  - a partial period flushed by snd_pcm_drain() adds the output_frames()
+ *    of the rest at the same ratio (+-1 frame);
+ *  - after the filter delay, each channel keeps the tone amplitude (RMS
+ *    within 2%) and frequency (zero crossings within 1%);
+ *  - for the sinc converters, at 768000 -> 8000 Hz where the filter
+ *    length is clamped, a tone just above the output Nyquist stays
+ *    below -45 dB.
+ *
+ *  With -c s16hold -i and ALSA_PLUGIN_DIR=.libs, the same checks run on
+ *  the S16 only test converter (rate-s16hold.c), so every stream format
+ *  is converted for the converter and back.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "../include/asoundlib.h"
+
+#define CHANNELS	2
+#define TONE		1000.0
+#define AMPLITUDE	0.5
+
+static const char *converter = "sinc";
+static unsigned int periods = 20;
+static int int_only;
+static char path[] = "/tmp/pcm-rate-sinc.XXXXXX";
+
+static const struct ratio {
+	unsigned int in, out;
+} ratios[] = {
+	{ 44100, 48000 },
+	{ 48000, 44100 },
+	{ 8000, 48000 },
+	{ 48000, 8000 },
+	{ 22050, 96000 },
+	{ 96000, 32000 },
+};
+
+/* client and slave formats */
+static const struct formats {
+	snd_pcm_format_t format, sformat;
+} formats[] = {
+	{ SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16 },
+	{ SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S32 },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_FLOAT },
+	/* the converter reads and writes these formats itself */
+	{ SND_PCM_FORMAT_S16, SND_PCM_FORMAT_U8 },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S16 },
+	{ SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_U8 },
+	{ SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S24_3LE },
+	{ SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16_BE },
+};
+
+static void put_sample(snd_pcm_format_t format, unsigned char *p, double v)
+{
+	if (format == SND_PCM_FORMAT_FLOAT) {
+		float f = v;
+		memcpy(p, &f, sizeof(f));
+	} else if (format == SND_PCM_FORMAT_S32) {
+		int32_t s = lrint(v * 2147483647.0);
+		memcpy(p, &s, sizeof(s));
+	} else {
+		int16_t s = lrint(v * 32767.0);
+		memcpy(p, &s, sizeof(s));
+	}
+}
+
+/* any linear or the native FLOAT format, as -1.0 .. 1.0 */
+static double get_sample(snd_pcm_format_t format, const unsigned char *p)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	int be = snd_pcm_format_big_endian(format) == 1;
+	uint32_t v = 0;
+	unsigned int i;
+
+	if (format == SND_PCM_FORMAT_FLOAT) {
+		float f;
+		memcpy(&f, p, sizeof(f));
+		return f;
+	}
+	for (i = 0; i < bytes; i++)
+		v |= (uint32_t)p[be ? bytes - 1 - i : i] << (8 * i);
+	v <<= 32 - snd_pcm_format_width(format);
+	if (snd_pcm_format_unsigned(format) == 1)
+		v ^= 0x80000000;
+	return (int32_t)v / 2147483648.0;
+}
+
+static int open_rate(snd_pcm_t **pcm, const struct ratio *r,
+		     const struct formats *f, snd_pcm_uframes_t *period)
+{
+	snd_pcm_hw_params_t *params;
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char buf[512];
+	int err;
+
+	snprintf(buf, sizeof(buf),
+		 "pcm.check {\n"
+		 "\ttype rate\n"
+		 "\tconverter \"%s\"\n"
+		 "\tslave {\n"
+		 "\t\tpcm { type file file \"%s\" slave.pcm { type null } }\n"
+		 "\t\trate %u\n"
+		 "\t\tformat %s\n"
+		 "\t}\n"
+		 "}\n", converter, path, r->out,
+		 snd_pcm_format_name(f->sformat));
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, buf, strlen(buf));
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "check", SND_PCM_STREAM_PLAYBACK, 0, lconf);
+	if (err < 0)
+		goto __end;
+
+	snd_pcm_hw_params_alloca(&params);
+	snd_pcm_hw_params_any(*pcm, params);
+	err = snd_pcm_hw_params_set_access(*pcm, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_format(*pcm, params, f->format);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_channels(*pcm, params, CHANNELS);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_rate(*pcm, params, r->in, 0);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_period_size_near(*pcm, params,
+							     period, 0);
+	if (err >= 0) {
+		snd_pcm_uframes_t buffer = *period * 4;
+		err = snd_pcm_hw_params_set_buffer_size_near(*pcm, params,
+							     &buffer);
+	}
+	if (err >= 0)
+		err = snd_pcm_hw_params(*pcm, params);
+	if (err < 0)
+		snd_pcm_close(*pcm);
+ __end:
+	snd_config_delete(lconf);
+	return err;
+}
+
+/* amplitude and frequency of one channel in the steady part */
+static int check_tone(const struct ratio *r, const struct formats *f,
+		      const unsigned char *out, snd_pcm_uframes_t from,
+		      snd_pcm_uframes_t to, unsigned int channel)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(f->sformat) / 8;
+	double sum = 0, prev = 0, rms, expected_rms = AMPLITUDE / sqrt(2);
+	double crossings = 0, expected;
+	snd_pcm_uframes_t n;
+
+	for (n = from; n < to; n++) {
+		double v = get_sample(f->sformat,
+				      out + (n * CHANNELS + channel) * bytes);
+		sum += v * v;
+		if (n > from && ((prev < 0) != (v < 0)))
+			crossings++;
+		prev = v;
+	}
+	rms = sqrt(sum / (to - from));
+	expected = 2 * TONE * (to - from) / r->out;
+	if (fabs(rms - expected_rms) > expected_rms * 0.02 ||
+	    fabs(crossings - expected) > expected * 0.01 + 2) {
+		printf("channel %u: RMS %f (expected %f), %.0f zero crossings "
+		       "(expected %.0f)\n", channel, rms, expected_rms,
+		       crossings, expected);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int run_check(const struct ratio *r, const struct formats *f,
+		     snd_pcm_uframes_t period, snd_pcm_uframes_t rest)
+{
+	unsigned int in_bytes = snd_pcm_format_physical_width(f->format) / 8 * CHANNELS;
+	unsigned int out_bytes = snd_pcm_format_physical_width(f->sformat) / 8 * CHANNELS;
+	snd_pcm_uframes_t frames, out_frames, out_period, n, from, to;
+	double ratio = (double)r->out / r->in;
+	unsigned char *in = NULL, *out = NULL;
+	snd_pcm_sframes_t written;
+	snd_pcm_t *pcm;
+	unsigned int c;
+	struct stat st;
+	FILE *fp;
+	int err;
+
+	if (truncate(path, 0) < 0) {
+		perror(path);
+		return -errno;
+	}
+	err = open_rate(&pcm, r, f, &period);
+	if (err < 0) {
+		printf("cannot setup: %s\n", snd_strerror(err));
+		return err;
+	}
+	rest = rest ? period / 3 : 0;
+	frames = periods * period + rest;
+	in = malloc(frames * in_bytes);
+	if (!in) {
+		snd_pcm_close(pcm);
+		return -ENOMEM;
+	}
+	for (n = 0; n < frames; n++) {
+		double v = AMPLITUDE * sin(2 * M_PI * TONE * n / r->in);
+		for (c = 0; c < CHANNELS; c++)
+			put_sample(f->format,
+				   in + (n * CHANNELS + c) * in_bytes / CHANNELS,
+				   c ? -v : v);
+	}
+	written = snd_pcm_writei(pcm, in, frames);
+	if (written >= 0 && rest)
+		err = snd_pcm_drain(pcm);
+	snd_pcm_close(pcm);
+	free(in);
+	if (written != (snd_pcm_sframes_t)frames || err < 0) {
+		printf("write error: %s\n",
+		       snd_strerror(written < 0 ? written : err));
+		return -EIO;
+	}
+
+	if (stat(path, &st) < 0 || st.st_size % out_bytes) {
+		printf("bad output file size\n");
+		return -EIO;
+	}
+	out_frames = st.st_size / out_bytes;
+	/* the full periods map to equal slave periods */
+	out_period = lrint(period * ratio);
+	if (!rest && out_frames % periods) {
+		printf("%lu output frames are not %u equal periods\n",
+		       out_frames, periods);
+		return -EINVAL;
+	}
+	if (!rest && labs((long)(out_frames / periods) - (long)out_period) > 1) {
+		printf("output period %lu, expected %lu\n",
+		       out_frames / periods, out_period);
+		return -EINVAL;
+	}
+	if (rest) {
+		/* the slave period is one of the nearest sizes */
+		for (n = out_period - 1; n <= out_period + 1; n++) {
+			long expected = periods * n + lrint((double)rest * n / period);
+			if (labs((long)out_frames - expected) <= 1)
+				break;
+		}
+		if (n > out_period + 1) {
+			printf("%lu output frames, expected about %ld\n",
+			       out_frames, lrint(frames * ratio));
+			return -EINVAL;
+		}
+	}
+
+	out = malloc(out_frames * out_bytes);
+	fp = fopen(path, "rb");
+	if (!out || !fp ||
+	    fread(out, out_bytes, out_frames, fp) != out_frames) {
+		printf("cannot read back %s\n", path);
+		if (fp)
+			fclose(fp);
+		free(out);
+		return -EIO;
+	}
+	fclose(fp);
+	/* skip the filter delay (at most 1024 taps) and the tail */
+	from = 1024;
+	to = out_frames - (out_frames > 4 * from ? from : 0);
+	for (c = 0; c < CHANNELS && from < to && !err; c++)
+		err = check_tone(r, f, out, from, to, c);
+	free(out);
+	return err;
+}
+
+/*
+ * 768000 -> 8000 Hz needs more than MAX_TAPS for all the sinc presets, the
+ * shortened filter must still stop a tone just above the output Nyquist
+ */
+static int check_alias(void)
+{
+	static const struct ratio r = { 768000, 8000 };
+	static const struct formats f = { SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S32 };
+	const double tone = 1.1 * r.out / 2;	/* 10% above Nyquist */
+	snd_pcm_uframes_t period = r.in / 100, frames, out_frames, n;
+	unsigned char *buf;
+	double sum = 0, level;
+	snd_pcm_sframes_t written;
+	snd_pcm_t *pcm;
+	struct stat st;
+	FILE *fp;
+	int err;
+
+	if (truncate(path, 0) < 0) {
+		perror(path);
+		return -errno;
+	}
+	err = open_rate(&pcm, &r, &f, &period);
+	if (err < 0) {
+		printf("cannot setup: %s\n", snd_strerror(err));
+		return err;
+	}
+	frames = periods * period;
+	buf = malloc(frames * CHANNELS * 4);
+	if (!buf) {
+		snd_pcm_close(pcm);
+		return -ENOMEM;
+	}
+	for (n = 0; n < frames * CHANNELS; n++)
+		put_sample(f.format, buf + n * 4,
+			   AMPLITUDE * sin(2 * M_PI * tone * (n / CHANNELS) / r.in));
+	written = snd_pcm_writei(pcm, buf, frames);
+	snd_pcm_close(pcm);
+	free(buf);
+	if (written != (snd_pcm_sframes_t)frames) {
+		printf("write error\n");
+		return -EIO;
+	}
+
+	if (stat(path, &st) < 0) {
+		printf("bad output file size\n");
+		return -EIO;
+	}
+	out_frames = st.st_size / (CHANNELS * 4);
+	buf = malloc(st.st_size);
+	fp = fopen(path, "rb");
+	if (!buf || !fp || out_frames <= 2 * 100 ||
+	    fread(buf, CHANNELS * 4, out_frames, fp) != out_frames) {
+		printf("cannot read back %s\n", path);
+		if (fp)
+			fclose(fp);
+		free(buf);
+		return -EIO;
+	}
+	fclose(fp);
+	/* skip the filter delay, 1024 taps are 21 output frames */
+	for (n = 100; n < out_frames; n++) {
+		double v = get_sample(f.sformat, buf + n * CHANNELS * 4);
+		sum += v * v;
+	}
+	free(buf);
+	level = 20 * log10(sqrt(sum / (out_frames - 100)) / (AMPLITUDE / sqrt(2)));
+	if (level > -45) {
+		printf("a %.0f Hz tone passes at %.1f dB\n", tone, level);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-rate-sinc [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-c,--converter rate converter (default %s)\n"
+	       "-p,--periods   full periods per run (default %u)\n"
+	       "-i,--int-only  skip the float formats (converters without FLOAT)\n",
+	       converter, periods);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"converter", 1, NULL, 'c'},
+		{"periods", 1, NULL, 'p'},
+		{"int-only", 0, NULL, 'i'},
+		{NULL, 0, NULL, 0},
+	};
+	unsigned int r, f, p, runs = 0;
+	int fd, c, err = 0;
+
+	while ((c = getopt_long(argc, argv, "hc:p:i", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			converter = optarg;
+			break;
+		case 'p':
+			periods = atoi(optarg);
+			if (periods < 4)
+				periods = 4;
+			break;
+		case 'i':
+			int_only = 1;
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	for (r = 0; r < sizeof(ratios) / sizeof(ratios[0]) && !err; r++) {
+		/* a period with an exact and one with a rounded slave size;
+		 * odd: drain a third of a period after the full ones
+		 */
+		const snd_pcm_uframes_t period_sizes[] = {
+			ratios[r].in / 100, 1024
+		};
+		for (f = 0; f < sizeof(formats) / sizeof(formats[0]) && !err; f++) {
+			if (int_only &&
+			    (snd_pcm_format_float(formats[f].format) == 1 ||
+			     snd_pcm_format_float(formats[f].sformat) == 1))
+				continue;
+			for (p = 0; p < 4 && !err; p++) {
+				snd_pcm_uframes_t period = period_sizes[p / 2];
+				snd_pcm_uframes_t rest = p & 1;
+				err = run_check(&ratios[r], &formats[f], period, rest);
+				if (err < 0)
+					printf("FAILED %u -> %u Hz, %s -> %s, "
+					       "period %lu%s\n", ratios[r].in,
+					       ratios[r].out,
+					       snd_pcm_format_name(formats[f].format),
+					       snd_pcm_format_name(formats[f].sformat),
+					       period, rest ? " + drained rest" : "");
+				runs++;
+			}
+		}
+	}
+	if (!err && strncmp(converter, "sinc", 4) == 0) {
+		err = check_alias();
+		if (err < 0)
+			printf("FAILED alias check %s\n", converter);
+		runs++;
+	}
+	unlink(path);
+	if (err < 0)
+		return 1;
+	printf("OK, %u runs\n", runs);
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ *  hw_params refinement / open time benchmark
+ *
+ *  Opens the given PCM repeatedly and negotiates a configuration the way
+ *  a typical application does (any, set_access, set_format, set_*_near,
+ *  hw_params), then repeats the negotiation on a single handle.  Both
+ *  runs are done with and without the refinement cache
+ *  ($LIBASOUND_REFINE_CACHE), the resulting configurations are compared
+ *  and the number of refining calls and the wall time are printed.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static const char *device = "plug:null";
+static snd_pcm_stream_t stream = SND_PCM_STREAM_PLAYBACK;
+static unsigned int loops = 200;
+static unsigned int rate = 44100;
+static unsigned int channels = 2;
+static snd_pcm_format_t format = SND_PCM_FORMAT_S16;
+
+/* calls refining the configuration space */
+static unsigned long refines;
+
+struct setup {
+	unsigned int rate;
+	unsigned int channels;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define CHECK(call) do { \
+	int __err; \
+	refines++; \
+	__err = (call); \
+	if (__err < 0) { \
+		fprintf(stderr, "%s: %s\n", #call, snd_strerror(__err)); \
+		return __err; \
+	} \
+} while (0)
+
+static int negotiate(snd_pcm_t *pcm, struct setup *setup, int install)
+{
+	snd_pcm_hw_params_t *params;
+	unsigned int val, buffer_time = 500000, period_time = 100000;
+	int dir = 0;
+
+	snd_pcm_hw_params_alloca(&params);
+	CHECK(snd_pcm_hw_params_any(pcm, params));
+	CHECK(snd_pcm_hw_params_set_rate_resample(pcm, params, 1));
+	CHECK(snd_pcm_hw_params_set_access(pcm, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED));
+	CHECK(snd_pcm_hw_params_set_format(pcm, params, format));
+	CHECK(snd_pcm_hw_params_set_channels(pcm, params, channels));
+	val = rate;
+	CHECK(snd_pcm_hw_params_set_rate_near(pcm, params, &val, &dir));
+	CHECK(snd_pcm_hw_params_set_buffer_time_near(pcm, params,
+						     &buffer_time, &dir));
+	CHECK(snd_pcm_hw_params_set_period_time_near(pcm, params,
+						     &period_time, &dir));
+	if (install)
+		CHECK(snd_pcm_hw_params(pcm, params));
+	/* the remaining space; a single configuration when installed */
+	snd_pcm_hw_params_get_rate_min(params, &setup->rate, &dir);
+	snd_pcm_hw_params_get_channels_min(params, &setup->channels);
+	snd_pcm_hw_params_get_buffer_size_min(params, &setup->buffer_size);
+	snd_pcm_hw_params_get_period_size_min(params, &setup->period_size, &dir);
+	return 0;
+}
+
+/* open, negotiate and close the PCM, as done on each device switch */
+static int bench_open(struct setup *setup, double *elapsed)
+{
+	snd_pcm_t *pcm;
+	unsigned int i;
+	double t;
+	int err;
+
+	t = now();
+	for (i = 0; i < loops; i++) {
+		err = snd_pcm_open(&pcm, device, stream, 0);
+		if (err < 0) {
+			fprintf(stderr, "cannot open %s: %s\n", device,
+				snd_strerror(err));
+			return err;
+		}
+		err = negotiate(pcm, setup, 1);
+		snd_pcm_close(pcm);
+		if (err < 0)
+			return err;
+	}
+	*elapsed = now() - t;
+	return 0;
+}
+
+/* negotiate repeatedly on a single handle */
+static int bench_refine(struct setup *setup, double *elapsed)
+{
+	snd_pcm_t *pcm;
+	unsigned int i;
+	double t;
+	int err;
+
+	err = snd_pcm_open(&pcm, device, stream, 0);
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", device,
+			snd_strerror(err));
+		return err;
+	}
+	t = now();
+	for (i = 0; i < loops; i++) {
+		err = negotiate(pcm, setup, 0);
+		if (err < 0)
+			break;
+	}
+	*elapsed = now() - t;
+	snd_pcm_close(pcm);
+	return err;
+}
+
+static int run(const char *name, int (*bench)(struct setup *, double *))
+{
+	struct setup setup[2];
+	double elapsed[2];
+	unsigned long calls = 0;
+	int cache, err;
+
+	for (cache = 0; cache < 2; cache++) {
+		setenv("LIBASOUND_REFINE_CACHE", cache ? "1" : "0", 1);
+		refines = 0;
+		err = bench(&setup[cache], &elapsed[cache]);
+		if (err < 0)
+			return err;
+		calls = refines;
+	}
+	printf("%-8s %6lu calls  uncached %8.3f ms  cached %8.3f ms  "
+	       "(%.2f us/call, x%.2f)\n",
+	       name, calls, elapsed[0] * 1e3, elapsed[1] * 1e3,
+	       elapsed[1] * 1e6 / calls, elapsed[0] / elapsed[1]);
+	if (memcmp(&setup[0], &setup[1], sizeof(setup[0]))) {
+		printf("MISMATCH: uncached %u Hz %u ch %lu/%lu, "
+		       "cached %u Hz %u ch %lu/%lu\n",
+		       setup[0].rate, setup[0].channels,
+		       setup[0].buffer_size, setup[0].period_size,
+		       setup[1].rate, setup[1].channels,
+		       setup[1].buffer_size, setup[1].period_size);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-refine-bench [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-D,--device    PCM device (default %s)\n"
+	       "-C,--capture   capture stream\n"
+	       "-r,--rate      rate to negotiate (default %u)\n"
+	       "-c,--channels  channels to negotiate (default %u)\n"
+	       "-f,--format    format to negotiate (default %s)\n"
+	       "-l,--loops     iterations (default %u)\n",
+	       device, rate, channels, snd_pcm_format_name(format), loops);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'D'},
+		{"capture", 0, NULL, 'C'},
+		{"rate", 1, NULL, 'r'},
+		{"channels", 1, NULL, 'c'},
+		{"format", 1, NULL, 'f'},
+		{"loops", 1, NULL, 'l'},
+		{NULL, 0, NULL, 0},
+	};
+	int c;
+
+	while ((c = getopt_long(argc, argv, "hD:Cr:c:f:l:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'C':
+			stream = SND_PCM_STREAM_CAPTURE;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 'f':
+			format = snd_pcm_format_value(optarg);
+			if (format == SND_PCM_FORMAT_UNKNOWN) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			if (!loops)
+				loops = 1;
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	printf("%s, %s, %s %u ch %u Hz, %u loops\n", device,
+	       snd_pcm_stream_name(stream), snd_pcm_format_name(format),
+	       channels, rate, loops);
+	if (run("open", bench_open) < 0 ||
+	    run("refine", bench_refine) < 0)
+		return 1;
+	return 0;
+}
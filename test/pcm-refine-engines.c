@@ -0,0 +1,377 @@
+/*
+ *  hw_params refinement engines equivalence test
+ *
+ *  Opens the given PCM twice, once with the worklist rule scheduler and
+ *  once with the former pass based engine ($LIBASOUND_REFINE_ENGINE),
+ *  applies the same random sequences of hw_params restrictions to both
+ *  and checks that every call returns the same result and leaves the
+ *  same configuration space.  The time spent in each engine is printed.
+ *  A single call taking longer than a second counts as a failure, too;
+ *  plug chains with a rate plugin used to take minutes in set_rate_near
+ *  (try -c deep -S 1).
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static const char *device = "null";
+static const char *chain;
+static unsigned int sequences = 2000;
+static unsigned int steps = 12;
+static unsigned int seed;
+
+enum { PASSES, WORKLIST, ENGINES };
+
+static const char *const engine_names[ENGINES] = {
+	[PASSES] = "passes",
+	[WORKLIST] = "worklist",
+};
+
+/* plug chains opened from a local configuration, see -c */
+static const struct chain {
+	const char *name;
+	const char *conf;
+} chains[] = {
+	{ "r48", "pcm.r48 { type plug slave { pcm { type null } rate 48000 } }" },
+	{ "deep", "pcm.deep { type plug slave.pcm { type rate slave {"
+		  " pcm { type route slave.pcm { type linear"
+		  " slave.pcm { type null } slave.format S32_LE }"
+		  " ttable.0.0 1 ttable.1.1 1 } rate 48000 } } }" },
+};
+
+#define MAX_STEP_TIME	1.0
+
+static double elapsed[ENGINES];
+static snd_output_t *output;
+static snd_config_t *lconf;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int rnd(unsigned int max)
+{
+	return rand() % max;
+}
+
+/* pick a value around the typical ranges of each parameter */
+static unsigned int rnd_rate(void)
+{
+	static const unsigned int rates[] = {
+		8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000,
+		192000
+	};
+
+	if (rnd(4))
+		return rates[rnd(sizeof(rates) / sizeof(rates[0]))];
+	return 1 + rnd(400000);
+}
+
+static unsigned int rnd_size(void)
+{
+	return 1 + rnd(1U << (4 + rnd(16)));
+}
+
+static unsigned int rnd_time(void)
+{
+	return 1 + rnd(1U << (6 + rnd(18)));
+}
+
+/*
+ * one restriction; the same seed gives the same call for both handles,
+ * the in/out values are returned via val for the comparison
+ */
+static int step(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, unsigned int op,
+		unsigned int arg, unsigned int arg2, int dir, unsigned long *val)
+{
+	unsigned int u = arg;
+	snd_pcm_uframes_t f = arg;
+	int dir2 = dir;
+	int err;
+
+	switch (op) {
+	case 0:
+		err = snd_pcm_hw_params_set_access(pcm, params, arg % 5);
+		break;
+	case 1:
+		err = snd_pcm_hw_params_set_format(pcm, params,
+						   arg % (SND_PCM_FORMAT_LAST + 1));
+		break;
+	case 2:
+		u = 1 + arg % 32;
+		err = snd_pcm_hw_params_set_channels_min(pcm, params, &u);
+		break;
+	case 3:
+		u = 1 + arg % 32;
+		err = snd_pcm_hw_params_set_channels_max(pcm, params, &u);
+		break;
+	case 4:
+		err = snd_pcm_hw_params_set_rate_min(pcm, params, &u, &dir);
+		break;
+	case 5:
+		err = snd_pcm_hw_params_set_rate_max(pcm, params, &u, &dir);
+		break;
+	case 6:
+		err = snd_pcm_hw_params_set_rate_near(pcm, params, &u, &dir);
+		break;
+	case 7:
+		err = snd_pcm_hw_params_set_period_size_min(pcm, params, &f, &dir);
+		break;
+	case 8:
+		err = snd_pcm_hw_params_set_period_size_max(pcm, params, &f, &dir);
+		break;
+	case 9:
+		err = snd_pcm_hw_params_set_buffer_size_near(pcm, params, &f);
+		break;
+	case 10:
+		err = snd_pcm_hw_params_set_period_time_near(pcm, params, &u, &dir);
+		break;
+	case 11:
+		err = snd_pcm_hw_params_set_buffer_time_near(pcm, params, &u, &dir);
+		break;
+	case 12:
+		u = 1 + arg % 64;
+		err = snd_pcm_hw_params_set_periods_min(pcm, params, &u, &dir);
+		break;
+	case 13:
+		u = 1 + arg % 64;
+		err = snd_pcm_hw_params_set_periods_max(pcm, params, &u, &dir);
+		break;
+	case 14:
+		err = snd_pcm_hw_params_set_periods_integer(pcm, params);
+		break;
+	case 15:
+		u = arg2 > arg ? arg2 : arg;
+		err = snd_pcm_hw_params_set_buffer_time_minmax(pcm, params,
+							       &arg, &dir,
+							       &u, &dir2);
+		f = arg;
+		break;
+	case 16:
+		err = snd_pcm_hw_params_set_rate_resample(pcm, params, arg & 1);
+		break;
+	default:
+		err = snd_pcm_hw_params_set_period_size_first(pcm, params, &f, &dir);
+		break;
+	}
+	*val = u ^ ((unsigned long)f << 1);
+	return err;
+}
+
+static int run_sequence(snd_pcm_t **pcm, snd_pcm_hw_params_t **params,
+			unsigned int n)
+{
+	unsigned int s, e;
+
+	for (e = 0; e < ENGINES; e++) {
+		int err = snd_pcm_hw_params_any(pcm[e], params[e]);
+		if (err < 0) {
+			fprintf(stderr, "%s: any: %s\n", engine_names[e],
+				snd_strerror(err));
+			return err;
+		}
+	}
+	for (s = 0; s < steps; s++) {
+		unsigned int op = rnd(18);
+		unsigned int arg, arg2;
+		int dir = (int)rnd(3) - 1;
+		unsigned long val[ENGINES];
+		int err[ENGINES];
+		double t;
+
+		switch (op) {
+		case 4: case 5: case 6:
+			arg = rnd_rate();
+			break;
+		case 7: case 8: case 9:
+			arg = rnd_size();
+			break;
+		case 10: case 11: case 15:
+			arg = rnd_time();
+			break;
+		default:
+			arg = rand();
+			break;
+		}
+		arg2 = rnd_time();
+		for (e = 0; e < ENGINES; e++) {
+			t = now();
+			err[e] = step(pcm[e], params[e], op, arg, arg2, dir, &val[e]);
+			t = now() - t;
+			elapsed[e] += t;
+			if (t > MAX_STEP_TIME) {
+				printf("SLOW in sequence %u step %u (op %u arg %u dir %d): "
+				       "%s took %.1f s\n", n, s, op, arg, dir,
+				       engine_names[e], t);
+				return -ETIMEDOUT;
+			}
+		}
+		if (err[PASSES] != err[WORKLIST] ||
+		    val[PASSES] != val[WORKLIST] ||
+		    memcmp(params[PASSES], params[WORKLIST],
+			   snd_pcm_hw_params_sizeof())) {
+			printf("MISMATCH in sequence %u step %u (op %u arg %u dir %d): "
+			       "result %d/%d\n", n, s, op, arg, dir,
+			       err[PASSES], err[WORKLIST]);
+			for (e = 0; e < ENGINES; e++) {
+				printf("%s:\n", engine_names[e]);
+				snd_pcm_hw_params_dump(params[e], output);
+			}
+			return -EINVAL;
+		}
+		if (err[PASSES] < 0) {
+			/* the space may be broken now; start over */
+			break;
+		}
+	}
+	return 0;
+}
+
+static int load_chain(const char *conf)
+{
+	snd_input_t *in;
+	int err;
+
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, conf, strlen(conf));
+	if (err < 0)
+		return err;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-refine-engines [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-D,--device    PCM device (default %s)\n"
+	       "-c,--chain     builtin plug chain instead: r48 or deep\n"
+	       "-n,--sequences number of random sequences (default %u)\n"
+	       "-s,--steps     restrictions per sequence (default %u)\n"
+	       "-S,--seed      random seed (default: time)\n",
+	       device, sequences, steps);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'D'},
+		{"chain", 1, NULL, 'c'},
+		{"sequences", 1, NULL, 'n'},
+		{"steps", 1, NULL, 's'},
+		{"seed", 1, NULL, 'S'},
+		{NULL, 0, NULL, 0},
+	};
+	snd_pcm_t *pcm[ENGINES];
+	snd_pcm_hw_params_t *params[ENGINES];
+	unsigned int e, n;
+	int c, err;
+
+	seed = time(NULL);
+	while ((c = getopt_long(argc, argv, "hD:c:n:s:S:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'c':
+			chain = optarg;
+			break;
+		case 'n':
+			sequences = atoi(optarg);
+			break;
+		case 's':
+			steps = atoi(optarg);
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	if (chain) {
+		for (e = 0; e < sizeof(chains) / sizeof(chains[0]); e++)
+			if (!strcmp(chain, chains[e].name))
+				break;
+		if (e == sizeof(chains) / sizeof(chains[0])) {
+			usage();
+			return 1;
+		}
+		device = chains[e].name;
+		err = load_chain(chains[e].conf);
+		if (err < 0) {
+			fprintf(stderr, "cannot load the chain: %s\n",
+				snd_strerror(err));
+			return 1;
+		}
+	}
+
+	snd_output_stdio_attach(&output, stdout, 0);
+	/* compare the engines themselves, not the cached results */
+	setenv("LIBASOUND_REFINE_CACHE", "0", 1);
+	for (e = 0; e < ENGINES; e++) {
+		setenv("LIBASOUND_REFINE_ENGINE", engine_names[e], 1);
+		if (lconf)
+			err = snd_pcm_open_lconf(&pcm[e], device,
+						 SND_PCM_STREAM_PLAYBACK, 0, lconf);
+		else
+			err = snd_pcm_open(&pcm[e], device,
+					   SND_PCM_STREAM_PLAYBACK, 0);
+		if (err < 0) {
+			fprintf(stderr, "cannot open %s: %s\n", device,
+				snd_strerror(err));
+			return 1;
+		}
+		snd_pcm_hw_params_malloc(&params[e]);
+	}
+
+	printf("%s, seed %u, %u sequences of %u steps\n", device, seed,
+	       sequences, steps);
+	srand(seed);
+	for (n = 0; n < sequences; n++) {
+		if (run_sequence(pcm, params, n) < 0)
+			return 1;
+	}
+	for (e = 0; e < ENGINES; e++)
+		printf("%-8s %8.3f ms\n", engine_names[e], elapsed[e] * 1e3);
+	printf("OK\n");
+
+	for (e = 0; e < ENGINES; e++) {
+		snd_pcm_hw_params_free(params[e]);
+		snd_pcm_close(pcm[e]);
+	}
+	if (lconf)
+		snd_config_delete(lconf);
+	snd_output_close(output);
+	return 0;
+}
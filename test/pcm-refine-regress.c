@@ -0,0 +1,219 @@
+/*
+ *  hw_params refinement regression test
+ *
+ *  Each case replays a sequence of hw_params calls which went wrong once,
+ *  on a plug chain opened from a local configuration (no configuration
+ *  file needed), and checks the outcome:
+ *
+ *  plug-empty-rate  a failed slave refine calls the plug cchange with an
+ *                   empty slave rate, which hit an assert
+ *  near-creep       set_rate_near through plug -> rate took about 50 s,
+ *                   one pass per Hz, from a wrong dir for (x x+1]
+ *  failed-refine    a failed refine left uninitialized stack bounds in
+ *                   the emptied interval, so the two refine engines
+ *                   (LIBASOUND_REFINE_ENGINE) left different bytes
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+static const char chains[] =
+	"pcm.r48 { type plug slave { pcm { type null } rate 48000 } }\n"
+	"pcm.deep { type plug slave.pcm { type rate slave {"
+	" pcm { type route slave.pcm { type linear"
+	" slave.pcm { type null } slave.format S32_LE }"
+	" ttable.0.0 1 ttable.1.1 1 } rate 48000 } } }\n";
+
+static snd_config_t *lconf;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_any(const char *name, snd_pcm_t **pcm,
+		    snd_pcm_hw_params_t *params)
+{
+	int err;
+
+	err = snd_pcm_open_lconf(pcm, name, SND_PCM_STREAM_PLAYBACK, 0, lconf);
+	if (err < 0) {
+		printf("cannot open %s: %s\n", name, snd_strerror(err));
+		return err;
+	}
+	err = snd_pcm_hw_params_any(*pcm, params);
+	if (err < 0) {
+		printf("%s: any: %s\n", name, snd_strerror(err));
+		snd_pcm_close(*pcm);
+	}
+	return err;
+}
+
+/* rate > 48000 on plug with slave rate 48000: an error is fine, abort not */
+static int check_plug_empty_rate(void)
+{
+	snd_pcm_hw_params_t *params;
+	snd_pcm_t *pcm;
+	unsigned int rate = 48000;
+	int dir = 1, err;
+
+	snd_pcm_hw_params_alloca(&params);
+	if (open_any("r48", &pcm, params) < 0)
+		return -1;
+	snd_pcm_hw_params_set_rate_min(pcm, params, &rate, &dir);
+	/* the failed call must leave the space as it was */
+	rate = 48000;
+	err = snd_pcm_hw_params_set_rate(pcm, params, rate, 0);
+	if (err < 0)
+		printf("set_rate 48000 after the failed call: %s\n",
+		       snd_strerror(err));
+	snd_pcm_close(pcm);
+	return err;
+}
+
+/* MMAP_COMPLEX, 19 channels, set_rate_near(192000) must take no time */
+static int check_near_creep(void)
+{
+	snd_pcm_hw_params_t *params;
+	snd_pcm_t *pcm;
+	unsigned int channels = 19, rate = 192000;
+	int dir = -1, err;
+	double t;
+
+	snd_pcm_hw_params_alloca(&params);
+	if (open_any("deep", &pcm, params) < 0)
+		return -1;
+	err = snd_pcm_hw_params_set_access(pcm, params,
+					   SND_PCM_ACCESS_MMAP_COMPLEX);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_channels_min(pcm, params, &channels);
+	if (err < 0) {
+		printf("setup: %s\n", snd_strerror(err));
+		goto __close;
+	}
+	t = now();
+	err = snd_pcm_hw_params_set_rate_near(pcm, params, &rate, &dir);
+	t = now() - t;
+	if (err < 0) {
+		printf("set_rate_near: %s\n", snd_strerror(err));
+	} else if (t > 1.0) {
+		printf("set_rate_near took %.1f s\n", t);
+		err = -1;
+	} else if (rate < 191999 || rate > 192000) {
+		/* just below 192000 was asked, either side of it will do */
+		printf("set_rate_near gave %u dir %d\n", rate, dir);
+		err = -1;
+	}
+ __close:
+	snd_pcm_close(pcm);
+	return err;
+}
+
+/*
+ * period_time_near fails and leaves the params changed (SND_CHANGE); the
+ * two refine engines run different code over the stack before it
+ */
+static int failed_refine(const char *engine, snd_pcm_hw_params_t *params)
+{
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t frames = 10271;
+	unsigned int channels = 16, period_time = 3406;
+	int dir = 1, err;
+
+	setenv("LIBASOUND_REFINE_ENGINE", engine, 1);
+	err = open_any("deep", &pcm, params);
+	unsetenv("LIBASOUND_REFINE_ENGINE");
+	if (err < 0)
+		return err;
+	snd_pcm_hw_params_set_period_size_min(pcm, params, &frames, &dir);
+	snd_pcm_hw_params_set_rate_resample(pcm, params, 0);
+	snd_pcm_hw_params_set_channels_min(pcm, params, &channels);
+	frames = 88;
+	snd_pcm_hw_params_set_buffer_size_near(pcm, params, &frames);
+	dir = 0;
+	err = snd_pcm_hw_params_set_period_time_near(pcm, params,
+						     &period_time, &dir);
+	snd_pcm_close(pcm);
+	if (err >= 0) {
+		printf("%s: set_period_time_near succeeded\n", engine);
+		return -1;
+	}
+	return 0;
+}
+
+static int check_failed_refine(void)
+{
+	snd_pcm_hw_params_t *params[2];
+
+	snd_pcm_hw_params_alloca(&params[0]);
+	snd_pcm_hw_params_alloca(&params[1]);
+	if (failed_refine("passes", params[0]) < 0 ||
+	    failed_refine("worklist", params[1]) < 0)
+		return -1;
+	if (memcmp(params[0], params[1], snd_pcm_hw_params_sizeof())) {
+		printf("the engines leave different params\n");
+		return -1;
+	}
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*check)(void);
+} cases[] = {
+	{ "plug-empty-rate", check_plug_empty_rate },
+	{ "near-creep", check_near_creep },
+	{ "failed-refine", check_failed_refine },
+};
+
+int main(void)
+{
+	snd_input_t *in;
+	unsigned int i, failed = 0;
+	int err;
+
+	err = snd_config_top(&lconf);
+	if (err >= 0)
+		err = snd_input_buffer_open(&in, chains, strlen(chains));
+	if (err >= 0) {
+		err = snd_config_load(lconf, in);
+		snd_input_close(in);
+	}
+	if (err < 0) {
+		fprintf(stderr, "cannot load the chains: %s\n",
+			snd_strerror(err));
+		return 1;
+	}
+	/* compare the engines themselves, not the cached results */
+	setenv("LIBASOUND_REFINE_CACHE", "0", 1);
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		err = cases[i].check();
+		printf("%-16s %s\n", cases[i].name, err < 0 ? "FAILED" : "OK");
+		if (err < 0)
+			failed++;
+	}
+	snd_config_delete(lconf);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+/*
+ *  route plugin matrix regression test
+ *
+ *  Plays the same stream through two route PCMs, one with "matrix yes"
+ *  (the ttable compiled into a sparse matrix at hw_params) and one with
+ *  "matrix no" (the per-sample path), each over a file plugin on a null
+ *  slave, and compares the written streams byte by byte.  Every run picks
+ *  random client and slave linear formats, channel counts and a random
+ *  ttable mixing up to all client channels into each slave channel, with
+ *  plain copies, attenuations and silent channels.  Half of the runs play
+ *  full scale samples with the same sign on all channels of a frame, so
+ *  that the mixed channels saturate the accumulator and get clipped.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+#define MAX_CLIENT_CHANNELS	24
+#define MAX_SLAVE_CHANNELS	12
+
+static unsigned int loops = 200;
+static snd_pcm_uframes_t total_frames = 3000;
+static unsigned int seed;
+static char path[2][32] = { "/tmp/pcm-route-matrix.XXXXXX",
+			    "/tmp/pcm-route-matrix.XXXXXX" };
+
+static const snd_pcm_format_t formats[] = {
+	SND_PCM_FORMAT_S8,
+	SND_PCM_FORMAT_U8,
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_S16_BE,
+	SND_PCM_FORMAT_U16_LE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S24_3LE,
+	SND_PCM_FORMAT_S24_3BE,
+	SND_PCM_FORMAT_S20_LE,
+	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S32_BE,
+	SND_PCM_FORMAT_U32_LE,
+};
+
+static const double coefs[] = { 1.0, 1.0, 0.5, 0.25, 0.7071, 0.3333, 0.01 };
+
+struct check {
+	snd_pcm_format_t format, sformat;
+	unsigned int channels, schannels;
+	double ttable[MAX_CLIENT_CHANNELS][MAX_SLAVE_CHANNELS];
+	int saturate;
+};
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+/* v is a full scale 32 bit sample */
+static void store_sample(unsigned char *p, snd_pcm_format_t format, int32_t v)
+{
+	unsigned int width = snd_pcm_format_width(format);
+	unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+	int be = snd_pcm_format_big_endian(format) > 0;
+	uint32_t s = (uint32_t)(v >> (32 - width));
+	unsigned int i;
+
+	if (snd_pcm_format_unsigned(format) > 0)
+		s ^= 1U << (width - 1);
+	if (bytes * 8 > width)
+		s &= (1U << width) - 1;
+	for (i = 0; i < bytes; i++)
+		p[be ? bytes - 1 - i : i] = s >> (8 * i);
+}
+
+static void fill(const struct check *chk, unsigned char *buf,
+		 snd_pcm_uframes_t frames)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(chk->format) / 8;
+	snd_pcm_uframes_t f;
+	unsigned int c;
+
+	for (f = 0; f < frames; f++) {
+		int positive = rand() & 1;
+		for (c = 0; c < chk->channels; c++) {
+			int32_t v;
+			if (!chk->saturate)
+				v = (int32_t)((uint32_t)rand() << 16 ^ rand());
+			else if (rand() % 8)
+				v = positive ? INT32_MAX : INT32_MIN;
+			else
+				v = positive ? INT32_MAX / 3 : INT32_MIN / 3;
+			store_sample(buf, chk->format, v);
+			buf += bytes;
+		}
+	}
+}
+
+static void random_check(struct check *chk)
+{
+	unsigned int c, s;
+
+	chk->format = formats[rand() % ARRAY_SIZE(formats)];
+	chk->sformat = formats[rand() % ARRAY_SIZE(formats)];
+	chk->channels = 1 + rand() % MAX_CLIENT_CHANNELS;
+	chk->schannels = 1 + rand() % MAX_SLAVE_CHANNELS;
+	chk->saturate = rand() & 1;
+	memset(chk->ttable, 0, sizeof(chk->ttable));
+	for (s = 0; s < chk->schannels; s++) {
+		switch (rand() % 4) {
+		case 0:		/* silent */
+			break;
+		case 1:		/* one source, copied or attenuated */
+			chk->ttable[rand() % chk->channels][s] =
+				coefs[rand() % ARRAY_SIZE(coefs)];
+			break;
+		default:	/* mix of a random subset */
+			for (c = 0; c < chk->channels; c++)
+				if (rand() % 3)
+					chk->ttable[c][s] =
+						coefs[rand() % ARRAY_SIZE(coefs)];
+			break;
+		}
+	}
+	/* route refuses an empty ttable */
+	for (s = 0; s < chk->schannels; s++)
+		for (c = 0; c < chk->channels; c++)
+			if (chk->ttable[c][s] != 0)
+				return;
+	chk->ttable[rand() % chk->channels][rand() % chk->schannels] = 1.0;
+}
+
+static int open_route(snd_pcm_t **pcm, const struct check *chk,
+		      const char *file, int matrix)
+{
+	snd_config_t *lconf;
+	snd_input_t *in;
+	char *buf, *p;
+	unsigned int c, s;
+	int err;
+
+	buf = malloc(256 + MAX_CLIENT_CHANNELS * MAX_SLAVE_CHANNELS * 24);
+	if (!buf)
+		return -ENOMEM;
+	p = buf;
+	p += sprintf(p, "pcm.check {\n"
+		     "\ttype route\n"
+		     "\tslave {\n"
+		     "\t\tpcm { type file file \"%s\" format raw"
+		     " slave.pcm { type null } }\n"
+		     "\t\tformat %s\n"
+		     "\t\tchannels %u\n"
+		     "\t}\n"
+		     "\tmatrix %s\n"
+		     "\tttable {\n", file, snd_pcm_format_name(chk->sformat),
+		     chk->schannels, matrix ? "yes" : "no");
+	for (c = 0; c < chk->channels; c++)
+		for (s = 0; s < chk->schannels; s++)
+			if (chk->ttable[c][s] != 0)
+				p += sprintf(p, "\t\t%u.%u %.4f\n", c, s,
+					     chk->ttable[c][s]);
+	p += sprintf(p, "\t}\n}\n");
+
+	err = snd_config_top(&lconf);
+	if (err < 0)
+		goto __free;
+	err = snd_input_buffer_open(&in, buf, p - buf);
+	if (err < 0)
+		goto __end;
+	err = snd_config_load(lconf, in);
+	snd_input_close(in);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_open_lconf(pcm, "check", SND_PCM_STREAM_PLAYBACK, 0, lconf);
+	if (err < 0)
+		goto __end;
+	err = snd_pcm_set_params(*pcm, chk->format,
+				 SND_PCM_ACCESS_RW_INTERLEAVED, chk->channels,
+				 48000, 0, 100000);
+	if (err < 0)
+		snd_pcm_close(*pcm);
+ __end:
+	snd_config_delete(lconf);
+ __free:
+	free(buf);
+	return err;
+}
+
+static int play(const struct check *chk, const unsigned char *data,
+		const char *file, int matrix)
+{
+	unsigned int frame_bytes = chk->channels *
+		snd_pcm_format_physical_width(chk->format) / 8;
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_t *pcm;
+	int err;
+
+	err = open_route(&pcm, chk, file, matrix);
+	if (err < 0) {
+		fprintf(stderr, "cannot open %s %u ch -> %s %u ch: %s\n",
+			snd_pcm_format_name(chk->format), chk->channels,
+			snd_pcm_format_name(chk->sformat), chk->schannels,
+			snd_strerror(err));
+		return err;
+	}
+	while (done < total_frames) {
+		snd_pcm_uframes_t size = 1 + rand() % 700;
+		snd_pcm_sframes_t n;
+		if (size > total_frames - done)
+			size = total_frames - done;
+		n = snd_pcm_writei(pcm, data + done * frame_bytes, size);
+		if (n < 0) {
+			fprintf(stderr, "write error: %s\n", snd_strerror(n));
+			err = n;
+			break;
+		}
+		done += n;
+	}
+	snd_pcm_drain(pcm);
+	snd_pcm_close(pcm);
+	return err;
+}
+
+static unsigned char *read_back(const char *file, size_t *size)
+{
+	unsigned char *buf;
+	FILE *fp;
+	long len;
+
+	fp = fopen(file, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	buf = malloc(len > 0 ? len : 1);
+	if (buf && fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	*size = len;
+	return buf;
+}
+
+static int run_check(const struct check *chk)
+{
+	unsigned int sample_bytes = snd_pcm_format_physical_width(chk->sformat) / 8;
+	unsigned char *data, *out[2] = { NULL, NULL };
+	size_t i, size[2];
+	int m, err = 0;
+
+	data = malloc(total_frames * chk->channels *
+		      snd_pcm_format_physical_width(chk->format) / 8);
+	if (!data)
+		return -ENOMEM;
+	fill(chk, data, total_frames);
+	for (m = 0; m < 2; m++) {
+		/* the file plugin appends, start from an empty file */
+		if (truncate(path[m], 0) < 0) {
+			err = -errno;
+			goto __end;
+		}
+		err = play(chk, data, path[m], !m);
+		if (err < 0)
+			goto __end;
+		out[m] = read_back(path[m], &size[m]);
+		if (!out[m]) {
+			fprintf(stderr, "cannot read back %s\n", path[m]);
+			err = -EIO;
+			goto __end;
+		}
+	}
+	if (size[0] != size[1] ||
+	    size[0] != total_frames * chk->schannels * sample_bytes) {
+		printf("MISMATCH %s %u ch -> %s %u ch: %zu bytes with matrix, "
+		       "%zu without\n", snd_pcm_format_name(chk->format),
+		       chk->channels, snd_pcm_format_name(chk->sformat),
+		       chk->schannels, size[0], size[1]);
+		err = -EINVAL;
+		goto __end;
+	}
+	for (i = 0; i < size[0]; i++) {
+		if (out[0][i] != out[1][i]) {
+			size_t sample = i / sample_bytes;
+			unsigned int b;
+			printf("MISMATCH %s %u ch -> %s %u ch%s at frame %zu "
+			       "channel %zu:", snd_pcm_format_name(chk->format),
+			       chk->channels, snd_pcm_format_name(chk->sformat),
+			       chk->schannels,
+			       chk->saturate ? " (saturating)" : "",
+			       sample / chk->schannels,
+			       sample % chk->schannels);
+			for (m = 0; m < 2; m++) {
+				printf(" %s ", m ? "without" : "with matrix");
+				for (b = 0; b < sample_bytes; b++)
+					printf("%02x", out[m][sample * sample_bytes + b]);
+			}
+			printf("\n");
+			err = -EINVAL;
+			break;
+		}
+	}
+ __end:
+	free(out[0]);
+	free(out[1]);
+	free(data);
+	return err;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-route-matrix [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-l,--loops     random runs (default %u)\n"
+	       "-f,--frames    frames per run (default %lu)\n"
+	       "-S,--seed      random seed (default: time)\n",
+	       loops, (unsigned long)total_frames);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"loops", 1, NULL, 'l'},
+		{"frames", 1, NULL, 'f'},
+		{"seed", 1, NULL, 'S'},
+		{NULL, 0, NULL, 0},
+	};
+	struct check chk;
+	unsigned int n, saturated = 0;
+	int c, fd, err = 0;
+
+	seed = time(NULL);
+	while ((c = getopt_long(argc, argv, "hl:f:S:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'f':
+			total_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+	printf("seed %u\n", seed);
+	srand(seed);
+
+	for (c = 0; c < 2; c++) {
+		fd = mkstemp(path[c]);
+		if (fd < 0) {
+			perror("mkstemp");
+			return 1;
+		}
+		close(fd);
+	}
+	for (n = 0; n < loops; n++) {
+		random_check(&chk);
+		err = run_check(&chk);
+		if (err < 0)
+			break;
+		saturated += chk.saturate;
+	}
+	unlink(path[0]);
+	unlink(path[1]);
+	if (err < 0)
+		return 1;
+	printf("OK, %u runs (%u saturating)\n", loops, saturated);
+	return 0;
+}
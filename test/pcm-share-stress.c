@@ -0,0 +1,449 @@
+/*
+ * stress test for the share plugin
+ *
+ * Opens many share PCMs over one slave (64 channels by default), each
+ * bound to its own slice of the slave channels, and lets every client
+ * write from its own thread for a while.  At the end it prints the
+ * frames written, the xruns and the average and worst time spent in
+ * snd_pcm_writei() and snd_pcm_avail_update() per client.
+ *
+ * Every client writes a frame counter on its channels.  The slave is
+ * wrapped in a file plugin writing to a pipe, and a reader thread checks
+ * that the counter of each client comes out of the slave complete, in
+ * order and only once, i.e. that the frames transferred are the frames
+ * committed.  The slave must not xrun for that, so it is the testclock
+ * ioplug module by default, consuming at the nominal rate and waiting
+ * for late clients (run with ALSA_PLUGIN_DIR=.libs; -D opens another
+ * slave from the global configuration); an xrun fails the test as well.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/asoundlib.h"
+
+#define MAX_CLIENTS	64
+
+static const char *devname;
+static unsigned int num_clients = 16;
+static unsigned int slave_channels = 64;
+static unsigned int rate = 48000;
+static unsigned int period_time = 10000;
+static unsigned int periods = 16;
+static unsigned int seconds = 5;
+
+/* frames written by every client */
+static unsigned long long total_frames;
+
+typedef struct {
+	pthread_t thread;
+	unsigned int index;
+	snd_pcm_t *pcm;
+	unsigned int channels;
+	unsigned long long frames;
+	unsigned int xruns;
+	unsigned long long writes;
+	double write_sum;
+	double write_max;
+	unsigned long long avails;
+	double avail_sum;
+	double avail_max;
+	int err;
+	/* seen by the reader */
+	unsigned long long expect;	/* next counter value, 0 = done */
+	unsigned long long bad_frame;
+	unsigned long long bad_value;
+	int bad;
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_config(snd_config_t *conf, const char *buf, size_t size)
+{
+	snd_input_t *in;
+	int err;
+
+	err = snd_input_buffer_open(&in, buf, size);
+	if (err < 0)
+		return err;
+	err = snd_config_load(conf, in);
+	snd_input_close(in);
+	return err;
+}
+
+/*
+ * pcm.share_stress_slave writing the slave stream to fd; the share plugin
+ * opens its slave by name, so this one goes to the global configuration
+ */
+static int add_slave_config(int fd)
+{
+	char buf[512], dev[256];
+	int err;
+
+	if (devname)
+		snprintf(dev, sizeof(dev), "\"%s\"", devname);
+	else
+		snprintf(dev, sizeof(dev), "{ type testclock }");
+	snprintf(buf, sizeof(buf),
+		 "pcm.share_stress_slave {\n"
+		 "\ttype file\n"
+		 "\tslave.pcm %s\n"
+		 "\tfile %d\n"
+		 "\tformat raw\n"
+		 "}\n", dev, fd);
+	err = snd_config_update();
+	if (err < 0)
+		return err;
+	return load_config(snd_config, buf, strlen(buf));
+}
+
+/* pcm.share_stress_N with the N-th slice of the slave channels */
+static int build_config(snd_config_t **lconf)
+{
+	unsigned int per_client = slave_channels / num_clients;
+	unsigned int c, k;
+	size_t size = 4096 + num_clients * (256 + per_client * 16);
+	char *buf, *p;
+	int err;
+
+	buf = malloc(size);
+	if (!buf)
+		return -ENOMEM;
+	p = buf;
+	for (c = 0; c < num_clients; c++) {
+		p += sprintf(p, "pcm.share_stress_%u {\n"
+			     "\ttype share\n"
+			     "\tslave { pcm \"share_stress_slave\" channels %u "
+			     "rate %u format S16_LE "
+			     "period_time %u buffer_time %u }\n"
+			     "\tbindings {\n",
+			     c, slave_channels, rate,
+			     period_time, period_time * periods);
+		for (k = 0; k < per_client; k++)
+			p += sprintf(p, "\t\t%u %u\n", k, c * per_client + k);
+		p += sprintf(p, "\t}\n}\n");
+	}
+	err = snd_config_top(lconf);
+	if (err >= 0)
+		err = load_config(*lconf, buf, p - buf);
+	free(buf);
+	return err;
+}
+
+/* frame counter, starting with 1, over the first two channels */
+static void fill_counter(int16_t *buf, unsigned int channels,
+			 unsigned long long pos, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t i;
+
+	memset(buf, 0, frames * channels * sizeof(*buf));
+	for (i = 0; i < frames; i++, buf += channels) {
+		unsigned int v = pos + i + 1;
+		buf[0] = v & 0xffff;
+		buf[1] = v >> 16;
+	}
+}
+
+/* the counter of a client at the start of a slave frame */
+static void check_frame(client_t *cl, const int16_t *frame,
+			unsigned long long index)
+{
+	unsigned int v = (uint16_t)frame[0] | (uint16_t)frame[1] << 16;
+
+	if (cl->bad || !cl->expect)
+		return;
+	/* nothing before the start of the client */
+	if (cl->expect == 1 && v == 0)
+		return;
+	if (v != (unsigned int)cl->expect) {
+		cl->bad = 1;
+		cl->bad_frame = index;
+		cl->bad_value = v;
+		return;
+	}
+	if (++cl->expect > total_frames)
+		cl->expect = 0;
+}
+
+/* check the slave stream until the writers close the pipe */
+static void *reader_thread(void *data)
+{
+	int fd = *(int *)data;
+	unsigned int per_client = slave_channels / num_clients;
+	size_t frame_bytes = slave_channels * sizeof(int16_t);
+	size_t size = frame_bytes * 1024, used = 0, pos;
+	unsigned long long index = 0;
+	unsigned int c;
+	char *buf;
+	ssize_t n;
+
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+	for (;;) {
+		n = read(fd, buf + used, size - used);
+		if (n <= 0)
+			break;
+		used += n;
+		for (pos = 0; pos + frame_bytes <= used; pos += frame_bytes) {
+			const int16_t *frame = (const int16_t *)(buf + pos);
+			for (c = 0; c < num_clients; c++)
+				check_frame(&clients[c], frame + c * per_client,
+					    index);
+			index++;
+		}
+		memmove(buf, buf + pos, used - pos);
+		used -= pos;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *client_thread(void *data)
+{
+	client_t *cl = data;
+	unsigned int channels = cl->channels;
+	snd_pcm_uframes_t period = (snd_pcm_uframes_t)rate * period_time / 1000000;
+	snd_pcm_uframes_t size;
+	snd_pcm_sframes_t n;
+	int16_t *buf;
+	double t;
+
+	buf = calloc(period * channels, sizeof(*buf));
+	if (!buf) {
+		cl->err = -ENOMEM;
+		return NULL;
+	}
+	while (cl->frames < total_frames) {
+		t = now();
+		n = snd_pcm_avail_update(cl->pcm);
+		t = now() - t;
+		cl->avails++;
+		cl->avail_sum += t;
+		if (t > cl->avail_max)
+			cl->avail_max = t;
+		size = period;
+		if (size > total_frames - cl->frames)
+			size = total_frames - cl->frames;
+		fill_counter(buf, channels, cl->frames, size);
+		t = now();
+		n = snd_pcm_writei(cl->pcm, buf, size);
+		t = now() - t;
+		cl->writes++;
+		cl->write_sum += t;
+		if (t > cl->write_max)
+			cl->write_max = t;
+		if (n == -EPIPE) {
+			cl->xruns++;
+			n = snd_pcm_prepare(cl->pcm);
+		}
+		if (n < 0) {
+			cl->err = n;
+			break;
+		}
+		cl->frames += n;
+	}
+	/* let the slave take the last frames */
+	snd_pcm_drain(cl->pcm);
+	free(buf);
+	return NULL;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-share-stress [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-D,--device    slave PCM (default testclock)\n"
+	       "-n,--clients   share clients (default %u)\n"
+	       "-c,--channels  slave channels (default %u)\n"
+	       "-r,--rate      rate (default %u)\n"
+	       "-p,--period    period time in us (default %u)\n"
+	       "-b,--periods   periods per buffer (default %u)\n"
+	       "-t,--time      seconds to run (default %u)\n",
+	       num_clients, slave_channels, rate, period_time, periods,
+	       seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"help", 0, NULL, 'h'},
+		{"device", 1, NULL, 'D'},
+		{"clients", 1, NULL, 'n'},
+		{"channels", 1, NULL, 'c'},
+		{"rate", 1, NULL, 'r'},
+		{"period", 1, NULL, 'p'},
+		{"periods", 1, NULL, 'b'},
+		{"time", 1, NULL, 't'},
+		{NULL, 0, NULL, 0},
+	};
+	snd_config_t *lconf;
+	pthread_t reader;
+	unsigned long long total = 0;
+	unsigned int c, xruns = 0, bad = 0;
+	char name[32];
+	int fds[2];
+	double t;
+	int opt, err = 0;
+
+	while ((opt = getopt_long(argc, argv, "hD:n:c:r:p:b:t:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'D':
+			devname = optarg;
+			break;
+		case 'n':
+			num_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			slave_channels = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			period_time = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			periods = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (num_clients == 0 || num_clients > MAX_CLIENTS ||
+	    slave_channels < num_clients * 2 || rate == 0 ||
+	    period_time == 0 || periods < 2) {
+		usage();
+		return 1;
+	}
+	total_frames = (unsigned long long)seconds * rate;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	err = add_slave_config(fds[1]);
+	if (err >= 0)
+		err = build_config(&lconf);
+	if (err < 0) {
+		fprintf(stderr, "config: %s\n", snd_strerror(err));
+		return 1;
+	}
+	pthread_create(&reader, NULL, reader_thread, &fds[0]);
+	for (c = 0; c < num_clients; c++) {
+		client_t *cl = &clients[c];
+		cl->index = c;
+		cl->channels = slave_channels / num_clients;
+		cl->expect = 1;
+		sprintf(name, "share_stress_%u", c);
+		err = snd_pcm_open_lconf(&cl->pcm, name, SND_PCM_STREAM_PLAYBACK,
+					 0, lconf);
+		if (err < 0) {
+			fprintf(stderr, "open %s: %s\n", name, snd_strerror(err));
+			goto __close;
+		}
+		err = snd_pcm_set_params(cl->pcm, SND_PCM_FORMAT_S16_LE,
+					 SND_PCM_ACCESS_RW_INTERLEAVED,
+					 cl->channels, rate, 0,
+					 period_time * periods);
+		if (err < 0) {
+			fprintf(stderr, "setup %s: %s\n", name, snd_strerror(err));
+			snd_pcm_close(cl->pcm);
+			cl->pcm = NULL;
+			goto __close;
+		}
+	}
+
+	t = now();
+	for (c = 0; c < num_clients; c++)
+		pthread_create(&clients[c].thread, NULL, client_thread, &clients[c]);
+	for (c = 0; c < num_clients; c++)
+		pthread_join(clients[c].thread, NULL);
+	t = now() - t;
+
+	for (c = 0; c < num_clients; c++) {
+		client_t *cl = &clients[c];
+		printf("client %2u: %10llu frames %4u xruns  "
+		       "writei avg %7.1f max %8.1f us  "
+		       "avail avg %6.1f max %8.1f us%s%s\n",
+		       c, cl->frames, cl->xruns,
+		       cl->writes ? cl->write_sum / cl->writes * 1e6 : 0,
+		       cl->write_max * 1e6,
+		       cl->avails ? cl->avail_sum / cl->avails * 1e6 : 0,
+		       cl->avail_max * 1e6,
+		       cl->err ? "  error: " : "",
+		       cl->err ? snd_strerror(cl->err) : "");
+		total += cl->frames;
+		xruns += cl->xruns;
+		if (cl->err)
+			err = cl->err;
+	}
+	printf("%u clients, %u slave channels: %.0f frames/s per client, "
+	       "%u xruns\n", num_clients, slave_channels,
+	       total / t / num_clients, xruns);
+
+ __close:
+	for (c = 0; c < num_clients; c++)
+		if (clients[c].pcm)
+			snd_pcm_close(clients[c].pcm);
+	snd_config_delete(lconf);
+	/* the slave is closed, let the reader see the end */
+	close(fds[1]);
+	pthread_join(reader, NULL);
+	close(fds[0]);
+	if (err < 0)
+		return 1;
+
+	for (c = 0; c < num_clients; c++) {
+		client_t *cl = &clients[c];
+		if (cl->bad) {
+			printf("client %2u: MISMATCH at slave frame %llu: "
+			       "counter %llu, expected %llu\n",
+			       c, cl->bad_frame, cl->bad_value, cl->expect);
+			bad++;
+		} else if (cl->expect) {
+			printf("client %2u: slave took %llu of %llu frames\n",
+			       c, cl->expect - 1, total_frames);
+			bad++;
+		}
+	}
+	if (bad || xruns) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK, %llu frames from each of %u clients\n",
+	       total_frames, num_clients);
+	return 0;
+}
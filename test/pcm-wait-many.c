@@ -0,0 +1,189 @@
+/*
+ *  snd_pcm_wait_many() test
+ *
+ *  Puts several prepared null playback PCMs (always ready) into a wait
+ *  set and waits on it with a smaller result array than the number of
+ *  handles.  Every call must fill the array, and all handles must be
+ *  reported in turn, i.e. each one within ceil(handles / space) calls.
+ *  A removed handle must not be reported any more.  Both the poll() and
+ *  the epoll mode are checked.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../include/asoundlib.h"
+
+#define MAX_PCMS	32
+
+static unsigned int npcms = 7;
+static unsigned int space = 3;
+static unsigned int rounds = 50;
+
+static int check_rotation(snd_pcm_waitset_t *set, snd_pcm_t **pcm,
+			  const int *active, unsigned int count,
+			  const char *mode)
+{
+	snd_pcm_t *ready[MAX_PCMS];
+	snd_pcm_sframes_t avail[MAX_PCMS];
+	unsigned int last[MAX_PCMS];
+	unsigned int calls = (count + space - 1) / space;
+	unsigned int expect = count < space ? count : space;
+	unsigned int r, i, p;
+
+	memset(last, 0, sizeof(last));
+	for (r = 1; r <= rounds; r++) {
+		int n = snd_pcm_wait_many(set, 1000, ready, avail, space);
+		if (n < 0) {
+			printf("%s: wait_many: %s\n", mode, snd_strerror(n));
+			return n;
+		}
+		if ((unsigned int)n != expect) {
+			printf("%s: call %u reported %d handles, expected %u\n",
+			       mode, r, n, expect);
+			return -EINVAL;
+		}
+		for (i = 0; i < (unsigned int)n; i++) {
+			for (p = 0; p < npcms; p++)
+				if (ready[i] == pcm[p])
+					break;
+			if (p == npcms || !active[p]) {
+				printf("%s: call %u reported an unknown or "
+				       "removed handle\n", mode, r);
+				return -EINVAL;
+			}
+			if (avail[i] <= 0) {
+				printf("%s: handle %u avail %ld\n", mode, p,
+				       avail[i]);
+				return -EINVAL;
+			}
+			last[p] = r;
+		}
+		/* nobody waits more than a full turn */
+		for (p = 0; p < npcms; p++) {
+			if (active[p] && r >= calls && r - last[p] >= calls) {
+				printf("%s: handle %u not reported since call "
+				       "%u (now %u)\n", mode, p, last[p], r);
+				return -EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+static int run(int mode, const char *name)
+{
+	snd_pcm_t *pcm[MAX_PCMS];
+	int active[MAX_PCMS];
+	snd_pcm_waitset_t *set;
+	unsigned int p;
+	int err;
+
+	err = snd_pcm_waitset_open(&set, mode);
+	if (err < 0)
+		return err;
+	for (p = 0; p < npcms; p++) {
+		err = snd_pcm_open(&pcm[p], "null", SND_PCM_STREAM_PLAYBACK, 0);
+		if (err < 0)
+			return err;
+		err = snd_pcm_set_params(pcm[p], SND_PCM_FORMAT_S16,
+					 SND_PCM_ACCESS_RW_INTERLEAVED, 2,
+					 48000, 0, 100000);
+		if (err < 0)
+			return err;
+		err = snd_pcm_waitset_add(set, pcm[p]);
+		if (err < 0)
+			return err;
+		active[p] = 1;
+	}
+	if (snd_pcm_waitset_add(set, pcm[0]) != -EEXIST) {
+		printf("%s: duplicate handle accepted\n", name);
+		return -EINVAL;
+	}
+	err = check_rotation(set, pcm, active, npcms, name);
+	if (err < 0)
+		return err;
+	if (npcms > 1) {
+		err = snd_pcm_waitset_remove(set, pcm[npcms / 2]);
+		if (err < 0)
+			return err;
+		active[npcms / 2] = 0;
+		err = check_rotation(set, pcm, active, npcms - 1, name);
+		if (err < 0)
+			return err;
+	}
+	snd_pcm_waitset_close(set);
+	for (p = 0; p < npcms; p++)
+		snd_pcm_close(pcm[p]);
+	printf("%-6s OK\n", name);
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: pcm-wait-many [OPTION]...\n"
+	       "-h,--help      help\n"
+	       "-n,--pcms      number of PCM handles (default %u, max %u)\n"
+	       "-s,--space     size of the result array (default %u)\n"
+	       "-r,--rounds    calls per check (default %u)\n",
+	       npcms, MAX_PCMS, space, rounds);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_option[] = {
+		{"help", 0, NULL, 'h'},
+		{"pcms", 1, NULL, 'n'},
+		{"space", 1, NULL, 's'},
+		{"rounds", 1, NULL, 'r'},
+		{NULL, 0, NULL, 0},
+	};
+	int c, err;
+
+	while ((c = getopt_long(argc, argv, "hn:s:r:", long_option, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			npcms = atoi(optarg);
+			if (npcms < 1 || npcms > MAX_PCMS)
+				npcms = MAX_PCMS;
+			break;
+		case 's':
+			space = atoi(optarg);
+			if (!space)
+				space = 1;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage();
+			return c != 'h';
+		}
+	}
+
+	err = run(0, "poll");
+	if (err >= 0)
+		err = run(SND_PCM_WAITSET_EPOLL, "epoll");
+	if (err < 0) {
+		fprintf(stderr, "failed: %s\n", snd_strerror(err));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ *  S16 only rate converter for the tests
+ *
+ *  A sample-and-hold converter which takes and produces S16 only
+ *  (get_supported_formats), so that the rate plugin must convert the
+ *  stream samples for it and back.  Each input period is mapped onto its
+ *  output period, as the builtin converters do.  It refuses other formats
+ *  at init, so a setup passing the stream format through fails.
+ *
+ *  Load it with ALSA_PLUGIN_DIR pointing to the directory of
+ *  libasound_module_rate_s16hold.so, e.g. pcm-rate-sinc -c s16hold.
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "../include/asoundlib.h"
+#include "../include/pcm_rate.h"
+
+struct rate_s16hold {
+	unsigned int channels;
+	snd_pcm_uframes_t in_period, out_period;
+};
+
+static int16_t *sample_addr(const snd_pcm_channel_area_t *area,
+			    snd_pcm_uframes_t offset)
+{
+	return (int16_t *)((char *)area->addr +
+			   (area->first + offset * area->step) / 8);
+}
+
+static int s16hold_init(void *obj, snd_pcm_rate_info_t *info)
+{
+	struct rate_s16hold *rate = obj;
+
+	if (info->in.format != SND_PCM_FORMAT_S16 ||
+	    info->out.format != SND_PCM_FORMAT_S16)
+		return -EINVAL;
+	rate->channels = info->channels;
+	rate->in_period = info->in.period_size;
+	rate->out_period = info->out.period_size;
+	return 0;
+}
+
+static int s16hold_adjust_pitch(void *obj, snd_pcm_rate_info_t *info)
+{
+	struct rate_s16hold *rate = obj;
+
+	rate->in_period = info->in.period_size;
+	rate->out_period = info->out.period_size;
+	return 0;
+}
+
+static void s16hold_convert(void *obj,
+			    const snd_pcm_channel_area_t *dst_areas,
+			    snd_pcm_uframes_t dst_offset, unsigned int dst_frames,
+			    const snd_pcm_channel_area_t *src_areas,
+			    snd_pcm_uframes_t src_offset, unsigned int src_frames)
+{
+	struct rate_s16hold *rate = obj;
+	unsigned int c, n;
+
+	for (c = 0; c < rate->channels; c++) {
+		for (n = 0; n < dst_frames; n++) {
+			int16_t v = 0;
+			if (src_frames)
+				v = *sample_addr(&src_areas[c], src_offset +
+						 (uint64_t)n * src_frames / dst_frames);
+			*sample_addr(&dst_areas[c], dst_offset + n) = v;
+		}
+	}
+}
+
+static snd_pcm_uframes_t s16hold_input_frames(void *obj,
+					      snd_pcm_uframes_t frames)
+{
+	struct rate_s16hold *rate = obj;
+
+	if (frames == rate->out_period)
+		return rate->in_period;
+	return (frames * rate->in_period + rate->out_period / 2) /
+		rate->out_period;
+}
+
+static snd_pcm_uframes_t s16hold_output_frames(void *obj,
+					       snd_pcm_uframes_t frames)
+{
+	struct rate_s16hold *rate = obj;
+
+	if (frames == rate->in_period)
+		return rate->out_period;
+	return (frames * rate->out_period + rate->in_period / 2) /
+		rate->in_period;
+}
+
+static void s16hold_close(void *obj)
+{
+	free(obj);
+}
+
+static int s16hold_get_supported_formats(void *obj ATTRIBUTE_UNUSED,
+					 uint64_t *in_formats,
+					 uint64_t *out_formats,
+					 unsigned int *flags)
+{
+	*in_formats = *out_formats = 1ULL << SND_PCM_FORMAT_S16;
+	*flags = 0;
+	return 0;
+}
+
+static const snd_pcm_rate_ops_t s16hold_ops = {
+	.close = s16hold_close,
+	.init = s16hold_init,
+	.adjust_pitch = s16hold_adjust_pitch,
+	.convert = s16hold_convert,
+	.input_frames = s16hold_input_frames,
+	.output_frames = s16hold_output_frames,
+	.version = SND_PCM_RATE_PLUGIN_VERSION,
+	.get_supported_formats = s16hold_get_supported_formats,
+};
+
+int SND_PCM_RATE_PLUGIN_ENTRY(s16hold)(unsigned int version, void **objp,
+				       snd_pcm_rate_ops_t *ops)
+{
+	struct rate_s16hold *rate;
+
+	if (version < SND_PCM_RATE_PLUGIN_VERSION)
+		return -EINVAL;
+	rate = calloc(1, sizeof(*rate));
+	if (!rate)
+		return -ENOMEM;
+	*objp = rate;
+	*ops = s16hold_ops;
+	return 0;
+}